@@ -1,14 +1,33 @@
 #include "args.h"
-#include <boost/regex.hpp>
+#include "httpget.h"
 
 Args::Args()
-: desc_("Usage: ./multiget [OPTIONS] url")
+: desc_("Usage: ./multiget [OPTIONS] url [mirror-url ...]\n       ./multiget [OPTIONS] -i manifest")
 , output_file_name_("multiget.out")
 , parallel_download_(false)
+, direct_write_(false)
+, keep_alive_(false)
+, adaptive_(false)
+, sharded_(false)
+, journal_(false)
+, splice_(false)
+, auto_tune_(false)
 , chunk_count_(4)
 , chunk_size_(1024*1024) // 1 MiB
-, total_size_(1024*1024*4) // 4 MiB
+, total_size_(0) // ask the server
+, chunk_size_specified_(false)
 , thread_count_(1)
+, max_connections_(8)
+, read_size_(256*1024) // 256 KiB
+, verify_(false)
+, range_retries_(5)
+, total_retries_(50)
+, progress_(false)
+, insecure_(false)
+, max_per_host_(6)
+, ranges_per_request_(32)
+, cache_size_(1024LL * 1024 * 1024)
+, stream_buffer_size_(64*1024*1024) // 64 MiB
 {
 }
 
@@ -19,24 +38,66 @@ void Args::usage()
     "NOTE: \"bytes\" takes precedence over chunks and size.  The following logic is used." << std::endl <<
     "  1. If bytes is included then chunk size will be calculated: size = bytes/chunks" << std::endl <<
     "     and the remainder will be downloaded in the last chunk" <<  std::endl <<
-    "  2. If bytes is not specified then bytes = chunks * size" << std::endl;
+    "  2. If bytes is not specified then the size of the file is requested from the server" << std::endl <<
+    "     and the whole file is downloaded.  If size is included it is used as the chunk size," << std::endl <<
+    "     otherwise the file is split into \"chunks\" chunks as in 1." << std::endl;
 }
 
 bool Args::parseCommandLine(int argc, char* argv[])
 {
     desc_.add_options()
         ("help,h", "produce help message")
-        ("outputfile,o", po::value<std::string>(&output_file_name_), "Name of the downloaded file (default is multiget.out)")
+        ("outputfile,o", po::value<std::string>(&output_file_name_),
+         "Name of the downloaded file, - to stream it in order to stdout while it downloads (default is multiget.out)")
+        ("buffer", po::value<int64_t>(&stream_buffer_size_),
+         "Most bytes to hold ahead of what has been written to stdout before pausing connections (default is 67108864)")
         ("parallel,p", "Download the chunks simultaneously")
+        ("direct,d", "Write each chunk directly into the preallocated output file (no temporary chunk files)")
+        ("adaptive,a", "Split the slowest chunk when a connection becomes free in parallel mode (implies -d)")
+        ("journal,j", "Keep a journal so an interrupted download can be resumed by running the same command again (implies -d)")
+        ("splice", "Move the body of each response from the socket into the output file inside the kernel with "
+         "splice(), for plain http:// that is not checksummed (Linux only)")
+        ("keepalive,k", "Reuse persistent connections to the server for the chunk requests")
         ("threads,t", po::value<int>(&thread_count_), "Number of threads to use during downlaod (default is 1)")
-        ("size,s", po::value<int>(&chunk_size_), "Chunk size for downloading the file (default is 1 MiB)")
+        ("sharded,x", "Give each thread its own io_service and spread the connections across them (implies -p, "
+         "default is one thread per core)")
+        ("auto", "Start with a few connections and add more while the throughput keeps improving, backing off on "
+         "errors, and size the chunks to match (implies -p, -m is the most connections to use, -c is ignored)")
+        ("connections,m", po::value<int>(&max_connections_), "Maximum number of chunks to download at once in parallel mode (default is 8)")
+        ("read-size,r", po::value<int>(&read_size_), "Largest number of bytes to receive on each read, at least 16384 (default is 262144)")
+        ("checksum,e", po::value<std::vector<std::string> >(&checksum_strings_),
+         "Expected checksum of the file as algorithm:hex where algorithm is crc32c, md5 or sha256 (may be repeated)")
+        ("verify,v", "Checksum the download and report the CRC32C even if there is nothing to check it against")
+        ("retries", po::value<int>(&range_retries_), "Number of times to retry the missing part of a chunk (default is 5)")
+        ("total-retries", po::value<int>(&total_retries_), "Number of retries allowed for the whole download (default is 50)")
+        ("progress,P", "Show the progress, download rate and time left on one line while downloading")
+        ("metrics", po::value<std::string>(&metrics_file_name_),
+         "Write the timings of every chunk request to this file, as CSV if it ends in .csv and JSON otherwise")
+        ("ca-file", po::value<std::string>(&ca_file_), "Also trust the certificates in this PEM file for https:// URLs")
+        ("insecure", "Accept any certificate for https:// URLs, without checking it")
+        ("input,i", po::value<std::string>(&manifest_file_name_),
+         "Download every file listed in this manifest (- for stdin), one \"url output [bytes] [algorithm:hex ...]\" per line")
+        ("per-host", po::value<int>(&max_per_host_), "Maximum number of requests to run at once to each server in batch mode (default is 6)")
+        ("ranges", po::value<std::string>(&range_file_name_),
+         "Download only the byte ranges listed in this file (- for stdin) as first-last, each written at its offset in the output file")
+        ("ranges-per-request", po::value<int>(&ranges_per_request_),
+         "Most of the --ranges to ask for in one request, 1 for a request per range (default is 32)")
+        ("delta", po::value<std::string>(&delta_index_),
+         "Update an old copy of the file using this block index (a file or URL, see multiget-index), downloading only "
+         "the blocks that changed")
+        ("delta-from", po::value<std::string>(&delta_source_), "The old copy to update from (default is the output file)")
+        ("cache", po::value<std::string>(&cache_dir_),
+         "Keep the downloaded ranges in this directory, and copy the ones it already has instead of downloading them again")
+        ("cache-size", po::value<int64_t>(&cache_size_),
+         "Most bytes to keep in the cache, the least recently used files go first (default is 1073741824)")
+        ("size,s", po::value<int64_t>(&chunk_size_), "Chunk size for downloading the file (default is bytes/chunks)")
         ("chunks,c", po::value<int>(&chunk_count_), "Number of chunks to downlaod (default is 4)")
-        ("bytes,b", po::value<int>(&total_size_), "Total number of bytes to download (default is 4 MiB)");
+        ("bytes,b", po::value<int64_t>(&total_size_), "Total number of bytes to download (default is the size of the file)");
     
     // We wont want to force someone to use --url or -u on the command line.  So we need to
     // create a hidden/postional option that is at the end of the command line
     po::options_description hidden_option;
-    hidden_option.add_options() ("url", po::value<std::string>(&url_), "URL to fetch");
+    hidden_option.add_options() ("url", po::value<std::vector<std::string> >(&url_strings_), "URL to fetch");
     
     po::positional_options_description positional_options;
     positional_options.add("url", -1);
@@ -52,7 +113,7 @@ bool Args::parseCommandLine(int argc, char* argv[])
     if (vm.count("help")) {
         return false; // This will trigger a call to "usage" and then quit
     }
-    if (!vm.count("url")) {
+    if (!vm.count("url") && !vm.count("input")) {
         std::cout << "ERROR - missing command line argument: url" << std::endl;
         return false;
     }
@@ -63,28 +124,142 @@ bool Args::parseCommandLine(int argc, char* argv[])
     if (vm.count("parallel")) {
         parallel_download_ = true;
     }
+    if (vm.count("direct")) {
+        direct_write_ = true;
+    }
+    if (vm.count("keepalive")) {
+        keep_alive_ = true;
+    }
+    if (vm.count("adaptive")) {
+        // Split chunks are written straight to their offsets, which needs direct mode
+        adaptive_ = true;
+        direct_write_ = true;
+    }
+    if (vm.count("journal")) {
+        // Only the preallocated output file keeps the downloaded bytes between runs
+        journal_ = true;
+        direct_write_ = true;
+    }
+    if (vm.count("auto")) {
+        auto_tune_ = true;
+        parallel_download_ = true;
+    }
+    if (vm.count("splice")) {
+        splice_ = true;
+    }
+    if (vm.count("verify")) {
+        verify_ = true;
+    }
+    if (vm.count("progress")) {
+        progress_ = true;
+    }
+    if (vm.count("insecure")) {
+        insecure_ = true;
+    }
+    if (streamOutput() && adaptive_) {
+        // A paused connection looks slow, and there is no point splitting it
+        std::cout << "Adaptive mode is not used when streaming to stdout" << std::endl;
+        adaptive_ = false;
+    }
+    if (vm.count("sharded")) {
+        sharded_ = true;
+        parallel_download_ = true;
+        if (!vm.count("threads")) {
+            thread_count_ = 0; // one per core
+        }
+    }
     
     return validateParameters(vm);
 }
 
 bool Args::validateParameters(po::variables_map& vm)
 {
-    // Parse the URL into server, port, and path
-    if (!parseURL()) {
-        return false;
+    // Parse the URLs into server, port, and path.  Every URL after the first is
+    // another place to get the same file from.
+    for (const std::string& url_string: url_strings_) {
+        URL url;
+        if (!url.parse(url_string)) {
+            return false;
+        }
+        urls_.push_back(url);
+    }
+    
+    for (const std::string& checksum: checksum_strings_) {
+        if (!parseChecksum(checksum, checksums_)) {
+            std::cout << "\"checksum\" must be crc32c:hex, md5:hex or sha256:hex" << std::endl;
+            return false;
+        }
     }
     
     // Validate some parameters
-    if (total_size_ == 0) {
-        std::cout << "\"bytes\" cannot be set to 0" << std::endl;
+    if (vm.count("bytes") && total_size_ <= 0) {
+        std::cout << "\"bytes\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (chunk_size_ <= 0) {
+        std::cout << "\"size\" must be greater than 0" << std::endl;
         return false;
     }
-    if (chunk_size_ == 0) {
-        std::cout << "\"size\" cannot be set to 0" << std::endl;
+    if (chunk_count_ <= 0) {
+        std::cout << "\"chunks\" must be greater than 0" << std::endl;
         return false;
     }
-    if (chunk_count_ == 0) {
-        std::cout << "\"chunks\" cannot be set to 0" << std::endl;
+    if (read_size_ < static_cast<int>(HTTPGet::MIN_READ_SIZE)) {
+        std::cout << "\"read-size\" must be at least " << HTTPGet::MIN_READ_SIZE << " - the response headers have to fit in one read" <<
+            std::endl;
+        return false;
+    }
+    if (range_retries_ < 0 || total_retries_ < 0) {
+        std::cout << "\"retries\" and \"total-retries\" must not be negative" << std::endl;
+        return false;
+    }
+    if (thread_count_ < 0) {
+        std::cout << "\"threads\" must not be negative" << std::endl;
+        return false;
+    }
+    if (max_connections_ <= 0) {
+        std::cout << "\"connections\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (streamOutput() && journal_) {
+        std::cout << "\"journal\" cannot be used when streaming to stdout" << std::endl;
+        return false;
+    }
+    if (stream_buffer_size_ <= 0) {
+        std::cout << "\"buffer\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (max_per_host_ <= 0) {
+        std::cout << "\"per-host\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (ranges_per_request_ <= 0) {
+        std::cout << "\"ranges-per-request\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (!range_file_name_.empty()) {
+        if (streamOutput() || journal_) {
+            std::cout << "\"ranges\" cannot be used with \"journal\" or when streaming to stdout" << std::endl;
+            return false;
+        }
+        if (!readRangeList(range_file_name_, ranges_)) {
+            return false;
+        }
+    }
+    if (!delta_index_.empty() && (streamOutput() || journal_ || !range_file_name_.empty())) {
+        std::cout << "\"delta\" cannot be used with \"journal\" or \"ranges\", or when streaming to stdout" << std::endl;
+        return false;
+    }
+    if (!cache_dir_.empty() && (streamOutput() || journal_ || !delta_index_.empty())) {
+        std::cout << "\"cache\" cannot be used with \"journal\" or \"delta\", or when streaming to stdout" << std::endl;
+        return false;
+    }
+    if (cache_size_ <= 0) {
+        std::cout << "\"cache-size\" must be greater than 0" << std::endl;
+        return false;
+    }
+    if (!delta_source_.empty() && delta_index_.empty()) {
+        std::cout << "\"delta-from\" needs a block index to be given with \"delta\"" << std::endl;
         return false;
     }
     
@@ -92,38 +267,58 @@ bool Args::validateParameters(po::variables_map& vm)
         // The user specified the total number of bytes which takes precedence over the other
         // parameters.  It is up to the user of this class to realize that chunk_size_ * chunk_count_
         // is not equal to total_size_
-        chunk_size_  = total_size_ / chunk_count_;
+        setTotalSize(total_size_);
     } else {
-        // Total size not specified - so calculate it based on the the chunk count and chunk size
-        total_size_ = chunk_size_ * chunk_count_;
+        // Total size not specified - it will be found out from the server
+        chunk_size_specified_ = (vm.count("size") > 0);
     }
     return true;
 }
 
-bool Args::parseURL()
+void Args::setTotalSize(int64_t total_size)
 {
-    // Parse the URL into server, port, and path
-    boost::regex pattern("(http|https)://([^/ :]+):?([^/ ]*)(/?[^ #?]*)");
-    boost::cmatch url_parts;
-    if(regex_match(url_.c_str(), url_parts, pattern))
-    {
-        server_ = std::string(url_parts[2].first, url_parts[2].second);
-        port_ = std::string(url_parts[3].first, url_parts[3].second);
-        path_ = std::string(url_parts[4].first, url_parts[4].second);
-        if (port_.length() == 0) {
-            port_ = "http";
-        }
-        if (server_.length() == 0) {
-            std::cout << "Unable to parse server from the url: " << url_ << std::endl;
-            return false;
+    total_size_ = total_size;
+    if (!chunk_size_specified_) {
+        chunk_size_ = total_size_ / chunk_count_;
+        if (chunk_size_ == 0) {
+            // Fewer bytes than chunks - so use one byte per chunk
+            chunk_size_ = 1;
         }
-        if (path_.length() == 0) {
-            std::cout << "Unable to parse file path from the url: " << url_ << std::endl;
-            return false;
-        }
-        return true;
-    } else {
-        std::cout << "Unable to parse the URL: " << url_ << std::endl;
-        return false;
     }
 }
+
+DownloadOptions Args::getDownloadOptions()
+{
+    DownloadOptions options;
+    options.urls = url_strings_;
+    options.output_file_name = output_file_name_;
+    options.total_size = total_size_;
+    // Without "bytes" or "size" the chunk size is worked out once the size of the file is known
+    options.chunk_size = (total_size_ > 0 || chunk_size_specified_) ? chunk_size_ : 0;
+    options.chunk_count = chunk_count_;
+    options.parallel = parallel_download_;
+    options.max_connections = max_connections_;
+    options.max_per_host = max_per_host_;
+    options.thread_count = thread_count_;
+    options.sharded = sharded_;
+    options.keep_alive = keep_alive_;
+    options.direct = direct_write_;
+    options.adaptive = adaptive_;
+    options.journal = journal_;
+    options.splice = splice_;
+    options.auto_tune = auto_tune_;
+    options.read_size = read_size_;
+    options.checksums = checksums_;
+    options.verify = verify_;
+    options.range_retries = range_retries_;
+    options.total_retries = total_retries_;
+    options.ca_file = ca_file_;
+    options.insecure = insecure_;
+    options.ranges = ranges_;
+    options.ranges_per_request = ranges_per_request_;
+    options.delta_index = delta_index_;
+    options.delta_source = delta_source_;
+    options.cache_dir = cache_dir_;
+    options.cache_size = cache_size_;
+    return options;
+}
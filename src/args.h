@@ -6,8 +6,15 @@
 namespace po = boost::program_options;
 
 #include <string>
+#include <vector>
+#include <stdint.h>
 using std::string;
 
+#include "url.h"
+#include "checksum.h"
+#include "download.h"
+#include "rangelist.h"
+
 /*! \brief Command line argument parser
  *
  * Read, parse and validate all the arguments from the command line using boost::program_options.
@@ -15,7 +22,9 @@ using std::string;
  * NOTE: \"bytes\" takes precedence over chunks and size.  The following logic is used.
  *  1. If bytes is included then chunk size will be calculated: size = bytes/chunks
  *     and the remainder will be downloaded in the last chunk
- *  2. If bytes is not specified then bytes = chunks * size
+ *  2. If bytes is not specified then the size of the file is requested from the server
+ *     and the whole file is downloaded.  If size is included it is used as the chunk size,
+ *     otherwise the file is split into \"chunks\" chunks as in 1.
  */
 class Args {
 public:
@@ -49,37 +58,63 @@ public:
         return output_file_name_;
     }
     /**
-     *   @brief  Get the server name parsed from the URL
+     *   @brief  Find out whether the file goes to stdout as it downloads (-o -)
+     *
+     *   @return true if streaming to stdout
+     */
+    bool streamOutput() {
+        return output_file_name_ == "-";
+    }
+    /**
+     *   @brief  Get the size of the reorder buffer when streaming to stdout (--buffer argument)
+     *
+     *   @return buffer size in bytes
+     */
+    int64_t getStreamBufferSize() {
+        return stream_buffer_size_;
+    }
+    /**
+     *   @brief  Get the server name parsed from the (first) URL
      *
      *   @return server part of url
      */
     const std::string& getServer() {
-        return server_;
+        return urls_[0].getServer();
     }
     /**
-     *   @brief  Get the port parsed from the URL
+     *   @brief  Get the port parsed from the (first) URL
      *
      *   If a port is included it will be return, otherwise port "80" is returned
      *   @return port part of url
      */
     const std::string& getPort() {
-        return port_;
+        return urls_[0].getPort();
     }
     /**
-     *   @brief  Get the path parsed from the URL
+     *   @brief  Get the path parsed from the (first) URL
      *
      *   @return path part of url
      */
     const std::string& getPath() {
-        return path_;
+        return urls_[0].getPath();
     }
     /**
-     *   @brief  Get the entire URL passed in on the command line
+     *   @brief  Get the (first) URL passed in on the command line
      *
      *   @return url
      */
     const std::string& getURL() {
-        return url_;
+        return urls_[0].getURL();
+    }
+    /**
+     *   @brief  Get all of the URLs passed in on the command line
+     *
+     *   Every URL after the first is a mirror of the same file.
+     *
+     *   @return urls in the order they were given
+     */
+    const std::vector<URL>& getURLs() {
+        return urls_;
     }
     /**
      *   @brief  Get value for parallem mode (-p argument)
@@ -89,6 +124,86 @@ public:
     bool downloadInParallel() {
         return parallel_download_;
     }
+    /**
+     *   @brief  Get value for direct mode (-d argument)
+     *
+     *   In direct mode the output file is preallocated and every chunk is written straight
+     *   to its offset, so no temporary chunk files are created.
+     *
+     *   @return true if chunks are written directly to the output file
+     */
+    bool writeInPlace() {
+        return direct_write_;
+    }
+    /**
+     *   @brief  Get value for adaptive mode (-a argument)
+     *
+     *   In adaptive mode a connection that becomes free after every chunk has started takes
+     *   over the upper half of the slowest running chunk.  Adaptive mode implies direct mode.
+     *
+     *   @return true if slow chunks should be split
+     */
+    bool splitSlowChunks() {
+        return adaptive_;
+    }
+    /**
+     *   @brief  Get value for keep-alive mode (-k argument)
+     *
+     *   In keep-alive mode connections to the server are kept open and reused by the
+     *   following chunk requests instead of connecting once per chunk.
+     *
+     *   @return true if connections should be reused
+     */
+    bool reuseConnections() {
+        return keep_alive_;
+    }
+    /**
+     *   @brief  Get value for journal mode (-j argument)
+     *
+     *   In journal mode the ranges that have been downloaded are recorded next to the
+     *   output file, and a download that was interrupted carries on where it stopped.
+     *   Journal mode implies direct mode.
+     *
+     *   @return true if a journal should be kept
+     */
+    bool keepJournal() {
+        return journal_;
+    }
+    /**
+     *   @brief  Get value for sharded mode (-x argument)
+     *
+     *   In sharded mode every thread runs an io_service of its own and the connections are
+     *   spread across them, instead of all the threads sharing one io_service.
+     *
+     *   @return true if each thread should have its own io_service
+     */
+    bool shardIOServices() {
+        return sharded_;
+    }
+    /**
+     *   @brief  Get value for splice mode (--splice argument)
+     *
+     *   In splice mode the kernel moves each body from the socket into the output file, so
+     *   the bytes are never copied into multiget.  Bodies that have to be read (https://,
+     *   chunked or checksummed) and output that is not a regular file are copied as usual.
+     *
+     *   @return true if the bodies should be spliced into the output file
+     */
+    bool useSplice() {
+        return splice_;
+    }
+    /**
+     *   @brief  Get value for auto tuning (--auto argument)
+     *
+     *   When auto tuning the number of connections and the chunk size are worked out from
+     *   the throughput as the download goes, instead of being fixed by -m and -c.  Auto
+     *   tuning implies parallel mode.
+     *
+     *   @return true if the connections and chunk size should be tuned
+     */
+    bool autoTune() {
+        return auto_tune_;
+    }
     /**
      *   @brief  Get the number of chunks to break the request into (-c argument)
      *
@@ -102,40 +217,202 @@ public:
      *
      *   @return chunk size in bytes
      */
-    int getChunkSize() {
+    int64_t getChunkSize() {
         return chunk_size_;
     }
     /**
      *   @brief  Get the total number of bytes to download (-b argument)
      *
-     *   @return Total number of bytes to request
+     *   @return Total number of bytes to request, or 0 if the size has to be found out from the server
      */
-    int getTotalSize() {
+    int64_t getTotalSize() {
         return total_size_;
     }
+    /**
+     *   @brief  Set the total number of bytes to download once it is known
+     *
+     *   The chunk size is recalculated unless it was given on the command line.
+     *
+     *   @param  total_size Size of the file
+     *
+     *   @return void
+     */
+    void setTotalSize(int64_t total_size);
+    /**
+     *   @brief  Get the maximum number of requests to run at once in parallel mode (-m argument)
+     *
+     *   @return connection count
+     */
+    int getMaxConnections() {
+        return max_connections_;
+    }
     /**
      *   @brief  Get the number of threads to use in parallel mode (-t argument)
      *
-     *   @return thread count
+     *   @return thread count, 0 for one per core (sharded mode only)
      */
     int getThreadCount() {
         return thread_count_;
     }
+    /**
+     *   @brief  Get the size of the receive buffers (-r argument)
+     *
+     *   @return read size in bytes
+     */
+    int getReadSize() {
+        return read_size_;
+    }
+    /**
+     *   @brief  Get the expected checksums of the file (-e arguments)
+     *
+     *   @return checksums keyed by algorithm, empty if none were given
+     */
+    const Checksums& getChecksums() {
+        return checksums_;
+    }
+    /**
+     *   @brief  Get value for verify mode (-v argument)
+     *
+     *   @return true if the download should be checksummed even without an expected checksum
+     */
+    bool verifyChecksums() {
+        return verify_;
+    }
+    /**
+     *   @brief  Get the number of times to retry a chunk (--retries argument)
+     *
+     *   @return retry count for each chunk
+     */
+    int getRangeRetries() {
+        return range_retries_;
+    }
+    /**
+     *   @brief  Get the number of retries allowed for the whole download (--total-retries argument)
+     *
+     *   @return retry count
+     */
+    int getTotalRetries() {
+        return total_retries_;
+    }
+    /**
+     *   @brief  Get value for progress mode (-P argument)
+     *
+     *   @return true if a progress line should be shown during the download
+     */
+    bool showProgress() {
+        return progress_;
+    }
+    /**
+     *   @brief  Get the name of the file for the request timings (--metrics argument)
+     *
+     *   @return filename, or an empty string if no timings are wanted
+     */
+    const std::string& getMetricsFile() {
+        return metrics_file_name_;
+    }
+    /**
+     *   @brief  Get the file of extra certificates to trust for https:// (--ca-file argument)
+     *
+     *   @return filename, or an empty string to trust only the system's certificates
+     */
+    const std::string& getCAFile() {
+        return ca_file_;
+    }
+    /**
+     *   @brief  Get value for insecure mode (--insecure argument)
+     *
+     *   @return true if any certificate should be accepted for https://
+     */
+    bool insecure() {
+        return insecure_;
+    }
+    /**
+     *   @brief  Get the options for downloading the file named on the command line
+     *
+     *   @return download options
+     */
+    DownloadOptions getDownloadOptions();
+    /**
+     *   @brief  Get the name of the manifest for batch mode (-i argument)
+     *
+     *   @return filename ("-" for stdin), or an empty string if a single file is being downloaded
+     */
+    const std::string& getManifestFile() {
+        return manifest_file_name_;
+    }
+    /**
+     *   @brief  Get the maximum number of requests to run at once to each server in batch mode (--per-host argument)
+     *
+     *   @return connection count
+     */
+    int getMaxPerHost() {
+        return max_per_host_;
+    }
+    /**
+     *   @brief  Get the ranges of the file to download (read from the --ranges file)
+     *
+     *   @return ranges, sorted and merged, or empty to download the whole file
+     */
+    const RangeList& getRanges() {
+        return ranges_;
+    }
+    /**
+     *   @brief  Get the most ranges to ask for in one request (--ranges-per-request argument)
+     *
+     *   @return range count
+     */
+    int getRangesPerRequest() {
+        return ranges_per_request_;
+    }
+    /**
+     *   @brief  Get the block index to update an old copy of the file with (--delta argument)
+     *
+     *   @return file name or URL of the index, empty to download the whole file
+     */
+    const std::string& getDeltaIndex() {
+        return delta_index_;
+    }
 private:
-    bool parseURL();
     bool validateParameters(po::variables_map& vm);
     
     po::options_description desc_;
     std::string output_file_name_;
-    std::string url_;
-    std::string server_;
-    std::string port_;
-    std::string path_;
+    std::vector<std::string> url_strings_;
+    std::vector<URL> urls_;
     bool parallel_download_;
+    bool direct_write_;
+    bool keep_alive_;
+    bool adaptive_;
+    bool sharded_;
+    bool journal_;
+    bool splice_;
+    bool auto_tune_;
     int chunk_count_;
-    int chunk_size_;
-    int total_size_;
+    int64_t chunk_size_;
+    int64_t total_size_;
+    bool chunk_size_specified_;
     int thread_count_;
+    int max_connections_;
+    int read_size_;
+    bool verify_;
+    int range_retries_;
+    int total_retries_;
+    bool progress_;
+    std::string metrics_file_name_;
+    std::string ca_file_;
+    bool insecure_;
+    std::string manifest_file_name_;
+    int max_per_host_;
+    std::string range_file_name_;
+    RangeList ranges_;
+    int ranges_per_request_;
+    std::string delta_index_;
+    std::string delta_source_;
+    std::string cache_dir_;
+    int64_t cache_size_;
+    int64_t stream_buffer_size_;
+    std::vector<std::string> checksum_strings_;
+    Checksums checksums_;
 };
 
 #endif // __multiget_args_h__
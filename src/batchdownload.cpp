@@ -0,0 +1,105 @@
+#include "batchdownload.h"
+#include "batchscheduler.h"
+#include "ioservicepool.h"
+#include "endpointcache.h"
+#include "bufferpool.h"
+#include "tlscontext.h"
+#include "httpget.h"
+#include "checksum.h"
+#include "outputfile.h"
+
+#include <algorithm>
+
+BatchDownload::BatchDownload(const DownloadOptions& options, const std::vector<ManifestEntry>& files)
+: options_(options)
+, files_(files)
+, metrics_(NULL)
+, succeeded_(files.size(), false)
+, succeeded_count_(0)
+, total_bytes_(0)
+{
+}
+
+bool BatchDownload::run()
+{
+    LogScope scope(log_handler_);
+    try {
+        download();
+    } catch (const std::exception& e) {
+        LogMessage() << "Exception: " << e.what() << " - unable to download the files";
+    } catch (...) {
+        LogMessage() << "Unknown exception - unable to download the files";
+    }
+    return succeeded_count_ == files_.size();
+}
+
+/*
+ * Run every file through one BatchScheduler, then check the files that have checksums in
+ * the list.  The results are left in succeeded_, succeeded_count_ and total_bytes_.
+ */
+void BatchDownload::download()
+{
+    IOServicePool io_services(1);
+    boost::asio::io_service& io_service = io_services.getIOService(0);
+    EndpointCache endpoint_cache;
+    // Smaller buffers would not hold the response headers
+    BufferPool buffer_pool(std::max<int>(options_.read_size, HTTPGet::MIN_READ_SIZE));
+    TLSContext tls(!options_.insecure);
+    if (!options_.ca_file.empty() && !tls.loadCAFile(options_.ca_file)) {
+        return;
+    }
+
+    BatchScheduler scheduler(io_service, files_, options_.max_connections, options_.max_per_host, options_.chunk_size,
+                             &io_services.getConnectionPool(0));
+    scheduler.setEndpointCache(&endpoint_cache);
+    scheduler.setTLSContext(&tls);
+    scheduler.setBufferPool(&buffer_pool);
+    scheduler.setChecksum(options_.verify);
+    scheduler.setMetrics(metrics_);
+    scheduler.setRetryLimits(options_.range_retries, options_.total_retries);
+    scheduler.setSplice(options_.splice);
+    scheduler.start();
+    IOServicePool::run(io_service, options_.thread_count);
+
+    for (size_t i = 0; i < files_.size(); i++) {
+        const ManifestEntry& entry = files_[i];
+        if (!scheduler.succeeded(i)) {
+            continue;
+        }
+        Checksums actual;
+        uint32_t crc;
+        if (scheduler.getCRC32C(i, crc)) {
+            actual["crc32c"] = crc32cBytes(crc);
+            if (entry.checksums.empty()) {
+                LogMessage() << "CRC32C of " << entry.output_file_name << ": " << toHex(actual["crc32c"]);
+            }
+        }
+        FileDigests digests;
+        for (Checksums::const_iterator it = entry.checksums.begin(); it != entry.checksums.end(); ++it) {
+            if (it->first != "crc32c") {
+                digests[it->first].reset(new MessageDigest(it->first));
+            }
+        }
+        // Without verify the ranges were not checksummed, so an expected CRC32C is read
+        // back from the file with the digests
+        CRC32C file_crc;
+        bool read_crc = entry.checksums.count("crc32c") && !actual.count("crc32c");
+        if (!digests.empty() || read_crc) {
+            digestFile(entry.output_file_name, digests, read_crc ? &file_crc : NULL);
+        }
+        if (read_crc) {
+            actual["crc32c"] = crc32cBytes(file_crc.value());
+        }
+        for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+            actual[it->first] = it->second->finish();
+        }
+        if (!entry.checksums.empty()) {
+            LogMessage() << "Checking " << entry.output_file_name;
+        }
+        if (verifyChecksums(entry.checksums, actual)) {
+            succeeded_[i] = true;
+            succeeded_count_++;
+            total_bytes_ += getFileSize(entry.output_file_name);
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef __multiget_batch_download_include__
+#define __multiget_batch_download_include__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "download.h"
+#include "manifest.h"
+#include "log.h"
+
+class Metrics;
+
+/*! \brief Download a list of files (see readManifest) with one set of connections
+ *
+ *  This is the batch mode of multiget as a class.  The files share one io_service, one pool
+ *  of keep-alive connections and one DNS cache, and no more than max_connections requests
+ *  run at once, nor more than max_per_host to any one server (see BatchScheduler).  Each
+ *  file is written in place to its output file, and checked against the checksums the list
+ *  gives for it once it is complete.
+ *
+ *  Of the DownloadOptions only these are used: max_connections, max_per_host, chunk_size
+ *  (1 MiB if 0), thread_count, read_size, verify, range_retries, total_retries (counted for
+ *  each file), ca_file, insecure and splice.
+ *
+ *  A BatchDownload is run once.
+ */
+class BatchDownload {
+public:
+    /**
+     *   @brief  Create a BatchDownload object.
+     *
+     *   @param  options How to download the files
+     *   @param  files The files to download and where to write them
+     *
+     *   @return BatchDownload object
+     */
+    BatchDownload(const DownloadOptions& options, const std::vector<ManifestEntry>& files);
+    virtual ~BatchDownload() {}
+
+    /**
+     *   @brief  Be told what the download has to say (must be called before run)
+     *
+     *   @param  handler Function to call with each message (see Download::setLogHandler)
+     *
+     *   @return void
+     */
+    void setLogHandler(const log_handler& handler) { log_handler_ = handler; }
+
+    /**
+     *   @brief  Record the timings of every request (must be called before run)
+     *
+     *   @param  metrics Where to add each request when it finishes, or NULL for none
+     *
+     *   @return void
+     */
+    void setMetrics(Metrics* metrics) { metrics_ = metrics; }
+
+    /**
+     *   @brief  Download the files on the calling thread (and any worker threads)
+     *
+     *   @return true if every file was downloaded and its checksums were right
+     */
+    bool run();
+
+    /**
+     *   @brief  Find out whether a file was downloaded and its checksums were right (once
+     *          run has returned)
+     *
+     *   @param  file Position of the file in the list
+     *
+     *   @return true if the file is good
+     */
+    bool succeeded(size_t file) { return file < succeeded_.size() && succeeded_[file]; }
+
+    /**
+     *   @brief  Get the number of files that were downloaded and checked (once run has returned)
+     *
+     *   @return file count
+     */
+    size_t getSucceededCount() { return succeeded_count_; }
+
+    /**
+     *   @brief  Get the number of bytes in the files that were downloaded and checked (once
+     *          run has returned)
+     *
+     *   @return byte count
+     */
+    int64_t getTotalBytes() { return total_bytes_; }
+
+private:
+    void download();
+
+    DownloadOptions             options_;
+    std::vector<ManifestEntry>  files_;
+    log_handler                 log_handler_;
+    Metrics*                    metrics_;
+    std::vector<bool>           succeeded_; // for each of files_
+    size_t                      succeeded_count_;
+    int64_t                     total_bytes_;
+
+    // Ensure that these method are not created explicitly
+    BatchDownload(const BatchDownload& in); // not implemented
+    BatchDownload& operator = (const BatchDownload &t); // not implemented
+};
+
+#endif // __multiget_batch_download_include__
@@ -0,0 +1,471 @@
+#include "batchscheduler.h"
+#include "httpget.h"
+#include "outputfile.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <boost/bind.hpp>
+
+#include <sys/stat.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+// Fewest output files to keep open at once, so that small files on busy servers do not
+// stop the files on other servers from starting
+static const size_t MIN_OPEN_FILES = 64;
+
+BatchScheduler::File::File(const ManifestEntry& entry)
+: entry(entry)
+, host(entry.url.getServer() + ":" + entry.url.getPort())
+, size(entry.size)
+, next_offset(0)
+, sizing(false)
+, whole(false)
+, checksum(entry.checksums.count("crc32c") > 0)
+, failed(false)
+, finished(false)
+, running(0)
+, pending(0)
+, retries(0)
+, bytes_written(0)
+{
+}
+
+BatchScheduler::BatchScheduler(boost::asio::io_service& io_service, const std::vector<ManifestEntry>& files, int max_in_flight,
+                               int max_per_host, int64_t chunk_size, ConnectionPool* pool)
+: io_service_(io_service)
+, pool_(pool)
+, checksum_(false)
+, max_in_flight_(max_in_flight > 0 ? max_in_flight : 1)
+, max_per_host_(max_per_host > 0 ? max_per_host : max_in_flight_)
+, chunk_size_(chunk_size > 0 ? chunk_size : 1024 * 1024)
+, next_file_(0)
+, in_flight_(0)
+{
+    for (const ManifestEntry& entry: files) {
+        files_.push_back(File(entry));
+    }
+}
+
+BatchScheduler::~BatchScheduler()
+{
+    for (HTTPGet* request: active_) {
+        delete request;
+    }
+}
+
+void BatchScheduler::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (checksum_) {
+        for (File& file: files_) {
+            file.checksum = true;
+        }
+    }
+    launch();
+}
+
+bool BatchScheduler::succeeded(size_t file)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_[file].finished && !files_[file].failed;
+}
+
+bool BatchScheduler::getCRC32C(size_t file, uint32_t& crc)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const File& source = files_[file];
+    if (!source.checksum || !source.finished || source.failed) {
+        return false;
+    }
+    crc = 0;
+    int64_t position = 0;
+    for (std::map<int64_t, Piece>::const_iterator it = source.pieces.begin(); it != source.pieces.end(); ++it) {
+        if (it->first != position) {
+            // A gap (or an overlap) - the pieces do not cover the file
+            return false;
+        }
+        crc = CRC32C::combine(crc, it->second.crc, it->second.length);
+        position += it->second.length;
+    }
+    return position == source.size;
+}
+
+/*
+ * Start requests until the window is full or nothing else can start yet.  Must be called
+ * with mutex_ held.
+ */
+void BatchScheduler::launch()
+{
+    Task task;
+    while (in_flight_ < max_in_flight_ && next_task(task)) {
+        launch_task(task);
+    }
+}
+
+/*
+ * Find the next range to request whose server has room for another request: a retry,
+ * then more of a file that has already started, then the start of the next file.  Must
+ * be called with mutex_ held.
+ */
+bool BatchScheduler::next_task(Task& task)
+{
+    for (std::deque<Task>::iterator it = ready_.begin(); it != ready_.end(); ++it) {
+        if (host_has_room(files_[it->file].host)) {
+            task = *it;
+            ready_.erase(it);
+            files_[task.file].pending--;
+            return true;
+        }
+    }
+    std::deque<size_t>::iterator it = open_.begin();
+    while (it != open_.end()) {
+        const File& file = files_[*it];
+        if (file.failed || file.whole || (file.size >= 0 && file.next_offset >= file.size)) {
+            // Every range of this file has been handed out
+            it = open_.erase(it);
+            continue;
+        }
+        if (host_has_room(file.host) && next_range(*it, task)) {
+            return true;
+        }
+        ++it;
+    }
+    size_t max_open = std::max(MIN_OPEN_FILES, static_cast<size_t>(2 * max_in_flight_));
+    while (next_file_ < files_.size() && open_.size() < max_open) {
+        size_t file = next_file_++;
+        if (!open_file(file)) {
+            continue;
+        }
+        open_.push_back(file);
+        if (host_has_room(files_[file].host) && next_range(file, task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Hand out the next range of a file.  Must be called with mutex_ held.
+ */
+bool BatchScheduler::next_range(size_t file, Task& task)
+{
+    File& source = files_[file];
+    if (source.sizing) {
+        return false;
+    }
+    task = Task();
+    task.file = file;
+    task.start = source.next_offset;
+    if (source.size < 0) {
+        // The response to the first range says how big the file is, and nothing else can be
+        // asked for until it has arrived.  A small file comes whole in this one request.
+        task.end = chunk_size_ - 1;
+        source.sizing = true;
+    } else {
+        task.end = std::min(task.start + chunk_size_, source.size) - 1;
+    }
+    source.next_offset = task.end + 1;
+    return true;
+}
+
+/*
+ * Create a file's parent directories, so the manifest can put files anywhere
+ */
+static void make_parent_directories(const std::string& path)
+{
+    for (std::string::size_type slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        // Any error shows up when the file is created
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+}
+
+/*
+ * Create the output file.  Returns false if there is nothing to request (it could not be
+ * created, or it is empty).  Must be called with mutex_ held.
+ */
+bool BatchScheduler::open_file(size_t file)
+{
+    File& source = files_[file];
+    make_parent_directories(source.entry.output_file_name);
+    source.output.reset(new OutputFile());
+    if (!source.output->open(source.entry.output_file_name, source.size > 0 ? source.size : 0)) {
+        fail_file(file, "unable to create the output file");
+        return false;
+    }
+    if (source.size == 0) {
+        check_finished(file);
+        return false;
+    }
+    return true;
+}
+
+bool BatchScheduler::host_has_room(const std::string& host)
+{
+    return host_in_flight_[host] < max_per_host_;
+}
+
+/*
+ * Create and start the request for one range.  Must be called with mutex_ held.
+ */
+void BatchScheduler::launch_task(const Task& task)
+{
+    File& file = files_[task.file];
+    const URL& url = file.entry.url;
+    HTTPGet* request = new HTTPGet(io_service_, url.getServer(), url.getPath(), url.getPort(), task.start, task.end, file.output.get());
+    setup_request(*request, url, pool_);
+    request->setChecksum(file.checksum);
+    request->setCompletionHandler(boost::bind(&BatchScheduler::handle_complete, this, _1));
+    active_.insert(request);
+    request_task_[request] = task;
+    host_in_flight_[file.host]++;
+    file.running++;
+    in_flight_++;
+    io_service_.post(boost::bind(&HTTPGet::start, request));
+}
+
+void BatchScheduler::handle_complete(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Task task = request_task_[request];
+    request_task_.erase(request);
+    File& file = files_[task.file];
+    host_in_flight_[file.host]--;
+    file.running--;
+    in_flight_--;
+    if (metrics_) {
+        metrics_->add(*request, file.entry.url.getURL());
+    }
+
+    int64_t written = request->getBytesWritten();
+    // A request that failed after the whole range arrived still has what we wanted
+    bool ok = request->succeeded() || (task.end >= 0 && written == task.end - task.start + 1);
+    ok = ok && !file.failed && check_response(file, task, request);
+    if (!file.failed && !(file.whole && task.end >= 0)) {
+        // (A range of a file that is now being fetched whole does not count)
+        file.bytes_written += written;
+        if (file.checksum && written > 0) {
+            Piece piece;
+            piece.length = written;
+            piece.crc = request->getCRC32C();
+            file.pieces[task.start] = piece;
+        }
+        if (ok && (file.sizing || task.end < 0)) {
+            learn_size(task.file, task, request);
+        } else if (!ok) {
+            retry(task, written, request->failedPermanently());
+        }
+    }
+
+    // The request is still on the call stack, so delete it later
+    io_service_.post(boost::bind(&BatchScheduler::release, this, request));
+    check_finished(task.file);
+    launch();
+}
+
+/*
+ * Make sure the response is for the same file as the others.  Returns false if the
+ * request's bytes cannot be used.  Must be called with mutex_ held.
+ */
+bool BatchScheduler::check_response(File& file, const Task& task, HTTPGet* request)
+{
+    size_t index = &file - &files_[0];
+    const HTTPResponse& response = request->getResponse();
+    if (!response.etag.empty()) {
+        if (file.etag.empty()) {
+            file.etag = response.etag.str();
+        } else if (response.etag != file.etag) {
+            fail_file(index, "the file changed while it was being downloaded");
+            return false;
+        }
+    }
+    if (response.status_code == 206 && response.instance_length >= 0 && file.size >= 0 && response.instance_length != file.size) {
+        fail_file(index, "the server says the file is " + std::to_string(response.instance_length) + " bytes, not " +
+                  std::to_string(file.size));
+        return false;
+    }
+    if (response.status_code == 200 && task.end >= 0 &&
+        (response.content_length < 0 || response.content_length > task.end + 1)) {
+        // The server sent the whole file instead of the range, and it is bigger than the range
+        fetch_whole(index);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The first request of a file (or the request for the whole file) has arrived, so the
+ * size of the file is known.  Must be called with mutex_ held.
+ */
+void BatchScheduler::learn_size(size_t index, const Task& task, HTTPGet* request)
+{
+    File& file = files_[index];
+    const HTTPResponse& response = request->getResponse();
+    int64_t size;
+    if (task.end < 0) {
+        size = task.start + request->getBytesWritten();
+    } else if (response.status_code == 206) {
+        size = response.instance_length;
+    } else {
+        // A 200 that fitted in the range (see check_response)
+        size = response.content_length;
+    }
+    if (size < 0) {
+        // The server did not say, e.g. "Content-Range: bytes 0-1023/*"
+        fetch_whole(index);
+        return;
+    }
+    if (file.size >= 0 && size != file.size) {
+        fail_file(index, "the file is " + std::to_string(size) + " bytes, not " + std::to_string(file.size));
+        return;
+    }
+    file.sizing = false;
+    file.size = size;
+    if (task.end < 0 || file.next_offset > size) {
+        file.next_offset = size;
+    }
+    if (file.next_offset < size && !file.output->setSize(size)) {
+        fail_file(index, "unable to allocate the output file");
+    }
+}
+
+/*
+ * The server does not support ranges, so forget the ranges and get the file in one
+ * request.  Must be called with mutex_ held.
+ */
+void BatchScheduler::fetch_whole(size_t index)
+{
+    File& file = files_[index];
+    if (file.whole) {
+        return;
+    }
+    LogMessage() << "The server does not support ranges - downloading " << file.entry.url.getURL() << " in a single request";
+    file.whole = true;
+    file.sizing = false;
+    file.next_offset = 0;
+    file.bytes_written = 0;
+    file.pieces.clear();
+    for (std::deque<Task>::iterator it = ready_.begin(); it != ready_.end();) {
+        if (it->file == index) {
+            it = ready_.erase(it);
+            file.pending--;
+        } else {
+            ++it;
+        }
+    }
+    Task task;
+    task.file = index;
+    ready_.push_front(task);
+    file.pending++;
+}
+
+/*
+ * Request the rest of a range that failed, after a backoff.  A permanent failure gives up
+ * on the file straight away.  Must be called with mutex_ held.
+ */
+void BatchScheduler::retry(const Task& failed, int64_t written, bool permanent)
+{
+    File& file = files_[failed.file];
+    Task task(failed);
+    task.start += written;
+    if (task.end >= 0 && task.start > task.end) {
+        return;
+    }
+    if (permanent) {
+        fail_file(task.file, "asking again would get the same error");
+        return;
+    }
+    if (task.retries >= max_range_retries_ || file.retries >= max_total_retries_) {
+        fail_file(task.file, "giving up after " + std::to_string(file.retries) + " retries");
+        return;
+    }
+    task.retries++;
+    file.retries++;
+
+    int delay = backoff(task.retries);
+    LogMessage() << "Retrying bytes " << task.start << "-" << (task.end >= 0 ? std::to_string(task.end) : "") << " of " <<
+        file.entry.url.getURL() << " in " << delay << "ms (retry " << task.retries << " of " << max_range_retries_ << ")";
+
+    std::shared_ptr<boost::asio::deadline_timer> timer(new boost::asio::deadline_timer(io_service_));
+    timer->expires_from_now(boost::posix_time::milliseconds(delay));
+    timer->async_wait(boost::bind(&BatchScheduler::handle_backoff, this, timer, task));
+    file.pending++;
+}
+
+void BatchScheduler::handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Task task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    File& file = files_[task.file];
+    file.pending--;
+    if (file.failed || (file.whole && task.end >= 0)) {
+        // The file has been given up on, or a request for all of it has replaced the range
+        check_finished(task.file);
+        return;
+    }
+    // Retries go ahead of the ranges that have not started yet
+    ready_.push_front(task);
+    file.pending++;
+    launch();
+}
+
+/*
+ * Stop downloading a file.  Its running requests are left to finish.  Must be called
+ * with mutex_ held.
+ */
+void BatchScheduler::fail_file(size_t index, const std::string& reason)
+{
+    File& file = files_[index];
+    if (file.failed) {
+        return;
+    }
+    LogMessage() << "Error: " << file.entry.url.getURL() << ": " << reason;
+    file.failed = true;
+    for (std::deque<Task>::iterator it = ready_.begin(); it != ready_.end();) {
+        if (it->file == index) {
+            it = ready_.erase(it);
+            file.pending--;
+        } else {
+            ++it;
+        }
+    }
+    check_finished(index);
+}
+
+/*
+ * Close a file once nothing is running or left to request for it.  Must be called with
+ * mutex_ held.
+ */
+void BatchScheduler::check_finished(size_t index)
+{
+    File& file = files_[index];
+    if (file.finished || file.running > 0 || file.pending > 0) {
+        return;
+    }
+    if (!file.failed && (file.sizing || file.size < 0 || file.next_offset < file.size)) {
+        return;
+    }
+    file.finished = true;
+    if (file.output) {
+        file.output->close();
+        file.output.reset();
+    }
+    if (!file.failed && file.bytes_written != file.size) {
+        LogMessage() << "Error: " << file.entry.url.getURL() << ": only " << file.bytes_written << " of " << file.size <<
+            " bytes arrived";
+        file.failed = true;
+    }
+    if (file.failed) {
+        LogMessage() << "Failed to download " << file.entry.url.getURL();
+    } else {
+        LogMessage() << "Downloaded " << file.entry.url.getURL() << " to " << file.entry.output_file_name << " (" << file.size <<
+            " bytes)";
+    }
+}
+
+void BatchScheduler::release(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_.erase(request);
+    delete request;
+}
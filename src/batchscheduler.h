@@ -0,0 +1,177 @@
+#ifndef __multiget_batch_scheduler_include__
+#define __multiget_batch_scheduler_include__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <boost/asio.hpp>
+
+#include "manifest.h"
+#include "schedulerbase.h"
+
+class HTTPGet;
+class OutputFile;
+class ConnectionPool;
+
+/*! \brief Download many files with one set of connections and one request window
+ *
+ *  The BatchScheduler works through a list of files (see readManifest) in order, sharing
+ *  the io_service, the keep-alive connections and the DNS results between all of them.
+ *  No more than the configured number of requests run at once, and no more than the
+ *  per-host limit go to any one server, so a long list cannot flood a server or run out
+ *  of file descriptors.  Only a bounded number of output files are open at a time.
+ *
+ *  Every file is written in place, a range at a time.  A file no bigger than the chunk
+ *  size is fetched in one request, a bigger one is split into chunk-sized ranges that
+ *  run alongside the ranges of the other files.  If the manifest does not give the size
+ *  the first range request finds it out.  A file whose server does not support ranges is
+ *  fetched in a single request instead.
+ *
+ *  A range that fails is retried after a backoff for the bytes that did not arrive.  A
+ *  file that fails, or that changes (a different ETag or size) while it is downloaded, is
+ *  given up on without holding up the rest of the batch.
+ *
+ *  The requests may run on several threads at once.
+ */
+class BatchScheduler : public SchedulerBase {
+public:
+    /**
+     *   @brief  Create a BatchScheduler object.
+     *
+     *   @param  io_service The io_service that runs the requests
+     *   @param  files The files to download
+     *   @param  max_in_flight Maximum number of requests running at once, over all servers
+     *   @param  max_per_host Maximum number of requests running at once to each server
+     *   @param  chunk_size Largest range to get in one request
+     *   @param  pool Persistent connections shared by all of the requests
+     *
+     *   @return BatchScheduler object
+     */
+    BatchScheduler(boost::asio::io_service& io_service, const std::vector<ManifestEntry>& files, int max_in_flight, int max_per_host,
+                   int64_t chunk_size, ConnectionPool* pool);
+    virtual ~BatchScheduler();
+
+    /**
+     *   @brief  Keep a CRC32C of every file (must be called before start)
+     *
+     *   Files with a crc32c checksum in the manifest are always checksummed.
+     *
+     *   @param  checksum true to checksum every file
+     *
+     *   @return void
+     */
+    void setChecksum(bool checksum) { checksum_ = checksum; }
+
+    /**
+     *   @brief  Start the first window of requests.  They run when the io_service is run,
+     *          which returns once every file has finished.
+     *
+     *   @return void
+     */
+    void start();
+
+    /**
+     *   @brief  Find out whether a file was downloaded
+     *
+     *   @param  file Position of the file in the list
+     *
+     *   @return true if every byte of the file was written
+     */
+    bool succeeded(size_t file);
+
+    /**
+     *   @brief  Get the CRC32C of a file (see setChecksum)
+     *
+     *   @param  file Position of the file in the list
+     *   @param  crc Receives the checksum
+     *
+     *   @return false if the file was not checksummed or did not download
+     */
+    bool getCRC32C(size_t file, uint32_t& crc);
+
+private:
+    /*
+     * The checksum of some bytes that have been written
+     */
+    struct Piece {
+        int64_t     length;
+        uint32_t    crc;
+    };
+    /*
+     * A range of a file to request
+     */
+    struct Task {
+        Task() : file(0), start(0), end(-1), retries(0) {}
+        size_t      file; // position in files_
+        int64_t     start;
+        int64_t     end; // -1 for the rest of the file
+        int         retries; // number of times the range has been retried
+    };
+    /*
+     * How far the download of a file has got
+     */
+    struct File {
+        explicit File(const ManifestEntry& entry);
+
+        ManifestEntry               entry;
+        std::string                 host; // server:port, for the per-host limit
+        std::shared_ptr<OutputFile> output; // open while the file is being downloaded
+        int64_t                     size; // -1 until it is known
+        int64_t                     next_offset; // first byte not yet given to a request
+        bool                        sizing; // a request that will tell us the size is running (or waiting to retry)
+        bool                        whole; // the server does not support ranges, so get it in one request
+        bool                        checksum; // keep a CRC32C of the file
+        bool                        failed;
+        bool                        finished; // nothing is running or left to run, the output is closed
+        int                         running; // requests running
+        int                         pending; // ranges waiting for their backoff or in ready_
+        int                         retries; // retries so far
+        int64_t                     bytes_written;
+        std::string                 etag; // ETag of the first response, to spot a change
+        std::map<int64_t, Piece>    pieces; // checksums of the bytes written, keyed by offset
+    };
+
+    void launch();
+    bool next_task(Task& task);
+    bool next_range(size_t file, Task& task);
+    bool open_file(size_t file);
+    bool host_has_room(const std::string& host);
+    void launch_task(const Task& task);
+    void handle_complete(HTTPGet* request);
+    bool check_response(File& file, const Task& task, HTTPGet* request);
+    void learn_size(size_t file, const Task& task, HTTPGet* request);
+    void fetch_whole(size_t file);
+    void retry(const Task& task, int64_t written, bool permanent);
+    void handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Task task);
+    void fail_file(size_t file, const std::string& reason);
+    void check_finished(size_t file);
+    void release(HTTPGet* request);
+
+    boost::asio::io_service&    io_service_;
+    ConnectionPool*             pool_;
+    bool                        checksum_;
+    int                         max_in_flight_;
+    int                         max_per_host_;
+    int64_t                     chunk_size_;
+
+    std::mutex                  mutex_; // protects everything below
+    std::vector<File>           files_;
+    size_t                      next_file_; // first file that has not been opened
+    std::deque<size_t>          open_; // files with ranges that have not been handed out, in order
+    std::deque<Task>            ready_; // retries whose backoff is over, and whole file requests
+    std::map<std::string, int>  host_in_flight_; // requests running to each server
+    std::map<HTTPGet*, Task>    request_task_; // the range each running request was started for
+    std::set<HTTPGet*>          active_; // requests that have not been deleted
+    int                         in_flight_;
+
+    // Ensure that these method are not created explicitly
+    BatchScheduler(const BatchScheduler& in); // not implemented
+    BatchScheduler& operator = (const BatchScheduler &t); // not implemented
+};
+
+#endif // __multiget_batch_scheduler_include__
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+namespace po = boost::program_options;
+
+#include "rangeserver.h"
+
+/*
+ * End to end throughput benchmark.  A RangeServer is started in this process on the
+ * loopback address and the multiget binary is run against it once for every combination
+ * of mode, chunk count (or chunk size) and thread count.  Each run reports the download
+ * rate and the 50th and 99th percentile time the server took to send a chunk, and the
+ * output file is checked byte for byte.
+ *
+ * Everything runs on one machine with no network, so it can be run after each change to
+ * catch regressions: "make bench", or ./benchmark --help for the options.
+ */
+
+// One configuration of multiget to measure
+struct BenchmarkRun {
+    std::string         mode;
+    int                 threads;
+    int                 chunks; // -c, or 0 if chunk_size is used
+    int64_t             chunk_size; // -s, or 0 if chunks is used
+};
+
+// What happened when a configuration was run
+struct BenchmarkResult {
+    BenchmarkResult() : seconds(0.0), exit_status(0), correct(true), requests(0), failures(0) {}
+    double              seconds;
+    int                 exit_status;
+    bool                correct;
+    int                 requests; // chunk requests answered by the server
+    int                 failures; // chunk requests that were cut short or answered 503 or 429
+    std::vector<double> latencies; // seconds to serve each chunk
+};
+
+static std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    boost::algorithm::split(items, list, boost::algorithm::is_any_of(","), boost::algorithm::token_compress_on);
+    items.erase(std::remove(items.begin(), items.end(), std::string()), items.end());
+    return items;
+}
+
+/*
+ * Nearest rank percentile of a sorted list
+ */
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+/*
+ * Run multiget in the scratch directory (so its temporary chunk files go there too)
+ * and wait for it
+ */
+static int run_multiget(const std::vector<std::string>& arguments, const std::string& directory, bool verbose)
+{
+    std::vector<char*> argv;
+    for (const std::string& argument: arguments) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (chdir(directory.c_str()) == -1) {
+            _exit(126);
+        }
+        if (!verbose) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int main(int argc, char* argv[])
+{
+    RangeServer::Options options;
+    std::string multiget("./multiget");
+    std::string modes("serial,parallel,direct,sharded");
+    std::string chunk_counts("1,4,16");
+    std::string chunk_sizes("4194304");
+    std::string thread_counts("1,4");
+    std::string extra;
+    std::string directory(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    int repeat = 1;
+    int server_threads = 1;
+    po::options_description desc("Usage: ./benchmark [OPTIONS]");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("multiget", po::value<std::string>(&multiget), "The multiget binary to measure (default is ./multiget)")
+        ("modes", po::value<std::string>(&modes), "Modes to measure: serial, parallel, direct, adaptive, sharded, auto, splice "
+                                                  "(default is serial,parallel,direct,sharded)")
+        ("chunks,c", po::value<std::string>(&chunk_counts), "Chunk counts to measure (default is 1,4,16)")
+        ("chunk-sizes,s", po::value<std::string>(&chunk_sizes), "Chunk sizes to measure, as well as the counts (default is 4194304)")
+        ("threads,t", po::value<std::string>(&thread_counts), "Thread counts to measure in the parallel modes (default is 1,4)")
+        ("extra", po::value<std::string>(&extra), "More options for every multiget run, e.g. \"-k -m 16\"")
+        ("repeat,n", po::value<int>(&repeat), "Number of times to run each configuration (default is 1)")
+        ("size", po::value<int64_t>(&options.file_size), "Size of the file to download in bytes (default is 67108864)")
+        ("latency,l", po::value<int>(&options.latency_ms), "Milliseconds the server waits before each response (default is 0)")
+        ("rate,r", po::value<int64_t>(&options.rate), "Most bytes per second the server sends on each connection (default is no limit)")
+        ("fail-rate,f", po::value<double>(&options.fail_rate), "Chance of the server cutting a response short (default is 0)")
+        ("error-rate,e", po::value<double>(&options.error_rate), "Chance of the server answering 503 (default is 0)")
+        ("max-requests", po::value<int>(&options.max_requests),
+         "Most requests the server serves at once, the rest are answered 429 (default is no limit)")
+        ("server-threads", po::value<int>(&server_threads), "Number of threads running the server (default is 1)")
+        ("dir", po::value<std::string>(&directory), "Where to put the downloaded files (default is $TMPDIR or /tmp)")
+        ("csv", "Print the results as CSV")
+        ("verbose", "Show the output of multiget");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    bool csv = (vm.count("csv") > 0);
+    bool verbose = (vm.count("verbose") > 0);
+    if (repeat <= 0 || server_threads <= 0 || options.file_size <= 0) {
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // multiget runs in the scratch directory, so it needs the full path
+    char resolved[PATH_MAX];
+    if (realpath(multiget.c_str(), resolved) == NULL || access(resolved, X_OK) == -1) {
+        std::cout << "Error: unable to run " << multiget << std::endl;
+        return EXIT_FAILURE;
+    }
+    multiget = resolved;
+    std::string scratch = directory + "/multiget-bench-XXXXXX";
+    if (mkdtemp(&scratch[0]) == NULL) {
+        std::cout << "Error: unable to create a directory in " << directory << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Every configuration to measure.  The thread count makes no difference to a serial download.
+    std::vector<BenchmarkRun> runs;
+    for (const std::string& mode: split_list(modes)) {
+        if (mode != "serial" && mode != "parallel" && mode != "direct" && mode != "adaptive" &&
+            mode != "sharded" && mode != "auto" && mode != "splice") {
+            std::cout << "Error: unknown mode " << mode << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::string> threads = (mode == "serial") ? std::vector<std::string>(1, "1") : split_list(thread_counts);
+        for (const std::string& thread_count: threads) {
+            BenchmarkRun run;
+            run.mode = mode;
+            run.threads = atoi(thread_count.c_str());
+            run.chunk_size = 0;
+            for (const std::string& count: split_list(chunk_counts)) {
+                run.chunks = atoi(count.c_str());
+                runs.push_back(run);
+            }
+            run.chunks = 0;
+            for (const std::string& size: split_list(chunk_sizes)) {
+                run.chunk_size = strtoll(size.c_str(), NULL, 10);
+                runs.push_back(run);
+            }
+        }
+    }
+
+    boost::asio::io_service io_service;
+    RangeServer server(io_service, 0, options);
+    std::vector<std::thread> server_workers;
+    for (int i = 0; i < server_threads; i++) {
+        server_workers.push_back(std::thread([&io_service]() { io_service.run(); }));
+    }
+    std::ostringstream url;
+    url << "http://127.0.0.1:" << server.getPort() << "/file";
+
+    if (csv) {
+        std::cout << "mode,chunks,chunk_size,threads,seconds,mb_per_second,p50_ms,p99_ms,requests,failures,result" << std::endl;
+    } else {
+        std::cout << "Downloading " << options.file_size << " bytes from " << url.str() << " with " << multiget << std::endl;
+        std::cout << std::left << std::setw(10) << "mode" << std::right << std::setw(8) << "chunks" << std::setw(12) << "chunk size" <<
+            std::setw(9) << "threads" << std::setw(10) << "MB/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" <<
+            std::setw(10) << "requests" << std::setw(10) << "failures" << "  result" << std::endl;
+    }
+
+    bool all_correct = true;
+    std::string output_file = scratch + "/out.bin";
+    for (const BenchmarkRun& run: runs) {
+        std::vector<std::string> arguments;
+        arguments.push_back(multiget);
+        if (run.mode == "parallel") {
+            arguments.push_back("-p");
+        } else if (run.mode == "direct") {
+            arguments.push_back("-p");
+            arguments.push_back("-d");
+        } else if (run.mode == "adaptive") {
+            arguments.push_back("-p");
+            arguments.push_back("-a");
+        } else if (run.mode == "sharded") {
+            arguments.push_back("-x");
+        } else if (run.mode == "splice") {
+            // Direct mode with the bodies moved into the file by the kernel
+            arguments.push_back("-p");
+            arguments.push_back("-d");
+            arguments.push_back("--splice");
+        } else if (run.mode == "auto") {
+            // The chunk count is ignored, the chunk size is where the tuner starts
+            arguments.push_back("--auto");
+        }
+        arguments.push_back("-t");
+        arguments.push_back(std::to_string(run.threads));
+        if (run.chunk_size > 0) {
+            arguments.push_back("-s");
+            arguments.push_back(std::to_string(run.chunk_size));
+        } else {
+            arguments.push_back("-c");
+            arguments.push_back(std::to_string(run.chunks));
+        }
+        for (const std::string& argument: split_list(boost::algorithm::replace_all_copy(extra, " ", ","))) {
+            arguments.push_back(argument);
+        }
+        arguments.push_back("-o");
+        arguments.push_back("out.bin");
+        arguments.push_back(url.str());
+
+        BenchmarkResult result;
+        for (int i = 0; i < repeat; i++) {
+            server.clearStats();
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            int status = run_multiget(arguments, scratch, verbose);
+            result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            if (status != 0) {
+                result.exit_status = status;
+            }
+            if (!RangeServer::checkFile(output_file, options.file_size)) {
+                result.correct = false;
+            }
+            unlink(output_file.c_str());
+
+            // The size probe asks for one byte, it is not a chunk
+            for (const RangeServer::RequestStats& stats: server.getStats()) {
+                if (stats.status == 503 || stats.status == 429 || !stats.completed) {
+                    result.failures++;
+                } else if (stats.length > 1) {
+                    result.requests++;
+                    result.latencies.push_back(stats.seconds);
+                }
+            }
+        }
+        std::sort(result.latencies.begin(), result.latencies.end());
+
+        double rate = (result.seconds > 0.0) ? options.file_size * repeat / result.seconds / 1e6 : 0.0;
+        double p50 = percentile(result.latencies, 0.50) * 1000.0;
+        double p99 = percentile(result.latencies, 0.99) * 1000.0;
+        std::string outcome = "ok";
+        if (result.exit_status != 0) {
+            outcome = "FAILED (exit status " + std::to_string(result.exit_status) + ")";
+        } else if (!result.correct) {
+            outcome = "CORRUPT";
+        }
+        all_correct = all_correct && result.exit_status == 0 && result.correct;
+
+        std::string chunk_size = (run.chunk_size > 0) ? std::to_string(run.chunk_size) : "-";
+        std::string chunks = (run.chunk_size > 0) ? "-" : std::to_string(run.chunks);
+        if (csv) {
+            std::cout << run.mode << "," << chunks << "," << chunk_size << "," << run.threads << "," << std::fixed <<
+                std::setprecision(3) << result.seconds / repeat << "," << rate << "," << p50 << "," << p99 << "," <<
+                result.requests << "," << result.failures << "," << outcome << std::endl;
+        } else {
+            std::cout << std::left << std::setw(10) << run.mode << std::right << std::setw(8) << chunks << std::setw(12) <<
+                chunk_size << std::setw(9) << run.threads << std::fixed << std::setprecision(1) << std::setw(10) << rate <<
+                std::setw(10) << p50 << std::setw(10) << p99 << std::setw(10) << result.requests << std::setw(10) <<
+                result.failures << "  " << outcome << std::endl;
+        }
+    }
+
+    io_service.stop();
+    for (std::thread& t: server_workers) {
+        t.join();
+    }
+    rmdir(scratch.c_str());
+    return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
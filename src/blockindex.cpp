@@ -0,0 +1,312 @@
+#include "blockindex.h"
+#include "checksum.h"
+#include "outputfile.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// First line of every index file, changed if the format ever changes
+static const char INDEX_MAGIC[] = "multiget-index 1";
+
+// Bytes of the old copy read at a time while looking for blocks
+static const size_t SCAN_BUFFER_SIZE = 4 * 1024 * 1024;
+
+BlockIndex::BlockIndex()
+: file_size_(0)
+, block_size_(DEFAULT_BLOCK_SIZE)
+{
+}
+
+/*
+ * The two 16 bit sums of the rsync checksum: a is the sum of the bytes and b the sum of
+ * the bytes weighted by their distance from the end of the window
+ */
+static void weak_sums(const char* data, size_t length, uint32_t& a, uint32_t& b)
+{
+    a = 0;
+    b = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint32_t byte = static_cast<unsigned char>(data[i]);
+        a += byte;
+        b += static_cast<uint32_t>(length - i) * byte;
+    }
+}
+
+static uint32_t weak_value(uint32_t a, uint32_t b)
+{
+    return (a & 0xffff) | (b << 16);
+}
+
+uint32_t BlockIndex::weakChecksum(const char* data, size_t length)
+{
+    uint32_t a, b;
+    weak_sums(data, length, a, b);
+    return weak_value(a, b);
+}
+
+static std::string md5(const char* data, size_t length)
+{
+    MessageDigest digest("md5");
+    digest.update(data, length);
+    return digest.finish();
+}
+
+int64_t BlockIndex::getBlockLength(size_t index)
+{
+    return std::min<int64_t>(block_size_, file_size_ - static_cast<int64_t>(index) * block_size_);
+}
+
+bool BlockIndex::create(const std::string& filename, int block_size)
+{
+    std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!input) {
+        LogMessage() << "Unable to read " << filename;
+        return false;
+    }
+    block_size_ = block_size;
+    file_size_ = 0;
+    blocks_.clear();
+    MessageDigest whole("sha256");
+    std::vector<char> buffer(block_size);
+    while (input) {
+        input.read(&buffer[0], buffer.size());
+        size_t count = static_cast<size_t>(input.gcount());
+        if (count == 0) {
+            break;
+        }
+        Block block;
+        block.weak = weakChecksum(&buffer[0], count);
+        block.strong = md5(&buffer[0], count);
+        blocks_.push_back(block);
+        whole.update(&buffer[0], count);
+        file_size_ += count;
+    }
+    if (input.bad()) {
+        LogMessage() << "Unable to read " << filename;
+        return false;
+    }
+    sha256_ = whole.finish();
+    return true;
+}
+
+/*
+ * The file is a header followed by one line per block:
+ *
+ *   multiget-index 1
+ *   size 40000
+ *   block-size 16384
+ *   sha256 9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08
+ *   block 5a3c01d2 d41d8cd98f00b204e9800998ecf8427e
+ *   block 9e1b7f30 0cc175b9c0f1b6a831c399e269772661
+ *   block 0b2f11aa 92eb5ffee6ae2fec3ad71c777531578f
+ *
+ * Each block is its weak checksum and its MD5, in hex.
+ */
+bool BlockIndex::write(const std::string& filename)
+{
+    std::ofstream output(filename.c_str());
+    output << INDEX_MAGIC << "\n";
+    output << "size " << file_size_ << "\n";
+    output << "block-size " << block_size_ << "\n";
+    output << "sha256 " << toHex(sha256_) << "\n";
+    for (const Block& block: blocks_) {
+        char weak[16];
+        snprintf(weak, sizeof(weak), "%08x", block.weak);
+        output << "block " << weak << " " << toHex(block.strong) << "\n";
+    }
+    output.close();
+    if (!output) {
+        LogMessage() << "Unable to write " << filename;
+        return false;
+    }
+    return true;
+}
+
+bool BlockIndex::read(const std::string& filename)
+{
+    std::ifstream input(filename.c_str());
+    if (!input) {
+        LogMessage() << "Unable to read the block index " << filename;
+        return false;
+    }
+    return load(input, filename);
+}
+
+bool BlockIndex::parse(const std::string& text, const std::string& name)
+{
+    std::istringstream input(text);
+    return load(input, name);
+}
+
+bool BlockIndex::load(std::istream& input, const std::string& name)
+{
+    std::string line;
+    if (!std::getline(input, line) || line != INDEX_MAGIC) {
+        LogMessage() << name << " is not a block index";
+        return false;
+    }
+    file_size_ = -1;
+    block_size_ = 0;
+    sha256_.clear();
+    blocks_.clear();
+    int line_number = 1;
+    while (std::getline(input, line)) {
+        line_number++;
+        std::string::size_type space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+        bool valid = true;
+        if (key == "size") {
+            file_size_ = strtoll(value.c_str(), NULL, 10);
+        } else if (key == "block-size") {
+            block_size_ = atoi(value.c_str());
+        } else if (key == "sha256") {
+            valid = fromHex(value, sha256_) && sha256_.size() == checksumLength("sha256");
+        } else if (key == "block") {
+            Block block;
+            std::string::size_type separator = value.find(' ');
+            char* end;
+            block.weak = static_cast<uint32_t>(strtoul(value.substr(0, separator).c_str(), &end, 16));
+            valid = separator == 8 && *end == '\0' && fromHex(value.substr(separator + 1), block.strong) &&
+                block.strong.size() == checksumLength("md5");
+            blocks_.push_back(block);
+        } else if (!key.empty()) {
+            // Something added by a later version, which an older one can do without
+            continue;
+        }
+        if (!valid) {
+            LogMessage() << "Line " << line_number << " of " << name << " is not valid";
+            return false;
+        }
+    }
+    if (file_size_ < 0 || block_size_ <= 0 || sha256_.empty() ||
+        static_cast<int64_t>(blocks_.size()) != (file_size_ + block_size_ - 1) / block_size_) {
+        LogMessage() << name << " is not a complete block index";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Compare a block with the bytes of the old copy, working out their MD5 the first time
+ */
+bool BlockIndex::check_block(size_t index, const char* data, std::string& strong)
+{
+    if (strong.empty()) {
+        strong = md5(data, static_cast<size_t>(getBlockLength(index)));
+    }
+    return strong == blocks_[index].strong;
+}
+
+size_t BlockIndex::findBlocks(const std::string& filename, std::vector<int64_t>& sources)
+{
+    sources.assign(blocks_.size(), -1);
+    std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!input) {
+        return 0;
+    }
+    int64_t old_size = ::getFileSize(filename);
+    size_t found = 0;
+
+    // The full sized blocks, sorted by their weak checksum.  A bitmap of the weak checksums
+    // rules out most positions without a search.
+    size_t full_blocks = static_cast<size_t>(file_size_ / block_size_);
+    std::vector<std::pair<uint32_t, size_t> > table;
+    for (size_t i = 0; i < full_blocks; i++) {
+        table.push_back(std::make_pair(blocks_[i].weak, i));
+    }
+    std::sort(table.begin(), table.end());
+    int bits = 16;
+    while (bits < 28 && (static_cast<size_t>(1) << bits) < full_blocks * 8) {
+        bits++;
+    }
+    std::vector<bool> filter(static_cast<size_t>(1) << bits);
+    for (size_t i = 0; i < full_blocks; i++) {
+        filter[(blocks_[i].weak * 2654435761u) >> (32 - bits)] = true;
+    }
+
+    // Slide a window along the old copy.  Where it matches a block, the next window starts
+    // after it, otherwise the window moves on one byte.
+    const size_t length = static_cast<size_t>(block_size_);
+    std::vector<char> buffer(std::max(SCAN_BUFFER_SIZE, 2 * length + 1));
+    int64_t base = 0; // offset in the old copy of buffer[0]
+    size_t filled = 0;
+    int64_t position = 0;
+    bool fresh = true; // the sums have to be worked out from scratch
+    uint32_t a = 0, b = 0;
+    while (full_blocks > 0 && position + static_cast<int64_t>(length) <= old_size) {
+        // Keep the window and the byte after it in the buffer
+        size_t wanted = std::min<int64_t>(length + 1, old_size - position);
+        if (position + static_cast<int64_t>(wanted) > base + static_cast<int64_t>(filled)) {
+            size_t keep = static_cast<size_t>(base + filled - position);
+            std::copy(buffer.begin() + (filled - keep), buffer.begin() + filled, buffer.begin());
+            base = position;
+            input.read(&buffer[keep], buffer.size() - keep);
+            filled = keep + static_cast<size_t>(input.gcount());
+            if (filled < wanted) {
+                break;
+            }
+        }
+        const char* window = &buffer[static_cast<size_t>(position - base)];
+        if (fresh) {
+            weak_sums(window, length, a, b);
+            fresh = false;
+        }
+        uint32_t weak = weak_value(a, b);
+        bool matched = false;
+        if (filter[(weak * 2654435761u) >> (32 - bits)]) {
+            std::string strong;
+            std::vector<std::pair<uint32_t, size_t> >::const_iterator it =
+                std::lower_bound(table.begin(), table.end(), std::make_pair(weak, static_cast<size_t>(0)));
+            for (; it != table.end() && it->first == weak; ++it) {
+                // A block that has been found already does not need finding again, unless
+                // this is another copy of the block that also goes somewhere else
+                if (sources[it->second] < 0 && check_block(it->second, window, strong)) {
+                    sources[it->second] = position;
+                    found++;
+                    matched = true;
+                }
+            }
+        }
+        if (matched) {
+            position += length;
+            fresh = true;
+        } else if (wanted > length) {
+            uint32_t out = static_cast<unsigned char>(window[0]);
+            uint32_t in = static_cast<unsigned char>(window[length]);
+            a = a - out + in;
+            b = b - static_cast<uint32_t>(length) * out + a;
+            position++;
+        } else {
+            break;
+        }
+    }
+
+    // A short last block is only looked for where it would be if nothing moved, and at
+    // the end of the old copy
+    if (full_blocks < blocks_.size()) {
+        size_t last = full_blocks;
+        int64_t last_length = getBlockLength(last);
+        int64_t candidates[2] = { static_cast<int64_t>(last) * block_size_, old_size - last_length };
+        std::vector<char> bytes(static_cast<size_t>(last_length));
+        for (int64_t offset: candidates) {
+            if (offset < 0 || offset + last_length > old_size || sources[last] >= 0) {
+                continue;
+            }
+            input.clear();
+            input.seekg(offset);
+            input.read(&bytes[0], bytes.size());
+            std::string strong;
+            if (input.gcount() == last_length && check_block(last, &bytes[0], strong)) {
+                sources[last] = offset;
+                found++;
+            }
+        }
+    }
+    return found;
+}
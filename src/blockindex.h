@@ -0,0 +1,143 @@
+#ifndef __multiget_block_index_include__
+#define __multiget_block_index_include__
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <stdint.h>
+
+/*! \brief Checksums of each block of a file, to find the blocks an old copy already has
+ *
+ *  The index is published next to the file (see multiget-index).  Every block has a weak
+ *  rolling checksum, like the one rsync uses, and an MD5.  The weak checksum of a block
+ *  sized window can be moved along an old copy of the file one byte at a time, so a block
+ *  is found wherever it is in the old copy, even if bytes were inserted or removed before
+ *  it.  The MD5 is only worked out where the weak checksum matches.  The index also holds
+ *  the SHA-256 of the whole file, so the file put together from the old copy and the
+ *  downloaded blocks can be checked.
+ *
+ *  The last block may be shorter than the others.  It is only looked for at the same
+ *  offset and at the end of the old copy.
+ */
+class BlockIndex {
+public:
+    // Block size used by multiget-index unless it is told otherwise
+    static const int DEFAULT_BLOCK_SIZE = 16384;
+
+    BlockIndex();
+    virtual ~BlockIndex() {}
+
+    /**
+     *   @brief  Work out the index of a file
+     *
+     *   @param  filename The file
+     *   @param  block_size Bytes in each block
+     *
+     *   @return false if the file cannot be read (the reason is printed)
+     */
+    bool create(const std::string& filename, int block_size);
+
+    /**
+     *   @brief  Write the index to a file
+     *
+     *   @param  filename Where to write it
+     *
+     *   @return false if it cannot be written (the reason is printed)
+     */
+    bool write(const std::string& filename);
+
+    /**
+     *   @brief  Read an index written by write
+     *
+     *   @param  filename The index file
+     *
+     *   @return false if it cannot be read or is not an index (the reason is printed)
+     */
+    bool read(const std::string& filename);
+
+    /**
+     *   @brief  Read an index that has been downloaded into memory
+     *
+     *   @param  text The contents of the index file
+     *   @param  name Where it came from, for the messages
+     *
+     *   @return false if it is not an index (the reason is printed)
+     */
+    bool parse(const std::string& text, const std::string& name);
+
+    /**
+     *   @brief  Look for the blocks of the file in an old copy of it
+     *
+     *   @param  filename The old copy
+     *   @param  sources Receives the offset of each block in the old copy, -1 if it was not found
+     *
+     *   @return number of blocks found, 0 if the old copy cannot be read
+     */
+    size_t findBlocks(const std::string& filename, std::vector<int64_t>& sources);
+
+    /**
+     *   @brief  Get the size of the file
+     *
+     *   @return size in bytes
+     */
+    int64_t getFileSize() { return file_size_; }
+
+    /**
+     *   @brief  Get the size of the blocks
+     *
+     *   @return bytes in every block but the last
+     */
+    int getBlockSize() { return block_size_; }
+
+    /**
+     *   @brief  Get the number of blocks
+     *
+     *   @return block count
+     */
+    size_t getBlockCount() { return blocks_.size(); }
+
+    /**
+     *   @brief  Get the length of one of the blocks
+     *
+     *   @param  index Which block
+     *
+     *   @return bytes in the block
+     */
+    int64_t getBlockLength(size_t index);
+
+    /**
+     *   @brief  Get the SHA-256 of the whole file
+     *
+     *   @return digest (binary, not hex)
+     */
+    const std::string& getSHA256() { return sha256_; }
+
+    /**
+     *   @brief  Work out the weak checksum of some bytes
+     *
+     *   @param  data The bytes
+     *   @param  length Number of bytes
+     *
+     *   @return checksum
+     */
+    static uint32_t weakChecksum(const char* data, size_t length);
+
+private:
+    /*
+     * Checksums of one block
+     */
+    struct Block {
+        uint32_t    weak;
+        std::string strong; // MD5, binary
+    };
+
+    bool load(std::istream& input, const std::string& name);
+    bool check_block(size_t index, const char* data, std::string& strong);
+
+    int64_t             file_size_;
+    int                 block_size_;
+    std::string         sha256_;
+    std::vector<Block>  blocks_;
+};
+
+#endif // __multiget_block_index_include__
@@ -0,0 +1,35 @@
+#include "bufferpool.h"
+
+BufferPool::BufferPool(size_t buffer_size)
+: buffer_size_(buffer_size > 0 ? buffer_size : 1)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (char* buffer: idle_) {
+        delete [] buffer;
+    }
+}
+
+char* BufferPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty()) {
+            char* buffer = idle_.back();
+            idle_.pop_back();
+            return buffer;
+        }
+    }
+    return new char[buffer_size_];
+}
+
+void BufferPool::release(char* buffer)
+{
+    if (!buffer) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(buffer);
+}
@@ -0,0 +1,63 @@
+#ifndef __multiget_buffer_pool_include__
+#define __multiget_buffer_pool_include__
+
+#include <vector>
+#include <mutex>
+#include <stddef.h>
+
+/*! \brief Shared pool of fixed-size receive buffers
+ *
+ *  Each HTTPGet object takes one buffer when it starts reading the body and hands it back
+ *  when it finishes.  The body is read straight into the buffer and written out from
+ *  there, so once the pool holds a buffer for every connection a download does no
+ *  allocation at all while it reads.  The buffer size is also the most that is asked
+ *  for on each read, so it sets the number of system calls per megabyte.
+ *
+ *  The pool is thread safe so it can be shared by HTTPGet objects running on several threads.
+ */
+class BufferPool {
+public:
+    /**
+     *   @brief  Create an empty pool
+     *
+     *   @param  buffer_size Size of every buffer in bytes
+     *
+     *   @return BufferPool object
+     */
+    explicit BufferPool(size_t buffer_size);
+    virtual ~BufferPool();
+
+    /**
+     *   @brief  Take a buffer out of the pool, allocating a new one if they are all in use
+     *
+     *   @return buffer of getBufferSize() bytes
+     */
+    char* acquire();
+
+    /**
+     *   @brief  Give a buffer back so it can be used by another request
+     *
+     *   @param  buffer A buffer returned by acquire
+     *
+     *   @return void
+     */
+    void release(char* buffer);
+
+    /**
+     *   @brief  Get the size of the buffers
+     *
+     *   @return size in bytes
+     */
+    size_t getBufferSize() { return buffer_size_; }
+
+private:
+    size_t              buffer_size_;
+    std::mutex          mutex_; // protects idle_
+    std::vector<char*>  idle_; // buffers that are not being used
+
+    // Ensure that these method are not created explicitly
+    BufferPool(const BufferPool& in); // not implemented
+    BufferPool& operator = (const BufferPool &t); // not implemented
+};
+
+#endif // __multiget_buffer_pool_include__
@@ -0,0 +1,16 @@
+#include "callbacksink.h"
+
+CallbackSink::CallbackSink(const write_handler& handler)
+: write_handler_(handler)
+{
+}
+
+bool CallbackSink::write(int64_t offset, const char* data, size_t length)
+{
+    return write_handler_(offset, data, length);
+}
+
+bool CallbackSink::setSize(int64_t size)
+{
+    return size_handler_ ? size_handler_(size) : true;
+}
@@ -0,0 +1,49 @@
+#ifndef __multiget_callback_sink_include__
+#define __multiget_callback_sink_include__
+
+#include <boost/function.hpp>
+
+#include "sink.h"
+
+/*! \brief Hand the bytes of a download to a function as they arrive
+ *
+ *  The function is called straight from the receive buffer of each request, so the
+ *  ranges arrive out of order and from several threads at once, and the bytes are only
+ *  valid until it returns.  Returning false fails the request that the bytes came from.
+ *
+ *  The bytes cannot be read back, so only a CRC32C checksum can be checked.
+ */
+class CallbackSink : public Sink {
+public:
+    typedef boost::function<bool (int64_t offset, const char* data, size_t length)> write_handler;
+    typedef boost::function<bool (int64_t size)> size_handler;
+
+    /**
+     *   @brief  Create a CallbackSink object.
+     *
+     *   @param  handler Called with each block of bytes and where it goes in the file
+     *
+     *   @return CallbackSink object
+     */
+    explicit CallbackSink(const write_handler& handler);
+    virtual ~CallbackSink() {}
+
+    /**
+     *   @brief  Be told the size of the file as soon as it is known (must be called before
+     *          the download starts)
+     *
+     *   @param  handler Called with the size, may return false to stop the download
+     *
+     *   @return void
+     */
+    void setSizeHandler(const size_handler& handler) { size_handler_ = handler; }
+
+    virtual bool write(int64_t offset, const char* data, size_t length);
+    virtual bool setSize(int64_t size);
+
+private:
+    write_handler   write_handler_;
+    size_handler    size_handler_;
+};
+
+#endif // __multiget_callback_sink_include__
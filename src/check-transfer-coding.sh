@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# A body sent with a transfer coding multiget cannot undo (here "gzip, chunked") has to be
+# refused at once, not retried and not written to the output with the coding and the
+# chunk framing still on.  Run by make check, from the build directory.
+
+dir=$(mktemp -d) || exit 1
+./rangeserver --port 0 --size 100000 --transfer-coding gzip > "$dir/server.log" &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$dir"' EXIT
+
+# The server prints its URL once it is listening
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    url=$(sed -n 's/^Serving .* on \(http:[^ ]*\)$/\1file/p' "$dir/server.log")
+    [ -n "$url" ] && break
+    sleep 0.2
+done
+if [ -z "$url" ]; then
+    echo "The rangeserver did not start"
+    exit 1
+fi
+
+status=0
+for mode in "" "-p -c 4" "-p -d -c 4"; do
+    if ./multiget $mode -o "$dir/out" "$url" > "$dir/multiget.log" 2>&1; then
+        echo "multiget $mode accepted a body with an unsupported transfer coding"
+        status=1
+    elif ! grep -q "transfer coding that cannot be decoded" "$dir/multiget.log"; then
+        echo "multiget $mode did not say why it failed"
+        status=1
+    elif grep -q "^Retrying" "$dir/multiget.log"; then
+        echo "multiget $mode retried a body with an unsupported transfer coding"
+        status=1
+    fi
+    if [ $status -ne 0 ]; then
+        cat "$dir/multiget.log"
+        break
+    fi
+done
+exit $status
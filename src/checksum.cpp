@@ -0,0 +1,404 @@
+#include "checksum.h"
+#include "sink.h"
+#include "log.h"
+
+#include <openssl/evp.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <fstream>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define MULTIGET_HAVE_SSE42_CRC 1
+#endif
+
+// CRC32C polynomial, bit reversed
+static const uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;
+
+/*
+ * Tables for the software version, which handles 8 bytes per step ("slicing by 8")
+ */
+struct CRC32CTables {
+    CRC32CTables()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int slice = 1; slice < 8; slice++) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+            }
+        }
+    }
+    uint32_t table[8][256];
+};
+
+static uint32_t crc32c_software(uint32_t crc, const unsigned char* data, size_t length)
+{
+    static const CRC32CTables tables;
+    const uint32_t (*table)[256] = tables.table;
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+        length--;
+    }
+    while (length >= 8) {
+        uint32_t low, high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+              table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+        length--;
+    }
+    return crc;
+}
+
+#ifdef MULTIGET_HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char* data, size_t length)
+{
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    return crc;
+}
+#endif
+
+CRC32C::CRC32C()
+: crc_(0)
+{
+}
+
+void CRC32C::update(const char* data, size_t length)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+#ifdef MULTIGET_HAVE_SSE42_CRC
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) {
+        crc_ = ~crc32c_hardware(~crc_, bytes, length);
+        return;
+    }
+#endif
+    crc_ = ~crc32c_software(~crc_, bytes, length);
+}
+
+/*
+ * Multiply a 32x32 matrix over GF(2) by a vector
+ */
+static uint32_t gf2_matrix_times(const uint32_t* matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    while (vector) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* matrix)
+{
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+    }
+}
+
+/*
+ * The same method as zlib's crc32_combine: apply the operator that appends
+ * second_length zero bytes to the first checksum, by repeated squaring, and add the second.
+ */
+uint32_t CRC32C::combine(uint32_t first, uint32_t second, int64_t second_length)
+{
+    if (second_length <= 0) {
+        return first;
+    }
+    uint32_t even[32]; // operator for an even power of two zero bits
+    uint32_t odd[32]; // operator for an odd power of two zero bits
+
+    // Operator for one zero bit
+    odd[0] = CRC32C_POLYNOMIAL;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four zero bits
+
+    // Apply the operator for each bit of second_length, starting with one zero byte
+    do {
+        gf2_matrix_square(even, odd);
+        if (second_length & 1) {
+            first = gf2_matrix_times(even, first);
+        }
+        second_length >>= 1;
+        if (second_length == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        if (second_length & 1) {
+            first = gf2_matrix_times(odd, first);
+        }
+        second_length >>= 1;
+    } while (second_length != 0);
+    return first ^ second;
+}
+
+MessageDigest::MessageDigest(const std::string& algorithm)
+: context_(EVP_MD_CTX_new())
+{
+    const EVP_MD* type = (algorithm == "md5") ? EVP_md5() : EVP_sha256();
+    EVP_DigestInit_ex(static_cast<EVP_MD_CTX*>(context_), type, NULL);
+}
+
+MessageDigest::~MessageDigest()
+{
+    EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(context_));
+}
+
+void MessageDigest::update(const char* data, size_t length)
+{
+    EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(context_), data, length);
+}
+
+std::string MessageDigest::finish()
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(static_cast<EVP_MD_CTX*>(context_), digest, &length);
+    return std::string(reinterpret_cast<const char*>(digest), length);
+}
+
+bool isChecksumSupported(const std::string& algorithm)
+{
+    return checksumLength(algorithm) > 0;
+}
+
+size_t checksumLength(const std::string& algorithm)
+{
+    if (algorithm == "crc32c") {
+        return 4;
+    } else if (algorithm == "md5") {
+        return 16;
+    } else if (algorithm == "sha256") {
+        return 32;
+    }
+    return 0;
+}
+
+bool parseChecksum(const std::string& text, Checksums& checksums)
+{
+    std::string::size_type colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string algorithm;
+    for (char c: text.substr(0, colon)) {
+        algorithm += tolower(c);
+    }
+    std::string bytes;
+    if (!fromHex(text.substr(colon + 1), bytes) || bytes.size() != checksumLength(algorithm)) {
+        return false;
+    }
+    checksums[algorithm] = bytes;
+    return true;
+}
+
+void parseDigestHeader(const std::string& header, Checksums& checksums)
+{
+    std::string::size_type position = 0;
+    while (position < header.size()) {
+        std::string::size_type comma = header.find(',', position);
+        if (comma == std::string::npos) {
+            comma = header.size();
+        }
+        std::string item = header.substr(position, comma - position);
+        position = comma + 1;
+
+        std::string::size_type equals = item.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        std::string algorithm;
+        for (char c: item.substr(0, equals)) {
+            // "SHA-256" and "sha-256" are both used, x-goog-hash uses "crc32c"
+            if (c != ' ' && c != '\t' && c != '-') {
+                algorithm += tolower(c);
+            }
+        }
+        std::string value;
+        for (char c: item.substr(equals + 1)) {
+            // Repr-Digest puts the value between colons
+            if (c != ' ' && c != '\t' && c != ':') {
+                value += c;
+            }
+        }
+        std::string bytes;
+        if (fromBase64(value, bytes) && bytes.size() == checksumLength(algorithm)) {
+            checksums[algorithm] = bytes;
+        }
+    }
+}
+
+std::string crc32cBytes(uint32_t crc)
+{
+    std::string bytes;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        bytes += static_cast<char>((crc >> shift) & 0xff);
+    }
+    return bytes;
+}
+
+std::string toHex(const std::string& bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c: bytes) {
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool fromHex(const std::string& hex, std::string& bytes)
+{
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    bytes.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int high = hex_value(hex[i]);
+        int low = hex_value(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+bool fromBase64(const std::string& base64, std::string& bytes)
+{
+    static const std::string alphabet("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+    bytes.clear();
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (char c: base64) {
+        if (c == '=') {
+            break;
+        }
+        std::string::size_type value = alphabet.find(c);
+        if (value == std::string::npos) {
+            return false;
+        }
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            bytes += static_cast<char>((bits >> bit_count) & 0xff);
+        }
+    }
+    return !bytes.empty();
+}
+
+/*
+ * Read a file from start to end and add it to the digests
+ */
+void digestFile(const std::string& filename, FileDigests& digests, CRC32C* crc)
+{
+    std::ifstream input_file(filename, std::ifstream::in | std::ifstream::binary);
+    std::vector<char> buffer(1024 * 1024);
+    while (input_file.read(&buffer[0], buffer.size()) || input_file.gcount() > 0) {
+        if (crc) {
+            crc->update(&buffer[0], input_file.gcount());
+        }
+        for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+            it->second->update(&buffer[0], input_file.gcount());
+        }
+    }
+}
+
+/*
+ * Read a sink from start to end and add it to the digests
+ */
+bool digestSink(Sink& sink, FileDigests& digests, CRC32C* crc)
+{
+    std::vector<char> buffer(1024 * 1024);
+    int64_t offset = 0;
+    size_t bytes;
+    while ((bytes = sink.read(offset, &buffer[0], buffer.size())) > 0) {
+        if (crc) {
+            crc->update(&buffer[0], bytes);
+        }
+        for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+            it->second->update(&buffer[0], bytes);
+        }
+        offset += bytes;
+    }
+    return offset > 0;
+}
+
+/*
+ * Compare the checksums of the download with the expected ones and report any that
+ * do not match.  Returns false if any of them are wrong, or cannot be checked because the
+ * download's checksum is missing.
+ */
+bool verifyChecksums(const Checksums& expected, const Checksums& actual)
+{
+    bool match = true;
+    for (Checksums::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        Checksums::const_iterator found = actual.find(it->first);
+        if (found == actual.end()) {
+            LogMessage() << "Unable to check the " << it->first << " checksum";
+            match = false;
+        } else if (found->second != it->second) {
+            LogMessage() << "Checksum mismatch: " << it->first << " expected: " << toHex(it->second) << ", actual: " <<
+                toHex(found->second);
+            match = false;
+        } else {
+            LogMessage() << "Checksum verified: " << it->first << " " << toHex(found->second);
+        }
+    }
+    return match;
+}
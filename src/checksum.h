@@ -0,0 +1,215 @@
+#ifndef __multiget_checksum_include__
+#define __multiget_checksum_include__
+
+#include <string>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+class Sink;
+
+/*! \brief Running CRC32C (Castagnoli) checksum
+ *
+ *  The checksum is updated as the bytes arrive.  It uses the SSE4.2 crc32 instruction when
+ *  the processor has it and a table driven version otherwise.  The checksums of adjacent
+ *  pieces can be combined into the checksum of the whole without seeing the bytes again,
+ *  so each chunk can be checksummed on its own connection in any order.
+ */
+class CRC32C {
+public:
+    CRC32C();
+
+    /**
+     *   @brief  Add bytes to the checksum
+     *
+     *   @param  data Bytes to add
+     *   @param  length Number of bytes
+     *
+     *   @return void
+     */
+    void update(const char* data, size_t length);
+
+    /**
+     *   @brief  Get the checksum of the bytes added so far
+     *
+     *   @return CRC32C
+     */
+    uint32_t value() const { return crc_; }
+
+    /**
+     *   @brief  Get the checksum of two adjacent pieces of data
+     *
+     *   @param  first Checksum of the first piece
+     *   @param  second Checksum of the piece that follows it
+     *   @param  second_length Length of the second piece in bytes
+     *
+     *   @return CRC32C of the first piece followed by the second
+     */
+    static uint32_t combine(uint32_t first, uint32_t second, int64_t second_length);
+
+private:
+    uint32_t crc_;
+};
+
+/*! \brief Running MD5 or SHA-256 digest (using OpenSSL)
+ */
+class MessageDigest {
+public:
+    /**
+     *   @brief  Start a digest
+     *
+     *   @param  algorithm "md5" or "sha256"
+     *
+     *   @return MessageDigest object
+     */
+    explicit MessageDigest(const std::string& algorithm);
+    virtual ~MessageDigest();
+
+    /**
+     *   @brief  Add bytes to the digest
+     *
+     *   @param  data Bytes to add
+     *   @param  length Number of bytes
+     *
+     *   @return void
+     */
+    void update(const char* data, size_t length);
+
+    /**
+     *   @brief  Finish the digest.  No more bytes may be added afterwards.
+     *
+     *   @return The digest (binary, not hex)
+     */
+    std::string finish();
+
+private:
+    void* context_; // EVP_MD_CTX, kept out of the header so OpenSSL is only needed here
+
+    // Ensure that these method are not created explicitly
+    MessageDigest(const MessageDigest& in); // not implemented
+    MessageDigest& operator = (const MessageDigest &t); // not implemented
+};
+
+/*
+ * Checksums of a file keyed by algorithm ("crc32c", "md5" or "sha256").  The values are
+ * binary, a CRC32C is 4 bytes in big endian order.
+ */
+typedef std::map<std::string, std::string> Checksums;
+
+/**
+ *   @brief  Find out whether an algorithm is one that multiget can check
+ *
+ *   @param  algorithm Name of the algorithm in lower case
+ *
+ *   @return true for "crc32c", "md5" and "sha256"
+ */
+bool isChecksumSupported(const std::string& algorithm);
+
+/**
+ *   @brief  Get the size of a checksum
+ *
+ *   @param  algorithm Name of the algorithm in lower case
+ *
+ *   @return size in bytes, or 0 if the algorithm is not supported
+ */
+size_t checksumLength(const std::string& algorithm);
+
+/**
+ *   @brief  Read a checksum written as algorithm:hex, e.g. "sha256:9f86d08..."
+ *
+ *   @param  text The checksum
+ *   @param  checksums Receives the checksum (the algorithm is stored in lower case)
+ *
+ *   @return false if the algorithm is not supported or the hex is not the right length
+ */
+bool parseChecksum(const std::string& text, Checksums& checksums);
+
+/**
+ *   @brief  Read the checksums out of a Digest, Repr-Digest or x-goog-hash header
+ *
+ *   e.g. "sha-256=X48E9qOokqqrvdts8nOJRJN3OWDUoyWxBf7kbu9DBPE=, md5=HUXZLQLMuI/KZ5KDcJPcOA=="
+ *   Algorithms that multiget does not know about are skipped.
+ *
+ *   @param  header Value of the header
+ *   @param  checksums Receives the checksums found in the header
+ *
+ *   @return void
+ */
+void parseDigestHeader(const std::string& header, Checksums& checksums);
+
+/**
+ *   @brief  Convert a CRC32C into the form used in Checksums
+ *
+ *   @param  crc Checksum
+ *
+ *   @return 4 bytes, most significant first
+ */
+std::string crc32cBytes(uint32_t crc);
+
+/**
+ *   @brief  Convert binary data to lower case hex
+ *
+ *   @param  bytes Binary data
+ *
+ *   @return hex string
+ */
+std::string toHex(const std::string& bytes);
+
+/**
+ *   @brief  Convert hex to binary data
+ *
+ *   @param  hex Hex string (upper or lower case)
+ *   @param  bytes Receives the binary data
+ *
+ *   @return false if hex is not valid
+ */
+bool fromHex(const std::string& hex, std::string& bytes);
+
+/**
+ *   @brief  Convert base64 to binary data
+ *
+ *   @param  base64 Base64 string, padding is optional
+ *   @param  bytes Receives the binary data
+ *
+ *   @return false if base64 is not valid
+ */
+bool fromBase64(const std::string& base64, std::string& bytes);
+
+// Whole file digests that are worked out while the file is read in order, keyed by algorithm
+typedef std::map<std::string, std::shared_ptr<MessageDigest> > FileDigests;
+
+/**
+ *   @brief  Read a file from start to end and add it to the digests
+ *
+ *   @param  filename The file
+ *   @param  digests The digests to update
+ *   @param  crc The CRC32C to update as well, or NULL
+ *
+ *   @return void
+ */
+void digestFile(const std::string& filename, FileDigests& digests, CRC32C* crc = NULL);
+
+/**
+ *   @brief  Read back what has been written to a sink and add it to the digests
+ *
+ *   @param  sink The sink
+ *   @param  digests The digests to update
+ *   @param  crc The CRC32C to update as well, or NULL
+ *
+ *   @return false if the sink cannot be read back
+ */
+bool digestSink(Sink& sink, FileDigests& digests, CRC32C* crc = NULL);
+
+/**
+ *   @brief  Compare the checksums of a download with the expected ones and report any
+ *          that do not match
+ *
+ *   @param  expected Checksums the file should have
+ *   @param  actual Checksums of the download
+ *
+ *   @return false if any of them are wrong or could not be worked out
+ */
+bool verifyChecksums(const Checksums& expected, const Checksums& actual);
+
+#endif // __multiget_checksum_include__
@@ -0,0 +1,49 @@
+#include "connectionpool.h"
+
+ConnectionPool::ConnectionPool(size_t max_idle_per_host)
+: max_idle_per_host_(max_idle_per_host)
+{
+}
+
+ConnectionPool::socket_ptr ConnectionPool::acquire(const std::string& server, const std::string& port, tls_stream_ptr* tls_stream)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Connection>& idle = idle_[(tls_stream ? "tls:" : "") + server + ":" + port];
+    // Hand out the most recently used connection first - it is the least likely
+    // to have been closed by the server while it sat in the pool
+    while (!idle.empty()) {
+        Connection connection = idle.back();
+        idle.pop_back();
+        if (connection.socket->is_open()) {
+            if (tls_stream) {
+                *tls_stream = connection.tls_stream;
+            }
+            return connection.socket;
+        }
+    }
+    return socket_ptr();
+}
+
+void ConnectionPool::release(const std::string& server, const std::string& port, socket_ptr socket, tls_stream_ptr tls_stream)
+{
+    if (!socket || !socket->is_open()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Connection>& idle = idle_[(tls_stream ? "tls:" : "") + server + ":" + port];
+    if (idle.size() < max_idle_per_host_) {
+        Connection connection;
+        connection.socket = socket;
+        connection.tls_stream = tls_stream;
+        idle.push_back(connection);
+    } else {
+        boost::system::error_code ignored;
+        socket->close(ignored);
+    }
+}
+
+void ConnectionPool::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+}
@@ -0,0 +1,90 @@
+#ifndef __multiget_connection_pool_include__
+#define __multiget_connection_pool_include__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+/*! \brief Per-host pool of persistent HTTP/1.1 connections
+ *
+ *  When an HTTPGet object finishes reading a response on a connection that the server
+ *  has agreed to keep open, it hands the socket back to the pool.  The next request for
+ *  the same host and port takes the idle socket instead of resolving and connecting
+ *  again, which saves a TCP handshake and slow-start ramp for every chunk.
+ *
+ *  An https:// connection is kept with its TLS stream, and is only handed out to requests
+ *  that ask for a TLS connection.
+ *
+ *  The pool is thread safe so it can be shared by HTTPGet objects running on several threads.
+ */
+class ConnectionPool {
+public:
+    typedef std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+    typedef std::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> > tls_stream_ptr;
+
+    /**
+     *   @brief  Create an empty pool
+     *
+     *   @param  max_idle_per_host Maximum number of idle connections kept for each host
+     *
+     *   @return ConnectionPool object
+     */
+    explicit ConnectionPool(size_t max_idle_per_host = 64);
+    virtual ~ConnectionPool() {}
+
+    /**
+     *   @brief  Take an idle connection to the host out of the pool
+     *
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"http\" or port number
+     *   @param  tls_stream NULL for a plain connection, otherwise receives the TLS stream
+     *           over the socket
+     *
+     *   @return An open socket, or an empty pointer if there are no idle connections
+     */
+    socket_ptr acquire(const std::string& server, const std::string& port, tls_stream_ptr* tls_stream = NULL);
+
+    /**
+     *   @brief  Return a connection to the pool so it can be used by another request
+     *
+     *   The socket must be open and have no unread response data.  If the pool already
+     *   holds the maximum number of idle connections for the host the socket is closed.
+     *
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"http\" or port number
+     *   @param  socket The connection to reuse
+     *   @param  tls_stream The TLS stream over the socket, or empty for a plain connection
+     *
+     *   @return void
+     */
+    void release(const std::string& server, const std::string& port, socket_ptr socket,
+                 tls_stream_ptr tls_stream = tls_stream_ptr());
+
+    /**
+     *   @brief  Close all of the idle connections
+     *
+     *   @return void
+     */
+    void clear();
+
+private:
+    struct Connection {
+        socket_ptr      socket;
+        tls_stream_ptr  tls_stream; // empty for a plain connection
+    };
+
+    size_t                                          max_idle_per_host_;
+    std::mutex                                      mutex_; // protects idle_
+    std::map<std::string, std::vector<Connection> > idle_; // idle connections keyed by server:port, with
+                                                           // "tls:" in front for TLS connections
+
+    // Ensure that these method are not created explicitly
+    ConnectionPool(const ConnectionPool& in); // not implemented
+    ConnectionPool& operator = (const ConnectionPool &t); // not implemented
+};
+
+#endif // __multiget_connection_pool_include__
@@ -0,0 +1,807 @@
+#include "download.h"
+#include "httpget.h"
+#include "connectionpool.h"
+#include "endpointcache.h"
+#include "scheduler.h"
+#include "rangescheduler.h"
+#include "blockindex.h"
+#include "memorysink.h"
+#include "rangecache.h"
+#include "ioservicepool.h"
+#include "bufferpool.h"
+#include "journal.h"
+#include "probe.h"
+#include "sink.h"
+#include "tuner.h"
+#include "tlscontext.h"
+#include "url.h"
+#include "log.h"
+
+#include <boost/bind.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fstream>
+#include <algorithm>
+
+// Chunk size when neither the size of the file nor the chunk size is known.  The file is
+// fetched in a single request then, so this only matters if the server says otherwise.
+static const int64_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+// The wait before probing again when no URL answered, doubled for each retry after that
+static const int PROBE_BACKOFF_MS = 500;
+
+// What the probe found out about the file
+struct RemoteFile {
+    RemoteFile() : size(-1), ranges_supported(true) {}
+    int64_t         size; // -1 if not known
+    bool            ranges_supported;
+    std::string     etag;
+    std::string     last_modified;
+    Checksums       checksums; // checksums of the whole file sent by the server
+};
+
+static void concatenate_output(const std::vector<HTTPGet*>& requests, const std::string& output_file_name, FileDigests& digests);
+static std::vector<URL> probeMirrors(boost::asio::io_service& io_service, const std::vector<URL>& urls, ConnectionPool* pool,
+                                     EndpointCache* endpoint_cache, TLSContext* tls, int retries,
+                                     const boost::function<bool ()>& cancelled, RemoteFile& remote);
+
+DownloadOptions::DownloadOptions()
+: output_file_name("multiget.out")
+, total_size(0) // ask the server
+, chunk_size(0) // total_size / chunk_count
+, chunk_count(4)
+, parallel(false)
+, max_connections(8)
+, max_per_host(6)
+, thread_count(1)
+, sharded(false)
+, keep_alive(false)
+, direct(false)
+, adaptive(false)
+, journal(false)
+, splice(false)
+, auto_tune(false)
+, read_size(256*1024) // 256 KiB
+, verify(false)
+, range_retries(5)
+, total_retries(50)
+, insecure(false)
+, ranges_per_request(32)
+, cache_size(1024LL * 1024 * 1024) // 1 GiB
+{
+}
+
+Download::Download(const DownloadOptions& options, Sink* sink)
+: options_(options)
+, sink_(sink)
+, metrics_(NULL)
+, complete_(false)
+, checksums_match_(true)
+, total_bytes_(-1)
+, cancelled_(false)
+{
+}
+
+Download::~Download()
+{
+    if (thread_.joinable()) {
+        cancel();
+        thread_.join();
+    }
+}
+
+bool Download::run()
+{
+    LogScope scope(log_handler_);
+    try {
+        download();
+    } catch (const std::exception& e) {
+        LogMessage() << "Exception: " << e.what() << " - unable to download file";
+    } catch (...) {
+        LogMessage() << "Unknown exception - unable to download file";
+    }
+    output_file_.close();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        io_services_.reset();
+    }
+    if (completion_handler_) {
+        completion_handler_(*this);
+    }
+    return succeeded();
+}
+
+void Download::start()
+{
+    // The download's messages go where the messages of the thread starting it go, unless
+    // it was given a handler of its own
+    if (!log_handler_ && LogScope::current()) {
+        log_handler_ = *LogScope::current();
+    }
+    thread_ = std::thread(boost::bind(&Download::run, this));
+}
+
+bool Download::wait()
+{
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    return succeeded();
+}
+
+void Download::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    if (io_services_) {
+        io_services_->stop();
+    }
+}
+
+bool Download::cancelled()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cancelled_;
+}
+
+void Download::report_progress(int64_t bytes_done, bool finished)
+{
+    progress_handler_(bytes_done, total_bytes_, finished);
+}
+
+/*
+ * Find out about the file, fetch it and check it.  The results are left in complete_,
+ * checksums_match_ and checksums_.
+ */
+void Download::download()
+{
+    // In sharded mode there is an io_service (and a pool of idle keep-alive connections) for
+    // each thread, otherwise there is just one that all of the threads share
+    std::shared_ptr<IOServicePool> io_services(new IOServicePool(options_.sharded ? options_.thread_count : 1));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) {
+            return;
+        }
+        io_services_ = io_services;
+    }
+    boost::asio::io_service& io_service = io_services->getIOService(0);
+    ConnectionPool* pool = options_.keep_alive ? &io_services->getConnectionPool(0) : NULL;
+    // The server is only looked up once, all of the requests share the result
+    EndpointCache endpoint_cache;
+    // Every connection reads into a buffer of the same size, and they are recycled
+    // Smaller buffers would not hold the response headers
+    BufferPool buffer_pool(std::max<int>(options_.read_size, HTTPGet::MIN_READ_SIZE));
+    // The https:// connections share the certificates and resume each other's sessions
+    TLSContext tls(!options_.insecure);
+    if (!options_.ca_file.empty() && !tls.loadCAFile(options_.ca_file)) {
+        return;
+    }
+
+    std::vector<URL> mirrors;
+    for (const std::string& url_string: options_.urls) {
+        URL url;
+        if (!url.parse(url_string)) {
+            return;
+        }
+        mirrors.push_back(url);
+    }
+    if (mirrors.empty()) {
+        LogMessage() << "Error: there is no URL to download";
+        return;
+    }
+    if (!options_.ranges.empty()) {
+        download_ranges(*io_services, pool, endpoint_cache, buffer_pool, tls, mirrors[0]);
+        return;
+    }
+    if (!options_.delta_index.empty()) {
+        download_delta(*io_services, pool, endpoint_cache, buffer_pool, tls, mirrors[0]);
+        return;
+    }
+    // A sink takes every range at its offset, and only a file on disk can be resumed
+    bool direct = sink_ || options_.direct || options_.adaptive || options_.journal;
+    bool keep_journal = options_.journal;
+    if (keep_journal && sink_) {
+        LogMessage() << "Unable to keep a journal - the download is not going to a file";
+        keep_journal = false;
+    }
+    const std::string& output_file_name = options_.output_file_name;
+    std::shared_ptr<RangeCache> cache = open_cache();
+    if (cache && keep_journal) {
+        LogMessage() << "Not using the cache - the download is kept in a journal";
+        cache.reset();
+    }
+
+    // Unless the user told us how many bytes to get, ask the server how big the file is
+    // and whether it can be split into ranges.  With mirrors, make sure they all have
+    // the same file before mixing their bytes.
+    // A journal, and the cache, are only any use if we know which version of the file it is for.
+    RemoteFile remote;
+    bool ranges_supported = true;
+    Checksums expected; // checksums of the whole file
+    int64_t total_size = options_.total_size;
+    if (total_size == 0 || mirrors.size() > 1 || keep_journal || cache) {
+        mirrors = probeMirrors(io_service, mirrors, pool, &endpoint_cache, &tls, options_.range_retries,
+                               boost::bind(&Download::cancelled, this), remote);
+        if (cancelled() || mirrors.empty()) {
+            return;
+        }
+        ranges_supported = remote.ranges_supported;
+        if (total_size == 0 && remote.size > 0) {
+            total_size = remote.size;
+            // The server's checksums are only any use if we are getting the whole file
+            expected = remote.checksums;
+        }
+        if (!ranges_supported) {
+            LogMessage() << "The server does not support ranges - downloading the file in a single request";
+        }
+    }
+
+    // Whatever the cache has of this version of the file is copied rather than downloaded,
+    // so every range has to go to its offset
+    RangeList cached;
+    if (cache) {
+        if (total_size <= 0 || total_size != remote.size || !ranges_supported || (remote.etag.empty() && remote.last_modified.empty())) {
+            LogMessage() << "Not using the cache - the version of the file is not known";
+            cache.reset();
+        } else {
+            cached = cache->select(options_.urls[0], total_size, remote.etag, remote.last_modified);
+            direct = true;
+        }
+    }
+
+    // Work out how many bytes to get on each request.  The tuner starts from a small chunk
+    // size (or the one given) and changes it as it goes.
+    int64_t chunk_size = options_.chunk_size;
+    total_bytes_ = total_size > 0 ? total_size : -1;
+    bool auto_tune = options_.auto_tune && total_bytes_ > 0 && ranges_supported;
+    if (auto_tune) {
+        if (chunk_size <= 0) {
+            chunk_size = DEFAULT_CHUNK_SIZE;
+        }
+        LogMessage() << "Getting a total of " << total_bytes_ << ", tuning the number of connections (up to " <<
+            options_.max_connections << ") and the chunk size as it goes";
+    } else if (chunk_size <= 0) {
+        chunk_size = total_bytes_ > 0 ? std::max<int64_t>(total_bytes_ / options_.chunk_count, 1) : DEFAULT_CHUNK_SIZE;
+    }
+    if (auto_tune) {
+        // Nothing more to say until the tuner has measured something
+    } else if (total_bytes_ < 0) {
+        LogMessage() << "Unable to find out the size of the file - downloading it in a single request";
+    } else {
+        if (!ranges_supported) {
+            chunk_size = total_bytes_;
+        }
+        int64_t num_chunks = total_bytes_ / chunk_size; // how many requests to make
+        int64_t remainder = total_bytes_ - (chunk_size * num_chunks);
+        LogMessage() << "Getting a total of " << total_bytes_ << " in " << num_chunks << " chunks, of size " << chunk_size <<
+            " with a remainder of " << remainder;
+        if (remainder > 0) {
+            // The amount of bytes does not fit into an even number of chunks, so add
+            // another chunk to get the last few bytes
+            num_chunks++;
+        }
+        LogMessage() << "Chunk size: " << chunk_size << ", num_chunks: " << num_chunks;
+    }
+
+    // Pick up where an interrupted download left off if the journal is for the same file
+    std::shared_ptr<Journal> journal;
+    bool resume = false;
+    if (keep_journal) {
+        if (total_bytes_ < 0 || !ranges_supported) {
+            LogMessage() << "Unable to keep a journal - the file cannot be fetched in ranges";
+        } else {
+            journal.reset(new Journal(output_file_name + ".journal"));
+            if (journal->load()) {
+                resume = journal->matches(total_bytes_, remote.etag, remote.last_modified) &&
+                    getFileSize(output_file_name) == total_bytes_;
+                if (resume) {
+                    LogMessage() << "Resuming download: " << journal->getBytesDone() << " of " << total_bytes_ <<
+                        " bytes are already in " << output_file_name;
+                } else {
+                    LogMessage() << "The journal in " << journal->getFilename() <<
+                        " is for another version of the file - starting again";
+                }
+            }
+            if (!resume) {
+                journal->reset(mirrors[0].getURL(), total_bytes_, remote.etag, remote.last_modified);
+                journal->save();
+            }
+        }
+    }
+
+    // In direct mode every chunk is written to its final offset, in the sink or in a
+    // preallocated output file
+    Sink* output = NULL;
+    if (sink_) {
+        output = sink_;
+        if (total_bytes_ > 0 && !sink_->setSize(total_bytes_)) {
+            return;
+        }
+    } else if (direct) {
+        if (!output_file_.open(output_file_name, total_bytes_, resume)) {
+            return;
+        }
+        output = &output_file_;
+    }
+    Journal::Extents done; // ranges that are not downloaded
+    std::vector<uint32_t> cached_crcs; // CRC32C of each of the cached ranges
+    if (!cached.empty()) {
+        if (!cache->copy(cached, *output, cached_crcs)) {
+            return;
+        }
+        int64_t cached_bytes = 0;
+        for (const ByteRange& range: cached) {
+            done[range.first] = range.last + 1;
+            cached_bytes += range.length();
+        }
+        LogMessage() << cached_bytes << " bytes of the file are in the cache " << options_.cache_dir;
+    }
+
+    // The scheduler creates a HTTPGet object for each chunk as a slot becomes free.  In serial
+    // mode there is only ever one request running, in parallel mode up to the connection limit.
+    bool parallel = options_.parallel || options_.sharded || auto_tune;
+    int max_in_flight = parallel ? options_.max_connections : 1;
+    Scheduler scheduler(io_service, mirrors, max_in_flight, output, pool);
+    ConnectionTuner tuner(max_in_flight, chunk_size);
+    if (auto_tune) {
+        scheduler.setTuner(&tuner);
+    }
+    scheduler.setEndpointCache(&endpoint_cache);
+    scheduler.setTLSContext(&tls);
+    scheduler.setBufferPool(&buffer_pool);
+    scheduler.setRetryLimits(options_.range_retries, options_.total_retries);
+    scheduler.setJournal(journal.get());
+    scheduler.setDone(done);
+    // The cached ranges' checksums fill the gaps between the downloaded ones
+    for (size_t i = 0; i < cached.size(); i++) {
+        scheduler.addChecksum(cached[i].first, cached[i].length(), cached_crcs[i]);
+    }
+    scheduler.setMetrics(metrics_);
+    if (progress_handler_) {
+        scheduler.setProgressHandler(boost::bind(&Download::report_progress, this, _1, _2));
+    }
+    // Checksums given in the options win over the ones the server sent
+    for (Checksums::const_iterator it = options_.checksums.begin(); it != options_.checksums.end(); ++it) {
+        expected[it->first] = it->second;
+    }
+    scheduler.setChecksum(!expected.empty() || options_.verify);
+    scheduler.setSplice(options_.splice);
+    if (options_.splice && (!expected.empty() || options_.verify)) {
+        LogMessage() << "Not splicing the download - it has to be read to checksum it";
+    }
+    for (size_t i = 1; i < io_services->size(); i++) {
+        scheduler.addIOService(io_services->getIOService(i), options_.keep_alive ? &io_services->getConnectionPool(i) : NULL);
+    }
+    scheduler.setAdaptive(options_.adaptive && direct && ranges_supported);
+    scheduler.start(total_bytes_, chunk_size);
+
+    // There is a single io_service shared by the HTTPGet objects (HTTPGet is implemented using
+    // all async methods).  It runs until the scheduler has no chunks left to request.
+    // In sharded mode each thread runs its own io_service instead.
+    if (options_.sharded) {
+        LogMessage() << "Creating " << io_services->size() << " threads, each with its own io_service";
+        io_services->run();
+    } else {
+        IOServicePool::run(io_service, parallel ? options_.thread_count : 1);
+    }
+    complete_ = scheduler.succeeded();
+
+    // MD5 and SHA-256 have to see the file in order, so they are worked out as the file
+    // is assembled.  CRC32C is put together from the checksums of the ranges, unless some
+    // of the file was already there (resumed from the journal), in which case the ranges
+    // do not cover it and it is read back as well.
+    FileDigests digests;
+    for (Checksums::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        if (it->first != "crc32c") {
+            digests[it->first].reset(new MessageDigest(it->first));
+        }
+    }
+    uint32_t crc;
+    bool have_crc = complete_ && scheduler.getCRC32C(crc);
+    CRC32C file_crc;
+    bool read_crc = complete_ && !have_crc && output && (expected.count("crc32c") || options_.verify);
+
+    // Take all the chunks and assemble them into a single file (and clean up the temp files).
+    // In direct mode the chunks are already in place so there is nothing left to copy, but
+    // the file has to be read back for the digests.
+    if (!output) {
+        concatenate_output(scheduler.getRequests(), output_file_name, digests);
+    } else if (complete_ && (!digests.empty() || read_crc) && !digestSink(*output, digests, read_crc ? &file_crc : NULL)) {
+        // e.g. a CallbackSink, which does not keep the bytes
+        digests.clear();
+        read_crc = false;
+    }
+
+    if (complete_) {
+        if (read_crc) {
+            crc = file_crc.value();
+            have_crc = true;
+        }
+        if (have_crc) {
+            checksums_["crc32c"] = crc32cBytes(crc);
+            LogMessage() << "CRC32C: " << toHex(checksums_["crc32c"]);
+        }
+        for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+            checksums_[it->first] = it->second->finish();
+        }
+        checksums_match_ = verifyChecksums(expected, checksums_);
+    }
+    if (cache && complete_ && checksums_match_) {
+        cache->store(subtractRanges(RangeList(1, ByteRange(0, total_bytes_ - 1)), cached), *output);
+    }
+    if (journal && complete_) {
+        // Nothing left to resume.  If the checksum is wrong then none of the file can be
+        // trusted, so the next run has to start again anyway.
+        journal->remove();
+    }
+}
+
+/*
+ * Fetch only the ranges in the options, each written at its offset.  Nothing has to be
+ * known about the file first, so there is no probe.  The results are left in complete_.
+ */
+void Download::download_ranges(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                               TLSContext& tls, const URL& url)
+{
+    RangeList ranges(options_.ranges);
+    mergeRanges(ranges);
+    if (!options_.checksums.empty() || options_.verify) {
+        LogMessage() << "Not checking the checksums - only some of the file is being downloaded";
+    }
+    Sink* output = sink_;
+    if (sink_) {
+        if (!sink_->setSize(ranges.back().last + 1)) {
+            return;
+        }
+    } else {
+        // Not preallocated, the file only takes up room where the ranges are
+        if (!output_file_.open(options_.output_file_name, 0)) {
+            return;
+        }
+        output = &output_file_;
+    }
+
+    // Only the ranges that are not in the cache are downloaded, and then they are added to it
+    RangeList fetch(ranges);
+    std::shared_ptr<RangeCache> cache = open_cache();
+    if (cache) {
+        RemoteFile remote;
+        if (probeMirrors(io_services.getIOService(0), std::vector<URL>(1, url), pool, &endpoint_cache, &tls, options_.range_retries,
+                         boost::bind(&Download::cancelled, this), remote).empty()) {
+            return;
+        }
+        if (remote.size <= 0 || !remote.ranges_supported || (remote.etag.empty() && remote.last_modified.empty())) {
+            LogMessage() << "Not using the cache - the version of the file is not known";
+            cache.reset();
+        } else {
+            RangeList cached = intersectRanges(ranges, cache->select(options_.urls[0], remote.size, remote.etag, remote.last_modified));
+            std::vector<uint32_t> crcs; // not needed, there is no checksum of the whole file
+            if (!cache->copy(cached, *output, crcs)) {
+                return;
+            }
+            fetch = subtractRanges(ranges, cached);
+            int64_t cached_bytes = 0;
+            for (const ByteRange& range: cached) {
+                cached_bytes += range.length();
+            }
+            LogMessage() << cached_bytes << " bytes of the ranges are in the cache " << options_.cache_dir;
+        }
+    }
+    total_bytes_ = 0;
+    for (const ByteRange& range: ranges) {
+        total_bytes_ += range.length();
+    }
+    complete_ = fetch.empty() || fetch_ranges(io_services, pool, endpoint_cache, buffer_pool, tls, url, fetch, output);
+    if (cache && complete_) {
+        cache->store(fetch, *output);
+    }
+}
+
+/*
+ * Open the cache named in the options, NULL if there is none or it cannot be used
+ */
+std::shared_ptr<RangeCache> Download::open_cache()
+{
+    std::shared_ptr<RangeCache> cache;
+    if (!options_.cache_dir.empty()) {
+        cache.reset(new RangeCache(options_.cache_dir, options_.cache_size));
+        if (!cache->open()) {
+            cache.reset();
+        }
+    }
+    return cache;
+}
+
+/*
+ * Bring an old copy of the file up to date with the block index in the options.  The
+ * blocks the old copy has are copied out of it, the others are downloaded, and once the
+ * new file matches the index it replaces the output file.  The results are left in
+ * complete_, checksums_match_ and checksums_.
+ */
+void Download::download_delta(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                              TLSContext& tls, const URL& url)
+{
+    if (sink_) {
+        LogMessage() << "Unable to update an old copy - the download is not going to a file";
+        return;
+    }
+    BlockIndex index;
+    if (!load_index(index)) {
+        return;
+    }
+    const std::string& output_file_name = options_.output_file_name;
+    std::string old_file_name = options_.delta_source.empty() ? output_file_name : options_.delta_source;
+    std::vector<int64_t> sources;
+    size_t found = index.findBlocks(old_file_name, sources);
+
+    // Everything the old copy does not have is downloaded, neighbouring blocks together
+    RangeList missing;
+    int64_t found_bytes = 0;
+    for (size_t i = 0; i < sources.size(); i++) {
+        int64_t first = static_cast<int64_t>(i) * index.getBlockSize();
+        if (sources[i] >= 0) {
+            found_bytes += index.getBlockLength(i);
+        } else if (!missing.empty() && missing.back().last + 1 == first) {
+            missing.back().last = first + index.getBlockLength(i) - 1;
+        } else {
+            missing.push_back(ByteRange(first, first + index.getBlockLength(i) - 1));
+        }
+    }
+    LogMessage() << found << " of " << index.getBlockCount() << " blocks (" << found_bytes << " bytes) are already in " <<
+        old_file_name << " - downloading the other " << (index.getFileSize() - found_bytes) << " bytes";
+
+    // The new file is put together next to the output file, which may be the old copy
+    std::string new_file_name = output_file_name + ".delta";
+    if (!output_file_.open(new_file_name, index.getFileSize())) {
+        return;
+    }
+    if (found > 0 && !copy_blocks(index, sources, old_file_name)) {
+        output_file_.close();
+        remove(new_file_name.c_str());
+        return;
+    }
+    total_bytes_ = index.getFileSize();
+    complete_ = missing.empty() || fetch_ranges(io_services, pool, endpoint_cache, buffer_pool, tls, url, missing, &output_file_);
+
+    // The index's SHA-256 says whether the blocks were put together right
+    if (complete_) {
+        Checksums expected(options_.checksums);
+        expected["sha256"] = index.getSHA256();
+        checksum_file(expected);
+    }
+    output_file_.close();
+    if (complete_ && checksums_match_) {
+        if (rename(new_file_name.c_str(), output_file_name.c_str()) != 0) {
+            LogMessage() << "Unable to replace " << output_file_name << ": " << strerror(errno);
+            complete_ = false;
+        }
+    } else {
+        remove(new_file_name.c_str());
+    }
+}
+
+/*
+ * Read the block index named in the options, from a file or by downloading it
+ */
+bool Download::load_index(BlockIndex& index)
+{
+    const std::string& name = options_.delta_index;
+    if (name.compare(0, 7, "http://") != 0 && name.compare(0, 8, "https://") != 0) {
+        return index.read(name);
+    }
+    DownloadOptions index_options;
+    index_options.urls.push_back(name);
+    index_options.ca_file = options_.ca_file;
+    index_options.insecure = options_.insecure;
+    index_options.read_size = options_.read_size;
+    MemorySink memory;
+    Download index_download(index_options, &memory);
+    if (!index_download.run()) {
+        LogMessage() << "Unable to download the block index " << name;
+        return false;
+    }
+    const std::vector<char>& data = memory.getData();
+    return index.parse(std::string(data.begin(), data.end()), name);
+}
+
+/*
+ * Read the output file back and check it against the expected checksums.  The results
+ * are left in checksums_match_ and checksums_.
+ */
+void Download::checksum_file(const Checksums& expected)
+{
+    FileDigests digests;
+    for (Checksums::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        if (it->first != "crc32c") {
+            digests[it->first].reset(new MessageDigest(it->first));
+        }
+    }
+    CRC32C crc;
+    std::vector<char> buffer(1024 * 1024);
+    int64_t offset = 0;
+    size_t count;
+    while ((count = output_file_.read(offset, &buffer[0], buffer.size())) > 0) {
+        crc.update(&buffer[0], count);
+        for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+            it->second->update(&buffer[0], count);
+        }
+        offset += count;
+    }
+    if (expected.count("crc32c")) {
+        checksums_["crc32c"] = crc32cBytes(crc.value());
+    }
+    for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+        checksums_[it->first] = it->second->finish();
+    }
+    checksums_match_ = verifyChecksums(expected, checksums_);
+}
+
+/*
+ * Copy the blocks the old copy has into the new file
+ */
+bool Download::copy_blocks(BlockIndex& index, const std::vector<int64_t>& sources, const std::string& old_file_name)
+{
+    std::ifstream input(old_file_name.c_str(), std::ios::in | std::ios::binary);
+    std::vector<char> buffer(index.getBlockSize());
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (sources[i] < 0) {
+            continue;
+        }
+        size_t length = static_cast<size_t>(index.getBlockLength(i));
+        input.seekg(sources[i]);
+        input.read(&buffer[0], length);
+        if (static_cast<size_t>(input.gcount()) != length) {
+            LogMessage() << "Unable to read " << old_file_name;
+            return false;
+        }
+        if (!output_file_.write(static_cast<int64_t>(i) * index.getBlockSize(), &buffer[0], length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Download some ranges of a file into the output, each at its offset
+ */
+bool Download::fetch_ranges(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                            TLSContext& tls, const URL& url, const RangeList& ranges, Sink* output)
+{
+    boost::asio::io_service& io_service = io_services.getIOService(0);
+    bool parallel = options_.parallel || options_.sharded || options_.auto_tune;
+    int64_t chunk_size = options_.chunk_size > 0 ? options_.chunk_size : DEFAULT_CHUNK_SIZE;
+    RangeScheduler scheduler(io_service, url, ranges, parallel ? options_.max_connections : 1, chunk_size, output, pool);
+    scheduler.setEndpointCache(&endpoint_cache);
+    scheduler.setTLSContext(&tls);
+    scheduler.setBufferPool(&buffer_pool);
+    scheduler.setRetryLimits(options_.range_retries, options_.total_retries);
+    scheduler.setMetrics(metrics_);
+    scheduler.setSplice(options_.splice);
+    scheduler.setRangesPerRequest(options_.ranges_per_request);
+    if (progress_handler_) {
+        scheduler.setProgressHandler(boost::bind(&Download::report_progress, this, _1, _2));
+    }
+    scheduler.start();
+    IOServicePool::run(io_service, parallel ? options_.thread_count : 1);
+    return scheduler.succeeded();
+}
+
+static void concatenate_output(const std::vector<HTTPGet*>& requests, const std::string& output_file_name, FileDigests& digests)
+{
+    // Open up the output file
+    LogMessage() << "Writing output file...";
+    std::ofstream output_file(output_file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    // Concatenate all the output files into to the requested output file
+    std::vector<char> buffer(1024 * 1024);
+    for (HTTPGet* request: requests) {
+        // Get the output file from this request and open it
+        std::string input_file_name = request->getOutputFilename();
+        LogMessage() << "Adding contents of " << input_file_name << " to " << output_file_name;
+        std::ifstream input_file(input_file_name, std::ifstream::in | std::ifstream::binary);
+        // Copy this chunk to the output file, adding it to the digests on the way.  Only the
+        // bytes the request counted are copied, anything after them is in another file.
+        int64_t remaining = request->getBytesWritten();
+        while (remaining > 0 && (input_file.read(&buffer[0], std::min<int64_t>(buffer.size(), remaining)) || input_file.gcount() > 0)) {
+            for (FileDigests::iterator it = digests.begin(); it != digests.end(); ++it) {
+                it->second->update(&buffer[0], input_file.gcount());
+            }
+            output_file.write(&buffer[0], input_file.gcount());
+            remaining -= input_file.gcount();
+        }
+        input_file.close();
+    }
+    output_file.close();
+}
+
+/*
+ * Ask every URL about the file at the same time.  The first URL that answers is the
+ * reference, any other URL that does not answer or does not report the same size and
+ * ETag is left out.  If there is more than one mirror, only the ones that support
+ * ranges are kept.  If none of them answers they are asked again after a backoff, unless
+ * every error is one that asking again will not fix.  Returns the URLs that can be used,
+ * none if the file cannot be downloaded (the reason is printed).
+ */
+static std::vector<URL> probeMirrors(boost::asio::io_service& io_service, const std::vector<URL>& urls, ConnectionPool* pool,
+                                     EndpointCache* endpoint_cache, TLSContext* tls, int retries,
+                                     const boost::function<bool ()>& cancelled, RemoteFile& remote)
+{
+    std::vector<std::shared_ptr<HTTPProbe> > probes;
+    size_t reference = 0;
+    int delay = PROBE_BACKOFF_MS;
+    for (int attempt = 0; ; attempt++) {
+        probes.clear();
+        for (const URL& url: urls) {
+            std::shared_ptr<HTTPProbe> probe(new HTTPProbe(io_service, url.getServer(), url.getPath(), url.getPort(), pool));
+            probe->setEndpointCache(endpoint_cache);
+            probe->setTLSContext(url.isHTTPS() ? tls : NULL);
+            probe->start();
+            probes.push_back(probe);
+        }
+        io_service.run();
+        io_service.reset();
+
+        reference = 0;
+        bool transient = false;
+        while (reference < probes.size() && !probes[reference]->succeeded()) {
+            transient = transient || !probes[reference]->failedPermanently();
+            reference++;
+        }
+        if (reference < probes.size() || cancelled()) {
+            break;
+        }
+        if (!transient || attempt >= retries) {
+            if (urls.size() > 1) {
+                LogMessage() << "Error: unable to download " << urls[0].getURL() << " from any of the " << urls.size() << " mirrors";
+            } else {
+                LogMessage() << "Error: unable to download " << urls[0].getURL();
+            }
+            return std::vector<URL>();
+        }
+        LogMessage() << "Probing again in " << delay << "ms (retry " << (attempt + 1) << " of " << retries << ")";
+        boost::asio::deadline_timer timer(io_service);
+        timer.expires_from_now(boost::posix_time::milliseconds(delay));
+        timer.wait();
+        delay *= 2;
+    }
+    if (reference == probes.size()) {
+        return std::vector<URL>();
+    }
+    int64_t file_size = probes[reference]->getFileSize();
+    remote.size = file_size;
+    remote.etag = probes[reference]->getETag();
+    remote.last_modified = probes[reference]->getLastModified();
+    remote.checksums = probes[reference]->getChecksums();
+    // With more than one mirror, the ones that cannot do ranges are left out below
+    remote.ranges_supported = urls.size() > 1 || probes[reference]->acceptsRanges();
+    const std::string etag = probes[reference]->getETag();
+    
+    std::vector<URL> usable;
+    for (size_t i = 0; i < probes.size(); i++) {
+        HTTPProbe& probe = *probes[i];
+        const char* problem = NULL;
+        if (!probe.succeeded()) {
+            problem = "no response";
+        } else if (probe.getFileSize() != file_size) {
+            problem = "the size is different";
+        } else if (!etag.empty() && !probe.getETag().empty() && probe.getETag() != etag) {
+            problem = "the ETag is different";
+        } else if (urls.size() > 1 && !probe.acceptsRanges()) {
+            problem = "ranges are not supported";
+        }
+        if (problem) {
+            LogMessage() << "Not using " << urls[i].getURL() << ": " << problem;
+        } else {
+            usable.push_back(urls[i]);
+        }
+    }
+    if (usable.empty()) {
+        // Only the reference is left, and it cannot do ranges
+        usable.push_back(urls[reference]);
+        remote.ranges_supported = false;
+    }
+    return usable;
+}
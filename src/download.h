@@ -0,0 +1,260 @@
+#ifndef __multiget_download_include__
+#define __multiget_download_include__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+#include <boost/function.hpp>
+
+#include "checksum.h"
+#include "outputfile.h"
+#include "rangelist.h"
+#include "log.h"
+
+class Sink;
+class Metrics;
+class IOServicePool;
+class ConnectionPool;
+class EndpointCache;
+class BufferPool;
+class TLSContext;
+class URL;
+class BlockIndex;
+class RangeCache;
+
+/*! \brief How to download a file (the command line options of multiget)
+ */
+struct DownloadOptions {
+    DownloadOptions();
+
+    std::vector<std::string>    urls; // the file, then any mirrors of it
+    std::string                 output_file_name; // where to write the file when there is no sink
+    int64_t                     total_size; // bytes to get, 0 to ask the server for the size
+    int64_t                     chunk_size; // bytes to get on each request, 0 for total_size / chunk_count
+    int                         chunk_count; // chunks to split the file into when chunk_size is 0
+    bool                        parallel; // run up to max_connections requests at once, not one at a time
+    int                         max_connections;
+    int                         max_per_host; // most requests to run at once to each server (BatchDownload only)
+    int                         thread_count; // threads to run the requests on, 0 for one per core (sharded only)
+    bool                        sharded; // give each thread its own io_service (implies parallel)
+    bool                        keep_alive; // reuse connections
+    bool                        direct; // write each chunk straight into the output file, not a temporary file
+    bool                        adaptive; // split the slowest chunk when a connection is free (implies direct)
+    bool                        journal; // keep a journal so the download can be resumed (output file only)
+    bool                        splice; // move plain HTTP bodies into the output file with splice() (Linux only)
+    bool                        auto_tune; // pick the number of connections (up to max_connections) and the chunk size
+                                           // from the throughput, chunk_size is only the starting point (implies parallel)
+    int                         read_size; // largest number of bytes to receive on each read (at least HTTPGet::MIN_READ_SIZE)
+    Checksums                   checksums; // expected checksums of the file
+    bool                        verify; // checksum the download even with nothing to check it against
+    int                         range_retries; // times to retry the missing part of a chunk
+    int                         total_retries; // retries allowed for the whole download
+    std::string                 ca_file; // certificates to trust for https:// as well as the system's, empty for none
+    bool                        insecure; // accept any certificate for https://
+    RangeList                   ranges; // only get these bytes of the file, each at its offset, empty for all of it
+    int                         ranges_per_request; // most of the ranges to ask for in one request
+    std::string                 delta_index; // block index (file or URL) to update an old copy with, empty to get the whole file
+    std::string                 delta_source; // the old copy, empty for the output file itself
+    std::string                 cache_dir; // keep downloaded ranges here for later downloads, empty for no cache
+    int64_t                     cache_size; // most bytes to keep in the cache
+};
+
+/*! \brief Download one file, in parallel ranges, into a file, memory or a function
+ *
+ *  This is the whole of multiget as a class, for programs that want to fetch files
+ *  themselves.  The bytes go to a Sink (see MemorySink and CallbackSink), or to the output
+ *  file named in the options if there is no sink.  With a sink the ranges are always
+ *  written straight to it, and the options that only make sense for a file on disk
+ *  (temporary chunk files and the journal) are not used.
+ *
+ *  If the options list ranges, only those bytes of the file are fetched (from the first
+ *  URL, several ranges to a request) and each is written at its own offset.  The output
+ *  file is left sparse.  There is no probe and the file as a whole is not checksummed.
+ *
+ *  If the options name a block index (see BlockIndex), an old copy of the file is brought
+ *  up to date: the blocks it already has are copied out of it, only the rest are
+ *  downloaded, and the new file replaces the output file once it matches the index.
+ *
+ *  With a cache directory in the options, whatever the cache has of the same version of
+ *  the file (see RangeCache) is copied out of it instead of downloaded, and what is
+ *  downloaded is added to it.  The version is found out with a probe.
+ *
+ *  A Download can be run on the calling thread (run), or on a thread of its own (start)
+ *  with the completion handler called when it is done and wait to block until then.
+ *  Either way it can be stopped early from another thread with cancel.
+ *
+ *  A Download is run once.
+ */
+class Download {
+public:
+    typedef boost::function<void (Download& download)> completion_handler;
+    // Called with the bytes downloaded so far, the size of the file (-1 if not known) and
+    // whether this is the last call
+    typedef boost::function<void (int64_t bytes_done, int64_t total_bytes, bool finished)> progress_handler;
+
+    /**
+     *   @brief  Create a Download object.
+     *
+     *   @param  options What to download and how
+     *   @param  sink Where the bytes go, or NULL to write options.output_file_name.  The
+     *           sink must outlive the download.
+     *
+     *   @return Download object
+     */
+    explicit Download(const DownloadOptions& options, Sink* sink = NULL);
+    virtual ~Download();
+
+    /**
+     *   @brief  Be told when the download has finished (must be called before run or start)
+     *
+     *   The handler is called on the thread that ran the download, whether it succeeded
+     *   or not.
+     *
+     *   @param  handler Function to call
+     *
+     *   @return void
+     */
+    void setCompletionHandler(const completion_handler& handler) { completion_handler_ = handler; }
+
+    /**
+     *   @brief  Be told how the download is going (must be called before run or start)
+     *
+     *   The handler is called when the transfer starts, a couple of times a second while
+     *   it runs and once more at the end, never from more than one thread at a time.
+     *
+     *   @param  handler Function to call
+     *
+     *   @return void
+     */
+    void setProgressHandler(const progress_handler& handler) { progress_handler_ = handler; }
+
+    /**
+     *   @brief  Be told what the download has to say (must be called before run or start)
+     *
+     *   The library prints nothing itself: each message (what is being downloaded, the
+     *   retries, the errors) is passed to the handler as one line, from whichever thread
+     *   it came up on.  Without a handler the messages go to the handler of the thread
+     *   that runs or starts the download (see LogScope), and are dropped if it has none.
+     *
+     *   @param  handler Function to call
+     *
+     *   @return void
+     */
+    void setLogHandler(const log_handler& handler) { log_handler_ = handler; }
+
+    /**
+     *   @brief  Record the timings of every request (must be called before run or start)
+     *
+     *   @param  metrics Where to add each request when it finishes, or NULL for none
+     *
+     *   @return void
+     */
+    void setMetrics(Metrics* metrics) { metrics_ = metrics; }
+
+    /**
+     *   @brief  Download the file on the calling thread (and any worker threads)
+     *
+     *   @return true if the whole file arrived and its checksums match
+     */
+    bool run();
+
+    /**
+     *   @brief  Download the file on a thread of its own and return straight away
+     *
+     *   @return void
+     */
+    void start();
+
+    /**
+     *   @brief  Wait for a download that was started with start to finish
+     *
+     *   @return true if the whole file arrived and its checksums match
+     */
+    bool wait();
+
+    /**
+     *   @brief  Stop the download as soon as possible.  It finishes without succeeding.
+     *
+     *   May be called from any thread, including from the handlers.
+     *
+     *   @return void
+     */
+    void cancel();
+
+    /**
+     *   @brief  Find out whether the download worked (once it has finished)
+     *
+     *   @return true if the whole file arrived and its checksums match
+     */
+    bool succeeded() { return complete_ && checksums_match_; }
+
+    /**
+     *   @brief  Find out whether every byte arrived (once it has finished)
+     *
+     *   @return true if every chunk was downloaded
+     */
+    bool isComplete() { return complete_; }
+
+    /**
+     *   @brief  Find out whether the checksums were right (once it has finished)
+     *
+     *   @return false if a checksum of the download did not match the expected one
+     */
+    bool checksumsMatch() { return checksums_match_; }
+
+    /**
+     *   @brief  Get the size of the file (once the download has started)
+     *
+     *   @return size in bytes, -1 if not known
+     */
+    int64_t getTotalBytes() { return total_bytes_; }
+
+    /**
+     *   @brief  Get the checksums of the download (once it has finished)
+     *
+     *   @return checksums keyed by algorithm, only the ones that were asked for or checked
+     */
+    const Checksums& getChecksums() { return checksums_; }
+
+private:
+    void download();
+    void download_ranges(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                         TLSContext& tls, const URL& url);
+    void download_delta(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                        TLSContext& tls, const URL& url);
+    bool fetch_ranges(IOServicePool& io_services, ConnectionPool* pool, EndpointCache& endpoint_cache, BufferPool& buffer_pool,
+                      TLSContext& tls, const URL& url, const RangeList& ranges, Sink* output);
+    std::shared_ptr<RangeCache> open_cache();
+    bool load_index(BlockIndex& index);
+    bool copy_blocks(BlockIndex& index, const std::vector<int64_t>& sources, const std::string& old_file_name);
+    void checksum_file(const Checksums& expected);
+    void report_progress(int64_t bytes_done, bool finished);
+    bool cancelled();
+
+    DownloadOptions             options_;
+    Sink*                       sink_; // user's sink, or NULL for the output file
+    OutputFile                  output_file_; // direct mode output when there is no sink
+    Metrics*                    metrics_;
+    completion_handler          completion_handler_;
+    progress_handler            progress_handler_;
+    log_handler                 log_handler_;
+    std::thread                 thread_; // runs the download after start
+
+    bool                        complete_;
+    bool                        checksums_match_;
+    int64_t                     total_bytes_;
+    Checksums                   checksums_;
+
+    std::mutex                  mutex_; // protects the two below
+    bool                        cancelled_;
+    std::shared_ptr<IOServicePool> io_services_; // while the download runs
+
+    // Ensure that these method are not created explicitly
+    Download(const Download& in); // not implemented
+    Download& operator = (const Download &t); // not implemented
+};
+
+#endif // __multiget_download_include__
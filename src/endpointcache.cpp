@@ -0,0 +1,227 @@
+#include "endpointcache.h"
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+/*
+ * One connection race.  Each attempt gets its own socket; a new attempt is started when
+ * the delay expires or as soon as the previous attempt fails.  All of the completion
+ * handlers run through one strand so the race can be shared by several threads.
+ */
+class ConnectRace : public std::enable_shared_from_this<ConnectRace> {
+public:
+    ConnectRace(boost::asio::io_service& io_service, EndpointCache* cache, const std::string& server, const std::string& port,
+                const std::vector<tcp::endpoint>& endpoints, const EndpointCache::connect_handler& handler, int attempt_delay_ms)
+    : io_service_(io_service)
+    , strand_(io_service)
+    , timer_(io_service)
+    , cache_(cache)
+    , server_(server)
+    , port_(port)
+    , endpoints_(endpoints)
+    , sockets_(endpoints.size())
+    , handler_(handler)
+    , attempt_delay_ms_(attempt_delay_ms)
+    , next_(0)
+    , pending_(0)
+    , done_(false)
+    {
+    }
+
+    void start()
+    {
+        strand_.dispatch(boost::bind(&ConnectRace::next, shared_from_this()));
+    }
+
+private:
+    void next()
+    {
+        if (done_ || next_ >= endpoints_.size()) {
+            return;
+        }
+        size_t i = next_++;
+        sockets_[i].reset(new tcp::socket(io_service_));
+        pending_++;
+        sockets_[i]->async_connect(endpoints_[i],
+                                   strand_.wrap(boost::bind(&ConnectRace::handle_connect, shared_from_this(), i,
+                                                            boost::asio::placeholders::error)));
+        if (next_ < endpoints_.size()) {
+            // Give this endpoint a head start before racing the next one against it
+            timer_.expires_from_now(boost::posix_time::milliseconds(attempt_delay_ms_));
+            timer_.async_wait(strand_.wrap(boost::bind(&ConnectRace::handle_timer, shared_from_this(),
+                                                       boost::asio::placeholders::error)));
+        }
+    }
+
+    void handle_timer(const boost::system::error_code& err)
+    {
+        if (!err) {
+            next();
+        }
+    }
+
+    void handle_connect(size_t i, const boost::system::error_code& err)
+    {
+        pending_--;
+        boost::system::error_code ignored;
+        if (done_) {
+            // Another attempt won the race
+            if (sockets_[i]) {
+                sockets_[i]->close(ignored);
+            }
+            return;
+        }
+        if (!err) {
+            done_ = true;
+            timer_.cancel(ignored);
+            for (size_t j = 0; j < sockets_.size(); j++) {
+                if (j != i && sockets_[j]) {
+                    sockets_[j]->close(ignored);
+                }
+            }
+            cache_->setPreferred(server_, port_, endpoints_[i]);
+            handler_(err, sockets_[i]);
+            return;
+        }
+
+        // This endpoint failed, so do not wait for the delay before trying the next one
+        last_error_ = err;
+        sockets_[i].reset();
+        if (next_ < endpoints_.size()) {
+            timer_.cancel(ignored);
+            next();
+        } else if (pending_ == 0) {
+            done_ = true;
+            handler_(last_error_, EndpointCache::socket_ptr());
+        }
+    }
+
+    boost::asio::io_service&                io_service_;
+    boost::asio::io_service::strand         strand_;
+    boost::asio::deadline_timer             timer_;
+    EndpointCache*                          cache_;
+    std::string                             server_;
+    std::string                             port_;
+    std::vector<tcp::endpoint>              endpoints_; // in the order they are tried
+    std::vector<EndpointCache::socket_ptr>  sockets_; // one per attempt
+    EndpointCache::connect_handler          handler_;
+    int                                     attempt_delay_ms_;
+    size_t                                  next_; // index of the next endpoint to try
+    int                                     pending_; // attempts still running
+    bool                                    done_; // the handler has been called
+    boost::system::error_code               last_error_;
+};
+
+} // namespace
+
+EndpointCache::EndpointCache(int attempt_delay_ms)
+: attempt_delay_ms_(attempt_delay_ms)
+{
+}
+
+void EndpointCache::asyncConnect(boost::asio::io_service& io_service, const std::string& server, const std::string& port,
+                                 const connect_handler& handler)
+{
+    std::string key = server + ":" + port;
+    Waiter waiter;
+    waiter.io_service = &io_service;
+    waiter.handler = handler;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    Entry& entry = entries_[key];
+    if (!entry.endpoints.empty()) {
+        std::vector<tcp::endpoint> endpoints(entry.endpoints);
+        lock.unlock();
+        race(waiter, key, endpoints);
+        return;
+    }
+
+    // Not resolved yet - wait for the lookup, starting it if this is the first request
+    entry.waiters.push_back(waiter);
+    if (entry.resolving) {
+        return;
+    }
+    entry.resolving = true;
+    lock.unlock();
+
+    resolver_ptr resolver(new tcp::resolver(io_service));
+    tcp::resolver::query query(server, port);
+    resolver->async_resolve(query,
+                            boost::bind(&EndpointCache::handle_resolve, this, key, resolver,
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::iterator));
+}
+
+void EndpointCache::setPreferred(const std::string& server, const std::string& port, const tcp::endpoint& endpoint)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<tcp::endpoint>& endpoints = entries_[server + ":" + port].endpoints;
+    std::vector<tcp::endpoint>::iterator it = std::find(endpoints.begin(), endpoints.end(), endpoint);
+    if (it != endpoints.end()) {
+        endpoints.erase(it);
+        endpoints.insert(endpoints.begin(), endpoint);
+    }
+}
+
+void EndpointCache::handle_resolve(const std::string& key, resolver_ptr resolver, const boost::system::error_code& err,
+                                   tcp::resolver::iterator endpoint_iterator)
+{
+    std::vector<tcp::endpoint> resolved;
+    for (tcp::resolver::iterator end; endpoint_iterator != end; ++endpoint_iterator) {
+        resolved.push_back(endpoint_iterator->endpoint());
+    }
+
+    // Interleave the address families, starting with whichever the resolver put first,
+    // so that a broken IPv6 (or IPv4) path only costs one attempt delay
+    std::vector<tcp::endpoint> first_family, other_family;
+    for (const tcp::endpoint& endpoint: resolved) {
+        if (endpoint.protocol() == resolved.front().protocol()) {
+            first_family.push_back(endpoint);
+        } else {
+            other_family.push_back(endpoint);
+        }
+    }
+    std::vector<tcp::endpoint> endpoints;
+    for (size_t i = 0; i < first_family.size() || i < other_family.size(); i++) {
+        if (i < first_family.size()) {
+            endpoints.push_back(first_family[i]);
+        }
+        if (i < other_family.size()) {
+            endpoints.push_back(other_family[i]);
+        }
+    }
+
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[key];
+        entry.resolving = false;
+        if (!err && !endpoints.empty()) {
+            // Failures are not cached, the next request will try the lookup again
+            entry.endpoints = endpoints;
+        }
+        waiters.swap(entry.waiters);
+    }
+
+    for (const Waiter& waiter: waiters) {
+        if (err || endpoints.empty()) {
+            boost::system::error_code error = err ? err : boost::asio::error::host_not_found;
+            waiter.io_service->post(boost::bind(waiter.handler, error, socket_ptr()));
+        } else {
+            race(waiter, key, endpoints);
+        }
+    }
+}
+
+void EndpointCache::race(const Waiter& waiter, const std::string& key, const std::vector<tcp::endpoint>& endpoints)
+{
+    std::string::size_type colon = key.rfind(':');
+    std::shared_ptr<ConnectRace> connect_race(new ConnectRace(*waiter.io_service, this, key.substr(0, colon), key.substr(colon + 1),
+                                                              endpoints, waiter.handler, attempt_delay_ms_));
+    connect_race->start();
+}
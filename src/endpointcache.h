@@ -0,0 +1,95 @@
+#ifndef __multiget_endpoint_cache_include__
+#define __multiget_endpoint_cache_include__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+/*! \brief Shared DNS results and connection racing for all the requests to a host
+ *
+ *  The first request to a host resolves it; any request that arrives while the lookup is
+ *  running waits for the same answer, and every later request uses the cached endpoint
+ *  list.  So N chunks cost one DNS lookup instead of N.  The results are kept for the
+ *  lifetime of the cache (i.e. one run of the program).
+ *
+ *  Connections are raced across the endpoints ("happy eyeballs", RFC 8305): the first
+ *  endpoint is tried, and if it has not answered within a short delay the next one is
+ *  tried alongside it, alternating between IPv6 and IPv4.  The first connection to
+ *  complete is used and the others are abandoned.  The endpoint that won is remembered
+ *  and tried first by the following requests to the host.
+ *
+ *  The cache is thread safe and may be shared by requests running on different io_services.
+ */
+class EndpointCache {
+public:
+    typedef std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+    typedef boost::function<void (const boost::system::error_code&, socket_ptr)> connect_handler;
+
+    /**
+     *   @brief  Create an empty cache
+     *
+     *   @param  attempt_delay_ms How long to wait for an endpoint before racing the next one
+     *
+     *   @return EndpointCache object
+     */
+    explicit EndpointCache(int attempt_delay_ms = 250);
+    virtual ~EndpointCache() {}
+
+    /**
+     *   @brief  Resolve the host (unless it is already known) and connect to it
+     *
+     *   The handler is called through io_service with an open socket that belongs to
+     *   io_service, or with the error from the lookup or the last connection attempt.
+     *
+     *   @param  io_service The io_service the connection will be used on
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"http\" or port number
+     *   @param  handler Function to call with the result
+     *
+     *   @return void
+     */
+    void asyncConnect(boost::asio::io_service& io_service, const std::string& server, const std::string& port,
+                      const connect_handler& handler);
+
+    /**
+     *   @brief  Remember the endpoint that answered first so it is tried first next time
+     *
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"http\" or port number
+     *   @param  endpoint The endpoint that won the race
+     *
+     *   @return void
+     */
+    void setPreferred(const std::string& server, const std::string& port, const boost::asio::ip::tcp::endpoint& endpoint);
+
+private:
+    struct Waiter {
+        boost::asio::io_service*    io_service;
+        connect_handler             handler;
+    };
+    struct Entry {
+        Entry() : resolving(false) {}
+        bool                                        resolving; // a lookup is running
+        std::vector<boost::asio::ip::tcp::endpoint> endpoints; // empty until resolved
+        std::vector<Waiter>                         waiters; // requests waiting for the lookup
+    };
+    typedef std::shared_ptr<boost::asio::ip::tcp::resolver> resolver_ptr;
+
+    void handle_resolve(const std::string& key, resolver_ptr resolver, const boost::system::error_code& err,
+                        boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
+    void race(const Waiter& waiter, const std::string& key, const std::vector<boost::asio::ip::tcp::endpoint>& endpoints);
+
+    int                             attempt_delay_ms_;
+    std::mutex                      mutex_; // protects entries_
+    std::map<std::string, Entry>    entries_; // keyed by server:port
+
+    // Ensure that these method are not created explicitly
+    EndpointCache(const EndpointCache& in); // not implemented
+    EndpointCache& operator = (const EndpointCache &t); // not implemented
+};
+
+#endif // __multiget_endpoint_cache_include__
@@ -1,34 +1,272 @@
 #include "httpget.h"
+#include "outputfile.h"
+#include "connectionpool.h"
+#include "endpointcache.h"
+#include "bufferpool.h"
+#include "tlscontext.h"
+#include "log.h"
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
-#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
 
-HTTPGet::HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int start_range,
-                 int end_range, const char* output_file_name)
+#if defined(__linux__)
+#define MULTIGET_HAVE_SPLICE 1
+#endif
+
+// Size of the receive buffer when there is no BufferPool
+static const size_t DEFAULT_READ_SIZE = 256 * 1024;
+
+const size_t HTTPGet::MIN_READ_SIZE;
+
+// Size to ask for when splicing the body through a pipe, the most bytes moved per wakeup.
+// Without privileges a pipe can be grown to 1 MiB by default (/proc/sys/fs/pipe-max-size).
+static const int SPLICE_PIPE_SIZE = 1024 * 1024;
+
+bool HeaderValue::assign(const char* value, size_t length)
+{
+    length_ = 0;
+    return append(value, length);
+}
+
+bool HeaderValue::append(const char* value, size_t length)
+{
+    size_t separator = length_ > 0 ? 2 : 0;
+    if (length_ + separator + length > MAX_LENGTH) {
+        return false;
+    }
+    if (separator) {
+        memcpy(value_ + length_, ", ", separator);
+        length_ += separator;
+    }
+    memcpy(value_ + length_, value, length);
+    length_ += length;
+    return true;
+}
+
+HTTPResponse::HTTPResponse()
+: status_code(0)
+, content_length(-1)
+, range_start(-1)
+, range_end(-1)
+, instance_length(-1)
+, accept_ranges(false)
+{
+}
+
+RequestTimings::RequestTimings()
+: body_bytes(0)
+, reads(0)
+, reused_connection(false)
+, resumed_session(false)
+{
+}
+
+HTTPGet::HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range,
+                 int64_t end_range, const char* output_file_name)
 : start_range_(start_range)
 , end_range_(end_range)
+, end_limit_(end_range)
+, claimed_end_(start_range)
+, server_(server)
+, path_(path)
+, port_(port)
+, io_service_(io_service)
 , resolver_(io_service)
-, socket_(io_service)
+, response_bytes_(0)
+, chunked_(false)
+, pool_(NULL)
+, endpoint_cache_(NULL)
+, buffer_pool_(NULL)
+, tls_(NULL)
+, tls_first_(false)
+, read_buffer_(NULL)
+, read_size_(0)
+, reused_connection_(false)
+, keep_alive_(false)
+, content_length_(-1)
+, body_received_(0)
+, succeeded_(false)
+, failed_permanently_(false)
 , output_file_name_(output_file_name)
-, output_file_(output_file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc)
+, direct_output_(NULL)
+, discard_body_(false)
+, bytes_written_(0)
+, checksum_(false)
+, ranges_refused_(false)
+, multipart_(false)
+, splice_(false)
+, pipe_size_(0)
+, splice_fd_(-1)
 {
-    // Create the HTTP request to get part of the file
-    std::ostream request_stream(&request_);
-    request_stream << "GET " << path << " HTTP/1.1\r\n";
-    request_stream << "Host: " << server << "\r\n";
-    // If end_range_ is set then we include the header, if it is 0 then the caller
-    // must want the entire file
-    if (end_range_ != 0) {
-        request_stream << "Range: " << "bytes=" << start_range << "-" << end_range << "\r\n";
-    }
-    // Once the file is downloaded - close the connection
-    request_stream << "Connection: close\r\n\r\n";
+    pipe_[0] = pipe_[1] = -1;
+    output_file_.open(output_file_name_, 0);
+}
+
+HTTPGet::HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range,
+                 int64_t end_range, Sink* output)
+: start_range_(start_range)
+, end_range_(end_range)
+, end_limit_(end_range)
+, claimed_end_(start_range)
+, server_(server)
+, path_(path)
+, port_(port)
+, io_service_(io_service)
+, resolver_(io_service)
+, response_bytes_(0)
+, chunked_(false)
+, pool_(NULL)
+, endpoint_cache_(NULL)
+, buffer_pool_(NULL)
+, tls_(NULL)
+, tls_first_(false)
+, read_buffer_(NULL)
+, read_size_(0)
+, reused_connection_(false)
+, keep_alive_(false)
+, content_length_(-1)
+, body_received_(0)
+, succeeded_(false)
+, failed_permanently_(false)
+, direct_output_(output)
+, discard_body_(false)
+, bytes_written_(0)
+, checksum_(false)
+, ranges_refused_(false)
+, multipart_(false)
+, splice_(false)
+, pipe_size_(0)
+, splice_fd_(-1)
+{
+    pipe_[0] = pipe_[1] = -1;
+}
+
+HTTPGet::HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range,
+                 int64_t end_range)
+: start_range_(start_range)
+, end_range_(end_range)
+, end_limit_(end_range)
+, claimed_end_(start_range)
+, server_(server)
+, path_(path)
+, port_(port)
+, io_service_(io_service)
+, resolver_(io_service)
+, response_bytes_(0)
+, chunked_(false)
+, pool_(NULL)
+, endpoint_cache_(NULL)
+, buffer_pool_(NULL)
+, tls_(NULL)
+, tls_first_(false)
+, read_buffer_(NULL)
+, read_size_(0)
+, reused_connection_(false)
+, keep_alive_(false)
+, content_length_(-1)
+, body_received_(0)
+, succeeded_(false)
+, failed_permanently_(false)
+, direct_output_(NULL)
+, discard_body_(true)
+, bytes_written_(0)
+, checksum_(false)
+, ranges_refused_(false)
+, multipart_(false)
+, splice_(false)
+, pipe_size_(0)
+, splice_fd_(-1)
+{
+    pipe_[0] = pipe_[1] = -1;
+}
+
+void HTTPGet::setRanges(const RangeList& ranges)
+{
+    ranges_ = ranges;
+    range_written_.assign(ranges_.size(), 0);
+    if (!ranges_.empty()) {
+        // The span of the ranges, for getStartRange and getEndRange
+        start_range_ = ranges_.front().first;
+        end_range_ = ranges_.back().last;
+        end_limit_ = end_range_;
+        claimed_end_ = start_range_;
+    }
+}
+
+void HTTPGet::start()
+{
+    start_time_ = std::chrono::steady_clock::now();
+    timings_.started = start_time_;
     
-    // We are only supporting the http protocol for this implementation (no HTTPS).  However,
-    // the use can specifiy a port other than 80 using the port paramater
-    tcp::resolver::query query(server, port);
+    // Create the HTTP request to get part of the file
+    std::ostringstream request_stream;
+    request_stream << "GET " << path_ << " HTTP/1.1\r\n";
+    request_stream << "Host: " << server_ << "\r\n";
+    // If end_range_ is set then we include the header, if it is negative then the caller
+    // must want the entire file (or the rest of it from start_range_)
+    if (!ranges_.empty()) {
+        request_stream << "Range: " << "bytes=" << formatRanges(ranges_) << "\r\n";
+    } else if (end_range_ >= 0) {
+        request_stream << "Range: " << "bytes=" << start_range_ << "-" << end_range_ << "\r\n";
+    } else if (start_range_ > 0) {
+        request_stream << "Range: " << "bytes=" << start_range_ << "-\r\n";
+    }
+    if (pool_) {
+        // Ask the server to leave the connection open so the next chunk can use it
+        request_stream << "Connection: keep-alive\r\n\r\n";
+    } else {
+        // Once the file is downloaded - close the connection
+        request_stream << "Connection: close\r\n\r\n";
+    }
+    request_ = request_stream.str();
+
+    // Skip the resolve and connect if there is an idle connection to this server
+    if (pool_) {
+        socket_ = pool_->acquire(server_, port_, tls_ ? &tls_stream_ : NULL);
+        if (socket_) {
+            reused_connection_ = true;
+            timings_.reused_connection = true;
+            send_request();
+            return;
+        }
+    }
+    connect();
+}
+
+HTTPGet::~HTTPGet()
+{
+    // Only the temporary chunk files belong to us, never the shared output file
+    if (!output_file_name_.empty()) {
+        unlink(output_file_name_.c_str());
+    }
+    release_buffer();
+    close_pipe();
+}
+
+void HTTPGet::connect()
+{
+    reused_connection_ = false;
+    tls_stream_.reset();
+    if (endpoint_cache_) {
+        // The cache resolves the host once for everyone and hands back a connected socket
+        socket_.reset();
+        endpoint_cache_->asyncConnect(io_service_, server_, port_,
+                                      boost::bind(&HTTPGet::handle_race, this, _1, _2));
+        return;
+    }
+    socket_.reset(new tcp::socket(io_service_));
+
+    // The port is "http", "https" or a port number
+    tcp::resolver::query query(server_, port_);
     // Resolve the server address (async)
     resolver_.async_resolve(query,
                             boost::bind(&HTTPGet::handle_resolve, this,
@@ -36,140 +274,756 @@ HTTPGet::HTTPGet(boost::asio::io_service& io_service, const std::string& server,
                                         boost::asio::placeholders::iterator));
 }
 
-HTTPGet::~HTTPGet()
+/*
+ * Start the TLS handshake on a new connection, offering the saved session for the server
+ * if there is one.  first is true if the other connections are waiting for this one to
+ * get a session.
+ */
+void HTTPGet::handshake(bool first)
 {
-    unlink(output_file_name_.c_str());
+    tls_first_ = first;
+    tls_stream_.reset(new boost::asio::ssl::stream<tcp::socket&>(*socket_, tls_->getContext()));
+    tls_->prepare(tls_stream_->native_handle(), server_, port_);
+    tls_stream_->async_handshake(boost::asio::ssl::stream_base::client,
+                                 boost::bind(&HTTPGet::handle_handshake, this, boost::asio::placeholders::error));
+}
+
+void HTTPGet::handle_handshake(const boost::system::error_code& err)
+{
+    timings_.handshaken = std::chrono::steady_clock::now();
+    if (!err)
+    {
+        timings_.resumed_session = SSL_session_reused(tls_stream_->native_handle()) != 0;
+        send_request();
+    }
+    else
+    {
+        LogMessage() << "Error: TLS handshake with " << server_ << " failed: " << err.message();
+        // An error from OpenSSL itself (e.g. the certificate cannot be verified) happens every
+        // time, a connection that was reset during the handshake may not
+        fail(err.category() == boost::asio::error::get_ssl_category());
+    }
+}
+
+void HTTPGet::send_request()
+{
+    if (tls_stream_) {
+        boost::asio::async_write(*tls_stream_, boost::asio::buffer(request_),
+                                 boost::bind(&HTTPGet::handle_write_request, this, boost::asio::placeholders::error));
+    } else {
+        boost::asio::async_write(*socket_, boost::asio::buffer(request_),
+                                 boost::bind(&HTTPGet::handle_write_request, this, boost::asio::placeholders::error));
+    }
+}
+
+/*
+ * A pooled connection may have been closed by the server while it was idle, which only
+ * shows up when we try to use it.  If nothing has been received on it yet then open a
+ * fresh connection and send the request again.
+ */
+bool HTTPGet::reconnect_if_stale(const boost::system::error_code& err)
+{
+    if (!reused_connection_ || err == boost::asio::error::operation_aborted) {
+        return false;
+    }
+    boost::system::error_code ignored;
+    socket_->close(ignored);
+    timings_.reused_connection = false;
+    connect();
+    return true;
 }
 
 void HTTPGet::handle_resolve(const boost::system::error_code& err, tcp::resolver::iterator endpoint_iterator)
 {
+    timings_.resolved = std::chrono::steady_clock::now();
     if (!err)
     {
         // Attempt a connection to each endpoint in the list until we
         // successfully establish a connection.
-        boost::asio::async_connect(socket_, endpoint_iterator,
+        boost::asio::async_connect(*socket_, endpoint_iterator,
                                    boost::bind(&HTTPGet::handle_connect, this, boost::asio::placeholders::error));
     }
     else
     {
-        std::cout << "Error: " << err.message() << "\n";
+        LogMessage() << "Error: " << err.message();
+        // The name does not exist, as opposed to the DNS server not answering
+        fail(err == boost::asio::error::host_not_found);
     }
 }
 
 void HTTPGet::handle_connect(const boost::system::error_code& err)
 {
+    timings_.connected = std::chrono::steady_clock::now();
     if (!err)
     {
-        // We are connected - send the HTTP request to get a chunk of the file
-        boost::asio::async_write(socket_, request_,
-                                 boost::bind(&HTTPGet::handle_write_request, this, boost::asio::placeholders::error));
+        if (tls_) {
+            // Wait for the first connection to the server to get a session to resume
+            tls_->asyncWaitForSession(io_service_, server_, port_, boost::bind(&HTTPGet::handshake, this, _1));
+        } else {
+            // We are connected - send the HTTP request to get a chunk of the file
+            send_request();
+        }
     }
     else
     {
-        std::cout << "Error: " << err.message() << "\n";
+        LogMessage() << "Error: " << err.message();
+        fail();
     }
 }
 
+void HTTPGet::handle_race(const boost::system::error_code& err, std::shared_ptr<boost::asio::ip::tcp::socket> socket)
+{
+    socket_ = socket;
+    handle_connect(err);
+}
+
 void HTTPGet::handle_write_request(const boost::system::error_code& err)
 {
+    timings_.request_sent = std::chrono::steady_clock::now();
     if (!err)
     {
-        // Read the HTTP responce (i.e. up until the first \r\n
-        boost::asio::async_read_until(socket_, response_, "\r\n",
-                                      boost::bind(&HTTPGet::handle_read_status_line, this, boost::asio::placeholders::error));
+        // Read the HTTP response into the receive buffer.  The headers are parsed where they
+        // land and whatever follows them is the start of the body.
+        acquire_buffer();
+        parser_.reset();
+        response_bytes_ = 0;
+        read_response();
     }
-    else
+    else if (!reconnect_if_stale(err))
     {
-        std::cout << "Error: " << err.message() << "\n";
+        LogMessage() << "Error: " << err.message();
+        fail();
     }
 }
 
-void HTTPGet::handle_read_status_line(const boost::system::error_code& err)
+void HTTPGet::read_response()
 {
-    if (!err)
+    boost::asio::mutable_buffers_1 buffer = boost::asio::buffer(read_buffer_ + response_bytes_, read_size_ - response_bytes_);
+    if (tls_stream_) {
+        tls_stream_->async_read_some(buffer, boost::bind(&HTTPGet::handle_read_response, this,
+                                                         boost::asio::placeholders::error,
+                                                         boost::asio::placeholders::bytes_transferred));
+    } else {
+        socket_->async_read_some(buffer, boost::bind(&HTTPGet::handle_read_response, this,
+                                                     boost::asio::placeholders::error,
+                                                     boost::asio::placeholders::bytes_transferred));
+    }
+}
+
+void HTTPGet::handle_read_response(const boost::system::error_code& err, size_t bytes)
+{
+    if (err)
     {
-        // Check that response is OK.
-        std::istream response_stream(&response_);
-        std::string http_version;
-        response_stream >> http_version;
-        unsigned int status_code;
-        response_stream >> status_code;
-        std::string status_message;
-        std::getline(response_stream, status_message);
-        if (!response_stream || http_version.substr(0, 5) != "HTTP/")
-        {
-            std::cout << "Invalid response\n";
-            return;
+        if (response_bytes_ > 0 || !reconnect_if_stale(err)) {
+            LogMessage() << "Error: " << err;
+            fail();
         }
-        if (status_code != 200 && status_code != 206)
-        {
-            std::cout << "Response returned with status code ";
-            std::cout << status_code << "\n";
-            return;
+        return;
+    }
+    if (response_bytes_ == 0) {
+        timings_.first_byte = std::chrono::steady_clock::now();
+    }
+    response_bytes_ += bytes;
+    ResponseParser::Result result = parser_.parse(read_buffer_, response_bytes_);
+    if (result == ResponseParser::INCOMPLETE) {
+        if (response_bytes_ == read_size_) {
+            LogMessage() << "Error: the response headers do not fit in " << read_size_ << " bytes";
+            fail(true);
+        } else {
+            read_response();
         }
-        
-        // Read the response headers, which are terminated by a blank line.
-        boost::asio::async_read_until(socket_, response_, "\r\n\r\n",
-                                      boost::bind(&HTTPGet::handle_read_headers, this,
-                                                  boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+        return;
     }
-    else
+    if (tls_stream_) {
+        // Any TLS 1.3 session ticket came before the response, so the session can be resumed now
+        tls_->saveSession(tls_stream_->native_handle(), server_, port_, tls_first_);
+        tls_first_ = false;
+    }
+    if (result == ResponseParser::INVALID) {
+        LogMessage() << "Invalid response";
+        fail(true);
+        return;
+    }
+    timings_.headers_read = std::chrono::steady_clock::now();
+
+    // Check that response is OK.
+    unsigned int status_code = parser_.getStatusCode();
+    response_info_.status_code = status_code;
+    if (status_code != 200 && status_code != 206)
     {
-        std::cout << "Error: " << err << "\n";
+        LogMessage() << "Response returned with status code " << status_code;
+        // Timeouts, rate limits and server errors may go away, anything else (404, 403, a
+        // redirect) will be the same next time
+        fail(status_code != 408 && status_code != 429 && status_code < 500);
+        return;
+    }
+    // HTTP/1.1 connections are persistent unless the server says otherwise
+    keep_alive_ = (pool_ != NULL && parser_.isHTTP11() && !parser_.connectionClose());
+    read_headers();
+    if (content_length_ < 0 && !chunked_) {
+        // Without a length the body ends when the server closes the connection
+        keep_alive_ = false;
+    }
+    if (discard_body_ && response_info_.status_code != 206) {
+        // All that was wanted is the headers, and the body could be the whole file
+        finish(false);
+        return;
+    }
+    if (parser_.getTransferEncoding() == ResponseParser::OTHER) {
+        // e.g. "gzip, chunked", which would leave the coding and the chunk framing in the output
+        LogMessage() << "Error: the body of " << path_ << " has a transfer coding that cannot be decoded";
+        fail(true);
+        return;
+    }
+    if (!ranges_.empty() && response_info_.status_code != 206) {
+        // The server is sending the whole file, let the caller ask for the ranges another way
+        ranges_refused_ = true;
+        fail();
+        return;
+    }
+    if (!ranges_.empty() && !multipart_ && response_info_.range_start < 0) {
+        LogMessage() << "Error: the server did not say which range it sent";
+        fail(true);
+        return;
+    }
+    if (!discard_body_ && ranges_.empty() && start_range_ > 0 &&
+        (response_info_.status_code != 206 || response_info_.range_start != start_range_)) {
+        // The body would not start where we need it to
+        LogMessage() << "Error: the server did not send the range starting at " << start_range_;
+        fail(true);
+        return;
+    }
+    if (checksum_ && !discard_body_ && !response_info_.content_md5.empty()) {
+        body_md5_.reset(new MessageDigest("md5"));
+    }
+    if (splice_ && !discard_body_ && !checksum_ && !chunked_ && !tls_stream_ && ranges_.empty()) {
+        // The kernel can move the rest of the body into the file, if the file can take it
+        open_pipe();
+    }
+
+    // We have finished reading all the headers...
+    // Now check to see if we have any of the body in the buffer.
+    size_t header_length = parser_.getHeaderLength();
+    size_t body_bytes = response_bytes_ - header_length;
+    if (body_bytes > 0) {
+        // Write out the start of the body that arrived with the headers, the rest is
+        // read into the receive buffer
+        size_t consumed = receive_body(read_buffer_ + header_length, body_bytes);
+        content_received(consumed < body_bytes);
+    } else if (content_length_ == 0 && !chunked_) {
+        finish(keep_alive_);
+    } else {
+        // Continue reading asynchronously until the end of the body
+        read_content();
     }
 }
 
-void HTTPGet::handle_read_headers(const boost::system::error_code& err, size_t bytes)
+/*
+ * Copy what we need from the headers into response_info_, before the body is read over
+ * them
+ */
+void HTTPGet::read_headers()
 {
-    if (!err)
-    {
-        // Process the response headers.
-        std::istream response_stream(&response_);
-        std::string header;
-        while (std::getline(response_stream, header) && header != "\r") {
-            //std::cout << header << std::endl;
-        }
-        
-        // We have finished reading all the headers...
-        // Now check to see if we have any of the body in the stream.
-        size_t avail = response_stream.rdbuf()->in_avail();
-        if (avail > 0) {
-            // Read in the remaining bytes
-            handle_read_content(err);
+    response_info_.content_length = parser_.getContentLength();
+    content_length_ = response_info_.content_length;
+    parser_.getContentRange(response_info_.range_start, response_info_.range_end, response_info_.instance_length);
+    response_info_.accept_ranges = parser_.acceptsRanges();
+    size_t etag_length;
+    size_t etag = parser_.getETag(etag_length);
+    response_info_.etag.assign(read_buffer_ + etag, etag_length);
+    response_info_.last_modified.clear();
+    response_info_.content_md5.clear();
+    response_info_.digest.clear();
+    multipart_ = false;
+    for (size_t i = 0; i < parser_.getHeaderCount(); i++) {
+        const ResponseParser::Header& header = parser_.getHeader(i);
+        const char* value = read_buffer_ + header.value;
+        if (ResponseParser::nameIs(read_buffer_, header, "last-modified")) {
+            response_info_.last_modified.assign(value, header.value_length);
+        } else if (ResponseParser::nameIs(read_buffer_, header, "content-md5")) {
+            response_info_.content_md5.assign(value, header.value_length);
+        } else if (ResponseParser::nameIs(read_buffer_, header, "digest") ||
+                   ResponseParser::nameIs(read_buffer_, header, "repr-digest") ||
+                   ResponseParser::nameIs(read_buffer_, header, "x-goog-hash")) {
+            // These can be repeated, keep all of the values (that fit)
+            response_info_.digest.append(value, header.value_length);
+        } else if (!ranges_.empty() && ResponseParser::nameIs(read_buffer_, header, "content-type")) {
+            size_t boundary, boundary_length;
+            if (MultipartDecoder::getBoundary(value, header.value_length, boundary, boundary_length)) {
+                // The decoder keeps its own copy, the buffer is about to be reused for the body
+                multipart_ = parts_.reset(value + boundary, boundary_length);
+            }
+        }
+    }
+    chunked_ = false;
+    switch (parser_.getTransferEncoding()) {
+        case ResponseParser::CHUNKED:
+            // The chunks say where the body ends, Content-Length is not used
+            chunked_ = true;
+            chunks_.reset();
+            content_length_ = -1;
+            break;
+        case ResponseParser::OTHER:
+            // The end of the body cannot be found from Content-Length
+            keep_alive_ = false;
+            content_length_ = -1;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Take a receive buffer for the response, from the pool if there is one and its buffers
+ * are big enough for the headers
+ */
+void HTTPGet::acquire_buffer()
+{
+    if (read_buffer_) {
+        // Kept from an earlier attempt on a stale connection
+        return;
+    }
+    if (buffer_pool_ && buffer_pool_->getBufferSize() >= MIN_READ_SIZE) {
+        read_buffer_ = buffer_pool_->acquire();
+        read_size_ = buffer_pool_->getBufferSize();
+    } else {
+        own_buffer_.resize(buffer_pool_ ? MIN_READ_SIZE : DEFAULT_READ_SIZE);
+        read_buffer_ = &own_buffer_[0];
+        read_size_ = own_buffer_.size();
+    }
+}
+
+void HTTPGet::read_content()
+{
+    if (pipe_[0] != -1) {
+        splice_content();
+        return;
+    }
+    if (direct_output_ && ranges_.empty() && direct_output_->pause(start_range_ + bytes_written_, boost::bind(&HTTPGet::resume_reading, this))) {
+        // The output has no room for more of this range yet.  Leave the rest in the socket,
+        // so TCP slows the server down, until it has caught up.
+        return;
+    }
+    if (tls_stream_) {
+        tls_stream_->async_read_some(boost::asio::buffer(read_buffer_, read_size_),
+                                     boost::bind(&HTTPGet::handle_read_content, this,
+                                                 boost::asio::placeholders::error,
+                                                 boost::asio::placeholders::bytes_transferred));
+    } else {
+        socket_->async_read_some(boost::asio::buffer(read_buffer_, read_size_),
+                                 boost::bind(&HTTPGet::handle_read_content, this,
+                                             boost::asio::placeholders::error,
+                                             boost::asio::placeholders::bytes_transferred));
+    }
+}
+
+/*
+ * Set up the pipe to splice the body through, if the output is a regular file.  Returns
+ * false if the body has to be read into the receive buffer instead.
+ */
+bool HTTPGet::open_pipe()
+{
+#ifdef MULTIGET_HAVE_SPLICE
+    splice_fd_ = direct_output_ ? direct_output_->getFileDescriptor() : output_file_.getFileDescriptor();
+    if (splice_fd_ == -1 || pipe2(pipe_, O_CLOEXEC) == -1) {
+        pipe_[0] = pipe_[1] = -1;
+        return false;
+    }
+    // A bigger pipe moves more of the body on each wakeup, but the default will do
+    fcntl(pipe_[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    int size = fcntl(pipe_[1], F_GETPIPE_SZ);
+    pipe_size_ = size > 0 ? size : 65536;
+    // splice must not block on the socket, asio will say when there is more to read
+    boost::system::error_code ignored;
+    socket_->native_non_blocking(true, ignored);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void HTTPGet::close_pipe()
+{
+    for (int i = 0; i < 2; i++) {
+        if (pipe_[i] != -1) {
+            ::close(pipe_[i]);
+            pipe_[i] = -1;
+        }
+    }
+}
+
+void HTTPGet::splice_content()
+{
+    socket_->async_wait(tcp::socket::wait_read,
+                        boost::bind(&HTTPGet::handle_splice, this, boost::asio::placeholders::error));
+}
+
+/*
+ * Move what has arrived on the socket into the output file: socket to pipe, then pipe to
+ * the file at the body's offset.  The same limits apply as in write_content, but bytes
+ * past them are left in the socket rather than read and dropped.
+ */
+void HTTPGet::handle_splice(const boost::system::error_code& err)
+{
+#ifdef MULTIGET_HAVE_SPLICE
+    if (err) {
+        LogMessage() << "Error: " << err;
+        fail();
+        return;
+    }
+    int64_t length = pipe_size_;
+    if (content_length_ >= 0) {
+        length = std::min(length, content_length_ - body_received_);
+    }
+    if (direct_output_ && end_range_ >= 0) {
+        length = claim(length);
+    }
+    ssize_t received;
+    do {
+        received = splice(socket_->native_handle(), NULL, pipe_[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (received == -1 && errno == EINTR);
+    if (received == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Woken up with nothing to read after all
+            splice_content();
         } else {
-            // Continue reading asynchronously until EOF
-            // NOTE: only call async_read IF not calling handle_read_content explicity
-            // otherwise you end up queuing up 2 async_reads which causes some nasty stuff
-            boost::asio::async_read(socket_, response_,
-                                    boost::asio::transfer_at_least(1),
-                                    boost::bind(&HTTPGet::handle_read_content, this,
-                                                boost::asio::placeholders::error));
+            LogMessage() << "Error: unable to splice from the socket: " << strerror(errno);
+            fail();
         }
+        return;
     }
-    else
-    {
-        std::cout << "Error: " << err << "\n";
+    if (received == 0) {
+        // The server closed the connection, which is handled as for the copy path
+        handle_read_content(boost::asio::error::eof, 0);
+        return;
+    }
+    loff_t offset = bytes_written_;
+    if (direct_output_) {
+        offset += start_range_;
+    }
+    ssize_t moved = 0;
+    while (moved < received) {
+        ssize_t bytes = splice(pipe_[0], NULL, splice_fd_, &offset, received - moved, SPLICE_F_MOVE);
+        if (bytes <= 0) {
+            if (bytes == -1 && errno == EINTR) {
+                continue;
+            }
+            LogMessage() << "Error: unable to splice into the output file: " << (bytes == 0 ? "no progress" : strerror(errno));
+            fail();
+            return;
+        }
+        moved += bytes;
     }
+    timings_.reads++;
+    body_received_ += received;
+    bytes_written_ += received;
+    content_received(false);
+#endif
+}
+
+/*
+ * The output has room again after a pause (called on whichever thread made the room)
+ */
+void HTTPGet::resume_reading()
+{
+    io_service_.post(boost::bind(&HTTPGet::read_content, this));
 }
 
-void HTTPGet::handle_read_content(const boost::system::error_code& err)
+void HTTPGet::handle_read_content(const boost::system::error_code& err, size_t bytes)
 {
     if (!err) {
+        timings_.reads++;
         // Write all of the data that has been read so far.
-        //std::cout << start_range_ << " got some content" << std::endl;
-        output_file_ << &response_;
-        
-        // Continue reading remaining data until EOF.
-        boost::asio::async_read(socket_, response_,
-                                boost::asio::transfer_at_least(1),
-                                boost::bind(&HTTPGet::handle_read_content, this,
-                                            boost::asio::placeholders::error));
-    } else if (err != boost::asio::error::eof) {
-        std::cout << "Error: " << err << "\n";
+        size_t consumed = receive_body(read_buffer_, bytes);
+        content_received(consumed < bytes);
+    } else if (err != boost::asio::error::eof && err != boost::asio::ssl::error::stream_truncated) {
+        LogMessage() << "Error: " << err;
+        fail();
     } else {
-        // We are at the end of the file - close the output file
-        output_file_.flush();
-        output_file_.close();
+        // Many servers close a TLS connection without a close_notify, which is no different
+        // from the end of a plain connection once the length has been checked
+        // We are at the end of the file - close the output file.  If we were told how
+        // long the body is then the server closed the connection before sending it all.
+        if (chunked_) {
+            LogMessage() << "Error: connection closed before the last chunk of the body";
+            fail();
+        } else if (content_length_ < 0 || body_received_ >= content_length_) {
+            finish(false);
+        } else {
+            LogMessage() << "Error: connection closed after " << body_received_ << " of " << content_length_ << " bytes";
+            fail();
+        }
+    }
+}
+
+/*
+ * Take the framing out of a chunked body, and write what is left.  Returns how many of
+ * the bytes belong to the body.
+ */
+size_t HTTPGet::receive_body(char* bytes, size_t length)
+{
+    if (!chunked_) {
+        return write_content(bytes, length);
+    }
+    size_t payload;
+    size_t consumed = chunks_.decode(bytes, length, payload);
+    write_content(bytes, payload);
+    return consumed;
+}
+
+/*
+ * Write body bytes straight from the receive buffer and return how many of them belong to
+ * the body.  On a persistent connection never take more than Content-Length bytes.  A
+ * server that ignores the Range header sends more than we asked for, so in direct mode
+ * never write past the end of our range (if there is one) as it belongs to another chunk.
+ */
+size_t HTTPGet::write_content(const char* bytes, size_t length)
+{
+    if (content_length_ >= 0) {
+        int64_t remaining = content_length_ - body_received_;
+        if (length > static_cast<size_t>(remaining)) {
+            length = remaining;
+        }
+    }
+    size_t consumed = length;
+    body_received_ += length;
+    if (body_md5_) {
+        body_md5_->update(bytes, length);
+    }
+
+    if (discard_body_) {
+        return consumed;
+    }
+    if (!ranges_.empty()) {
+        write_ranges(bytes, length);
+        return consumed;
+    }
+    if (!direct_output_) {
+        if (output_file_.write(bytes_written_, bytes, length)) {
+            bytes_written_ += length;
+            if (checksum_) {
+                crc_.update(bytes, length);
+            }
+        }
+        return consumed;
+    }
+    if (end_range_ >= 0) {
+        length = claim(length);
+        if (length == 0) {
+            return consumed;
+        }
+    }
+    if (direct_output_->write(start_range_ + bytes_written_, bytes, length)) {
+        bytes_written_ += length;
+        if (checksum_) {
+            crc_.update(bytes, length);
+        }
     }
+    return consumed;
 }
 
+/*
+ * Write the bytes of a response to several ranges.  A multipart/byteranges body says where
+ * each part goes, anything else is the single range in the Content-Range header.
+ */
+void HTTPGet::write_ranges(const char* bytes, size_t length)
+{
+    if (!multipart_) {
+        write_range_bytes(response_info_.range_start + body_received_ - length, bytes, length);
+        return;
+    }
+    while (length > 0 && !parts_.isComplete() && !parts_.isInvalid()) {
+        size_t payload;
+        int64_t offset;
+        size_t used = parts_.decode(bytes, length, payload, offset);
+        if (payload > 0) {
+            write_range_bytes(offset, bytes + used - payload, payload);
+        }
+        bytes += used;
+        length -= used;
+    }
+}
+
+static bool range_ends_before(const ByteRange& range, int64_t offset)
+{
+    return range.last < offset;
+}
+
+/*
+ * Write the bytes that belong at offset in the file, keeping only the parts of them that
+ * fall in the ranges asked for.  A server may have merged nearby ranges into one, so the
+ * bytes between them are dropped.  Each range is written in order from its start, which is
+ * what a retry of the rest of it relies on.
+ */
+void HTTPGet::write_range_bytes(int64_t offset, const char* bytes, size_t length)
+{
+    int64_t end = offset + static_cast<int64_t>(length); // one past the last byte
+    size_t i = std::lower_bound(ranges_.begin(), ranges_.end(), offset, range_ends_before) - ranges_.begin();
+    for (; i < ranges_.size() && ranges_[i].first < end; i++) {
+        int64_t next = ranges_[i].first + range_written_[i];
+        int64_t first = std::max(offset, next);
+        int64_t last = std::min(end - 1, ranges_[i].last);
+        if (first != next || last < first) {
+            // A gap before these bytes (the range is retried from where it stopped), or
+            // bytes that have already been written
+            continue;
+        }
+        if (direct_output_->write(first, bytes + (first - offset), last - first + 1)) {
+            range_written_[i] += last - first + 1;
+            bytes_written_ += last - first + 1;
+        }
+    }
+}
+
+/*
+ * Decide what to do after some of the body has been written.  trailing_data is true if
+ * the server sent more than the body.
+ */
+void HTTPGet::content_received(bool trailing_data)
+{
+    if (chunked_ && chunks_.isInvalid()) {
+        LogMessage() << "Error: invalid chunked encoding in the body";
+        fail();
+        return;
+    }
+    if (multipart_ && parts_.isInvalid()) {
+        LogMessage() << "Error: invalid multipart/byteranges body";
+        fail();
+        return;
+    }
+    bool body_complete = chunked_ ? chunks_.isComplete() : (content_length_ >= 0 && body_received_ >= content_length_);
+    if (multipart_ && !chunked_ && content_length_ < 0 && parts_.isComplete()) {
+        // Without a length the closing boundary is the end of the body
+        body_complete = true;
+    }
+    if (body_complete) {
+        if (body_md5_ && !content_md5_matches()) {
+            fail();
+            return;
+        }
+        // The whole body has arrived.  If the server sent anything after it then we
+        // have lost track of the stream and cannot use the connection again.
+        finish(keep_alive_ && !trailing_data);
+    } else if (range_complete()) {
+        // The range was shortened and the rest belongs to another request.  The unread
+        // part of the body is still on its way so the connection cannot be reused.
+        finish(false);
+    } else {
+        // Continue reading remaining data until the end of the body
+        read_content();
+    }
+}
+
+/*
+ * Check the body against the Content-MD5 header.  If it does not match then none of the
+ * bytes can be trusted, so they no longer count as written.
+ */
+bool HTTPGet::content_md5_matches()
+{
+    std::string expected;
+    if (!fromBase64(response_info_.content_md5.str(), expected)) {
+        // Nothing to check against
+        return true;
+    }
+    std::string actual = body_md5_->finish();
+    body_md5_.reset();
+    if (actual == expected) {
+        return true;
+    }
+    LogMessage() << "Error: bytes " << start_range_ << "-" << (start_range_ + body_received_ - 1) << " of " << path_ <<
+        " do not match the Content-MD5 header (expected " << toHex(expected) << ", received " << toHex(actual) << ")";
+    bytes_written_ = 0;
+    crc_ = CRC32C();
+    return false;
+}
+
+void HTTPGet::release_buffer()
+{
+    if (read_buffer_ && buffer_pool_ && (own_buffer_.empty() || read_buffer_ != &own_buffer_[0])) {
+        buffer_pool_->release(read_buffer_);
+    }
+    read_buffer_ = NULL;
+}
+
+void HTTPGet::fail(bool permanent)
+{
+    failed_permanently_ = permanent;
+    timings_.finished = std::chrono::steady_clock::now();
+    timings_.body_bytes = body_received_;
+    output_file_.close();
+    release_buffer();
+    close_pipe();
+    if (tls_first_) {
+        // Let the connections waiting for a session go ahead without one
+        tls_->abandonSession(server_, port_);
+        tls_first_ = false;
+    }
+    tls_stream_.reset();
+    if (socket_) {
+        boost::system::error_code ignored;
+        socket_->close(ignored);
+        socket_.reset();
+    }
+    if (completion_handler_) {
+        completion_handler_(this);
+    }
+}
+
+bool HTTPGet::range_complete()
+{
+    return direct_output_ && ranges_.empty() && end_range_ >= 0 && start_range_ + bytes_written_ > end_limit_;
+}
+
+bool HTTPGet::shrinkRange(int64_t end_range)
+{
+    if (!direct_output_ || end_range_ < 0 || !ranges_.empty()) {
+        return false;
+    }
+    // A write that is in progress has claimed its bytes (see claim), so the new end only
+    // has to be past those for nothing beyond it to be written
+    std::lock_guard<std::mutex> lock(limit_mutex_);
+    if (end_range >= end_limit_ || end_range < claimed_end_) {
+        return false;
+    }
+    end_limit_ = end_range;
+    return true;
+}
+
+/*
+ * Cut a write of the body at the end of the range, and claim the bytes it covers so that
+ * shrinkRange cannot move the end in front of them while they are being written.  Returns
+ * how many bytes to write, 0 once the range is done.  Direct mode with a single range only.
+ */
+int64_t HTTPGet::claim(int64_t length)
+{
+    std::lock_guard<std::mutex> lock(limit_mutex_);
+    int64_t position = start_range_ + bytes_written_;
+    length = std::max<int64_t>(0, std::min(length, end_limit_ + 1 - position));
+    claimed_end_ = position + length;
+    return length;
+}
+
+void HTTPGet::finish(bool reusable)
+{
+    timings_.finished = std::chrono::steady_clock::now();
+    timings_.body_bytes = body_received_;
+    succeeded_ = true;
+    output_file_.close();
+    release_buffer();
+    close_pipe();
+
+    if (reusable && pool_) {
+        // Let the next request to this server skip the connection setup
+        pool_->release(server_, port_, socket_, tls_stream_);
+    } else {
+        boost::system::error_code ignored;
+        socket_->close(ignored);
+    }
+    tls_stream_.reset();
+    socket_.reset();
+    
+    // This must be the last thing we do - the handler may arrange for us to be deleted
+    if (completion_handler_) {
+        completion_handler_(this);
+    }
+}
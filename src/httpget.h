@@ -3,18 +3,164 @@
 #define __multiget_http_get_include__
 
 #include <string>
-#include <fstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/function.hpp>
 using namespace boost::asio::ip;
 
+#include "outputfile.h"
+#include "checksum.h"
+#include "responseparser.h"
+#include "rangelist.h"
+
+class ConnectionPool;
+class EndpointCache;
+class BufferPool;
+class TLSContext;
+
+/*! \brief A header value copied into a fixed buffer, so that reading the headers of a
+ *         response does not allocate
+ *
+ *  A value that does not fit is left out, as if the server had not sent it, rather than
+ *  cut short (two ETags that differ after the first MAX_LENGTH bytes must not compare equal).
+ */
+class HeaderValue {
+public:
+    // Longest value kept
+    static const size_t MAX_LENGTH = 255;
+
+    HeaderValue() : length_(0) {}
+
+    /**
+     *   @brief  Replace the value
+     *
+     *   @param  value Bytes of the value, which need not be null terminated
+     *   @param  length Number of bytes
+     *
+     *   @return false if it is too long, in which case the value is left empty
+     */
+    bool assign(const char* value, size_t length);
+
+    /**
+     *   @brief  Add another value to the end, after a ", " if there is one already
+     *
+     *   @param  value Bytes of the value, which need not be null terminated
+     *   @param  length Number of bytes
+     *
+     *   @return false if it does not fit, in which case the value is unchanged
+     */
+    bool append(const char* value, size_t length);
+
+    void clear() { length_ = 0; }
+    bool empty() const { return length_ == 0; }
+    size_t size() const { return length_; }
+    const char* data() const { return value_; }
+
+    /**
+     *   @brief  Get a copy of the value
+     *
+     *   @return value
+     */
+    std::string str() const { return std::string(value_, length_); }
+
+    bool operator == (const std::string& other) const { return other.compare(0, std::string::npos, value_, length_) == 0; }
+    bool operator != (const std::string& other) const { return !(*this == other); }
+
+private:
+    char            value_[MAX_LENGTH];
+    size_t          length_;
+};
+
+/*! \brief The parts of an HTTP response header that multiget uses
+ */
+struct HTTPResponse {
+    HTTPResponse();
+    
+    unsigned int    status_code;
+    int64_t         content_length; // Content-Length, -1 if not sent
+    int64_t         range_start; // first byte in Content-Range, -1 if not sent
+    int64_t         range_end; // last byte in Content-Range, -1 if not sent
+    int64_t         instance_length; // complete size from Content-Range, -1 if not sent or unknown
+    bool            accept_ranges; // true if the server sent "Accept-Ranges: bytes"
+    HeaderValue     etag;
+    HeaderValue     last_modified;
+    HeaderValue     content_md5; // base64 MD5 of the body, empty if not sent
+    HeaderValue     digest; // Digest, Repr-Digest and x-goog-hash values (checksums of the whole file)
+};
+
+/*! \brief When each step of a request happened, and how much of the body it read
+ *
+ *  A step that did not happen is left at the default time_point.  A request on a reused
+ *  connection does not resolve or connect, and when an EndpointCache does the connecting
+ *  the lookup is part of the connect.
+ */
+struct RequestTimings {
+    RequestTimings();
+
+    std::chrono::steady_clock::time_point started; // start() was called
+    std::chrono::steady_clock::time_point resolved; // the host name was looked up
+    std::chrono::steady_clock::time_point connected; // the connection was made
+    std::chrono::steady_clock::time_point handshaken; // the TLS handshake finished (https:// only)
+    std::chrono::steady_clock::time_point request_sent; // the request was written
+    std::chrono::steady_clock::time_point first_byte; // the status line arrived
+    std::chrono::steady_clock::time_point headers_read; // the rest of the headers arrived
+    std::chrono::steady_clock::time_point finished; // the request succeeded or failed
+    int64_t         body_bytes; // body bytes received
+    int64_t         reads; // number of reads of the body from the socket
+    bool            reused_connection; // true if the connection came from a ConnectionPool
+    bool            resumed_session; // true if the TLS handshake resumed an earlier session
+};
+
 /*! \brief Get a file from the internet (the entire file or a range of bytes)
  *
  *  HTTPGet uses asynchronous IO to pull a file from a URL.  It will use a start
- *  and end range to determine which bytes to download.  If start and end are both
- *  set to 0 it will pull the entire file in a single request.
+ *  and end range to determine which bytes to download.  If end is negative it will
+ *  pull the entire file (from start onwards) in a single request.
+ *
+ *  Nothing is sent until start() is called.  Once the request has finished, successfully
+ *  or not, the completion handler (if any) is called from the thread running the io_service.
+ *
+ *  If a ConnectionPool is supplied the request is sent on an idle persistent connection
+ *  to the server when one is available.  The body is read up to Content-Length instead of
+ *  EOF, and the connection is handed back to the pool afterwards unless the server asked
+ *  for it to be closed.
+ *
+ *  If an EndpointCache is supplied the host is only resolved once for all of the requests,
+ *  and new connections are raced across the resolved addresses.
+ *
+ *  If a TLSContext is supplied the request is sent over TLS (https://).  A new connection
+ *  resumes the session of an earlier connection to the server when there is one, so only
+ *  the first connection pays for a full handshake.
+ *
+ *  If checksums are turned on, a CRC32C of the bytes written is kept as they arrive, and a
+ *  body that comes with a Content-MD5 header is checked against it.  A body that does not
+ *  match is treated as a failed request and none of its bytes count as written.
+ *
+ *  The response is read into a fixed-size buffer (taken from a BufferPool if one is
+ *  supplied).  The headers are parsed where they land (see ResponseParser) and the body
+ *  is written from there with positional writes, so there is no copy through a stream.
+ *  A chunked body is decoded in the buffer, so its end is found without waiting for the
+ *  server to close the connection.
+ *
+ *  On Linux the body can instead be moved from the socket to the output file by the kernel
+ *  (see setSplice), so it never enters user space at all.
+ *
+ *  In direct mode one request can ask for several ranges at once (see setRanges).  The
+ *  multipart/byteranges response is split into its parts as it arrives and each part is
+ *  written at its own offset, so scattered ranges cost one round trip instead of one each.
  */
 class HTTPGet {
 public:
+    // The status line and headers have to fit in the receive buffer, so a BufferPool with
+    // smaller buffers than this is not used
+    static const size_t MIN_READ_SIZE = 16 * 1024;
+
     /**
      *   @brief  Create a HTTPGet object.
      *
@@ -28,8 +174,44 @@ public:
      *
      *   @return HTTPGet object
      */
-    HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int start_range, int end_range,
+    HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range, int64_t end_range,
             const char* output_file_name);
+    /**
+     *   @brief  Create a HTTPGet object that writes directly into a shared output.
+     *
+     *   The body is written at its final position (start_range onwards) in output,
+     *   so no temporary file is created.  Any bytes the server sends beyond end_range
+     *   are discarded.
+     *
+     *   @param  io_service
+     *   @param  server dns name of server or IP address
+     *   @param  path path to file e.g. /pathtofile.extention
+     *   @param  port either \"http\" or port number
+     *   @param  start_range Used in HTTP Range header to indicate beginning byte
+     *   @param  end_range Used in HTTP Range header to indicate end byte
+     *   @param  output Preallocated file (or other sink) that receives the body at its offset
+     *
+     *   @return HTTPGet object
+     */
+    HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range, int64_t end_range,
+            Sink* output);
+    /**
+     *   @brief  Create a HTTPGet object that only wants the response headers.
+     *
+     *   This is used to find out about a file before downloading it.  A ranged (206)
+     *   body is read and thrown away so the connection can be reused, any other body is
+     *   not read at all.
+     *
+     *   @param  io_service
+     *   @param  server dns name of server or IP address
+     *   @param  path path to file e.g. /pathtofile.extention
+     *   @param  port either \"http\" or port number
+     *   @param  start_range Used in HTTP Range header to indicate beginning byte
+     *   @param  end_range Used in HTTP Range header to indicate end byte
+     *
+     *   @return HTTPGet object
+     */
+    HTTPGet(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port, int64_t start_range, int64_t end_range);
     virtual ~HTTPGet();
     
     /**
@@ -41,6 +223,220 @@ public:
      */
     std::string getOutputFilename() { return output_file_name_; }
     
+    typedef boost::function<void (HTTPGet*)> completion_handler;
+    
+    /**
+     *   @brief  Use persistent connections from a pool (must be called before start)
+     *
+     *   @param  pool Persistent connections to reuse, or NULL to use one connection per request
+     *
+     *   @return void
+     */
+    void setConnectionPool(ConnectionPool* pool) { pool_ = pool; }
+    
+    /**
+     *   @brief  Use shared DNS results and connection racing (must be called before start)
+     *
+     *   @param  endpoint_cache Resolved hosts shared with the other requests, or NULL to
+     *           resolve the host for this request alone
+     *
+     *   @return void
+     */
+    void setEndpointCache(EndpointCache* endpoint_cache) { endpoint_cache_ = endpoint_cache; }
+    
+    /**
+     *   @brief  Send the request over TLS (must be called before start)
+     *
+     *   @param  tls Certificates and saved sessions shared with the other requests, or NULL
+     *           for plain HTTP
+     *
+     *   @return void
+     */
+    void setTLSContext(TLSContext* tls) { tls_ = tls; }
+    
+    /**
+     *   @brief  Read the body into buffers from a shared pool (must be called before start)
+     *
+     *   @param  buffer_pool Receive buffers shared with the other requests, or NULL for this
+     *           request to allocate its own
+     *
+     *   @return void
+     */
+    void setBufferPool(BufferPool* buffer_pool) { buffer_pool_ = buffer_pool; }
+    
+    /**
+     *   @brief  Checksum the body as it arrives (must be called before start)
+     *
+     *   @param  checksum true to keep a CRC32C of the bytes written and check Content-MD5
+     *
+     *   @return void
+     */
+    void setChecksum(bool checksum) { checksum_ = checksum; }
+    
+    /**
+     *   @brief  Move the body from the socket into the output file with splice() (must be
+     *          called before start, Linux only)
+     *
+     *   Once the headers have been read, the rest of the body goes from the socket through
+     *   a pipe into the file at its offset without being copied into user space.  This is
+     *   only possible for a plain HTTP body that is not chunked, is not checksummed and goes
+     *   to a regular file.  Any other body is read into the receive buffer as usual.
+     *
+     *   @param  splice true to splice the body when possible
+     *
+     *   @return void
+     */
+    void setSplice(bool splice) { splice_ = splice; }
+    
+    /**
+     *   @brief  Ask for several ranges in one request (must be called before start, direct
+     *          mode only)
+     *
+     *   They replace the range given to the constructor.  A server may send the ranges as
+     *   the parts of a multipart/byteranges body, or merge them into fewer ranges, and
+     *   either way only the bytes that were asked for are written.  A server that ignores
+     *   the request and starts to send the whole file is cut off (see rangesRefused).
+     *
+     *   @param  ranges The ranges, sorted and not overlapping (see mergeRanges)
+     *
+     *   @return void
+     */
+    void setRanges(const RangeList& ranges);
+    
+    /**
+     *   @brief  Get the ranges asked for with setRanges
+     *
+     *   @return ranges, empty if the request is for a single range
+     */
+    const RangeList& getRanges() { return ranges_; }
+    
+    /**
+     *   @brief  Get the number of bytes written from the start of one of the ranges (see setRanges)
+     *
+     *   Only valid once the request has finished.
+     *
+     *   @param  index Which range
+     *
+     *   @return byte count
+     */
+    int64_t getRangeBytesWritten(size_t index) { return range_written_[index]; }
+    
+    /**
+     *   @brief  Find out whether the server answered a request for several ranges with the
+     *          whole file (see setRanges)
+     *
+     *   @return true if the ranges have to be asked for one at a time
+     */
+    bool rangesRefused() { return ranges_refused_; }
+    
+    /**
+     *   @brief  Get the CRC32C of the bytes written so far (see setChecksum)
+     *
+     *   Only valid once the request has finished.  It covers getBytesWritten() bytes from
+     *   the start of the range.
+     *
+     *   @return CRC32C
+     */
+    uint32_t getCRC32C() { return crc_.value(); }
+    
+    /**
+     *   @brief  Set the function to call when the request finishes (must be called before start)
+     *
+     *   The handler is the last thing to run on behalf of the request, so it may arrange
+     *   for the HTTPGet object to be deleted.  It must not delete it directly.
+     *
+     *   @param  handler Function to call with this object when the request finishes
+     *
+     *   @return void
+     */
+    void setCompletionHandler(const completion_handler& handler) { completion_handler_ = handler; }
+    
+    /**
+     *   @brief  Begin the asynchronous request
+     *
+     *   @return void
+     */
+    void start();
+    
+    /**
+     *   @brief  Find out whether the whole body was received
+     *
+     *   @return true if the request finished without an error
+     */
+    bool succeeded() { return succeeded_; }
+
+    /**
+     *   @brief  Find out whether the request failed in a way that asking again will not fix
+     *
+     *   @return true if the request should not be retried
+     */
+    bool failedPermanently() { return failed_permanently_; }
+    
+    /**
+     *   @brief  Stop the request early at a new end of range (direct mode only)
+     *
+     *   This is used to hand the rest of a slow request to another connection.  It may be
+     *   called from any thread while the request is running.  Once the body reaches the new
+     *   end the connection is closed and the request completes successfully.  No byte past
+     *   the new end is written by this request once it returns true, so the rest of the
+     *   range can be given to another request straight away.
+     *
+     *   @param  end_range New last byte to get.  It must not have been written yet, nor be
+     *           part of a write that is in progress.
+     *
+     *   @return true if the range was shortened, false if it is too late to do so
+     */
+    bool shrinkRange(int64_t end_range);
+    
+    /**
+     *   @brief  Get the first byte of the range
+     *
+     *   @return start of range
+     */
+    int64_t getStartRange() { return start_range_; }
+    
+    /**
+     *   @brief  Get the last byte of the range, after any call to shrinkRange
+     *
+     *   @return end of range (negative if the entire file was requested)
+     */
+    int64_t getEndRange() { return end_limit_; }
+    
+    /**
+     *   @brief  Get the number of body bytes written to the output file so far
+     *
+     *   May be called from any thread while the request is running.
+     *
+     *   @return byte count
+     */
+    int64_t getBytesWritten() { return bytes_written_; }
+    
+    /**
+     *   @brief  Get the time at which start() was called
+     *
+     *   @return start time
+     */
+    std::chrono::steady_clock::time_point getStartTime() { return start_time_; }
+    
+    /**
+     *   @brief  Get the status line and headers of the response
+     *
+     *   Only valid once the request has finished.
+     *
+     *   @return response headers
+     */
+    const HTTPResponse& getResponse() { return response_info_; }
+    
+    /**
+     *   @brief  Get the time taken by each step of the request
+     *
+     *   Only valid once the request has finished.  The times are taken on the thread
+     *   running the request, without any locking.
+     *
+     *   @return timings
+     */
+    const RequestTimings& getTimings() { return timings_; }
+    
 private:
     /**
      *   @brief  boost asio tcp async function
@@ -50,21 +446,95 @@ private:
      */
     void handle_resolve(const boost::system::error_code& err, tcp::resolver::iterator endpoint_iterator);
     void handle_connect(const boost::system::error_code& err);
+    void handle_race(const boost::system::error_code& err, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+    void handle_handshake(const boost::system::error_code& err);
     void handle_write_request(const boost::system::error_code& err);
-    void handle_read_status_line(const boost::system::error_code& err);
-    void handle_read_headers(const boost::system::error_code& err, size_t bytes);
-    void handle_read_content(const boost::system::error_code& err);
+    void handle_read_response(const boost::system::error_code& err, size_t bytes);
+    void handle_read_content(const boost::system::error_code& err, size_t bytes);
+    void handle_splice(const boost::system::error_code& err);
+    
+    void read_headers();
+    void connect();
+    void handshake(bool first);
+    void send_request();
+    bool reconnect_if_stale(const boost::system::error_code& err);
+    void acquire_buffer();
+    void read_response();
+    void read_content();
+    bool open_pipe();
+    void close_pipe();
+    void splice_content();
+    void resume_reading();
+    size_t receive_body(char* bytes, size_t length);
+    size_t write_content(const char* bytes, size_t length);
+    void write_ranges(const char* bytes, size_t length);
+    void write_range_bytes(int64_t offset, const char* bytes, size_t length);
+    void content_received(bool trailing_data);
+    void release_buffer();
+    bool content_md5_matches();
+    bool range_complete();
+    int64_t claim(int64_t length);
+    void fail(bool permanent = false);
+    void finish(bool reusable);
     
-    int                             start_range_; // first byte to get in Range
-    int                             end_range_; // last byte to get in Range
+    typedef std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+    typedef std::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> > tls_stream_ptr;
+    
+    int64_t                         start_range_; // first byte to get in Range
+    int64_t                         end_range_; // last byte to get in Range
+    std::atomic<int64_t>            end_limit_; // last byte to write, end_range_ unless shrinkRange was called
+    std::mutex                      limit_mutex_; // protects the two below, end_limit_ is only changed while holding it
+    int64_t                         claimed_end_; // first byte past the write in progress, never moved past end_limit_
+    std::string                     server_;
+    std::string                     path_;
+    std::string                     port_;
     // The following are needed for the boost::asio functions
+    boost::asio::io_service&        io_service_;
     boost::asio::ip::tcp::resolver  resolver_;
-    boost::asio::ip::tcp::socket    socket_;
-    boost::asio::streambuf          request_;
-    boost::asio::streambuf          response_;
+    socket_ptr                      socket_;
+    tls_stream_ptr                  tls_stream_; // TLS over socket_, empty for plain HTTP
+    std::string                     request_;
+    ResponseParser                  parser_; // parses the status line and headers in read_buffer_
+    size_t                          response_bytes_; // bytes of the response in read_buffer_ while the headers are read
+    bool                            chunked_; // the body has Transfer-Encoding: chunked
+    ChunkedDecoder                  chunks_; // takes the framing out of a chunked body
+    
+    ConnectionPool*                 pool_; // Persistent connections, or NULL for one connection per request
+    EndpointCache*                  endpoint_cache_; // Shared DNS results, or NULL to use resolver_
+    BufferPool*                     buffer_pool_; // Shared receive buffers, or NULL to use own_buffer_
+    TLSContext*                     tls_; // Shared TLS settings and sessions, or NULL for plain HTTP
+    bool                            tls_first_; // this connection is getting the session for the others
+    char*                           read_buffer_; // The response is read into this, NULL until the request is sent
+    size_t                          read_size_; // Size of read_buffer_
+    std::vector<char>               own_buffer_; // read_buffer_ when there is no buffer_pool_
+    bool                            reused_connection_; // true if socket_ came from pool_
+    bool                            keep_alive_; // false once the server says it will close the connection
+    HTTPResponse                    response_info_; // status and headers of the response
+    int64_t                         content_length_; // Length of the body, -1 if not known
+    int64_t                         body_received_; // Number of body bytes read so far
+    bool                            succeeded_; // true once the whole body has been received
+    bool                            failed_permanently_; // retrying will get the same error
+    completion_handler              completion_handler_;
     
     std::string                     output_file_name_; // Keep track of what file we used
-    std::ofstream                   output_file_; // A stream to the above file
+    OutputFile                      output_file_; // The above file, opened by the constructor
+    Sink*                           direct_output_; // Shared output, or NULL when using output_file_
+    bool                            discard_body_; // true if only the response headers are wanted
+    std::atomic<int64_t>            bytes_written_; // Number of body bytes written so far
+    bool                            checksum_; // true to checksum the body
+    RangeList                       ranges_; // ranges asked for in one request, empty for start_range_-end_range_
+    std::vector<int64_t>            range_written_; // bytes written from the start of each of ranges_
+    bool                            ranges_refused_; // the server sent the whole file instead of ranges_
+    bool                            multipart_; // the body is multipart/byteranges
+    MultipartDecoder                parts_; // splits a multipart/byteranges body into its ranges
+    bool                            splice_; // true to splice the body into the output file when possible
+    int                             pipe_[2]; // read and write ends of the pipe while the body is spliced, -1 otherwise
+    size_t                          pipe_size_; // capacity of the pipe
+    int                             splice_fd_; // output file the body is spliced into
+    CRC32C                          crc_; // checksum of the bytes written
+    std::shared_ptr<MessageDigest>  body_md5_; // MD5 of the body, if the server sent Content-MD5
+    std::chrono::steady_clock::time_point start_time_;
+    RequestTimings                  timings_; // when each step happened
     
     // Ensure that these method are not created explicitly
     HTTPGet(); // not implemented
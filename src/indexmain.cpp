@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include "blockindex.h"
+#include "log.h"
+
+/*
+ * Print a message from the library
+ */
+static void print_message(const std::string& message)
+{
+    std::cout << message << std::endl;
+}
+
+/*
+ * Write the block index of a file, to publish next to it so that multiget can update an
+ * old copy by downloading only the blocks that changed:
+ *
+ *   ./multiget-index -o big.iso.idx big.iso
+ *   ./multiget --delta http://server/big.iso.idx -o big.iso http://server/big.iso
+ */
+int main(int argc, char* argv[])
+{
+    std::string filename;
+    std::string index_file_name;
+    int block_size = BlockIndex::DEFAULT_BLOCK_SIZE;
+    po::options_description desc("Usage: ./multiget-index [OPTIONS] file");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("outputfile,o", po::value<std::string>(&index_file_name), "Where to write the index (default is the file name with .idx added)")
+        ("block-size,b", po::value<int>(&block_size),
+         "Bytes in each block, smaller blocks find more of an old copy but make a bigger index (default is 16384)");
+    po::options_description hidden_option;
+    hidden_option.add_options() ("file", po::value<std::string>(&filename), "File to index");
+    po::options_description all_options;
+    all_options.add(desc).add(hidden_option);
+    po::positional_options_description positional_options;
+    positional_options.add("file", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(all_options).positional(positional_options).run(), vm);
+        po::notify(vm);
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    if (filename.empty() || block_size <= 0) {
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (index_file_name.empty()) {
+        index_file_name = filename + ".idx";
+    }
+
+    LogScope log(print_message);
+    BlockIndex index;
+    if (!index.create(filename, block_size) || !index.write(index_file_name)) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "Wrote the index of " << filename << " (" << index.getFileSize() << " bytes in " << index.getBlockCount() <<
+        " blocks) to " << index_file_name << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include "ioservicepool.h"
+#include "connectionpool.h"
+#include "log.h"
+
+#include <thread>
+
+IOServicePool::IOServicePool(size_t count)
+{
+    if (count == 0) {
+        count = std::thread::hardware_concurrency();
+        if (count == 0) {
+            // The number of cores is not known
+            count = 1;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        io_services_.push_back(std::shared_ptr<boost::asio::io_service>(new boost::asio::io_service()));
+        connection_pools_.push_back(std::shared_ptr<ConnectionPool>(new ConnectionPool()));
+    }
+}
+
+IOServicePool::~IOServicePool()
+{
+    // Close the idle connections before the io_services that own them go away
+    connection_pools_.clear();
+}
+
+void IOServicePool::run()
+{
+    if (io_services_.size() == 1) {
+        io_services_[0]->run();
+        return;
+    }
+    // The threads send their messages wherever the calling thread's go
+    log_handler handler = LogScope::current() ? *LogScope::current() : log_handler();
+    std::vector<std::thread> threads;
+    for (std::shared_ptr<boost::asio::io_service>& io_service: io_services_) {
+        threads.push_back(std::thread([io_service, handler]() {
+            LogScope scope(handler);
+            io_service->run();
+        }));
+    }
+    for (std::thread& t: threads) {
+        t.join();
+    }
+}
+
+void IOServicePool::stop()
+{
+    for (std::shared_ptr<boost::asio::io_service>& io_service: io_services_) {
+        io_service->stop();
+    }
+}
+
+void IOServicePool::run(boost::asio::io_service& io_service, int thread_count)
+{
+    if (thread_count <= 1) {
+        // Just run on the calling thread
+        io_service.run();
+        return;
+    }
+    // All of the threads run the one and only io_service.  Create all the threads and wait
+    // for them to finish.
+    LogMessage() << "Creating " << thread_count << " threads to perform the download";
+    log_handler handler = LogScope::current() ? *LogScope::current() : log_handler();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++) {
+        threads.push_back(std::thread([&io_service, handler]() {
+            LogScope scope(handler);
+            io_service.run();
+        }));
+    }
+    for (std::thread& t: threads) {
+        t.join();
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef __multiget_io_service_pool_include__
+#define __multiget_io_service_pool_include__
+
+#include <vector>
+#include <memory>
+#include <boost/asio.hpp>
+
+class ConnectionPool;
+
+/*! \brief A set of io_services, each one run by its own thread
+ *
+ *  Running one io_service on several threads funnels every completion through a single
+ *  reactor queue and its lock.  Instead each thread gets an io_service of its own, and a
+ *  request (its socket, its handlers and its file writes) stays on the io_service it was
+ *  created on.  Nothing is shared between the threads in the reactor, so adding threads
+ *  adds throughput rather than contention.
+ *
+ *  Sockets belong to the io_service that created them, so each io_service has its own
+ *  pool of persistent connections.
+ */
+class IOServicePool {
+public:
+    /**
+     *   @brief  Create the io_services
+     *
+     *   @param  count Number of io_services (and threads), 0 for one per core
+     *
+     *   @return IOServicePool object
+     */
+    explicit IOServicePool(size_t count);
+    virtual ~IOServicePool();
+
+    /**
+     *   @brief  Get the number of io_services
+     *
+     *   @return io_service count
+     */
+    size_t size() { return io_services_.size(); }
+
+    /**
+     *   @brief  Get one of the io_services
+     *
+     *   @param  index Which io_service, from 0 to size() - 1
+     *
+     *   @return io_service
+     */
+    boost::asio::io_service& getIOService(size_t index) { return *io_services_[index]; }
+
+    /**
+     *   @brief  Get the persistent connections that belong to one of the io_services
+     *
+     *   @param  index Which io_service, from 0 to size() - 1
+     *
+     *   @return connection pool
+     */
+    ConnectionPool& getConnectionPool(size_t index) { return *connection_pools_[index]; }
+
+    /**
+     *   @brief  Run every io_service on a thread of its own
+     *
+     *   Returns once all of the io_services have run out of work.
+     *
+     *   @return void
+     */
+    void run();
+
+    /**
+     *   @brief  Stop every io_service as soon as possible, leaving any handlers unrun
+     *
+     *   May be called from any thread.
+     *
+     *   @return void
+     */
+    void stop();
+
+    /**
+     *   @brief  Run one io_service on several threads at once
+     *
+     *   Returns once the io_service has run out of work.
+     *
+     *   @param  io_service The io_service
+     *   @param  thread_count Number of threads, one (the calling thread) if less than 1
+     *
+     *   @return void
+     */
+    static void run(boost::asio::io_service& io_service, int thread_count);
+
+private:
+    std::vector<std::shared_ptr<boost::asio::io_service> >  io_services_;
+    std::vector<std::shared_ptr<ConnectionPool> >           connection_pools_; // one per io_service
+
+    // Ensure that these method are not created explicitly
+    IOServicePool(const IOServicePool& in); // not implemented
+    IOServicePool& operator = (const IOServicePool &t); // not implemented
+};
+
+#endif // __multiget_io_service_pool_include__
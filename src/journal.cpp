@@ -0,0 +1,212 @@
+#include "journal.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// First line of every journal file, changed if the format ever changes
+static const char JOURNAL_MAGIC[] = "multiget-journal 1";
+
+Journal::Journal(const std::string& filename)
+: filename_(filename)
+, size_(-1)
+{
+}
+
+/*
+ * The file is a header followed by one line per range:
+ *
+ *   multiget-journal 1
+ *   url http://server/path
+ *   size 1234567
+ *   etag "abc"
+ *   last-modified Tue, 15 Nov 1994 12:45:26 GMT
+ *   range 0 1048576
+ *   range 2097152 3145728
+ *
+ * Each range is the first byte and one past the last byte.
+ */
+bool Journal::load()
+{
+    std::ifstream input(filename_);
+    std::string line;
+    if (!std::getline(input, line) || line != JOURNAL_MAGIC) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    url_.clear();
+    size_ = -1;
+    etag_.clear();
+    last_modified_.clear();
+    extents_.clear();
+    while (std::getline(input, line)) {
+        std::string::size_type space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+        if (key == "url") {
+            url_ = value;
+        } else if (key == "size") {
+            size_ = strtoll(value.c_str(), NULL, 10);
+        } else if (key == "etag") {
+            etag_ = value;
+        } else if (key == "last-modified") {
+            last_modified_ = value;
+        } else if (key == "range") {
+            long long start, end;
+            if (sscanf(value.c_str(), "%lld %lld", &start, &end) != 2 || start < 0 || end < start) {
+                return false;
+            }
+            add_extent(extents_, start, end - start);
+        }
+    }
+    return size_ > 0;
+}
+
+void Journal::reset(const std::string& url, int64_t size, const std::string& etag, const std::string& last_modified)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    url_ = url;
+    size_ = size;
+    etag_ = etag;
+    last_modified_ = last_modified;
+    extents_.clear();
+}
+
+bool Journal::matches(int64_t size, const std::string& etag, const std::string& last_modified)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size != size_ || (etag.empty() && last_modified.empty())) {
+        return false;
+    }
+    return etag == etag_ && last_modified == last_modified_;
+}
+
+void Journal::add(int64_t start, int64_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    add_extent(extents_, start, length);
+}
+
+Journal::Extents Journal::getExtents()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return extents_;
+}
+
+int64_t Journal::getBytesDone()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t done = 0;
+    for (Extents::const_iterator it = extents_.begin(); it != extents_.end(); ++it) {
+        done += it->second - it->first;
+    }
+    return done;
+}
+
+bool Journal::save(const std::vector<std::pair<int64_t, int64_t> >& in_progress)
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex_);
+    std::ostringstream contents;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Extents extents(extents_);
+        for (const std::pair<int64_t, int64_t>& range: in_progress) {
+            add_extent(extents, range.first, range.second);
+        }
+        contents << JOURNAL_MAGIC << "\n";
+        contents << "url " << url_ << "\n";
+        contents << "size " << size_ << "\n";
+        contents << "etag " << etag_ << "\n";
+        contents << "last-modified " << last_modified_ << "\n";
+        for (Extents::const_iterator it = extents.begin(); it != extents.end(); ++it) {
+            contents << "range " << it->first << " " << it->second << "\n";
+        }
+    }
+
+    // Replace the journal in one step so there is always a complete one on disk
+    std::string temporary_name = filename_ + ".tmp";
+    int fd = ::open(temporary_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        LogMessage() << "Unable to write " << temporary_name << ": " << strerror(errno);
+        return false;
+    }
+    std::string data = contents.str();
+    const char* bytes = data.c_str();
+    size_t length = data.size();
+    while (length > 0) {
+        ssize_t written = ::write(fd, bytes, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogMessage() << "Unable to write " << temporary_name << ": " << strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    bool synced = (fsync(fd) == 0);
+    ::close(fd);
+    if (!synced || rename(temporary_name.c_str(), filename_.c_str()) == -1) {
+        LogMessage() << "Unable to save " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+
+    // The rename is only certain to survive a crash once the directory holding the
+    // journal has been synced too
+    std::string::size_type slash = filename_.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : filename_.substr(0, slash));
+    int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1) {
+        LogMessage() << "Unable to save " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+    synced = (fsync(dir_fd) == 0);
+    int saved_errno = errno;
+    ::close(dir_fd);
+    if (!synced) {
+        LogMessage() << "Unable to save " << filename_ << ": " << strerror(saved_errno);
+        return false;
+    }
+    return true;
+}
+
+void Journal::remove()
+{
+    unlink(filename_.c_str());
+}
+
+/*
+ * Add a range to a set of extents, merging it with any ranges it overlaps or touches
+ */
+void Journal::add_extent(Extents& extents, int64_t start, int64_t length)
+{
+    if (length <= 0) {
+        return;
+    }
+    int64_t end = start + length;
+    Extents::iterator it = extents.upper_bound(start);
+    if (it != extents.begin()) {
+        Extents::iterator previous = it;
+        --previous;
+        if (previous->second >= start) {
+            start = previous->first;
+            end = std::max(end, previous->second);
+            it = extents.erase(previous);
+        }
+    }
+    while (it != extents.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = extents.erase(it);
+    }
+    extents[start] = end;
+}
@@ -0,0 +1,135 @@
+#ifndef __multiget_journal_include__
+#define __multiget_journal_include__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+/*! \brief Record of which parts of the output file have been downloaded
+ *
+ *  The journal is a small text file kept next to the output file.  It names the remote
+ *  file (URL, size, ETag and Last-Modified) and lists the byte ranges that are safely on
+ *  disk.  If the download is interrupted, the next run can check that the remote file has
+ *  not changed and then fetch only the ranges that are not in the journal.
+ *
+ *  The journal is replaced atomically (written to a temporary file, synced and renamed) so
+ *  a crash while it is being saved leaves the previous version.  It is up to the caller to
+ *  make sure the bytes in a range have reached the disk before the range is saved.
+ *
+ *  The journal is thread safe.
+ */
+class Journal {
+public:
+    typedef std::map<int64_t, int64_t> Extents; // first byte -> one past the last byte
+
+    /**
+     *   @brief  Create an empty journal
+     *
+     *   @param  filename Name of the journal file
+     *
+     *   @return Journal object
+     */
+    explicit Journal(const std::string& filename);
+    virtual ~Journal() {}
+
+    /**
+     *   @brief  Read the journal file
+     *
+     *   @return false if there is no journal file or it cannot be understood
+     */
+    bool load();
+
+    /**
+     *   @brief  Start a new journal for a remote file, forgetting any ranges
+     *
+     *   @param  url Where the file comes from
+     *   @param  size Size of the file in bytes
+     *   @param  etag ETag of the file, or an empty string
+     *   @param  last_modified Last-Modified time of the file, or an empty string
+     *
+     *   @return void
+     */
+    void reset(const std::string& url, int64_t size, const std::string& etag, const std::string& last_modified);
+
+    /**
+     *   @brief  Find out whether the journal is for this version of the remote file
+     *
+     *   At least one of the ETag and Last-Modified has to be known and the same, otherwise
+     *   there is no way to tell that the file has not changed.
+     *
+     *   @param  size Size of the file in bytes
+     *   @param  etag ETag of the file, or an empty string
+     *   @param  last_modified Last-Modified time of the file, or an empty string
+     *
+     *   @return true if the ranges in the journal can be trusted
+     */
+    bool matches(int64_t size, const std::string& etag, const std::string& last_modified);
+
+    /**
+     *   @brief  Record that some bytes have been written to the output file
+     *
+     *   @param  start First byte
+     *   @param  length Number of bytes
+     *
+     *   @return void
+     */
+    void add(int64_t start, int64_t length);
+
+    /**
+     *   @brief  Get the ranges that have been downloaded
+     *
+     *   @return ranges in file order, adjacent ranges are merged
+     */
+    Extents getExtents();
+
+    /**
+     *   @brief  Get the number of bytes that have been downloaded
+     *
+     *   @return byte count
+     */
+    int64_t getBytesDone();
+
+    /**
+     *   @brief  Write the journal file
+     *
+     *   @param  in_progress Ranges that are on disk but not added yet (first byte, length),
+     *           e.g. the part of each running request that has been synced
+     *
+     *   @return false if the file could not be written
+     */
+    bool save(const std::vector<std::pair<int64_t, int64_t> >& in_progress = std::vector<std::pair<int64_t, int64_t> >());
+
+    /**
+     *   @brief  Delete the journal file, once the download is complete
+     *
+     *   @return void
+     */
+    void remove();
+
+    /**
+     *   @brief  Get the name of the journal file
+     *
+     *   @return filename
+     */
+    const std::string& getFilename() { return filename_; }
+
+private:
+    static void add_extent(Extents& extents, int64_t start, int64_t length);
+
+    std::string     filename_;
+    std::mutex      save_mutex_; // only one save at a time
+    std::mutex      mutex_; // protects everything below
+    std::string     url_;
+    int64_t         size_;
+    std::string     etag_;
+    std::string     last_modified_;
+    Extents         extents_;
+
+    // Ensure that these method are not created explicitly
+    Journal(const Journal& in); // not implemented
+    Journal& operator = (const Journal &t); // not implemented
+};
+
+#endif // __multiget_journal_include__
@@ -0,0 +1,39 @@
+#include "log.h"
+
+// The handler of each thread, NULL until a LogScope is installed on it
+static thread_local const log_handler* current_handler = NULL;
+
+LogScope::LogScope(const log_handler& handler)
+: handler_(handler)
+, previous_(current_handler)
+{
+    if (handler_) {
+        current_handler = &handler_;
+    }
+}
+
+LogScope::~LogScope()
+{
+    current_handler = previous_;
+}
+
+const log_handler* LogScope::current()
+{
+    return current_handler;
+}
+
+LogMessage::~LogMessage()
+{
+    if (!current_handler) {
+        return;
+    }
+    std::string message = stream_.str();
+    if (!message.empty() && message[message.size() - 1] == '\n') {
+        message.erase(message.size() - 1);
+    }
+    try {
+        (*current_handler)(message);
+    } catch (...) {
+        // A destructor must not throw, and a message is not worth failing the download for
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef __multiget_log_include__
+#define __multiget_log_include__
+
+#include <string>
+#include <sstream>
+#include <boost/function.hpp>
+
+// Called with each message the library has for the user, one line without the newline
+typedef boost::function<void (const std::string& message)> log_handler;
+
+/*! \brief Where the messages of the library go while it runs on the calling thread
+ *
+ *  The library prints nothing itself.  A LogScope sends the messages written on its
+ *  thread to a handler until it goes out of scope, when the handler it replaced (if any)
+ *  is put back.  Without one the messages are dropped.  Download installs the handler
+ *  it was given for the length of the download, and the worker threads the library
+ *  creates start with the handler of the thread that created them.
+ *
+ *  The handler may be called from several threads at once.
+ */
+class LogScope {
+public:
+    /**
+     *   @brief  Send the messages written on this thread to a handler
+     *
+     *   @param  handler Function to call with each message, empty to leave them going
+     *           wherever they go now
+     *
+     *   @return LogScope object
+     */
+    explicit LogScope(const log_handler& handler);
+    virtual ~LogScope();
+
+    /**
+     *   @brief  Get the handler messages on this thread go to
+     *
+     *   @return the handler, or NULL if the messages are dropped
+     */
+    static const log_handler* current();
+
+private:
+    log_handler         handler_;
+    const log_handler*  previous_; // put back when this goes out of scope
+
+    // Ensure that these method are not created explicitly
+    LogScope(const LogScope& in); // not implemented
+    LogScope& operator = (const LogScope &t); // not implemented
+};
+
+/*! \brief One message for the user, built up with << and handed to the current
+ *         handler (see LogScope) when it goes out of scope, e.g.
+ *
+ *      LogMessage() << "Retrying in " << delay << "ms";
+ */
+class LogMessage {
+public:
+    LogMessage() {}
+    virtual ~LogMessage();
+
+    template<typename T>
+    LogMessage& operator << (const T& value)
+    {
+        stream_ << value;
+        return *this;
+    }
+
+private:
+    std::ostringstream  stream_;
+
+    // Ensure that these method are not created explicitly
+    LogMessage(const LogMessage& in); // not implemented
+    LogMessage& operator = (const LogMessage &t); // not implemented
+};
+
+#endif // __multiget_log_include__
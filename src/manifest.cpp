@@ -0,0 +1,59 @@
+#include "manifest.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+bool readManifest(const std::string& filename, std::vector<ManifestEntry>& entries)
+{
+    std::ifstream file;
+    if (filename != "-") {
+        file.open(filename.c_str());
+        if (!file) {
+            LogMessage() << "Unable to read the manifest " << filename;
+            return false;
+        }
+    }
+    std::istream& input = (filename == "-") ? std::cin : file;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(input, line)) {
+        line_number++;
+        std::istringstream fields(line);
+        std::string url;
+        if (!(fields >> url) || url[0] == '#') {
+            continue;
+        }
+        ManifestEntry entry;
+        if (!(fields >> entry.output_file_name)) {
+            LogMessage() << "Line " << line_number << " of " << filename << " has no output file";
+            return false;
+        }
+        if (!entry.url.parse(url)) {
+            return false;
+        }
+        std::string field;
+        while (fields >> field) {
+            if (field.find(':') != std::string::npos) {
+                if (!parseChecksum(field, entry.checksums)) {
+                    LogMessage() << "Line " << line_number << " of " << filename <<
+                        ": checksums must be crc32c:hex, md5:hex or sha256:hex";
+                    return false;
+                }
+            } else {
+                char* end;
+                entry.size = strtoll(field.c_str(), &end, 10);
+                if (*end != '\0' || entry.size < 0) {
+                    LogMessage() << "Line " << line_number << " of " << filename << ": \"" << field <<
+                        "\" is not a size or a checksum";
+                    return false;
+                }
+            }
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __multiget_manifest_include__
+#define __multiget_manifest_include__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "url.h"
+#include "checksum.h"
+
+/*! \brief One file to download in batch mode
+ */
+struct ManifestEntry {
+    ManifestEntry() : size(-1) {}
+
+    URL             url;
+    std::string     output_file_name;
+    int64_t         size; // size of the file in bytes, -1 if the server has to be asked
+    Checksums       checksums; // expected checksums of the file, may be empty
+};
+
+/**
+ *   @brief  Read a list of files to download
+ *
+ *   There is one file per line: the URL, the output file and then optionally the size in
+ *   bytes and any number of checksums as algorithm:hex, separated by spaces or tabs.
+ *   Blank lines and lines starting with '#' are skipped.  For example:
+ *
+ *     http://example.com/data/a.bin  a.bin  1048576  sha256:9f86d081884c7d65...
+ *     http://example.com/data/b.bin  out/b.bin
+ *
+ *   @param  filename Name of the manifest, or "-" to read standard input
+ *   @param  entries Receives the files in the order they are listed
+ *
+ *   @return false if the manifest cannot be read or a line is not valid (the reason is printed)
+ */
+bool readManifest(const std::string& filename, std::vector<ManifestEntry>& entries);
+
+#endif // __multiget_manifest_include__
@@ -0,0 +1,45 @@
+#include "memorysink.h"
+#include "log.h"
+
+#include <string.h>
+
+#include <new>
+#include <algorithm>
+
+MemorySink::MemorySink()
+{
+}
+
+bool MemorySink::write(int64_t offset, const char* data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (static_cast<uint64_t>(offset) + length > data_.size()) {
+        // The size is not known, or a server sent more than it said
+        data_.resize(offset + length);
+    }
+    memcpy(&data_[offset], data, length);
+    return true;
+}
+
+bool MemorySink::setSize(int64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    try {
+        data_.resize(size);
+    } catch (const std::bad_alloc&) {
+        LogMessage() << "Unable to allocate " << size << " bytes for the download";
+        return false;
+    }
+    return true;
+}
+
+size_t MemorySink::read(int64_t offset, char* data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (static_cast<uint64_t>(offset) >= data_.size()) {
+        return 0;
+    }
+    length = std::min<uint64_t>(length, data_.size() - offset);
+    memcpy(data, &data_[offset], length);
+    return length;
+}
@@ -0,0 +1,66 @@
+#ifndef __multiget_memory_sink_include__
+#define __multiget_memory_sink_include__
+
+#include <vector>
+#include <mutex>
+
+#include "sink.h"
+
+/*! \brief Download into a buffer in memory
+ *
+ *  The buffer is sized once the size of the file is known, and grows as the bytes arrive
+ *  if it is not.  A gap that has not arrived yet reads as zeros.
+ *
+ *  Writes may be made from several threads at once.
+ */
+class MemorySink : public Sink {
+public:
+    MemorySink();
+    virtual ~MemorySink() {}
+
+    /**
+     *   @brief  Copy a block of data into the buffer at the specified offset
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Bytes to write
+     *   @param  length Number of bytes to write
+     *
+     *   @return true
+     */
+    virtual bool write(int64_t offset, const char* data, size_t length);
+
+    /**
+     *   @brief  Size the buffer for the whole file
+     *
+     *   @param  size Final size of the file in bytes
+     *
+     *   @return false if there is not enough memory
+     */
+    virtual bool setSize(int64_t size);
+
+    /**
+     *   @brief  Copy bytes out of the buffer
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Receives the bytes
+     *   @param  length Number of bytes to read
+     *
+     *   @return Number of bytes read, 0 at the end of the buffer
+     */
+    virtual size_t read(int64_t offset, char* data, size_t length);
+
+    /**
+     *   @brief  Get the downloaded bytes (once the download has finished)
+     *
+     *   The vector may be swapped out to take the bytes without a copy.
+     *
+     *   @return The buffer
+     */
+    std::vector<char>& getData() { return data_; }
+
+private:
+    std::mutex          mutex_; // protects data_ while the download runs
+    std::vector<char>   data_;
+};
+
+#endif // __multiget_memory_sink_include__
@@ -0,0 +1,186 @@
+#include "metrics.h"
+#include "log.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+// The steps of a request as columns of the report, each one from the end of the step before
+static const char* const PHASE_NAMES[] = { "dns_ms", "connect_ms", "tls_ms", "send_ms", "ttfb_ms", "headers_ms", "transfer_ms", "total_ms" };
+static const size_t PHASE_COUNT = sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]);
+
+Metrics::Metrics()
+: created_(std::chrono::steady_clock::now())
+{
+}
+
+double Metrics::since_created(const std::chrono::steady_clock::time_point& time)
+{
+    if (time == std::chrono::steady_clock::time_point()) {
+        return -1;
+    }
+    return std::chrono::duration<double>(time - created_).count();
+}
+
+void Metrics::add(HTTPGet& request, const std::string& url)
+{
+    const RequestTimings& timings = request.getTimings();
+    Record record;
+    record.url = url;
+    record.start = request.getStartRange();
+    record.end = request.getEndRange();
+    record.status = request.getResponse().status_code;
+    record.succeeded = request.succeeded();
+    record.reused_connection = timings.reused_connection;
+    record.resumed_session = timings.resumed_session;
+    record.bytes_written = request.getBytesWritten();
+    record.body_bytes = timings.body_bytes;
+    record.reads = timings.reads;
+    record.started = since_created(timings.started);
+    record.resolved = since_created(timings.resolved);
+    record.connected = since_created(timings.connected);
+    record.handshaken = since_created(timings.handshaken);
+    record.request_sent = since_created(timings.request_sent);
+    record.first_byte = since_created(timings.first_byte);
+    record.headers_read = since_created(timings.headers_read);
+    record.finished = since_created(timings.finished);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.push_back(record);
+}
+
+/*
+ * Work out how long each step took in milliseconds, or -1 if it did not happen.  A step
+ * that was skipped (e.g. the lookup and connect on a reused connection) is measured from
+ * the last step that did happen.
+ */
+static void get_phases(double started, double resolved, double connected, double handshaken, double request_sent,
+                       double first_byte, double headers_read, double finished, double* phases)
+{
+    double times[] = { resolved, connected, handshaken, request_sent, first_byte, headers_read, finished };
+    double previous = started;
+    for (size_t i = 0; i < PHASE_COUNT - 1; i++) {
+        if (times[i] < 0 || previous < 0) {
+            phases[i] = -1;
+        } else {
+            phases[i] = (times[i] - previous) * 1000.0;
+            previous = times[i];
+        }
+    }
+    phases[PHASE_COUNT - 1] = (finished >= 0 && started >= 0) ? (finished - started) * 1000.0 : -1;
+}
+
+static std::string json_string(const std::string& value)
+{
+    std::string quoted("\"");
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool Metrics::write(const std::string& filename, int64_t total_bytes)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - created_).count();
+    std::ofstream out(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+    if (!out) {
+        LogMessage() << "Unable to write the metrics to " << filename;
+        return false;
+    }
+    out << std::fixed << std::setprecision(3);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0) {
+        write_csv(out);
+    } else {
+        write_json(out, total_bytes, seconds);
+    }
+    return static_cast<bool>(out);
+}
+
+/*
+ * A summary of the download and an object for each request.  Must be called with mutex_ held.
+ */
+void Metrics::write_json(std::ostream& out, int64_t total_bytes, double seconds)
+{
+    int failed = 0;
+    int reused = 0;
+    int handshakes = 0;
+    int resumed = 0;
+    int64_t bytes = 0;
+    int64_t reads = 0;
+    for (const Record& record: records_) {
+        failed += record.succeeded ? 0 : 1;
+        reused += record.reused_connection ? 1 : 0;
+        handshakes += record.handshaken >= 0 ? 1 : 0;
+        resumed += record.resumed_session ? 1 : 0;
+        bytes += record.bytes_written;
+        reads += record.reads;
+    }
+    out << "{\n";
+    out << "  \"total_bytes\": " << total_bytes << ",\n";
+    out << "  \"bytes_written\": " << bytes << ",\n";
+    out << "  \"seconds\": " << seconds << ",\n";
+    out << "  \"bytes_per_second\": " << (seconds > 0 ? bytes / seconds : 0.0) << ",\n";
+    out << "  \"request_count\": " << records_.size() << ",\n";
+    out << "  \"failed_count\": " << failed << ",\n";
+    out << "  \"reused_connection_count\": " << reused << ",\n";
+    out << "  \"tls_handshake_count\": " << handshakes << ",\n";
+    out << "  \"resumed_session_count\": " << resumed << ",\n";
+    out << "  \"read_count\": " << reads << ",\n";
+    out << "  \"requests\": [";
+    for (size_t i = 0; i < records_.size(); i++) {
+        const Record& record = records_[i];
+        double phases[PHASE_COUNT];
+        get_phases(record.started, record.resolved, record.connected, record.handshaken, record.request_sent,
+                   record.first_byte, record.headers_read, record.finished, phases);
+        out << (i > 0 ? ",\n" : "\n");
+        out << "    {\"url\": " << json_string(record.url) << ", \"start\": " << record.start << ", \"end\": " << record.end <<
+            ", \"status\": " << record.status << ", \"succeeded\": " << (record.succeeded ? "true" : "false") <<
+            ", \"reused_connection\": " << (record.reused_connection ? "true" : "false") <<
+            ", \"resumed_session\": " << (record.resumed_session ? "true" : "false") <<
+            ", \"bytes_written\": " << record.bytes_written << ", \"body_bytes\": " << record.body_bytes <<
+            ", \"reads\": " << record.reads << ", \"started_ms\": " << record.started * 1000.0;
+        for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+            out << ", \"" << PHASE_NAMES[phase] << "\": ";
+            if (phases[phase] < 0) {
+                out << "null";
+            } else {
+                out << phases[phase];
+            }
+        }
+        out << "}";
+    }
+    out << (records_.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+}
+
+/*
+ * One line for each request.  Must be called with mutex_ held.
+ */
+void Metrics::write_csv(std::ostream& out)
+{
+    out << "url,start,end,status,succeeded,reused_connection,resumed_session,bytes_written,body_bytes,reads,started_ms";
+    for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+        out << "," << PHASE_NAMES[phase];
+    }
+    out << "\n";
+    for (const Record& record: records_) {
+        double phases[PHASE_COUNT];
+        get_phases(record.started, record.resolved, record.connected, record.handshaken, record.request_sent,
+                   record.first_byte, record.headers_read, record.finished, phases);
+        out << record.url << "," << record.start << "," << record.end << "," << record.status << "," <<
+            (record.succeeded ? 1 : 0) << "," << (record.reused_connection ? 1 : 0) << "," << (record.resumed_session ? 1 : 0) << "," <<
+            record.bytes_written << "," <<
+            record.body_bytes << "," << record.reads << "," << record.started * 1000.0;
+        for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+            out << ",";
+            if (phases[phase] >= 0) {
+                out << phases[phase];
+            }
+        }
+        out << "\n";
+    }
+}
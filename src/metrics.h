@@ -0,0 +1,91 @@
+#ifndef __multiget_metrics_include__
+#define __multiget_metrics_include__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+#include "httpget.h"
+
+/*! \brief Timings of every chunk request, written out as JSON or CSV
+ *
+ *  The scheduler adds each request to the Metrics once it has finished, so nothing is
+ *  recorded while the body is being read.  The report breaks each request down into the
+ *  time spent looking up the host, connecting, doing the TLS handshake, waiting for the
+ *  first byte of the response and transferring the body, so it shows where the time of a
+ *  slow download went.
+ *
+ *  Requests may be added from several threads at once.
+ */
+class Metrics {
+public:
+    /**
+     *   @brief  Create an empty set of metrics.  Times in the report are relative to now.
+     *
+     *   @return Metrics object
+     */
+    Metrics();
+    virtual ~Metrics() {}
+
+    /**
+     *   @brief  Record a request that has finished
+     *
+     *   @param  request The request
+     *   @param  url Where the request was sent
+     *
+     *   @return void
+     */
+    void add(HTTPGet& request, const std::string& url);
+
+    /**
+     *   @brief  Write the report
+     *
+     *   @param  filename File to write, CSV if the name ends in ".csv" and JSON otherwise
+     *   @param  total_bytes Size of the download in bytes, or -1 if not known
+     *
+     *   @return false if the file could not be written
+     */
+    bool write(const std::string& filename, int64_t total_bytes);
+
+private:
+    /*
+     * One finished request, times are in seconds from the creation of the Metrics and
+     * negative for a step that did not happen
+     */
+    struct Record {
+        std::string url;
+        int64_t     start; // first byte of the range
+        int64_t     end; // last byte of the range, -1 for the rest of the file
+        unsigned    status; // HTTP status code, 0 if there was no response
+        bool        succeeded;
+        bool        reused_connection;
+        bool        resumed_session;
+        int64_t     bytes_written;
+        int64_t     body_bytes;
+        int64_t     reads;
+        double      started;
+        double      resolved;
+        double      connected;
+        double      handshaken;
+        double      request_sent;
+        double      first_byte;
+        double      headers_read;
+        double      finished;
+    };
+
+    double since_created(const std::chrono::steady_clock::time_point& time);
+    void write_json(std::ostream& out, int64_t total_bytes, double seconds);
+    void write_csv(std::ostream& out);
+
+    std::chrono::steady_clock::time_point created_;
+    std::mutex              mutex_; // protects records_
+    std::vector<Record>     records_;
+
+    // Ensure that these method are not created explicitly
+    Metrics(const Metrics& in); // not implemented
+    Metrics& operator = (const Metrics &t); // not implemented
+};
+
+#endif // __multiget_metrics_include__
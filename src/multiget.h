@@ -0,0 +1,40 @@
+#ifndef __multiget_include__
+#define __multiget_include__
+
+/*! \brief libmultiget - download a file over HTTP(S) in parallel ranges
+ *
+ *  The one header a program needs to use the library, e.g.
+ *
+ *      DownloadOptions options;
+ *      options.urls.push_back("http://example.com/file.bin");
+ *      options.parallel = true;
+ *      MemorySink sink;
+ *      Download download(options, &sink);
+ *      if (download.run()) {
+ *          std::vector<char>& bytes = sink.getData();
+ *      }
+ *
+ *  A list of files (see readManifest) is downloaded over one set of connections with a
+ *  BatchDownload instead.
+ *
+ *  The library prints nothing: pass a handler to Download::setLogHandler to be given
+ *  its messages.
+ *
+ *  Link with -lmultiget and the libraries it uses: boost_system, boost_regex,
+ *  boost_thread, pthread, ssl and crypto.
+ */
+
+#include "download.h"
+#include "batchdownload.h"
+#include "manifest.h"
+#include "log.h"
+#include "sink.h"
+#include "outputfile.h"
+#include "memorysink.h"
+#include "callbacksink.h"
+#include "streamsink.h"
+#include "checksum.h"
+#include "metrics.h"
+#include "blockindex.h"
+
+#endif // __multiget_include__
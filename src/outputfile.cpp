@@ -0,0 +1,122 @@
+#include "outputfile.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+
+OutputFile::OutputFile()
+: fd_(-1)
+, regular_file_(false)
+{
+}
+
+OutputFile::~OutputFile()
+{
+    close();
+}
+
+bool OutputFile::open(const std::string& filename, off_t size, bool keep_contents)
+{
+    close();
+    filename_ = filename;
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | (keep_contents ? 0 : O_TRUNC), 0644);
+    if (fd_ == -1) {
+        LogMessage() << "Unable to create " << filename << ": " << strerror(errno);
+        return false;
+    }
+    struct stat statbuf;
+    regular_file_ = fstat(fd_, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+    if (size > 0 && !setSize(size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::setSize(int64_t size)
+{
+    // Reserve the blocks up front so the chunks never have to extend the file.  Not every
+    // file system supports fallocate, in that case just set the size and let the writes
+    // allocate the blocks.
+#ifdef __linux__
+    if (fallocate(fd_, 0, 0, size) == 0) {
+        return true;
+    }
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        LogMessage() << "Unable to allocate " << size << " bytes for " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+#endif
+    if (ftruncate(fd_, size) == -1) {
+        LogMessage() << "Unable to set the size of " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::write(int64_t offset, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = pwrite(fd_, data, length, offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogMessage() << "Unable to write to " << filename_ << ": " << strerror(errno);
+            return false;
+        }
+        data += written;
+        offset += written;
+        length -= written;
+    }
+    return true;
+}
+
+size_t OutputFile::read(int64_t offset, char* data, size_t length)
+{
+    while (true) {
+        ssize_t bytes = pread(fd_, data, length, offset);
+        if (bytes >= 0) {
+            return bytes;
+        }
+        if (errno != EINTR) {
+            LogMessage() << "Unable to read " << filename_ << ": " << strerror(errno);
+            return 0;
+        }
+    }
+}
+
+bool OutputFile::sync()
+{
+    if (fd_ == -1 || fdatasync(fd_) == -1) {
+        return false;
+    }
+    return true;
+}
+
+void OutputFile::close()
+{
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    regular_file_ = false;
+}
+
+/*
+ * Get the size of the specified file in bytes
+ */
+int64_t getFileSize(const std::string& filename)
+{
+    struct stat statbuf;
+    
+    if (stat(filename.c_str(), &statbuf) == -1) {
+        return 0;
+    } else {
+        return statbuf.st_size;
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef __multiget_output_file_include__
+#define __multiget_output_file_include__
+
+#include <string>
+#include <memory>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "sink.h"
+
+/*! \brief Preallocated output file that accepts writes at any offset
+ *
+ *  OutputFile is used when the chunks are written directly to their final location
+ *  instead of to temporary chunk files.  The file is created once at its final size
+ *  and each HTTPGet object writes its body with positional writes, so the file is
+ *  complete as soon as the last chunk finishes and no copy pass is required.
+ *
+ *  Writes to non-overlapping ranges may be made from several threads at once.
+ */
+class OutputFile : public Sink {
+public:
+    OutputFile();
+    virtual ~OutputFile();
+
+    /**
+     *   @brief  Create (or truncate) the file and reserve disk space for it
+     *
+     *   @param  filename Name of the file to create
+     *   @param  size Final size of the file in bytes
+     *   @param  keep_contents true to keep what is already in the file (to resume a download)
+     *
+     *   @return true if the file was created, false otherwise
+     */
+    bool open(const std::string& filename, off_t size, bool keep_contents = false);
+
+    /**
+     *   @brief  Reserve disk space for the file once its size is known
+     *
+     *   Writes to other parts of the file may be in progress.
+     *
+     *   @param  size Final size of the file in bytes
+     *
+     *   @return true if the space was reserved, false otherwise
+     */
+    virtual bool setSize(int64_t size);
+
+    /**
+     *   @brief  Write a block of data at the specified offset
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Bytes to write
+     *   @param  length Number of bytes to write
+     *
+     *   @return true if all the bytes were written, false otherwise
+     */
+    virtual bool write(int64_t offset, const char* data, size_t length);
+
+    /**
+     *   @brief  Read back a block of data that has been written
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Receives the bytes
+     *   @param  length Number of bytes to read
+     *
+     *   @return Number of bytes read, 0 at the end of the file or on an error
+     */
+    virtual size_t read(int64_t offset, char* data, size_t length);
+
+    /**
+     *   @brief  Wait for everything written so far to reach the disk
+     *
+     *   @return true if the data was flushed
+     */
+    virtual bool sync();
+
+    /**
+     *   @brief  Get the file to splice bodies into
+     *
+     *   @return file descriptor, or -1 if the file is not open or is not a regular file
+     *           (e.g. a pipe or a device)
+     */
+    virtual int getFileDescriptor() { return regular_file_ ? fd_ : -1; }
+
+    /**
+     *   @brief  Close the file
+     *
+     *   @return void
+     */
+    void close();
+
+    /**
+     *   @brief  Get the name of the file
+     *
+     *   @return filename
+     */
+    const std::string& getFilename() { return filename_; }
+
+private:
+    std::string filename_;
+    int         fd_;
+    bool        regular_file_; // fd_ is a regular file, so bytes can be spliced into it at an offset
+
+    // Ensure that these method are not created explicitly
+    OutputFile(const OutputFile& in); // not implemented
+    OutputFile& operator = (const OutputFile &t); // not implemented
+};
+
+/**
+ *   @brief  Get the size of a file
+ *
+ *   @param  filename The file
+ *
+ *   @return size in bytes, 0 if the file does not exist
+ */
+int64_t getFileSize(const std::string& filename);
+
+#endif // __multiget_output_file_include__
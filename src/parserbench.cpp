@@ -0,0 +1,265 @@
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "responseparser.h"
+
+/*
+ * Microbenchmarks for the response parser.  Each case parses the same response over and
+ * over and reports the time and the heap allocations per response, against the istream
+ * and getline parsing HTTPGet used before ResponseParser.  The chunked decoder is measured
+ * in MB/s.  Nothing touches the network: "make bench-parser", or ./parserbench --help.
+ */
+
+// Every allocation in the program is counted, so the parsers can be shown not to allocate
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+// The sized and array forms are replaced as well, so that every delete matches the new
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+// What both parsers pull out of the headers, so neither can skip the work
+struct Parsed {
+    unsigned int    status;
+    int64_t         content_length;
+    int64_t         range_start;
+    bool            chunked;
+    bool            close;
+    size_t          etag_length;
+};
+
+static std::string make_response(int extra_headers)
+{
+    std::string response = "HTTP/1.1 206 Partial Content\r\n"
+                           "Date: Sat, 17 Oct 2026 06:59:00 GMT\r\n"
+                           "Server: Apache/2.4.62 (Unix)\r\n"
+                           "Last-Modified: Thu, 01 Jan 2015 00:00:00 GMT\r\n"
+                           "ETag: \"5e2f-5a3c1e2b4f6d0\"\r\n"
+                           "Accept-Ranges: bytes\r\n"
+                           "Content-Length: 1048576\r\n"
+                           "Content-Range: bytes 4194304-5242879/104857600\r\n"
+                           "Content-Type: application/octet-stream\r\n"
+                           "Cache-Control: public, max-age=31536000\r\n"
+                           "Connection: keep-alive\r\n";
+    for (int i = 0; i < extra_headers; i++) {
+        response += "X-Cache-Header-" + std::to_string(i) + ": MISS from edge-cache-" + std::to_string(i) + ".example.net\r\n";
+    }
+    return response + "\r\n";
+}
+
+/*
+ * The parsing HTTPGet did before ResponseParser: read the status line and then each header
+ * from a streambuf with an istream and getline
+ */
+static void parse_with_istream(const std::string& response, Parsed& parsed)
+{
+    boost::asio::streambuf buffer;
+    std::ostream(&buffer) << response;
+    std::istream stream(&buffer);
+    std::string http_version;
+    stream >> http_version >> parsed.status;
+    std::string status_message;
+    std::getline(stream, status_message);
+    parsed.content_length = -1;
+    parsed.range_start = -1;
+    parsed.chunked = false;
+    parsed.close = false;
+    parsed.etag_length = 0;
+    std::string header;
+    while (std::getline(stream, header) && header != "\r") {
+        std::string::size_type colon = header.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = boost::algorithm::to_lower_copy(header.substr(0, colon));
+        std::string value = boost::algorithm::trim_copy(header.substr(colon + 1));
+        std::string lower_value = boost::algorithm::to_lower_copy(value);
+        if (name == "content-length") {
+            parsed.content_length = strtoll(value.c_str(), NULL, 10);
+        } else if (name == "content-range") {
+            long long first, last;
+            char length[32];
+            if (sscanf(lower_value.c_str(), "bytes %lld-%lld/%31s", &first, &last, length) == 3) {
+                parsed.range_start = first;
+            }
+        } else if (name == "etag") {
+            parsed.etag_length = value.size();
+        } else if (name == "connection") {
+            parsed.close = lower_value.find("close") != std::string::npos;
+        } else if (name == "transfer-encoding") {
+            parsed.chunked = lower_value == "chunked";
+        }
+    }
+}
+
+/*
+ * The same with ResponseParser, fed the response in reads of read_size bytes
+ */
+static void parse_with_parser(ResponseParser& parser, const std::string& response, size_t read_size, Parsed& parsed)
+{
+    parser.reset();
+    size_t received = 0;
+    ResponseParser::Result result = ResponseParser::INCOMPLETE;
+    while (result == ResponseParser::INCOMPLETE && received < response.size()) {
+        received = std::min(received + read_size, response.size());
+        result = parser.parse(response.data(), received);
+    }
+    int64_t end, instance_length;
+    parsed.status = parser.getStatusCode();
+    parsed.content_length = parser.getContentLength();
+    parser.getContentRange(parsed.range_start, end, instance_length);
+    parsed.chunked = parser.getTransferEncoding() == ResponseParser::CHUNKED;
+    parsed.close = parser.connectionClose();
+    parser.getETag(parsed.etag_length);
+}
+
+static void report(const std::string& name, size_t iterations, double seconds, size_t allocated)
+{
+    std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1) <<
+        std::setw(12) << seconds * 1e9 / iterations << std::setw(14) << static_cast<double>(allocated) / iterations << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = 200000;
+    int64_t body_size = 64 * 1024 * 1024;
+    po::options_description desc("Usage: ./parserbench [OPTIONS]");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("iterations,n", po::value<size_t>(&iterations), "Number of times to parse each response (default is 200000)")
+        ("body-size", po::value<int64_t>(&body_size), "Bytes of chunked body to decode (default is 67108864)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    if (iterations == 0 || body_size <= 0) {
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << std::left << std::setw(44) << "case" << std::right << std::setw(12) << "ns/response" <<
+        std::setw(14) << "allocations" << std::endl;
+    struct Case {
+        const char*     name;
+        int             extra_headers;
+    };
+    const Case cases[] = { { "10 headers", 0 }, { "40 headers", 30 } };
+    ResponseParser parser;
+    bool all_match = true;
+    for (const Case& test: cases) {
+        std::string response = make_response(test.extra_headers);
+        Parsed expected, parsed;
+        parse_with_istream(response, expected);
+
+        size_t allocated = allocations;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            parse_with_istream(response, parsed);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        report(std::string("istream, ") + test.name, iterations, seconds, allocations - allocated);
+
+        // In one read, as it usually arrives, and dribbled in 7 bytes at a time
+        const size_t read_sizes[] = { response.size(), 7 };
+        for (size_t read_size: read_sizes) {
+            allocated = allocations;
+            started = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < iterations; i++) {
+                parse_with_parser(parser, response, read_size, parsed);
+            }
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            std::string name = std::string("ResponseParser, ") + test.name + (read_size == 7 ? ", 7 byte reads" : "");
+            report(name, iterations, seconds, allocations - allocated);
+            if (parsed.status != expected.status || parsed.content_length != expected.content_length ||
+                parsed.range_start != expected.range_start || parsed.chunked != expected.chunked ||
+                parsed.close != expected.close || parsed.etag_length != expected.etag_length) {
+                std::cout << "Error: ResponseParser and istream disagree on " << test.name << std::endl;
+                all_match = false;
+            }
+        }
+    }
+
+    // Chunked body in 16 KiB chunks, decoded from 256 KiB reads like HTTPGet's
+    std::string chunk(16 * 1024, 'x');
+    std::string body;
+    for (int64_t size = 0; size < body_size; size += chunk.size()) {
+        char line[32];
+        snprintf(line, sizeof(line), "%zx\r\n", chunk.size());
+        body += line + chunk + "\r\n";
+    }
+    body += "0\r\n\r\n";
+    std::vector<char> buffer(256 * 1024);
+    ChunkedDecoder decoder;
+    size_t allocated = allocations;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    size_t payload_bytes = 0;
+    for (size_t offset = 0; offset < body.size();) {
+        size_t length = std::min(buffer.size(), body.size() - offset);
+        memcpy(&buffer[0], body.data() + offset, length);
+        size_t payload;
+        decoder.decode(&buffer[0], length, payload);
+        payload_bytes += payload;
+        offset += length;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "ChunkedDecoder: " << std::setprecision(1) << body.size() / seconds / 1e6 << " MB/s including the copy into the buffer, " <<
+        (allocations - allocated) << " allocations" << std::endl;
+    if (!decoder.isComplete() || static_cast<int64_t>(payload_bytes) < body_size) {
+        std::cout << "Error: the chunked body did not decode" << std::endl;
+        all_match = false;
+    }
+    return all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
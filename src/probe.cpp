@@ -0,0 +1,43 @@
+#include "probe.h"
+
+HTTPProbe::HTTPProbe(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port,
+                     ConnectionPool* pool)
+: request_(io_service, server, path, port, 0, 0)
+{
+    request_.setConnectionPool(pool);
+}
+
+int64_t HTTPProbe::getFileSize()
+{
+    if (!request_.succeeded()) {
+        return -1;
+    }
+    const HTTPResponse& response = request_.getResponse();
+    if (response.status_code == 206) {
+        // The Content-Length is only the length of the range
+        return response.instance_length;
+    }
+    return response.content_length;
+}
+
+Checksums HTTPProbe::getChecksums()
+{
+    Checksums checksums;
+    if (!request_.succeeded()) {
+        return checksums;
+    }
+    const HTTPResponse& response = request_.getResponse();
+    parseDigestHeader(response.digest.str(), checksums);
+    std::string md5;
+    if (response.status_code == 200 && fromBase64(response.content_md5.str(), md5)) {
+        // On a 206 this would only be the MD5 of the range
+        checksums["md5"] = md5;
+    }
+    return checksums;
+}
+
+bool HTTPProbe::acceptsRanges()
+{
+    const HTTPResponse& response = request_.getResponse();
+    return request_.succeeded() && response.status_code == 206 && response.range_start == 0;
+}
@@ -0,0 +1,125 @@
+#ifndef __multiget_probe_include__
+#define __multiget_probe_include__
+
+#include <string>
+#include <stdint.h>
+#include <boost/asio.hpp>
+
+#include "httpget.h"
+
+class ConnectionPool;
+class EndpointCache;
+
+/*! \brief Find out the size of a remote file and whether it can be fetched in ranges
+ *
+ *  HTTPProbe asks for the first byte of the file with "Range: bytes=0-0".  A server that
+ *  supports ranges answers 206 with the complete size in Content-Range.  Any other server
+ *  answers 200 with the size in Content-Length, in which case the body is not read.
+ *
+ *  The probe runs when the io_service is run.  If a ConnectionPool is supplied the
+ *  connection is left in the pool for the first chunk request.
+ */
+class HTTPProbe {
+public:
+    /**
+     *   @brief  Create a HTTPProbe object.
+     *
+     *   @param  io_service
+     *   @param  server dns name of server or IP address
+     *   @param  path path to file e.g. /pathtofile.extention
+     *   @param  port either \"http\" or port number
+     *   @param  pool Persistent connections to reuse, or NULL to use a connection of its own
+     *
+     *   @return HTTPProbe object
+     */
+    HTTPProbe(boost::asio::io_service& io_service, const std::string& server, const std::string& path, const std::string& port,
+              ConnectionPool* pool);
+    virtual ~HTTPProbe() {}
+
+    /**
+     *   @brief  Share DNS results with the requests that follow (must be called before start)
+     *
+     *   @param  endpoint_cache Resolved hosts, or NULL for the probe to do its own lookup
+     *
+     *   @return void
+     */
+    void setEndpointCache(EndpointCache* endpoint_cache) { request_.setEndpointCache(endpoint_cache); }
+
+    /**
+     *   @brief  Send the probe over TLS (must be called before start)
+     *
+     *   @param  tls Certificates and saved sessions shared with the requests that follow, or
+     *           NULL for plain HTTP
+     *
+     *   @return void
+     */
+    void setTLSContext(TLSContext* tls) { request_.setTLSContext(tls); }
+
+    /**
+     *   @brief  Send the request
+     *
+     *   @return void
+     */
+    void start() { request_.start(); }
+
+    /**
+     *   @brief  Find out whether the server answered the probe
+     *
+     *   @return true if a 200 or 206 response was received
+     */
+    bool succeeded() { return request_.succeeded(); }
+
+    /**
+     *   @brief  Find out whether the probe failed in a way that asking again will not fix
+     *
+     *   @return true for e.g. a 404, false for e.g. a 503 or a connection that was reset
+     */
+    bool failedPermanently() { return request_.failedPermanently(); }
+
+    /**
+     *   @brief  Get the size of the file
+     *
+     *   @return size in bytes, or -1 if the server did not say
+     */
+    int64_t getFileSize();
+
+    /**
+     *   @brief  Find out whether the server will send parts of the file
+     *
+     *   @return true if the server answered the range request with a range
+     */
+    bool acceptsRanges();
+
+    /**
+     *   @brief  Get the entity tag of the file
+     *
+     *   @return ETag header, or an empty string if the server did not send one
+     */
+    std::string getETag() { return request_.getResponse().etag.str(); }
+
+    /**
+     *   @brief  Get the modification time of the file
+     *
+     *   @return Last-Modified header, or an empty string if the server did not send one
+     */
+    std::string getLastModified() { return request_.getResponse().last_modified.str(); }
+
+    /**
+     *   @brief  Get the checksums of the whole file that the server sent
+     *
+     *   These come from the Digest, Repr-Digest and x-goog-hash headers, and from
+     *   Content-MD5 if the server answered with the whole file.
+     *
+     *   @return checksums, empty if the server did not send any
+     */
+    Checksums getChecksums();
+
+private:
+    HTTPGet request_;
+
+    // Ensure that these method are not created explicitly
+    HTTPProbe(const HTTPProbe& in); // not implemented
+    HTTPProbe& operator = (const HTTPProbe &t); // not implemented
+};
+
+#endif // __multiget_probe_include__
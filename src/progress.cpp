@@ -0,0 +1,82 @@
+#include "progress.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+// How much each new measurement counts towards the smoothed rate
+static const double RATE_SMOOTHING = 0.3;
+
+ProgressMeter::ProgressMeter(int64_t total_bytes, int64_t bytes_done)
+: total_bytes_(total_bytes)
+, start_bytes_(bytes_done)
+, last_bytes_(bytes_done)
+, start_time_(std::chrono::steady_clock::now())
+, last_time_(start_time_)
+, rate_(-1)
+, line_length_(0)
+{
+}
+
+std::string ProgressMeter::format_bytes(double bytes)
+{
+    static const char* const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    size_t unit = 0;
+    while (bytes >= 1024 && unit < sizeof(units) / sizeof(units[0]) - 1) {
+        bytes /= 1024;
+        unit++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+    return out.str();
+}
+
+void ProgressMeter::update(int64_t bytes_done)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double interval = std::chrono::duration<double>(now - last_time_).count();
+    if (interval > 0) {
+        double rate = (bytes_done - last_bytes_) / interval;
+        rate_ = (rate_ < 0) ? rate : RATE_SMOOTHING * rate + (1 - RATE_SMOOTHING) * rate_;
+    }
+    last_bytes_ = bytes_done;
+    last_time_ = now;
+
+    std::ostringstream line;
+    line << format_bytes(std::max(rate_, 0.0)) << "/s";
+    if (total_bytes_ > 0 && rate_ > 0 && bytes_done < total_bytes_) {
+        int64_t eta = static_cast<int64_t>((total_bytes_ - bytes_done) / rate_ + 0.5);
+        line << "  ETA " << eta / 60 << ":" << std::setw(2) << std::setfill('0') << eta % 60;
+    }
+    draw(bytes_done, line.str());
+    std::cout << std::flush;
+}
+
+void ProgressMeter::finish(int64_t bytes_done)
+{
+    // Show the average rate for the whole download rather than the last moment of it
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+    double rate = seconds > 0 ? (bytes_done - start_bytes_) / seconds : 0.0;
+    draw(bytes_done, format_bytes(rate) + "/s average");
+    std::cout << std::endl;
+    line_length_ = 0;
+}
+
+void ProgressMeter::draw(int64_t bytes_done, const std::string& rate)
+{
+    std::ostringstream line;
+    line << format_bytes(bytes_done);
+    if (total_bytes_ > 0) {
+        line << " of " << format_bytes(total_bytes_) << " (" << (bytes_done * 100 / total_bytes_) << "%)";
+    }
+    line << "  " << rate;
+    // Blank out whatever is left of a longer line drawn before
+    std::string text = line.str();
+    size_t length = text.size();
+    if (length < line_length_) {
+        text.append(line_length_ - length, ' ');
+    }
+    line_length_ = length;
+    std::cout << "\r" << text;
+}
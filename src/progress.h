@@ -0,0 +1,60 @@
+#ifndef __multiget_progress_include__
+#define __multiget_progress_include__
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+/*! \brief One line on the terminal showing how the download is going
+ *
+ *  The line shows the bytes done, the percentage, the current download rate and the time
+ *  left, and is redrawn in place each time it is updated.  The rate is smoothed so the
+ *  time left does not jump about.
+ *
+ *  The meter is not thread safe, it is only updated from one thread at a time.
+ */
+class ProgressMeter {
+public:
+    /**
+     *   @brief  Create a ProgressMeter object.  Nothing is shown until the first update.
+     *
+     *   @param  total_bytes Size of the download, or -1 if not known
+     *   @param  bytes_done Bytes that were done before the download started (a resumed download)
+     *
+     *   @return ProgressMeter object
+     */
+    ProgressMeter(int64_t total_bytes, int64_t bytes_done);
+    virtual ~ProgressMeter() {}
+
+    /**
+     *   @brief  Redraw the line
+     *
+     *   @param  bytes_done Number of bytes downloaded so far
+     *
+     *   @return void
+     */
+    void update(int64_t bytes_done);
+
+    /**
+     *   @brief  Draw the line for the last time and move on to the next line
+     *
+     *   @param  bytes_done Number of bytes downloaded
+     *
+     *   @return void
+     */
+    void finish(int64_t bytes_done);
+
+private:
+    void draw(int64_t bytes_done, const std::string& rate);
+    static std::string format_bytes(double bytes);
+
+    int64_t                                 total_bytes_;
+    int64_t                                 start_bytes_; // bytes done before the download started
+    int64_t                                 last_bytes_; // bytes done at the last update
+    std::chrono::steady_clock::time_point   start_time_;
+    std::chrono::steady_clock::time_point   last_time_; // time of the last update
+    double                                  rate_; // smoothed bytes per second
+    size_t                                  line_length_; // length of the line drawn last
+};
+
+#endif // __multiget_progress_include__
@@ -0,0 +1,355 @@
+#include "rangecache.h"
+#include "checksum.h"
+#include "sink.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+// First line of every range list, changed if the format ever changes
+static const char CACHE_MAGIC[] = "multiget-cache 1";
+
+// Bytes copied at a time between the cache and a download
+static const size_t COPY_SIZE = 1024 * 1024;
+
+// A data file with no list that has not been written to for this long was left by a store
+// that never finished, rather than one that is still running
+static const time_t ORPHAN_AGE_S = 3600;
+
+RangeCache::Lock::Lock(int fd)
+: fd_(fd)
+{
+    while (flock(fd_, LOCK_EX) == -1 && errno == EINTR) {
+    }
+}
+
+RangeCache::Lock::~Lock()
+{
+    flock(fd_, LOCK_UN);
+}
+
+RangeCache::RangeCache(const std::string& directory, int64_t max_size)
+: directory_(directory)
+, max_size_(max_size)
+, lock_fd_(-1)
+, size_(-1)
+, data_fd_(-1)
+{
+}
+
+RangeCache::~RangeCache()
+{
+    if (data_fd_ != -1) {
+        close(data_fd_);
+    }
+    if (lock_fd_ != -1) {
+        close(lock_fd_);
+    }
+}
+
+bool RangeCache::open()
+{
+    if (mkdir(directory_.c_str(), 0755) == -1 && errno != EEXIST) {
+        LogMessage() << "Unable to create the cache " << directory_ << ": " << strerror(errno);
+        return false;
+    }
+    std::string lock_file_name = directory_ + "/lock";
+    lock_fd_ = ::open(lock_file_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock_fd_ == -1) {
+        LogMessage() << "Unable to use the cache " << directory_ << ": " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+RangeList RangeCache::select(const std::string& url, int64_t size, const std::string& etag, const std::string& last_modified)
+{
+    // The files are named after a hash of the version, so a new version of a file never
+    // finds the ranges of an old one
+    MessageDigest digest("sha256");
+    std::string version = url + "\n" + std::to_string(size) + "\n" + etag + "\n" + last_modified;
+    digest.update(version.data(), version.size());
+    key_ = directory_ + "/" + toHex(digest.finish()).substr(0, 32);
+    url_ = url;
+    size_ = size;
+    etag_ = etag;
+    last_modified_ = last_modified;
+    if (data_fd_ != -1) {
+        close(data_fd_);
+        data_fd_ = -1;
+    }
+
+    RangeList ranges;
+    Lock lock(lock_fd_);
+    if (read_list(ranges) && !ranges.empty()) {
+        // Opened while locked, so it cannot be evicted in between
+        data_fd_ = ::open((key_ + ".data").c_str(), O_RDONLY);
+        if (data_fd_ == -1) {
+            ranges.clear();
+        } else {
+            // Now the most recently used
+            utimensat(AT_FDCWD, (key_ + ".ranges").c_str(), NULL, 0);
+        }
+    }
+    return ranges;
+}
+
+bool RangeCache::copy(const RangeList& ranges, Sink& output, std::vector<uint32_t>& crcs)
+{
+    std::vector<char> buffer(COPY_SIZE);
+    crcs.clear();
+    for (const ByteRange& range: ranges) {
+        CRC32C crc;
+        for (int64_t offset = range.first; offset <= range.last; ) {
+            size_t length = static_cast<size_t>(std::min<int64_t>(buffer.size(), range.last + 1 - offset));
+            ssize_t bytes = pread(data_fd_, &buffer[0], length, offset);
+            if (bytes <= 0) {
+                LogMessage() << "Unable to read " << key_ << ".data";
+                return false;
+            }
+            if (!output.write(offset, &buffer[0], static_cast<size_t>(bytes))) {
+                return false;
+            }
+            crc.update(&buffer[0], static_cast<size_t>(bytes));
+            offset += bytes;
+        }
+        crcs.push_back(crc.value());
+    }
+    return true;
+}
+
+bool RangeCache::store(const RangeList& ranges, Sink& source)
+{
+    int64_t bytes = 0;
+    for (const ByteRange& range: ranges) {
+        bytes += range.length();
+    }
+    if (bytes == 0) {
+        return true;
+    }
+    if (bytes > max_size_) {
+        LogMessage() << "Not caching the download - it is bigger than the cache";
+        return false;
+    }
+
+    // The data goes in first, without the lock, as no other process reads it until it is
+    // on the list.  Each range is read back from the download's output.
+    std::string data_file_name = key_ + ".data";
+    int fd = ::open(data_file_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        LogMessage() << "Unable to write " << data_file_name << ": " << strerror(errno);
+        return false;
+    }
+    struct stat written;
+    bool ok = fstat(fd, &written) == 0 && (written.st_size >= size_ || ftruncate(fd, size_) == 0);
+    std::vector<char> buffer(COPY_SIZE);
+    for (RangeList::const_iterator it = ranges.begin(); ok && it != ranges.end(); ++it) {
+        for (int64_t offset = it->first; ok && offset <= it->last; ) {
+            size_t length = static_cast<size_t>(std::min<int64_t>(buffer.size(), it->last + 1 - offset));
+            size_t count = source.read(offset, &buffer[0], length);
+            if (count == 0) {
+                LogMessage() << "Not caching the download - it cannot be read back";
+                ok = false;
+            } else if (pwrite(fd, &buffer[0], count, offset) != static_cast<ssize_t>(count)) {
+                LogMessage() << "Unable to write " << data_file_name << ": " << strerror(errno);
+                ok = false;
+            }
+            offset += count;
+        }
+    }
+    ok = ok && fdatasync(fd) == 0;
+
+    if (ok) {
+        Lock lock(lock_fd_);
+        // Another process may have evicted the version while the data was written, in
+        // which case the ranges went into a file that is no longer there
+        struct stat current;
+        ok = stat(data_file_name.c_str(), &current) == 0 && current.st_ino == written.st_ino && current.st_dev == written.st_dev;
+        RangeList cached;
+        if (ok) {
+            read_list(cached);
+            cached.insert(cached.end(), ranges.begin(), ranges.end());
+            mergeRanges(cached);
+            ok = write_list(cached);
+        }
+        if (ok) {
+            evict();
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/*
+ * The list is a header followed by one line per range:
+ *
+ *   multiget-cache 1
+ *   url http://server/path
+ *   size 1234567
+ *   etag "abc"
+ *   last-modified Tue, 15 Nov 1994 12:45:26 GMT
+ *   range 0 1048575
+ *   range 2097152 3145727
+ *
+ * Each range is the first and last byte.  Must be called with the lock held.
+ */
+bool RangeCache::read_list(RangeList& ranges)
+{
+    ranges.clear();
+    std::ifstream input((key_ + ".ranges").c_str());
+    std::string line;
+    if (!std::getline(input, line) || line != CACHE_MAGIC) {
+        return false;
+    }
+    std::string url, etag, last_modified;
+    int64_t size = -1;
+    while (std::getline(input, line)) {
+        std::string::size_type space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+        if (key == "url") {
+            url = value;
+        } else if (key == "size") {
+            size = strtoll(value.c_str(), NULL, 10);
+        } else if (key == "etag") {
+            etag = value;
+        } else if (key == "last-modified") {
+            last_modified = value;
+        } else if (key == "range") {
+            ByteRange range;
+            char* end;
+            range.first = strtoll(value.c_str(), &end, 10);
+            range.last = strtoll(end, NULL, 10);
+            if (range.first >= 0 && range.last >= range.first && range.last < size_) {
+                ranges.push_back(range);
+            }
+        }
+    }
+    // Another version of a file can only have the same name if the hash collides
+    if (url != url_ || size != size_ || etag != etag_ || last_modified != last_modified_) {
+        ranges.clear();
+        return false;
+    }
+    mergeRanges(ranges);
+    return true;
+}
+
+/*
+ * Replace the list atomically, so that a process that crashes part way through leaves the
+ * old list.  Must be called with the lock held.
+ */
+bool RangeCache::write_list(const RangeList& ranges)
+{
+    std::string list_file_name = key_ + ".ranges";
+    std::string temp_file_name = list_file_name + ".tmp";
+    {
+        std::ofstream output(temp_file_name.c_str(), std::ios::out | std::ios::trunc);
+        output << CACHE_MAGIC << "\n";
+        output << "url " << url_ << "\n";
+        output << "size " << size_ << "\n";
+        output << "etag " << etag_ << "\n";
+        output << "last-modified " << last_modified_ << "\n";
+        for (const ByteRange& range: ranges) {
+            output << "range " << range.first << " " << range.last << "\n";
+        }
+        output.close();
+        if (!output) {
+            LogMessage() << "Unable to write " << temp_file_name;
+            remove(temp_file_name.c_str());
+            return false;
+        }
+    }
+    if (rename(temp_file_name.c_str(), list_file_name.c_str()) != 0) {
+        LogMessage() << "Unable to write " << list_file_name << ": " << strerror(errno);
+        remove(temp_file_name.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+ * What is known about one version when deciding what to evict
+ */
+struct CachedVersion {
+    std::string     key;
+    time_t          used; // when its list was last touched
+    int64_t         bytes; // disk space taken by its data
+};
+
+static bool used_before(const CachedVersion& a, const CachedVersion& b)
+{
+    return a.used < b.used;
+}
+
+static bool has_suffix(const std::string& name, const std::string& suffix)
+{
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * Remove the least recently used versions (other than the selected one) until the data
+ * files fit in the limit.  A data file without a list is left by a store that stopped
+ * before adding its ranges.  It counts against the limit as if last used when it was
+ * written, and is removed once it is old enough that no store can still be writing it.
+ * Must be called with the lock held.
+ */
+void RangeCache::evict()
+{
+    DIR* dir = opendir(directory_.c_str());
+    if (!dir) {
+        return;
+    }
+    std::vector<CachedVersion> versions;
+    int64_t total = 0;
+    const std::string list_extension(".ranges");
+    const std::string data_extension(".data");
+    time_t now = time(NULL);
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name(entry->d_name);
+        bool is_list = has_suffix(name, list_extension);
+        if (!is_list && !has_suffix(name, data_extension)) {
+            continue;
+        }
+        CachedVersion version;
+        version.key = directory_ + "/" + name.substr(0, name.size() - (is_list ? list_extension : data_extension).size());
+        struct stat list, data;
+        bool has_list = stat((version.key + list_extension).c_str(), &list) == 0;
+        bool has_data = stat((version.key + data_extension).c_str(), &data) == 0;
+        if (is_list ? !has_list : (has_list || !has_data)) {
+            // Gone, or counted with its list
+            continue;
+        }
+        if (!has_list && version.key != key_ && now - data.st_mtime > ORPHAN_AGE_S) {
+            remove((version.key + data_extension).c_str());
+            continue;
+        }
+        version.used = has_list ? list.st_mtime : data.st_mtime;
+        // The data files are sparse, so count the blocks rather than the size
+        version.bytes = has_data ? static_cast<int64_t>(data.st_blocks) * 512 : 0;
+        total += version.bytes;
+        versions.push_back(version);
+    }
+    closedir(dir);
+
+    std::sort(versions.begin(), versions.end(), used_before);
+    for (std::vector<CachedVersion>::const_iterator it = versions.begin(); it != versions.end() && total > max_size_; ++it) {
+        if (it->key == key_) {
+            continue;
+        }
+        remove((it->key + data_extension).c_str());
+        remove((it->key + list_extension).c_str());
+        total -= it->bytes;
+    }
+}
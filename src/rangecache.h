@@ -0,0 +1,116 @@
+#ifndef __multiget_range_cache_include__
+#define __multiget_range_cache_include__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "rangelist.h"
+
+class Sink;
+
+/*! \brief Ranges of downloaded files kept on disk, to be used again by later downloads
+ *
+ *  Every version of a file (URL, size and ETag or Last-Modified) has a sparse data file in
+ *  the cache directory, with each range at its offset, and a list of the ranges it holds.
+ *  A download looks up the version it is getting (select), copies what the cache has into
+ *  its output and only downloads the gaps, then stores what it downloaded.
+ *
+ *  Several processes may use the same directory at once.  The lists are only read and
+ *  replaced, and files only removed, while holding an flock on the directory's lock file.
+ *  A range is written to the data file and synced before it is added to the list, so every
+ *  range on a list is on the disk.  Two processes storing the same range write the same
+ *  bytes.  A data file that is removed while it is being read stays readable until closed.
+ *
+ *  When the data files add up to more than the limit, the least recently used versions
+ *  are removed.  A version is used whenever it is selected.  A data file left without a
+ *  list by a store that was interrupted counts against the limit too, and is removed once
+ *  it is an hour old.
+ */
+class RangeCache {
+public:
+    /**
+     *   @brief  Create a RangeCache object.
+     *
+     *   @param  directory Where the cache is kept, created if it does not exist
+     *   @param  max_size Most bytes of data to keep
+     *
+     *   @return RangeCache object
+     */
+    RangeCache(const std::string& directory, int64_t max_size);
+    virtual ~RangeCache();
+
+    /**
+     *   @brief  Create the directory and open its lock file
+     *
+     *   @return false if the cache cannot be used (the reason is printed)
+     */
+    bool open();
+
+    /**
+     *   @brief  Pick the version of a file to use, and find out which of its ranges are cached
+     *
+     *   @param  url The file
+     *   @param  size Size of the file in bytes
+     *   @param  etag The server's ETag, empty if it did not send one
+     *   @param  last_modified The server's Last-Modified, empty if it did not send one
+     *
+     *   @return the cached ranges, sorted and merged (empty if there are none)
+     */
+    RangeList select(const std::string& url, int64_t size, const std::string& etag, const std::string& last_modified);
+
+    /**
+     *   @brief  Copy cached ranges of the selected version into an output
+     *
+     *   @param  ranges Ranges to copy, all of them cached (as returned by select)
+     *   @param  output Where they go, each at its offset
+     *   @param  crcs Receives the CRC32C of each range
+     *
+     *   @return false if a range could not be read or written
+     */
+    bool copy(const RangeList& ranges, Sink& output, std::vector<uint32_t>& crcs);
+
+    /**
+     *   @brief  Add downloaded ranges of the selected version to the cache
+     *
+     *   Versions that have not been used for longest are removed to keep to the size limit.
+     *
+     *   @param  ranges Ranges to add
+     *   @param  source Where they were downloaded to, read back with Sink::read
+     *
+     *   @return false if they could not be added
+     */
+    bool store(const RangeList& ranges, Sink& source);
+
+private:
+    /*
+     * Takes the lock on the directory for as long as it exists
+     */
+    class Lock {
+    public:
+        explicit Lock(int fd);
+        ~Lock();
+    private:
+        int fd_;
+    };
+
+    bool read_list(RangeList& ranges);
+    bool write_list(const RangeList& ranges);
+    void evict();
+
+    std::string     directory_;
+    int64_t         max_size_;
+    int             lock_fd_;
+    std::string     key_; // name of the selected version's files, without the extension
+    std::string     url_;
+    int64_t         size_;
+    std::string     etag_;
+    std::string     last_modified_;
+    int             data_fd_; // the selected version's data file, -1 if nothing is cached
+
+    // Ensure that these method are not created explicitly
+    RangeCache(const RangeCache& in); // not implemented
+    RangeCache& operator = (const RangeCache &t); // not implemented
+};
+
+#endif // __multiget_range_cache_include__
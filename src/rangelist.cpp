@@ -0,0 +1,145 @@
+#include "rangelist.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+
+static bool range_before(const ByteRange& a, const ByteRange& b)
+{
+    return a.first < b.first;
+}
+
+/*
+ * Read "first-last" into a range
+ */
+static bool parse_range(const std::string& text, ByteRange& range)
+{
+    std::string::size_type dash = text.find('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == text.size()) {
+        return false;
+    }
+    char* end;
+    range.first = strtoll(text.c_str(), &end, 10);
+    if (end != text.c_str() + dash) {
+        return false;
+    }
+    range.last = strtoll(text.c_str() + dash + 1, &end, 10);
+    return *end == '\0' && range.first >= 0 && range.last >= range.first;
+}
+
+bool parseRanges(const std::string& text, RangeList& ranges)
+{
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, text, boost::algorithm::is_any_of(", \t\r"), boost::algorithm::token_compress_on);
+    for (const std::string& field: fields) {
+        if (field.empty()) {
+            continue;
+        }
+        ByteRange range;
+        if (!parse_range(field, range)) {
+            return false;
+        }
+        ranges.push_back(range);
+    }
+    return true;
+}
+
+bool readRangeList(const std::string& filename, RangeList& ranges)
+{
+    std::ifstream file;
+    if (filename != "-") {
+        file.open(filename.c_str());
+        if (!file) {
+            LogMessage() << "Unable to read the range list " << filename;
+            return false;
+        }
+    }
+    std::istream& input = (filename == "-") ? std::cin : file;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(input, line)) {
+        line_number++;
+        boost::algorithm::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!parseRanges(line, ranges)) {
+            LogMessage() << "Line " << line_number << " of " << filename << ": ranges must be first-last, e.g. 0-4095";
+            return false;
+        }
+    }
+    if (ranges.empty()) {
+        LogMessage() << "There are no ranges in " << filename;
+        return false;
+    }
+    mergeRanges(ranges);
+    return true;
+}
+
+void mergeRanges(RangeList& ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), range_before);
+    RangeList merged;
+    for (const ByteRange& range: ranges) {
+        if (!merged.empty() && range.first <= merged.back().last + 1) {
+            merged.back().last = std::max(merged.back().last, range.last);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    ranges.swap(merged);
+}
+
+RangeList intersectRanges(const RangeList& a, const RangeList& b)
+{
+    RangeList both;
+    size_t j = 0;
+    for (const ByteRange& range: a) {
+        while (j < b.size() && b[j].last < range.first) {
+            j++;
+        }
+        for (size_t k = j; k < b.size() && b[k].first <= range.last; k++) {
+            both.push_back(ByteRange(std::max(range.first, b[k].first), std::min(range.last, b[k].last)));
+        }
+    }
+    return both;
+}
+
+RangeList subtractRanges(const RangeList& a, const RangeList& b)
+{
+    RangeList left;
+    size_t j = 0;
+    for (const ByteRange& range: a) {
+        while (j < b.size() && b[j].last < range.first) {
+            j++;
+        }
+        int64_t position = range.first;
+        for (size_t k = j; k < b.size() && b[k].first <= range.last; k++) {
+            if (b[k].first > position) {
+                left.push_back(ByteRange(position, b[k].first - 1));
+            }
+            position = std::max(position, b[k].last + 1);
+        }
+        if (position <= range.last) {
+            left.push_back(ByteRange(position, range.last));
+        }
+    }
+    return left;
+}
+
+std::string formatRanges(const RangeList& ranges)
+{
+    std::ostringstream out;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (i > 0) {
+            out << ",";
+        }
+        out << ranges[i].first << "-" << ranges[i].last;
+    }
+    return out.str();
+}
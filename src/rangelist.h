@@ -0,0 +1,90 @@
+#ifndef __multiget_range_list_include__
+#define __multiget_range_list_include__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*! \brief Bytes first to last of a file, both included (as in a Range header)
+ */
+struct ByteRange {
+    ByteRange() : first(0), last(-1) {}
+    ByteRange(int64_t first, int64_t last) : first(first), last(last) {}
+    int64_t length() const { return last - first + 1; }
+
+    int64_t     first;
+    int64_t     last;
+};
+
+typedef std::vector<ByteRange> RangeList;
+
+/**
+ *   @brief  Parse ranges written as in a Range header, without the "bytes=", e.g. "0-499,1000-1499"
+ *
+ *   Both ends of every range must be given, as the size of the file may not be known.
+ *
+ *   @param  text The ranges, separated by commas
+ *   @param  ranges The ranges are added to this
+ *
+ *   @return false if a range is not valid
+ */
+bool parseRanges(const std::string& text, RangeList& ranges);
+
+/**
+ *   @brief  Read a list of ranges of a file to download
+ *
+ *   There are one or more ranges on each line, as first-last with the last byte included,
+ *   separated by commas or spaces.  Blank lines and lines starting with '#' are skipped.
+ *   For example:
+ *
+ *     0-4095
+ *     1048576-1052671, 2097152-2101247
+ *
+ *   The ranges are sorted, and ranges that overlap or touch are merged (see mergeRanges).
+ *
+ *   @param  filename Name of the list, or "-" to read standard input
+ *   @param  ranges Receives the ranges
+ *
+ *   @return false if the list cannot be read or a range is not valid (the reason is printed)
+ */
+bool readRangeList(const std::string& filename, RangeList& ranges);
+
+/**
+ *   @brief  Sort ranges by their first byte and merge the ones that overlap or touch
+ *
+ *   @param  ranges The ranges to tidy up
+ *
+ *   @return void
+ */
+void mergeRanges(RangeList& ranges);
+
+/**
+ *   @brief  Find the bytes that are in both of two lists of ranges
+ *
+ *   @param  a Ranges, sorted and merged
+ *   @param  b Ranges, sorted and merged
+ *
+ *   @return the bytes in both, sorted and merged
+ */
+RangeList intersectRanges(const RangeList& a, const RangeList& b);
+
+/**
+ *   @brief  Find the bytes of a list of ranges that are not in another
+ *
+ *   @param  a Ranges, sorted and merged
+ *   @param  b Ranges to take out, sorted and merged
+ *
+ *   @return the bytes in a but not in b, sorted and merged
+ */
+RangeList subtractRanges(const RangeList& a, const RangeList& b);
+
+/**
+ *   @brief  Write ranges as in a Range header, without the "bytes="
+ *
+ *   @param  ranges The ranges
+ *
+ *   @return e.g. "0-499,1000-1499"
+ */
+std::string formatRanges(const RangeList& ranges);
+
+#endif // __multiget_range_list_include__
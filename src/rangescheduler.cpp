@@ -0,0 +1,304 @@
+#include "rangescheduler.h"
+#include "httpget.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <boost/bind.hpp>
+
+#include <stdlib.h>
+
+#include <sstream>
+#include <algorithm>
+
+// How often the progress is reported
+static const int PROGRESS_INTERVAL_MS = 500;
+
+/*
+ * Describe the ranges of a request for a message
+ */
+static std::string describe(const RangeList& ranges)
+{
+    std::ostringstream out;
+    if (ranges.size() == 1) {
+        out << "bytes " << ranges[0].first << "-" << ranges[0].last;
+    } else {
+        out << ranges.size() << " ranges between bytes " << ranges.front().first << " and " << ranges.back().last;
+    }
+    return out.str();
+}
+
+RangeScheduler::RangeScheduler(boost::asio::io_service& io_service, const URL& url, const RangeList& ranges, int max_in_flight,
+                               int64_t chunk_size, Sink* output, ConnectionPool* pool)
+: io_service_(io_service)
+, url_(url)
+, ranges_(ranges)
+, total_bytes_(0)
+, max_in_flight_(max_in_flight > 0 ? max_in_flight : 1)
+, chunk_size_(chunk_size > 0 ? chunk_size : 1024 * 1024)
+, output_(output)
+, pool_(pool)
+, ranges_per_request_(1)
+, request_count_(0)
+, one_at_a_time_(false)
+, failed_(false)
+, in_flight_(0)
+, waiting_(0)
+, retries_(0)
+, finished_bytes_(0)
+{
+    for (const ByteRange& range: ranges_) {
+        total_bytes_ += range.length();
+    }
+}
+
+RangeScheduler::~RangeScheduler()
+{
+    for (HTTPGet* request: active_) {
+        delete request;
+    }
+}
+
+void RangeScheduler::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Fill each request up to the range or byte limit, in file order.  A range that is
+    // bigger than a request is split, and its pieces go in requests of their own.
+    Task task;
+    int64_t task_bytes = 0;
+    for (const ByteRange& range: ranges_) {
+        for (int64_t first = range.first; first <= range.last; first += chunk_size_) {
+            ByteRange piece(first, std::min(range.last, first + chunk_size_ - 1));
+            if (!task.ranges.empty() && (task.ranges.size() >= static_cast<size_t>(ranges_per_request_) ||
+                                         task_bytes + piece.length() > chunk_size_)) {
+                ready_.push_back(task);
+                task = Task();
+                task_bytes = 0;
+            }
+            task.ranges.push_back(piece);
+            task_bytes += piece.length();
+        }
+    }
+    if (!task.ranges.empty()) {
+        ready_.push_back(task);
+    }
+    request_count_ = ready_.size();
+    LogMessage() << "Getting " << ranges_.size() << " ranges (" << total_bytes_ << " bytes) in " << request_count_ << " requests";
+
+    if (progress_handler_) {
+        progress_handler_(0, false);
+        progress_timer_.reset(new boost::asio::deadline_timer(io_service_));
+        progress_timer_->expires_from_now(boost::posix_time::milliseconds(PROGRESS_INTERVAL_MS));
+        progress_timer_->async_wait(boost::bind(&RangeScheduler::show_progress, this, boost::asio::placeholders::error));
+    }
+    launch();
+}
+
+bool RangeScheduler::succeeded()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !failed_ && done() && finished_bytes_ == total_bytes_;
+}
+
+/*
+ * Start requests until the window is full or there are none left.  Must be called with
+ * mutex_ held.
+ */
+void RangeScheduler::launch()
+{
+    while (!failed_ && in_flight_ < max_in_flight_ && !ready_.empty()) {
+        Task task = ready_.front();
+        ready_.pop_front();
+        if (one_at_a_time_ && task.ranges.size() > 1) {
+            ask_one_at_a_time(task);
+            continue;
+        }
+        launch_task(task);
+    }
+}
+
+/*
+ * Create and start the request for some ranges.  Must be called with mutex_ held.
+ */
+void RangeScheduler::launch_task(const Task& task)
+{
+    HTTPGet* request = new HTTPGet(io_service_, url_.getServer(), url_.getPath(), url_.getPort(), task.ranges.front().first,
+                                   task.ranges.back().last, output_);
+    if (task.ranges.size() > 1) {
+        request->setRanges(task.ranges);
+    }
+    setup_request(*request, url_, pool_);
+    request->setCompletionHandler(boost::bind(&RangeScheduler::handle_complete, this, _1));
+    active_.insert(request);
+    request_task_[request] = task;
+    in_flight_++;
+    io_service_.post(boost::bind(&HTTPGet::start, request));
+}
+
+void RangeScheduler::handle_complete(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Task task = request_task_[request];
+    request_task_.erase(request);
+    in_flight_--;
+    if (metrics_) {
+        metrics_->add(*request, url_.getURL());
+    }
+
+    if (request->rangesRefused()) {
+        ask_one_at_a_time(task);
+    } else if (request->getResponse().status_code == 200 && task.ranges.front().first > 0) {
+        // Asking again would only get the whole file again
+        if (!failed_) {
+            LogMessage() << "Error: the server does not send ranges of " << url_.getURL();
+        }
+        failed_ = true;
+        ready_.clear();
+    } else if (request->failedPermanently()) {
+        // Asking again would get the same error
+        if (!failed_) {
+            LogMessage() << "Error: giving up on " << url_.getURL();
+        }
+        failed_ = true;
+        ready_.clear();
+    } else {
+        // Whatever did not arrive is asked for again, whether the request failed or the
+        // server just left some of the ranges out
+        Task missing;
+        missing.retries = task.retries;
+        for (size_t i = 0; i < task.ranges.size(); i++) {
+            const ByteRange& range = task.ranges[i];
+            int64_t written = request->getRanges().empty() ? request->getBytesWritten() : request->getRangeBytesWritten(i);
+            finished_bytes_ += written;
+            if (written < range.length()) {
+                missing.ranges.push_back(ByteRange(range.first + written, range.last));
+            }
+        }
+        if (!missing.ranges.empty()) {
+            retry(missing);
+        }
+    }
+
+    // The request is still on the call stack, so delete it later
+    io_service_.post(boost::bind(&RangeScheduler::release, this, request));
+    launch();
+    if (done() && progress_timer_) {
+        io_service_.post(boost::bind(&RangeScheduler::finished, this));
+    }
+}
+
+/*
+ * The server sent the whole file instead of several ranges, so from now on ask for each
+ * range on its own.  The ranges of the request go first.  Must be called with mutex_ held.
+ */
+void RangeScheduler::ask_one_at_a_time(const Task& task)
+{
+    if (!one_at_a_time_) {
+        LogMessage() << "The server does not send several ranges at once - asking for them one at a time";
+        one_at_a_time_ = true;
+    }
+    for (RangeList::const_reverse_iterator it = task.ranges.rbegin(); it != task.ranges.rend(); ++it) {
+        Task single;
+        single.retries = task.retries;
+        single.ranges.push_back(*it);
+        ready_.push_front(single);
+    }
+}
+
+/*
+ * Request the ranges that did not arrive, after a backoff.  Must be called with mutex_ held.
+ */
+void RangeScheduler::retry(const Task& failed)
+{
+    if (failed.retries >= max_range_retries_ || retries_ >= max_total_retries_) {
+        LogMessage() << "Error: giving up on " << describe(failed.ranges) << " of " << url_.getURL() << " after " << retries_ <<
+            " retries";
+        failed_ = true;
+        ready_.clear();
+        return;
+    }
+    Task task(failed);
+    task.retries++;
+    retries_++;
+
+    int delay = backoff(task.retries);
+    LogMessage() << "Retrying " << describe(task.ranges) << " in " << delay << "ms (retry " << task.retries << " of " <<
+        max_range_retries_ << ")";
+
+    std::shared_ptr<boost::asio::deadline_timer> timer(new boost::asio::deadline_timer(io_service_));
+    timer->expires_from_now(boost::posix_time::milliseconds(delay));
+    timer->async_wait(boost::bind(&RangeScheduler::handle_backoff, this, timer, task));
+    waiting_++;
+}
+
+void RangeScheduler::handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Task task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_--;
+    if (!failed_) {
+        // Retries go ahead of the requests that have not started yet
+        ready_.push_front(task);
+        launch();
+    }
+    if (done() && progress_timer_) {
+        io_service_.post(boost::bind(&RangeScheduler::finished, this));
+    }
+}
+
+/*
+ * Count the bytes written so far, including the running requests' progress.  Must be
+ * called with mutex_ held.
+ */
+int64_t RangeScheduler::bytes_done()
+{
+    int64_t bytes = finished_bytes_;
+    for (std::map<HTTPGet*, Task>::const_iterator it = request_task_.begin(); it != request_task_.end(); ++it) {
+        bytes += it->first->getBytesWritten();
+    }
+    return bytes;
+}
+
+/*
+ * Find out whether there is nothing running or left to run.  Must be called with mutex_ held.
+ */
+bool RangeScheduler::done()
+{
+    return in_flight_ == 0 && waiting_ == 0 && ready_.empty();
+}
+
+/*
+ * Report the progress.  It is reported with mutex_ held, so that it is never reported
+ * again after the final count.
+ */
+void RangeScheduler::show_progress(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done()) {
+            return;
+        }
+        progress_handler_(bytes_done(), false);
+    }
+    progress_timer_->expires_from_now(boost::posix_time::milliseconds(PROGRESS_INTERVAL_MS));
+    progress_timer_->async_wait(boost::bind(&RangeScheduler::show_progress, this, boost::asio::placeholders::error));
+}
+
+/*
+ * Stop the progress timer, so the io_service runs out of work, and report the final count
+ */
+void RangeScheduler::finished()
+{
+    boost::system::error_code ignored;
+    progress_timer_->cancel(ignored);
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_handler_(bytes_done(), true);
+}
+
+void RangeScheduler::release(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_.erase(request);
+    delete request;
+}
@@ -0,0 +1,165 @@
+#ifndef __multiget_range_scheduler_include__
+#define __multiget_range_scheduler_include__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+#include "url.h"
+#include "rangelist.h"
+#include "schedulerbase.h"
+
+class HTTPGet;
+class Sink;
+class ConnectionPool;
+
+/*! \brief Download a list of arbitrary ranges of a file, several to a request
+ *
+ *  The Scheduler splits a whole file evenly.  When only scattered pieces of a big file are
+ *  wanted (e.g. the index blocks of an archive) a request for each piece would spend most
+ *  of its time on the round trip, so the RangeScheduler asks for up to ranges_per_request
+ *  of them, and up to chunk_size bytes, in one request (see HTTPGet::setRanges).  A range
+ *  bigger than the chunk size is split into chunk-sized requests of its own, so big ranges
+ *  still download in parallel.  Every range is written at its own offset in the output.
+ *
+ *  If the server answers a request for several ranges with the whole file, that request and
+ *  every one after it asks for one range at a time instead.  If it answers a single range
+ *  with the whole file too, the download fails.
+ *
+ *  A request that fails, or that is answered without some of its ranges, is retried after
+ *  a backoff for only the bytes that did not arrive.  The number of retries is limited for
+ *  each request and for the download as a whole.
+ *
+ *  The requests may run on several threads at once.
+ */
+class RangeScheduler : public SchedulerBase {
+public:
+    // Called with the number of bytes written so far, and whether that is the final count
+    typedef boost::function<void (int64_t bytes_done, bool finished)> progress_handler;
+
+    /**
+     *   @brief  Create a RangeScheduler object.
+     *
+     *   @param  io_service The io_service that runs the requests
+     *   @param  url The file
+     *   @param  ranges The ranges of it to get, sorted and not overlapping (see mergeRanges)
+     *   @param  max_in_flight Maximum number of requests running at once
+     *   @param  chunk_size Most bytes to ask for in one request
+     *   @param  output Where the ranges are written, each at its offset
+     *   @param  pool Persistent connections to reuse, or NULL to use one connection per request
+     *
+     *   @return RangeScheduler object
+     */
+    RangeScheduler(boost::asio::io_service& io_service, const URL& url, const RangeList& ranges, int max_in_flight,
+                   int64_t chunk_size, Sink* output, ConnectionPool* pool);
+    virtual ~RangeScheduler();
+
+    /**
+     *   @brief  Set the most ranges to ask for in one request (must be called before start)
+     *
+     *   @param  ranges_per_request 1 to ask for every range on its own
+     *
+     *   @return void
+     */
+    void setRangesPerRequest(int ranges_per_request) { ranges_per_request_ = ranges_per_request > 0 ? ranges_per_request : 1; }
+
+    /**
+     *   @brief  Report the progress of the download (must be called before start)
+     *
+     *   The handler is called when the download starts, a couple of times a second while
+     *   it runs, and once more when the last request is done.
+     *
+     *   @param  handler Function to call, or an empty function for none
+     *
+     *   @return void
+     */
+    void setProgressHandler(const progress_handler& handler) { progress_handler_ = handler; }
+
+    /**
+     *   @brief  Group the ranges into requests and start the first window of them.  They
+     *          run when the io_service is run, which returns once every range is done.
+     *
+     *   @return void
+     */
+    void start();
+
+    /**
+     *   @brief  Get the number of requests the ranges were grouped into by start
+     *
+     *   @return request count, not counting retries
+     */
+    size_t getRequestCount() { return request_count_; }
+
+    /**
+     *   @brief  Get the number of bytes in all of the ranges
+     *
+     *   @return byte count
+     */
+    int64_t getTotalBytes() { return total_bytes_; }
+
+    /**
+     *   @brief  Find out whether every range was downloaded
+     *
+     *   @return true if every byte of every range was written
+     */
+    bool succeeded();
+
+private:
+    /*
+     * Ranges to get in one request
+     */
+    struct Task {
+        Task() : retries(0) {}
+        RangeList   ranges;
+        int         retries; // number of times the request has been retried
+    };
+
+    void launch();
+    void launch_task(const Task& task);
+    void handle_complete(HTTPGet* request);
+    void ask_one_at_a_time(const Task& task);
+    void retry(const Task& task);
+    void handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Task task);
+    void show_progress(const boost::system::error_code& err);
+    void finished();
+    int64_t bytes_done();
+    bool done();
+    void release(HTTPGet* request);
+
+    boost::asio::io_service&    io_service_;
+    URL                         url_;
+    RangeList                   ranges_;
+    int64_t                     total_bytes_; // bytes in ranges_
+    int                         max_in_flight_;
+    int64_t                     chunk_size_;
+    Sink*                       output_;
+    ConnectionPool*             pool_;
+    int                         ranges_per_request_;
+    progress_handler            progress_handler_; // may be empty
+    std::shared_ptr<boost::asio::deadline_timer> progress_timer_; // calls progress_handler_
+    size_t                      request_count_;
+
+    std::mutex                  mutex_; // protects everything below
+    std::deque<Task>            ready_; // requests to start, retries first
+    std::map<HTTPGet*, Task>    request_task_; // the ranges each running request was started for
+    std::set<HTTPGet*>          active_; // requests that have not been deleted
+    bool                        one_at_a_time_; // the server does not send several ranges at once
+    bool                        failed_; // a range ran out of retries, or cannot be downloaded at all
+    int                         in_flight_;
+    int                         waiting_; // retries waiting for their backoff to expire
+    int                         retries_; // retries so far
+    int64_t                     finished_bytes_; // bytes written by finished requests
+
+    // Ensure that these method are not created explicitly
+    RangeScheduler(const RangeScheduler& in); // not implemented
+    RangeScheduler& operator = (const RangeScheduler &t); // not implemented
+};
+
+#endif // __multiget_range_scheduler_include__
@@ -0,0 +1,621 @@
+#include "rangeserver.h"
+
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string.hpp>
+
+using boost::asio::ip::tcp;
+
+// Length of the pattern the generated file repeats.  It is prime so that no chunk size
+// lines up with it.
+static const size_t PATTERN_SIZE = 1048573;
+// Most body bytes passed to each write
+static const size_t SEND_SIZE = 65536;
+// Separates the parts of a multipart/byteranges body
+static const char BOUNDARY[] = "rangeserver-boundary";
+
+/*
+ * The pattern is followed by a copy of its first SEND_SIZE bytes so that a whole write can
+ * always be taken from one place, wherever it starts.
+ */
+static std::vector<char> make_pattern()
+{
+    std::vector<char> bytes(PATTERN_SIZE + SEND_SIZE);
+    uint32_t state = 2463534242u; // xorshift32
+    for (size_t i = 0; i < PATTERN_SIZE; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        bytes[i] = static_cast<char>(state >> 24);
+    }
+    std::copy(bytes.begin(), bytes.begin() + SEND_SIZE, bytes.begin() + PATTERN_SIZE);
+    return bytes;
+}
+
+const char* RangeServer::getPattern(int64_t offset, size_t& length)
+{
+    static const std::vector<char> pattern(make_pattern());
+    size_t position = static_cast<size_t>(offset % PATTERN_SIZE);
+    length = pattern.size() - position;
+    return &pattern[position];
+}
+
+bool RangeServer::checkFile(const std::string& filename, int64_t size)
+{
+    std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!input) {
+        return false;
+    }
+    std::vector<char> buffer(1024 * 1024);
+    int64_t offset = 0;
+    while (input) {
+        input.read(&buffer[0], buffer.size());
+        size_t count = static_cast<size_t>(input.gcount());
+        if (offset + static_cast<int64_t>(count) > size) {
+            return false;
+        }
+        // Compare a piece at a time, as the pattern wraps around
+        size_t checked = 0;
+        while (checked < count) {
+            size_t available;
+            const char* expected = getPattern(offset, available);
+            size_t length = std::min(available, count - checked);
+            if (!std::equal(expected, expected + length, buffer.begin() + checked)) {
+                return false;
+            }
+            checked += length;
+            offset += length;
+        }
+    }
+    return offset == size;
+}
+
+RangeServer::Options::Options()
+: file_size(64 * 1024 * 1024)
+, latency_ms(0)
+, rate(0)
+, fail_rate(0.0)
+, error_rate(0.0)
+, max_requests(0)
+, ranges(true)
+, multi_ranges(true)
+, seed(1)
+{
+}
+
+/*! \brief One client connection, answering its requests one after another
+ */
+class RangeServer::Connection : public std::enable_shared_from_this<RangeServer::Connection> {
+public:
+    Connection(boost::asio::io_service& io_service, RangeServer& server);
+
+    tcp::socket& socket() { return socket_; }
+    void start();
+
+private:
+    /*
+     * A piece of a multipart body: either text (a boundary and part headers) or a range
+     * of the file
+     */
+    struct Piece {
+        std::string     text;
+        int64_t         start; // first byte of the file, if there is no text
+        int64_t         length;
+    };
+
+    void read_request();
+    void handle_read_request(const boost::system::error_code& err);
+    void parse_range(const std::string& range);
+    bool parse_spec(const std::string& spec, int64_t& start, int64_t& end);
+    void make_multipart(const std::vector<std::pair<int64_t, int64_t> >& ranges);
+    void make_chunked();
+    void handle_latency(const boost::system::error_code& err);
+    void send_headers();
+    void handle_write_headers(const boost::system::error_code& err);
+    void send_body();
+    void handle_rate_limit(const boost::system::error_code& err);
+    void write_body();
+    void handle_write_body(const boost::system::error_code& err, size_t bytes_transferred);
+    void finish(bool completed);
+
+    RangeServer&                    server_;
+    const Options&                  options_;
+    tcp::socket                     socket_;
+    boost::asio::deadline_timer     timer_;
+    boost::asio::streambuf          request_;
+    std::string                     headers_;
+    bool                            keep_alive_;
+    bool                            head_; // HEAD request, no body
+    int                             status_;
+    bool                            counted_; // the request counts against max_requests
+    int64_t                         start_;
+    int64_t                         length_;
+    int64_t                         sent_;
+    int64_t                         cut_at_; // body bytes to send before failing, -1 to send them all
+    std::vector<Piece>              pieces_; // the body, if it is multipart or chunked
+    bool                            chunked_; // pieces_ is the range in one chunk, with options_.transfer_coding
+    size_t                          piece_; // the piece being sent
+    int64_t                         piece_start_; // where in the body pieces_[piece_] starts
+    std::chrono::steady_clock::time_point received_;
+    std::chrono::steady_clock::time_point body_started_;
+};
+
+RangeServer::Connection::Connection(boost::asio::io_service& io_service, RangeServer& server)
+: server_(server)
+, options_(server.options_)
+, socket_(io_service)
+, timer_(io_service)
+, keep_alive_(true)
+, head_(false)
+, status_(0)
+, counted_(false)
+, start_(0)
+, length_(0)
+, sent_(0)
+, cut_at_(-1)
+, chunked_(false)
+, piece_(0)
+, piece_start_(0)
+{
+}
+
+void RangeServer::Connection::start()
+{
+    boost::system::error_code ignored;
+    socket_.set_option(tcp::no_delay(true), ignored);
+    read_request();
+}
+
+void RangeServer::Connection::read_request()
+{
+    boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+                                  boost::bind(&Connection::handle_read_request, shared_from_this(),
+                                              boost::asio::placeholders::error));
+}
+
+void RangeServer::Connection::handle_read_request(const boost::system::error_code& err)
+{
+    if (err) {
+        // The client closed the connection (or sent rubbish)
+        return;
+    }
+    received_ = std::chrono::steady_clock::now();
+
+    // Only the headers are consumed, anything after them is the next request
+    std::istream stream(&request_);
+    std::string line;
+    std::getline(stream, line);
+    std::string method, path, version;
+    std::istringstream(line) >> method >> path >> version;
+    keep_alive_ = (version == "HTTP/1.1");
+    head_ = (method == "HEAD");
+
+    std::string range;
+    while (std::getline(stream, line) && line != "\r") {
+        std::string::size_type colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+        std::string value = boost::algorithm::trim_copy(line.substr(colon + 1));
+        if (name == "range") {
+            range = value;
+        } else if (name == "connection") {
+            boost::algorithm::to_lower(value);
+            if (value == "close") {
+                keep_alive_ = false;
+            } else if (value == "keep-alive") {
+                keep_alive_ = true;
+            }
+        }
+    }
+
+    start_ = 0;
+    length_ = 0;
+    sent_ = 0;
+    cut_at_ = -1;
+    pieces_.clear();
+    chunked_ = false;
+    piece_ = 0;
+    piece_start_ = 0;
+    counted_ = false;
+    if (method != "GET" && !head_) {
+        status_ = 501;
+        keep_alive_ = false;
+    } else if (server_.random() < options_.error_rate) {
+        status_ = 503;
+    } else if (!server_.begin_request()) {
+        status_ = 429;
+    } else {
+        counted_ = true;
+        status_ = 200;
+        length_ = options_.file_size;
+        if (options_.ranges && !range.empty()) {
+            parse_range(range);
+        }
+        if (!options_.transfer_coding.empty() && pieces_.empty() && length_ > 0) {
+            make_chunked();
+        }
+        if (!head_ && length_ > 0 && server_.random() < options_.fail_rate) {
+            cut_at_ = static_cast<int64_t>(server_.random() * length_);
+        }
+    }
+
+    if (options_.latency_ms > 0) {
+        timer_.expires_from_now(boost::posix_time::milliseconds(options_.latency_ms));
+        timer_.async_wait(boost::bind(&Connection::handle_latency, shared_from_this(),
+                                      boost::asio::placeholders::error));
+    } else {
+        send_headers();
+    }
+}
+
+/*
+ * Handle "bytes=first-last", "bytes=first-" and "bytes=-suffix", or a list of them.
+ * Ranges that cannot be satisfied are left out, and if that leaves none the answer is 416.
+ * A list is answered with a multipart/byteranges body, or with the whole file if
+ * multi_ranges is off, which a server is allowed to do.
+ */
+void RangeServer::Connection::parse_range(const std::string& range)
+{
+    if (range.compare(0, 6, "bytes=") != 0) {
+        return;
+    }
+    std::vector<std::string> specs;
+    boost::algorithm::split(specs, range.substr(6), boost::algorithm::is_any_of(","));
+    if (specs.size() > 1 && !options_.multi_ranges) {
+        return;
+    }
+    std::vector<std::pair<int64_t, int64_t> > ranges;
+    for (const std::string& spec: specs) {
+        int64_t start, end;
+        if (!parse_spec(spec, start, end)) {
+            // Not a byte range at all, so the header is ignored
+            return;
+        }
+        if (start < options_.file_size && end >= start) {
+            ranges.push_back(std::make_pair(start, end));
+        }
+    }
+    if (ranges.empty()) {
+        status_ = 416;
+        length_ = 0;
+        return;
+    }
+    status_ = 206;
+    start_ = ranges[0].first;
+    if (ranges.size() == 1) {
+        length_ = ranges[0].second - ranges[0].first + 1;
+    } else {
+        make_multipart(ranges);
+    }
+}
+
+/*
+ * Read one range of a Range header, with the last byte limited to the end of the file
+ */
+bool RangeServer::Connection::parse_spec(const std::string& spec, int64_t& start, int64_t& end)
+{
+    std::string::size_type dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return false;
+    }
+    std::string first = boost::algorithm::trim_copy(spec.substr(0, dash));
+    std::string last = boost::algorithm::trim_copy(spec.substr(dash + 1));
+    if (first.empty()) {
+        if (last.empty()) {
+            return false;
+        }
+        int64_t suffix = strtoll(last.c_str(), NULL, 10);
+        start = std::max<int64_t>(0, options_.file_size - suffix);
+        end = options_.file_size - 1;
+    } else {
+        start = strtoll(first.c_str(), NULL, 10);
+        end = last.empty() ? options_.file_size - 1 : std::min<int64_t>(strtoll(last.c_str(), NULL, 10), options_.file_size - 1);
+    }
+    return true;
+}
+
+/*
+ * Lay out the body for several ranges: each one after a boundary and its own
+ * Content-Range, then the closing boundary
+ */
+void RangeServer::Connection::make_multipart(const std::vector<std::pair<int64_t, int64_t> >& ranges)
+{
+    length_ = 0;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        std::ostringstream out;
+        out << (i == 0 ? "" : "\r\n") << "--" << BOUNDARY << "\r\n";
+        out << "Content-Type: application/octet-stream\r\n";
+        out << "Content-Range: bytes " << ranges[i].first << "-" << ranges[i].second << "/" << options_.file_size << "\r\n\r\n";
+        Piece text = { out.str(), 0, 0 };
+        text.length = text.text.size();
+        Piece data = { std::string(), ranges[i].first, ranges[i].second - ranges[i].first + 1 };
+        pieces_.push_back(text);
+        pieces_.push_back(data);
+        length_ += text.length + data.length;
+    }
+    Piece close = { std::string("\r\n--") + BOUNDARY + "--\r\n", 0, 0 };
+    close.length = close.text.size();
+    pieces_.push_back(close);
+    length_ += close.length;
+}
+
+/*
+ * Lay out the body as a single chunk followed by the last (empty) chunk
+ */
+void RangeServer::Connection::make_chunked()
+{
+    std::ostringstream size;
+    size << std::hex << length_ << "\r\n";
+    Piece open = { size.str(), 0, 0 };
+    open.length = open.text.size();
+    Piece data = { std::string(), start_, length_ };
+    Piece close = { std::string("\r\n0\r\n\r\n"), 0, 0 };
+    close.length = close.text.size();
+    pieces_.push_back(open);
+    pieces_.push_back(data);
+    pieces_.push_back(close);
+    length_ = open.length + data.length + close.length;
+    chunked_ = true;
+}
+
+void RangeServer::Connection::handle_latency(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    send_headers();
+}
+
+void RangeServer::Connection::send_headers()
+{
+    std::ostringstream out;
+    out << "HTTP/1.1 " << status_ << " ";
+    switch (status_) {
+        case 200: out << "OK"; break;
+        case 206: out << "Partial Content"; break;
+        case 416: out << "Range Not Satisfiable"; break;
+        case 501: out << "Not Implemented"; break;
+        case 429: out << "Too Many Requests"; break;
+        default: out << "Service Unavailable"; break;
+    }
+    out << "\r\n";
+    // The range itself, without the chunk framing
+    int64_t range_length = chunked_ ? pieces_[1].length : length_;
+    if (chunked_) {
+        out << "Transfer-Encoding: " << options_.transfer_coding << ", chunked\r\n";
+    } else {
+        out << "Content-Length: " << length_ << "\r\n";
+    }
+    if (!pieces_.empty() && !chunked_) {
+        out << "Content-Type: multipart/byteranges; boundary=" << BOUNDARY << "\r\n";
+    } else if (status_ == 200 || status_ == 206) {
+        out << "Content-Type: application/octet-stream\r\n";
+    }
+    if (status_ == 200 || status_ == 206) {
+        out << "ETag: \"rangeserver-" << options_.file_size << "\"\r\n";
+        out << "Last-Modified: Thu, 01 Jan 2015 00:00:00 GMT\r\n";
+    }
+    if (status_ == 206 && (pieces_.empty() || chunked_)) {
+        out << "Content-Range: bytes " << start_ << "-" << (start_ + range_length - 1) << "/" << options_.file_size << "\r\n";
+    } else if (status_ == 416) {
+        out << "Content-Range: bytes */" << options_.file_size << "\r\n";
+    } else if (status_ == 503 || status_ == 429) {
+        out << "Retry-After: 1\r\n";
+    }
+    if (options_.ranges) {
+        out << "Accept-Ranges: bytes\r\n";
+    }
+    out << "Connection: " << (keep_alive_ ? "keep-alive" : "close") << "\r\n";
+    out << "\r\n";
+    headers_ = out.str();
+
+    boost::asio::async_write(socket_, boost::asio::buffer(headers_),
+                             boost::bind(&Connection::handle_write_headers, shared_from_this(),
+                                         boost::asio::placeholders::error));
+}
+
+void RangeServer::Connection::handle_write_headers(const boost::system::error_code& err)
+{
+    if (err) {
+        finish(false);
+        return;
+    }
+    if (head_) {
+        finish(true);
+        return;
+    }
+    body_started_ = std::chrono::steady_clock::now();
+    send_body();
+}
+
+void RangeServer::Connection::send_body()
+{
+    if (sent_ == length_) {
+        finish(true);
+        return;
+    }
+    if (cut_at_ >= 0 && sent_ >= cut_at_) {
+        // Pretend the connection broke
+        finish(false);
+        return;
+    }
+    if (options_.rate > 0) {
+        // Send nothing until the bytes already sent are within the limit
+        std::chrono::steady_clock::time_point due = body_started_ +
+            std::chrono::microseconds(sent_ * 1000000 / options_.rate);
+        std::chrono::steady_clock::duration wait = due - std::chrono::steady_clock::now();
+        if (wait.count() > 0) {
+            timer_.expires_from_now(boost::posix_time::microseconds(
+                std::chrono::duration_cast<std::chrono::microseconds>(wait).count()));
+            timer_.async_wait(boost::bind(&Connection::handle_rate_limit, shared_from_this(),
+                                          boost::asio::placeholders::error));
+            return;
+        }
+    }
+    write_body();
+}
+
+void RangeServer::Connection::handle_rate_limit(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    write_body();
+}
+
+void RangeServer::Connection::write_body()
+{
+    size_t available;
+    const char* data;
+    if (pieces_.empty()) {
+        data = getPattern(start_ + sent_, available);
+    } else {
+        while (sent_ >= piece_start_ + pieces_[piece_].length) {
+            piece_start_ += pieces_[piece_].length;
+            piece_++;
+        }
+        const Piece& piece = pieces_[piece_];
+        int64_t offset = sent_ - piece_start_;
+        if (piece.text.empty()) {
+            data = getPattern(piece.start + offset, available);
+        } else {
+            data = piece.text.data() + offset;
+            available = piece.text.size() - offset;
+        }
+        available = std::min<int64_t>(available, piece.length - offset);
+    }
+    int64_t length = std::min<int64_t>(std::min(available, SEND_SIZE), length_ - sent_);
+    if (options_.rate > 0) {
+        // Small writes at low rates, so the limit is smooth rather than bursty
+        length = std::min<int64_t>(length, std::max<int64_t>(1024, options_.rate / 20));
+    }
+    if (cut_at_ >= 0) {
+        length = std::min(length, cut_at_ - sent_);
+    }
+    boost::asio::async_write(socket_, boost::asio::buffer(data, static_cast<size_t>(length)),
+                             boost::bind(&Connection::handle_write_body, shared_from_this(),
+                                         boost::asio::placeholders::error,
+                                         boost::asio::placeholders::bytes_transferred));
+}
+
+void RangeServer::Connection::handle_write_body(const boost::system::error_code& err, size_t bytes_transferred)
+{
+    sent_ += bytes_transferred;
+    if (err) {
+        finish(false);
+        return;
+    }
+    send_body();
+}
+
+void RangeServer::Connection::finish(bool completed)
+{
+    RequestStats stats;
+    stats.start = start_;
+    stats.length = length_;
+    stats.bytes_sent = sent_;
+    stats.status = status_;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - received_).count();
+    stats.completed = completed;
+    server_.record(stats);
+    if (counted_) {
+        server_.end_request();
+        counted_ = false;
+    }
+
+    if (completed && keep_alive_) {
+        read_request();
+    } else {
+        boost::system::error_code ignored;
+        socket_.shutdown(tcp::socket::shutdown_both, ignored);
+        socket_.close(ignored);
+    }
+}
+
+RangeServer::RangeServer(boost::asio::io_service& io_service, unsigned short port, const Options& options)
+: io_service_(io_service)
+, acceptor_(io_service)
+, options_(options)
+, random_(options.seed)
+, active_(0)
+{
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    start_accept();
+}
+
+unsigned short RangeServer::getPort()
+{
+    return acceptor_.local_endpoint().port();
+}
+
+std::vector<RangeServer::RequestStats> RangeServer::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void RangeServer::clearStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.clear();
+}
+
+void RangeServer::start_accept()
+{
+    std::shared_ptr<Connection> connection(new Connection(io_service_, *this));
+    acceptor_.async_accept(connection->socket(),
+                           boost::bind(&RangeServer::handle_accept, this, boost::asio::placeholders::error, connection));
+}
+
+void RangeServer::handle_accept(const boost::system::error_code& err, std::shared_ptr<Connection> connection)
+{
+    if (err == boost::asio::error::operation_aborted) {
+        return;
+    }
+    if (!err) {
+        connection->start();
+    }
+    start_accept();
+}
+
+void RangeServer::record(const RequestStats& stats)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.push_back(stats);
+}
+
+/*
+ * Count a request that is about to be served, unless that would go over the limit
+ */
+bool RangeServer::begin_request()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (options_.max_requests > 0 && active_ >= options_.max_requests) {
+        return false;
+    }
+    active_++;
+    return true;
+}
+
+void RangeServer::end_request()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_--;
+}
+
+double RangeServer::random()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random_);
+}
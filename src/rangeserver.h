@@ -0,0 +1,139 @@
+#ifndef __multiget_rangeserver_include__
+#define __multiget_rangeserver_include__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <stdint.h>
+#include <boost/asio.hpp>
+
+/*! \brief Local HTTP/1.1 server that answers range requests for a generated file
+ *
+ *  RangeServer stands in for a real web server when testing and benchmarking multiget on
+ *  one machine without a network.  Every path names the same file, whose bytes are made up
+ *  from a fixed pseudo random pattern so the download can be checked without keeping a copy
+ *  of it (see getPattern).  The file is never held in memory or on disk.
+ *
+ *  Like a slow or unreliable server on the internet, it can wait before each response,
+ *  limit the speed of each connection, cut bodies short, answer 503 and turn away requests
+ *  beyond a limit with 429.
+ *  A list of ranges is answered with a multipart/byteranges body, or optionally with the
+ *  whole file like the many servers that do not send several ranges at once.  Bodies can
+ *  be labelled with a transfer coding such as gzip, to check that clients refuse them.
+ *
+ *  The server listens on the loopback address only.  It runs when its io_service is run,
+ *  which may be on several threads.  Each request is recorded so the time taken to serve
+ *  each chunk can be reported.
+ */
+class RangeServer {
+public:
+    /*! \brief How the server behaves
+     */
+    struct Options {
+        Options();
+        int64_t     file_size; // size of the generated file in bytes
+        int         latency_ms; // wait before each response is sent
+        int64_t     rate; // most bytes per second sent on each connection, 0 for no limit
+        double      fail_rate; // chance of closing the connection part way through a body
+        double      error_rate; // chance of answering 503 Service Unavailable
+        int         max_requests; // most requests served at once, the rest get 429 Too Many Requests (0 for no limit)
+        bool        ranges; // false to ignore Range headers like a server that does not support them
+        bool        multi_ranges; // false to answer a list of ranges with the whole file, as many servers do
+        std::string transfer_coding; // sent as "Transfer-Encoding: <coding>, chunked" with the body in one chunk,
+                                     // and not actually applied (empty to send the body as it is)
+        unsigned    seed; // for the failures, so that a run can be repeated
+    };
+
+    /*! \brief What happened to one request
+     */
+    struct RequestStats {
+        int64_t     start; // first byte asked for
+        int64_t     length; // number of bytes in the response body
+        int64_t     bytes_sent; // number of body bytes sent before the response ended
+        int         status; // HTTP status code
+        double      seconds; // from the end of the request headers to the end of the response
+        bool        completed; // false if the body was cut short
+    };
+
+    /**
+     *   @brief  Create a RangeServer and start accepting connections
+     *
+     *   @param  io_service
+     *   @param  port Port to listen on, 0 for any free port
+     *   @param  options How the server behaves
+     *
+     *   @return RangeServer object
+     */
+    RangeServer(boost::asio::io_service& io_service, unsigned short port, const Options& options);
+    virtual ~RangeServer() {}
+
+    /**
+     *   @brief  Get the port the server is listening on
+     *
+     *   @return port number
+     */
+    unsigned short getPort();
+
+    /**
+     *   @brief  Get a record of every request that has been answered
+     *
+     *   @return requests in the order they finished
+     */
+    std::vector<RequestStats> getStats();
+
+    /**
+     *   @brief  Forget the requests answered so far, e.g. between benchmark runs
+     *
+     *   @return void
+     */
+    void clearStats();
+
+    /**
+     *   @brief  Get the bytes of the generated file starting at an offset
+     *
+     *   The file repeats a pattern whose length is not a power of two, so a chunk written
+     *   to the wrong offset shows up as a mismatch.
+     *
+     *   @param  offset Position in the file
+     *   @param  length Receives the number of bytes available from the returned pointer
+     *
+     *   @return pointer to the bytes, valid for the lifetime of the program
+     */
+    static const char* getPattern(int64_t offset, size_t& length);
+
+    /**
+     *   @brief  Check that a file holds the generated bytes
+     *
+     *   @param  filename File to check
+     *   @param  size Expected size in bytes
+     *
+     *   @return true if the file has the expected size and contents
+     */
+    static bool checkFile(const std::string& filename, int64_t size);
+
+private:
+    class Connection;
+    friend class Connection;
+
+    void start_accept();
+    void handle_accept(const boost::system::error_code& err, std::shared_ptr<Connection> connection);
+    void record(const RequestStats& stats);
+    bool begin_request();
+    void end_request();
+    double random();
+
+    boost::asio::io_service&        io_service_;
+    boost::asio::ip::tcp::acceptor  acceptor_;
+    Options                         options_;
+    std::mutex                      mutex_; // protects everything below
+    std::mt19937                    random_;
+    std::vector<RequestStats>       stats_;
+    int                             active_; // requests being served, counted against max_requests
+
+    // Ensure that these method are not created explicitly
+    RangeServer(const RangeServer& in); // not implemented
+    RangeServer& operator = (const RangeServer &t); // not implemented
+};
+
+#endif // __multiget_rangeserver_include__
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include "rangeserver.h"
+
+/*
+ * Serve the generated file on the loopback address until killed, e.g. to try multiget
+ * by hand against a slow or unreliable server:
+ *
+ *   ./rangeserver --port 8080 --latency 50 --rate 1000000 &
+ *   ./multiget -p -c 8 http://127.0.0.1:8080/file
+ */
+int main(int argc, char* argv[])
+{
+    RangeServer::Options options;
+    int port = 8080;
+    int threads = 1;
+    po::options_description desc("Usage: ./rangeserver [OPTIONS]");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("port,P", po::value<int>(&port), "Port to listen on (default is 8080, 0 for any free port)")
+        ("size,s", po::value<int64_t>(&options.file_size), "Size of the generated file in bytes (default is 67108864)")
+        ("latency,l", po::value<int>(&options.latency_ms), "Milliseconds to wait before each response (default is 0)")
+        ("rate,r", po::value<int64_t>(&options.rate), "Most bytes per second sent on each connection (default is no limit)")
+        ("fail-rate,f", po::value<double>(&options.fail_rate), "Chance of cutting a response body short (default is 0)")
+        ("error-rate,e", po::value<double>(&options.error_rate), "Chance of answering 503 Service Unavailable (default is 0)")
+        ("max-requests,m", po::value<int>(&options.max_requests),
+         "Most requests to serve at once, the rest are answered 429 Too Many Requests (default is no limit)")
+        ("no-ranges,n", "Ignore Range headers and always send the whole file")
+        ("no-multi-ranges", "Answer a request for several ranges with the whole file")
+        ("transfer-coding", po::value<std::string>(&options.transfer_coding),
+         "Send bodies chunked and labelled with this transfer coding as well, e.g. gzip (it is not actually applied)")
+        ("seed", po::value<unsigned>(&options.seed), "Seed for the failures (default is 1)")
+        ("threads,t", po::value<int>(&threads), "Number of threads serving connections (default is 1)");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    if (vm.count("no-ranges")) {
+        options.ranges = false;
+    }
+    if (vm.count("no-multi-ranges")) {
+        options.multi_ranges = false;
+    }
+    if (port < 0 || port > 65535 || options.file_size < 0 || options.latency_ms < 0 || options.rate < 0 || options.max_requests < 0 ||
+        threads <= 0) {
+        std::cout << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        boost::asio::io_service io_service;
+        RangeServer server(io_service, static_cast<unsigned short>(port), options);
+        std::cout << "Serving " << options.file_size << " bytes on http://127.0.0.1:" << server.getPort() << "/" << std::endl;
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; i++) {
+            workers.push_back(std::thread([&io_service]() { io_service.run(); }));
+        }
+        io_service.run();
+        for (std::thread& t: workers) {
+            t.join();
+        }
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
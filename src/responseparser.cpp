@@ -0,0 +1,557 @@
+#include "responseparser.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MULTIGET_HAVE_SSE2 1
+#endif
+
+/*
+ * Find the next '\n' between p and end, or NULL if there is none
+ */
+static const char* find_line_end(const char* p, const char* end)
+{
+#ifdef MULTIGET_HAVE_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    return static_cast<const char*>(memchr(p, '\n', end - p));
+}
+
+static inline char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/*
+ * Compare length bytes with a lower case string, ignoring the case of the bytes
+ */
+static bool equals_ignore_case(const char* data, size_t length, const char* lower)
+{
+    size_t i = 0;
+    for (; i < length && lower[i] != '\0'; i++) {
+        if (to_lower(data[i]) != lower[i]) {
+            return false;
+        }
+    }
+    return i == length && lower[i] == '\0';
+}
+
+/*
+ * Look for a lower case string in length bytes, ignoring the case of the bytes
+ */
+static bool contains_ignore_case(const char* data, size_t length, const char* lower)
+{
+    size_t needle = strlen(lower);
+    for (size_t i = 0; i + needle <= length; i++) {
+        if (equals_ignore_case(data + i, needle, lower)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Read a decimal number and move p past it.  Returns false if there are no digits or the
+ * number does not fit.
+ */
+static bool parse_number(const char*& p, const char* end, int64_t& value)
+{
+    const char* start = p;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (value > (INT64_MAX - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    return p > start;
+}
+
+static void skip_spaces(const char*& p, const char* end)
+{
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+}
+
+/*
+ * "bytes first-last/complete-length", the length may be "*" (complete is -1 then)
+ */
+static bool parse_content_range(const char* p, const char* end, int64_t& first, int64_t& last, int64_t& complete)
+{
+    complete = -1;
+    if (end - p < 6 || !equals_ignore_case(p, 5, "bytes")) {
+        return false;
+    }
+    p += 5;
+    skip_spaces(p, end);
+    if (!parse_number(p, end, first) || p == end || *p++ != '-' ||
+        !parse_number(p, end, last) || p == end || *p++ != '/') {
+        return false;
+    }
+    if (p == end || (*p != '*' && !parse_number(p, end, complete))) {
+        return false;
+    }
+    return last >= first;
+}
+
+ResponseParser::ResponseParser()
+{
+    reset();
+}
+
+void ResponseParser::reset()
+{
+    line_start_ = 0;
+    searched_ = 0;
+    header_length_ = 0;
+    status_code_ = 0;
+    http11_ = false;
+    content_length_ = -1;
+    range_start_ = -1;
+    range_end_ = -1;
+    instance_length_ = -1;
+    transfer_encoding_ = IDENTITY;
+    connection_close_ = false;
+    accept_ranges_ = false;
+    etag_ = 0;
+    etag_length_ = 0;
+    header_count_ = 0;
+}
+
+ResponseParser::Result ResponseParser::parse(const char* data, size_t length)
+{
+    if (header_length_ > 0) {
+        return COMPLETE;
+    }
+    while (true) {
+        const char* end = find_line_end(data + searched_, data + length);
+        if (!end) {
+            searched_ = length;
+            return INCOMPLETE;
+        }
+        size_t next = end - data + 1;
+        size_t line_end = end - data;
+        if (line_end > line_start_ && data[line_end - 1] == '\r') {
+            line_end--;
+        }
+        if (status_code_ == 0) {
+            if (!parse_status_line(data + line_start_, line_end - line_start_)) {
+                return INVALID;
+            }
+        } else if (line_end == line_start_) {
+            header_length_ = next;
+            return COMPLETE;
+        } else if (!parse_header(data, line_start_, line_end)) {
+            return INVALID;
+        }
+        line_start_ = next;
+        searched_ = next;
+    }
+}
+
+void ResponseParser::getContentRange(int64_t& start, int64_t& end, int64_t& instance_length)
+{
+    start = range_start_;
+    end = range_end_;
+    instance_length = instance_length_;
+}
+
+bool ResponseParser::nameIs(const char* data, const Header& header, const char* lower_name)
+{
+    return equals_ignore_case(data + header.name, header.name_length, lower_name);
+}
+
+/*
+ * "HTTP/1.1 206 Partial Content"
+ */
+bool ResponseParser::parse_status_line(const char* line, size_t length)
+{
+    const char* p = line;
+    const char* end = line + length;
+    if (length < 5 || memcmp(p, "HTTP/", 5) != 0) {
+        return false;
+    }
+    p += 5;
+    int64_t major, minor;
+    if (!parse_number(p, end, major) || p == end || *p++ != '.' || !parse_number(p, end, minor)) {
+        return false;
+    }
+    http11_ = major > 1 || (major == 1 && minor >= 1);
+    if (p == end || !is_space(*p)) {
+        return false;
+    }
+    skip_spaces(p, end);
+    int64_t status;
+    const char* digits = p;
+    if (!parse_number(p, end, status) || p - digits != 3 || status < 100 || (p < end && !is_space(*p))) {
+        return false;
+    }
+    status_code_ = static_cast<unsigned int>(status);
+    return true;
+}
+
+/*
+ * Record a "Name: value" line and decode it if it is one multiget needs.  A line without a
+ * colon is ignored.  Returns false if the line is not valid.
+ */
+bool ResponseParser::parse_header(const char* data, size_t start, size_t end)
+{
+    const char* colon = static_cast<const char*>(memchr(data + start, ':', end - start));
+    if (!colon) {
+        return true;
+    }
+    const char* name = data + start;
+    const char* name_end = colon;
+    while (name_end > name && is_space(name_end[-1])) {
+        name_end--;
+    }
+    const char* value = colon + 1;
+    const char* value_end = data + end;
+    skip_spaces(value, value_end);
+    while (value_end > value && is_space(value_end[-1])) {
+        value_end--;
+    }
+    size_t name_length = name_end - name;
+    size_t value_length = value_end - value;
+
+    if (header_count_ < MAX_HEADERS) {
+        Header& header = headers_[header_count_++];
+        header.name = name - data;
+        header.name_length = name_length;
+        header.value = value - data;
+        header.value_length = value_length;
+    }
+
+    // Only the first letter is looked at before the whole name is compared, most headers
+    // go no further than that
+    switch (to_lower(name[0])) {
+        case 'a':
+            if (equals_ignore_case(name, name_length, "accept-ranges")) {
+                accept_ranges_ = contains_ignore_case(value, value_length, "bytes");
+            }
+            break;
+        case 'c':
+            if (equals_ignore_case(name, name_length, "content-length")) {
+                const char* p = value;
+                int64_t length;
+                if (!parse_number(p, value_end, length) || p != value_end) {
+                    return false;
+                }
+                content_length_ = length;
+            } else if (equals_ignore_case(name, name_length, "content-range")) {
+                int64_t first, last, complete;
+                if (parse_content_range(value, value_end, first, last, complete)) {
+                    range_start_ = first;
+                    range_end_ = last;
+                    instance_length_ = complete;
+                }
+            } else if (equals_ignore_case(name, name_length, "connection")) {
+                connection_close_ = contains_ignore_case(value, value_length, "close");
+            }
+            break;
+        case 't':
+            if (equals_ignore_case(name, name_length, "transfer-encoding")) {
+                if (equals_ignore_case(value, value_length, "identity")) {
+                    transfer_encoding_ = IDENTITY;
+                } else if (equals_ignore_case(value, value_length, "chunked")) {
+                    transfer_encoding_ = CHUNKED;
+                } else {
+                    // e.g. "gzip, chunked", the chunks would still have to be decompressed
+                    transfer_encoding_ = OTHER;
+                }
+            }
+            break;
+        case 'e':
+            if (equals_ignore_case(name, name_length, "etag")) {
+                etag_ = value - data;
+                etag_length_ = value_length;
+            }
+            break;
+    }
+    return true;
+}
+
+ChunkedDecoder::ChunkedDecoder()
+{
+    reset();
+}
+
+void ChunkedDecoder::reset()
+{
+    state_ = SIZE;
+    remaining_ = 0;
+    digits_ = 0;
+}
+
+size_t ChunkedDecoder::decode(char* data, size_t length, size_t& payload)
+{
+    payload = 0;
+    size_t i = 0;
+    while (i < length && state_ != DONE && state_ != BROKEN) {
+        char c = data[i];
+        switch (state_) {
+            case SIZE:
+                if ((c >= '0' && c <= '9') || (to_lower(c) >= 'a' && to_lower(c) <= 'f')) {
+                    if (++digits_ > 15) {
+                        state_ = BROKEN;
+                        break;
+                    }
+                    remaining_ = remaining_ * 16 + (c <= '9' ? c - '0' : to_lower(c) - 'a' + 10);
+                    i++;
+                    break;
+                }
+                if (digits_ == 0) {
+                    state_ = BROKEN;
+                    break;
+                }
+                // Anything after the size (";name=value", or spaces) is an extension
+                state_ = EXTENSION;
+                break;
+            case EXTENSION:
+                i++;
+                if (c == '\n') {
+                    state_ = remaining_ > 0 ? DATA : TRAILER;
+                }
+                break;
+            case DATA: {
+                size_t bytes = static_cast<size_t>(std::min<uint64_t>(remaining_, length - i));
+                if (payload != i) {
+                    memmove(data + payload, data + i, bytes);
+                }
+                payload += bytes;
+                i += bytes;
+                remaining_ -= bytes;
+                if (remaining_ == 0) {
+                    state_ = DATA_END;
+                }
+                break;
+            }
+            case DATA_END:
+                i++;
+                if (c == '\n') {
+                    state_ = SIZE;
+                    digits_ = 0;
+                } else if (c != '\r') {
+                    state_ = BROKEN;
+                }
+                break;
+            case TRAILER:
+                i++;
+                if (c == '\n') {
+                    state_ = DONE;
+                } else if (c != '\r') {
+                    state_ = TRAILER_LINE;
+                }
+                break;
+            case TRAILER_LINE:
+                i++;
+                if (c == '\n') {
+                    state_ = TRAILER;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+MultipartDecoder::MultipartDecoder()
+{
+    reset("", 0);
+}
+
+bool MultipartDecoder::reset(const char* boundary, size_t length)
+{
+    state_ = DELIMITER;
+    preamble_ = true;
+    line_length_ = 0;
+    line_truncated_ = false;
+    have_range_ = false;
+    offset_ = 0;
+    remaining_ = 0;
+    delimiter_length_ = 0;
+    if (length == 0 || length > MAX_BOUNDARY) {
+        state_ = BROKEN;
+        return false;
+    }
+    memcpy(delimiter_, "--", 2);
+    memcpy(delimiter_ + 2, boundary, length);
+    delimiter_length_ = length + 2;
+    return true;
+}
+
+size_t MultipartDecoder::decode(const char* data, size_t length, size_t& payload, int64_t& offset)
+{
+    payload = 0;
+    offset = offset_;
+    size_t i = 0;
+    while (i < length) {
+        switch (state_) {
+            case DATA: {
+                // Hand the payload back as it is, there is nothing in it to look at
+                size_t bytes = static_cast<size_t>(std::min<int64_t>(remaining_, length - i));
+                offset = offset_;
+                offset_ += bytes;
+                remaining_ -= bytes;
+                payload = bytes;
+                if (remaining_ == 0) {
+                    state_ = DATA_END;
+                }
+                return i + bytes;
+            }
+            case DONE:
+                // The epilogue
+                return length;
+            case BROKEN:
+                return i;
+            default: {
+                // Everything else is lines, which may arrive a piece at a time
+                const char* end = find_line_end(data + i, data + length);
+                size_t bytes = (end ? end - data : length) - i;
+                size_t room = MAX_LINE - line_length_;
+                if (bytes > room) {
+                    line_truncated_ = true;
+                }
+                memcpy(line_ + line_length_, data + i, std::min(bytes, room));
+                line_length_ += std::min(bytes, room);
+                i += bytes;
+                if (end) {
+                    i++;
+                    end_line();
+                    line_length_ = 0;
+                    line_truncated_ = false;
+                }
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+/*
+ * Act on a whole line: a boundary, a part header, or the line end after a payload
+ */
+void MultipartDecoder::end_line()
+{
+    size_t length = line_length_;
+    while (length > 0 && (line_[length - 1] == '\r' || is_space(line_[length - 1]))) {
+        length--;
+    }
+    switch (state_) {
+        case DATA_END:
+            state_ = (length == 0) ? DELIMITER : BROKEN;
+            break;
+        case DELIMITER:
+            // Spaces after the boundary are allowed (transport padding)
+            if (!line_truncated_ && length >= delimiter_length_ && memcmp(line_, delimiter_, delimiter_length_) == 0) {
+                if (length == delimiter_length_) {
+                    state_ = HEADERS;
+                    have_range_ = false;
+                    preamble_ = false;
+                    break;
+                }
+                if (length == delimiter_length_ + 2 && memcmp(line_ + delimiter_length_, "--", 2) == 0) {
+                    state_ = DONE;
+                    break;
+                }
+            }
+            if (!preamble_) {
+                state_ = BROKEN;
+            }
+            break;
+        case HEADERS: {
+            if (length == 0) {
+                // The payload follows the blank line, and has to say where it goes
+                if (!have_range_) {
+                    state_ = BROKEN;
+                } else {
+                    state_ = (remaining_ > 0) ? DATA : DATA_END;
+                }
+                break;
+            }
+            const char* colon = static_cast<const char*>(memchr(line_, ':', length));
+            if (line_truncated_ || !colon || !equals_ignore_case(line_, colon - line_, "content-range")) {
+                // e.g. Content-Type, which is the same for every part
+                break;
+            }
+            const char* value = colon + 1;
+            skip_spaces(value, line_ + length);
+            int64_t first, last, complete;
+            if (!parse_content_range(value, line_ + length, first, last, complete)) {
+                state_ = BROKEN;
+                break;
+            }
+            offset_ = first;
+            remaining_ = last - first + 1;
+            have_range_ = true;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool MultipartDecoder::getBoundary(const char* content_type, size_t length, size_t& boundary, size_t& boundary_length)
+{
+    // multipart/byteranges; boundary=3d6b6a416f9b5 (or boundary="...")
+    const char* end = content_type + length;
+    const char* type_end = static_cast<const char*>(memchr(content_type, ';', length));
+    if (!type_end) {
+        return false;
+    }
+    const char* type = content_type;
+    const char* type_last = type_end;
+    while (type_last > type && is_space(type_last[-1])) {
+        type_last--;
+    }
+    if (!equals_ignore_case(type, type_last - type, "multipart/byteranges")) {
+        return false;
+    }
+    const char* p = type_end;
+    while (p < end) {
+        p++; // past the ';'
+        skip_spaces(p, end);
+        const char* name = p;
+        const char* parameter_end = static_cast<const char*>(memchr(p, ';', end - p));
+        if (!parameter_end) {
+            parameter_end = end;
+        }
+        const char* equals = static_cast<const char*>(memchr(p, '=', parameter_end - p));
+        if (equals && equals_ignore_case(name, equals - name, "boundary")) {
+            const char* value = equals + 1;
+            const char* value_end = parameter_end;
+            while (value_end > value && is_space(value_end[-1])) {
+                value_end--;
+            }
+            if (value_end - value >= 2 && *value == '"' && value_end[-1] == '"') {
+                value++;
+                value_end--;
+            }
+            boundary = value - content_type;
+            boundary_length = value_end - value;
+            return boundary_length > 0;
+        }
+        p = parameter_end;
+    }
+    return false;
+}
@@ -0,0 +1,344 @@
+#ifndef __multiget_response_parser_include__
+#define __multiget_response_parser_include__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \brief Incremental parser for the status line and headers of an HTTP/1.x response
+ *
+ *  The parser works on the receive buffer itself.  It is handed the whole of the response
+ *  received so far each time more arrives, picks up where it stopped, and says when the
+ *  blank line at the end of the headers has been seen.  Whatever follows the headers in
+ *  the buffer is the start of the body.
+ *
+ *  Line ends are found 16 bytes at a time with SSE2 where it is available.  The headers
+ *  multiget needs (Content-Length, Content-Range, Transfer-Encoding, Connection, ETag and
+ *  Accept-Ranges) are decoded as they are found, and every header is recorded as offsets
+ *  into the buffer so the caller can look at the rest.  Nothing is allocated and nothing is
+ *  copied, so the values are only valid while the buffer holds the response.
+ */
+class ResponseParser {
+public:
+    enum Result {
+        INCOMPLETE, // the end of the headers has not arrived yet
+        COMPLETE, // all of the headers have been parsed
+        INVALID // not an HTTP response, or a Content-Length that is not a number
+    };
+
+    enum TransferEncoding {
+        IDENTITY, // the body is sent as it is
+        CHUNKED, // the body is sent in chunks (see ChunkedDecoder)
+        OTHER // an encoding multiget cannot undo, e.g. gzip
+    };
+
+    /*! \brief Where a header's name and value are in the buffer (the value is trimmed)
+     */
+    struct Header {
+        size_t      name;
+        size_t      name_length;
+        size_t      value;
+        size_t      value_length;
+    };
+
+    // Most headers that are recorded.  Any after that are still decoded if multiget needs
+    // them, they just cannot be looked up with getHeader.
+    static const size_t MAX_HEADERS = 64;
+
+    ResponseParser();
+    virtual ~ResponseParser() {}
+
+    /**
+     *   @brief  Start again for a new response
+     *
+     *   @return void
+     */
+    void reset();
+
+    /**
+     *   @brief  Parse the response received so far
+     *
+     *   @param  data Start of the response, the same pointer on every call
+     *   @param  length Number of bytes received, at least as many as last time
+     *
+     *   @return COMPLETE once the blank line after the headers has been parsed
+     */
+    Result parse(const char* data, size_t length);
+
+    /**
+     *   @brief  Get the length of the status line and headers, including the blank line
+     *
+     *   @return bytes before the body (only valid once COMPLETE)
+     */
+    size_t getHeaderLength() { return header_length_; }
+
+    /**
+     *   @brief  Get the status code from the status line
+     *
+     *   @return status code, 0 if the status line has not been parsed
+     */
+    unsigned int getStatusCode() { return status_code_; }
+
+    /**
+     *   @brief  Find out whether the server speaks HTTP/1.1 (or later), so connections persist by default
+     *
+     *   @return true for HTTP/1.1
+     */
+    bool isHTTP11() { return http11_; }
+
+    /**
+     *   @brief  Get the Content-Length header
+     *
+     *   @return length of the body, -1 if not sent
+     */
+    int64_t getContentLength() { return content_length_; }
+
+    /**
+     *   @brief  Get the Content-Range header
+     *
+     *   @param  start Receives the first byte, -1 if not sent
+     *   @param  end Receives the last byte, -1 if not sent
+     *   @param  instance_length Receives the size of the whole file, -1 if not sent or "*"
+     *
+     *   @return void
+     */
+    void getContentRange(int64_t& start, int64_t& end, int64_t& instance_length);
+
+    /**
+     *   @brief  Get the Transfer-Encoding header
+     *
+     *   @return how the body is sent
+     */
+    TransferEncoding getTransferEncoding() { return transfer_encoding_; }
+
+    /**
+     *   @brief  Find out whether the server sent "Connection: close"
+     *
+     *   @return true if the server will close the connection after the response
+     */
+    bool connectionClose() { return connection_close_; }
+
+    /**
+     *   @brief  Find out whether the server sent "Accept-Ranges: bytes"
+     *
+     *   @return true if the server says it answers range requests
+     */
+    bool acceptsRanges() { return accept_ranges_; }
+
+    /**
+     *   @brief  Get the ETag header
+     *
+     *   @param  length Receives the length of the value, 0 if not sent
+     *
+     *   @return offset of the value in the buffer
+     */
+    size_t getETag(size_t& length) { length = etag_length_; return etag_; }
+
+    /**
+     *   @brief  Get the number of headers
+     *
+     *   @return number of headers parsed so far
+     */
+    size_t getHeaderCount() { return header_count_; }
+
+    /**
+     *   @brief  Get one of the headers
+     *
+     *   @param  index Which header, in the order they were sent
+     *
+     *   @return where its name and value are
+     */
+    const Header& getHeader(size_t index) { return headers_[index]; }
+
+    /**
+     *   @brief  Compare a header name with a lower case name, ignoring the case of the header
+     *
+     *   @param  data The buffer that was parsed
+     *   @param  header The header
+     *   @param  lower_name Name to look for, in lower case
+     *
+     *   @return true if the names match
+     */
+    static bool nameIs(const char* data, const Header& header, const char* lower_name);
+
+private:
+    bool parse_status_line(const char* line, size_t length);
+    bool parse_header(const char* data, size_t start, size_t end);
+
+    size_t              line_start_; // start of the line being looked for
+    size_t              searched_; // how far the current line has been searched for its end
+    size_t              header_length_;
+    unsigned int        status_code_;
+    bool                http11_;
+    int64_t             content_length_;
+    int64_t             range_start_;
+    int64_t             range_end_;
+    int64_t             instance_length_;
+    TransferEncoding    transfer_encoding_;
+    bool                connection_close_;
+    bool                accept_ranges_;
+    size_t              etag_;
+    size_t              etag_length_;
+    size_t              header_count_;
+    Header              headers_[MAX_HEADERS];
+};
+
+/*! \brief Take the framing out of a body sent with "Transfer-Encoding: chunked"
+ *
+ *  The body is decoded in place: the payload of the chunks is moved to the front of the
+ *  bytes handed in and the chunk sizes, extensions and trailers are dropped.  The decoder
+ *  keeps its state between calls, so the body can arrive in any number of pieces, and it
+ *  says when the last chunk has been seen so the end of the body is known without waiting
+ *  for the server to close the connection.
+ */
+class ChunkedDecoder {
+public:
+    ChunkedDecoder();
+    virtual ~ChunkedDecoder() {}
+
+    /**
+     *   @brief  Start again for a new body
+     *
+     *   @return void
+     */
+    void reset();
+
+    /**
+     *   @brief  Decode the next piece of the body
+     *
+     *   @param  data Bytes received, overwritten with the payload
+     *   @param  length Number of bytes received
+     *   @param  payload Receives the number of payload bytes now at the start of data
+     *
+     *   @return Number of bytes that belonged to the body, less than length only if the body
+     *           ended part way through
+     */
+    size_t decode(char* data, size_t length, size_t& payload);
+
+    /**
+     *   @brief  Find out whether the whole body has been decoded
+     *
+     *   @return true once the last chunk and the trailers have been seen
+     */
+    bool isComplete() { return state_ == DONE; }
+
+    /**
+     *   @brief  Find out whether the framing was broken
+     *
+     *   @return true if the body was not valid chunked encoding
+     */
+    bool isInvalid() { return state_ == BROKEN; }
+
+private:
+    enum State {
+        SIZE, // reading the hex size of a chunk
+        EXTENSION, // skipping the rest of the size line
+        DATA, // copying the payload of a chunk
+        DATA_END, // expecting the CRLF after the payload
+        TRAILER, // at the start of a trailer line (or the final blank line)
+        TRAILER_LINE, // skipping a trailer line
+        DONE,
+        BROKEN
+    };
+
+    State       state_;
+    uint64_t    remaining_; // size of the chunk being read, or bytes of it left in DATA
+    int         digits_; // hex digits in the size so far
+};
+
+/*! \brief Split a "multipart/byteranges" body into the ranges it holds
+ *
+ *  A server answers a request for several ranges with one part for each of them, every
+ *  part with its own Content-Range header and separated by a boundary line.  The decoder
+ *  walks through the body as it arrives, in any number of pieces, and hands back where the
+ *  payload of each part is in the bytes it was given and where in the file it belongs.
+ *  The payload is never copied or scanned for the boundary: its length is known from the
+ *  part's Content-Range, so only the boundary lines and part headers are looked at.
+ */
+class MultipartDecoder {
+public:
+    // Longest boundary allowed (RFC 2046)
+    static const size_t MAX_BOUNDARY = 70;
+
+    MultipartDecoder();
+    virtual ~MultipartDecoder() {}
+
+    /**
+     *   @brief  Start again for a new body
+     *
+     *   @param  boundary The boundary from the Content-Type header (see getBoundary)
+     *   @param  length Length of the boundary
+     *
+     *   @return false if the boundary is empty or too long
+     */
+    bool reset(const char* boundary, size_t length);
+
+    /**
+     *   @brief  Decode the next piece of the body
+     *
+     *   It stops after the first run of payload bytes, so call it again with the rest of
+     *   the bytes until they have all been used.
+     *
+     *   @param  data Bytes received
+     *   @param  length Number of bytes received
+     *   @param  payload Receives the number of payload bytes at the end of the bytes used, 0 if none
+     *   @param  offset Receives where in the file the payload bytes go
+     *
+     *   @return Number of bytes used
+     */
+    size_t decode(const char* data, size_t length, size_t& payload, int64_t& offset);
+
+    /**
+     *   @brief  Find out whether the whole body has been decoded
+     *
+     *   @return true once the closing boundary has been seen
+     */
+    bool isComplete() { return state_ == DONE; }
+
+    /**
+     *   @brief  Find out whether the body was broken
+     *
+     *   @return true if the body was not a valid multipart/byteranges body
+     */
+    bool isInvalid() { return state_ == BROKEN; }
+
+    /**
+     *   @brief  Find the boundary in a Content-Type header
+     *
+     *   @param  content_type The value of the header
+     *   @param  length Length of the value
+     *   @param  boundary Receives the offset of the boundary in the value
+     *   @param  boundary_length Receives the length of the boundary
+     *
+     *   @return true if the type is multipart/byteranges and has a boundary
+     */
+    static bool getBoundary(const char* content_type, size_t length, size_t& boundary, size_t& boundary_length);
+
+private:
+    enum State {
+        DELIMITER, // expecting a boundary line (or skipping the preamble before the first one)
+        HEADERS, // reading the headers of a part
+        DATA, // passing on the payload of a part
+        DATA_END, // expecting the line end after the payload
+        DONE, // the closing boundary has been seen, anything after it is ignored
+        BROKEN
+    };
+
+    // Longest line kept, anything after that is dropped.  Room for "--", the boundary,
+    // "--" and a Content-Range header for any file.
+    static const size_t MAX_LINE = 128;
+
+    void end_line();
+
+    State       state_;
+    bool        preamble_; // the first boundary has not been seen yet
+    char        delimiter_[MAX_BOUNDARY + 2]; // "--" and the boundary
+    size_t      delimiter_length_;
+    char        line_[MAX_LINE]; // the line being read in DELIMITER, HEADERS and DATA_END
+    size_t      line_length_;
+    bool        line_truncated_;
+    bool        have_range_; // the part has a Content-Range header
+    int64_t     offset_; // where in the file the next payload byte goes
+    int64_t     remaining_; // payload bytes of the part left
+};
+
+#endif // __multiget_response_parser_include__
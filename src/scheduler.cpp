@@ -0,0 +1,726 @@
+#include "scheduler.h"
+#include "httpget.h"
+#include "checksum.h"
+#include "journal.h"
+#include "sink.h"
+#include "metrics.h"
+#include "tuner.h"
+#include "log.h"
+
+#include <boost/bind.hpp>
+
+#include <chrono>
+#include <stdlib.h>
+
+#include <sstream>
+#include <algorithm>
+
+// A mirror that gives less than this fraction of the best mirror's throughput is dropped
+static const double SLOW_MIRROR_FRACTION = 0.1;
+
+// How often the journal is saved while the download runs
+static const int JOURNAL_INTERVAL_MS = 2000;
+
+// How often the progress is reported
+static const int PROGRESS_INTERVAL_MS = 500;
+
+// How often the throughput is measured for the tuner
+static const int TUNE_INTERVAL_MS = 1000;
+
+// Smallest chunk the tuner's chunk size is cut down to when the end of the file is spread
+// across the connections
+static const int64_t MIN_TUNED_CHUNK_SIZE = 256 * 1024;
+
+Scheduler::Mirror::Mirror(const URL& url)
+: url(url)
+, usable(true)
+, completed(0)
+, bytes(0)
+, seconds(0)
+, current_weight(0)
+{
+}
+
+/*
+ * Bytes per second per connection, or 0 if nothing has been measured yet
+ */
+double Scheduler::Mirror::throughput() const
+{
+    return seconds > 0 ? bytes / seconds : 0;
+}
+
+Scheduler::Scheduler(boost::asio::io_service& io_service, const std::vector<URL>& mirrors, int max_in_flight, Sink* output,
+                     ConnectionPool* pool)
+: max_in_flight_(max_in_flight > 0 ? max_in_flight : 1)
+, output_(output)
+, adaptive_(false)
+, checksum_(false)
+, journal_(NULL)
+, tuner_(NULL)
+, retry_count_(0)
+, waiting_(0)
+, total_size_(0)
+, chunk_size_(0)
+, next_chunk_(0)
+, next_offset_(0)
+, in_flight_(0)
+, failed_(0)
+, stopped_(false)
+, finished_bytes_(0)
+, tuned_bytes_(0)
+{
+    for (const URL& url: mirrors) {
+        mirrors_.push_back(Mirror(url));
+    }
+    addIOService(io_service, pool);
+}
+
+Scheduler::~Scheduler()
+{
+    for (HTTPGet* request: requests_) {
+        delete request;
+    }
+    for (HTTPGet* request: active_) {
+        delete request;
+    }
+}
+
+void Scheduler::addIOService(boost::asio::io_service& io_service, ConnectionPool* pool)
+{
+    Shard shard;
+    shard.io_service = &io_service;
+    shard.pool = pool;
+    shard.in_flight = 0;
+    shards_.push_back(shard);
+}
+
+void Scheduler::start(int64_t total_size, int64_t chunk_size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shards_.size() > 1) {
+        // An io_service with nothing to do would stop its thread, and it may be needed later
+        for (Shard& shard: shards_) {
+            shard.work.reset(new boost::asio::io_service::work(*shard.io_service));
+        }
+    }
+    total_size_ = total_size;
+    chunk_size_ = chunk_size > 0 ? chunk_size : total_size;
+    if (journal_ && output_) {
+        done_ = journal_->getExtents();
+        journal_timer_.reset(new boost::asio::deadline_timer(*shards_[0].io_service));
+        journal_timer_->expires_from_now(boost::posix_time::milliseconds(JOURNAL_INTERVAL_MS));
+        journal_timer_->async_wait(boost::bind(&Scheduler::save_journal, this, boost::asio::placeholders::error));
+    }
+    if (!output_) {
+        done_.clear();
+    }
+    for (Journal::Extents::const_iterator it = done_.begin(); it != done_.end(); ++it) {
+        finished_bytes_ += it->second - it->first;
+    }
+    if (progress_handler_) {
+        // The first report is where the download starts from (more than 0 when it is resumed)
+        progress_handler_(finished_bytes_, false);
+        progress_timer_.reset(new boost::asio::deadline_timer(*shards_[0].io_service));
+        progress_timer_->expires_from_now(boost::posix_time::milliseconds(PROGRESS_INTERVAL_MS));
+        progress_timer_->async_wait(boost::bind(&Scheduler::show_progress, this, boost::asio::placeholders::error));
+    }
+    if (tuner_ && total_size_ > 0) {
+        max_in_flight_ = std::min(max_in_flight_, tuner_->getConnections());
+        tuned_bytes_ = finished_bytes_;
+        tuned_at_ = std::chrono::steady_clock::now();
+        tune_timer_.reset(new boost::asio::deadline_timer(*shards_[0].io_service));
+        tune_timer_->expires_from_now(boost::posix_time::milliseconds(TUNE_INTERVAL_MS));
+        tune_timer_->async_wait(boost::bind(&Scheduler::tune, this, boost::asio::placeholders::error));
+    }
+    launch();
+    if (in_flight_ == 0) {
+        finished();
+    }
+}
+
+bool Scheduler::succeeded()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_ == 0 && !chunks_left() && retry_.empty() && in_flight_ == 0 && waiting_ == 0;
+}
+
+static bool starts_before(HTTPGet* first, HTTPGet* second)
+{
+    return first->getStartRange() < second->getStartRange();
+}
+
+std::vector<HTTPGet*> Scheduler::getRequests()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<HTTPGet*> requests(requests_);
+    std::sort(requests.begin(), requests.end(), starts_before);
+    return requests;
+}
+
+void Scheduler::addChecksum(int64_t offset, int64_t length, uint32_t crc)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Piece piece;
+    piece.length = length;
+    piece.crc = crc;
+    pieces_[offset] = piece;
+}
+
+bool Scheduler::getCRC32C(uint32_t& crc)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!checksum_) {
+        return false;
+    }
+    crc = 0;
+    int64_t position = 0;
+    for (std::map<int64_t, Piece>::const_iterator it = pieces_.begin(); it != pieces_.end(); ++it) {
+        if (it->first != position) {
+            // A gap (or an overlap) - the pieces do not cover the file
+            return false;
+        }
+        crc = CRC32C::combine(crc, it->second.crc, it->second.length);
+        position += it->second.length;
+    }
+    return total_size_ < 0 || position == total_size_;
+}
+
+/*
+ * Start requests until the window is full or there are no chunks left.  If the output
+ * has paused requests that are ahead of it, they may be holding the whole window while it
+ * waits for the range of a retry, so retries are started even if the window is full.
+ * Must be called with mutex_ held.
+ */
+void Scheduler::launch()
+{
+    if (stopped_) {
+        return;
+    }
+    while (in_flight_ < max_in_flight_ || (!retry_.empty() && output_ && output_->isFull())) {
+        Range range;
+        if (!retry_.empty()) {
+            // Ranges that a dropped mirror did not deliver come first
+            range = retry_.front();
+            retry_.pop_front();
+        } else if (chunks_left()) {
+            range = Range();
+            range.index = next_chunk_++;
+            // The range starts indexing at 0 so we always need to minus 1 from the end of the range.
+            // The last chunk gets whatever is left over.
+            range.start = next_offset_;
+            range.end = std::min(range.start + next_chunk_size(), total_size_) - 1;
+            next_offset_ = range.end + 1;
+            if (total_size_ < 0) {
+                range.start = 0;
+                range.end = -1;
+            } else if (!done_.empty()) {
+                // Only ask for the parts the journal does not have
+                queue_missing(range);
+                continue;
+            }
+        } else {
+            break;
+        }
+        launch_range(range);
+    }
+    // Every chunk has been started, so put any idle connections to work on the
+    // slowest of the running requests
+    if (adaptive_ && output_) {
+        while (in_flight_ < max_in_flight_ && split_slowest()) {
+        }
+    }
+}
+
+/*
+ * Find out whether there are chunks that have not been started.  When the size is not known
+ * the whole file is one chunk.  Must be called with mutex_ held.
+ */
+bool Scheduler::chunks_left()
+{
+    return total_size_ < 0 ? next_chunk_ == 0 : next_offset_ < total_size_;
+}
+
+/*
+ * Get the size of the next chunk.  The tuner's chunk size is cut down near the end of the
+ * file so that what is left is spread across the connections.  Must be called with mutex_ held.
+ */
+int64_t Scheduler::next_chunk_size()
+{
+    if (!tuner_) {
+        return chunk_size_;
+    }
+    int64_t spread = (total_size_ - next_offset_) / max_in_flight_;
+    return std::min(tuner_->getChunkSize(), std::max(spread, MIN_TUNED_CHUNK_SIZE));
+}
+
+/*
+ * Queue the parts of a chunk that are not in the journal.  Must be called with mutex_ held.
+ */
+void Scheduler::queue_missing(const Range& range)
+{
+    std::vector<Range> missing;
+    int64_t position = range.start;
+    Journal::Extents::const_iterator it = done_.upper_bound(range.start);
+    if (it != done_.begin()) {
+        --it;
+    }
+    for (; it != done_.end() && it->first <= range.end && position <= range.end; ++it) {
+        if (it->second <= position) {
+            continue;
+        }
+        if (it->first > position) {
+            Range piece(range);
+            piece.start = position;
+            piece.end = it->first - 1;
+            missing.push_back(piece);
+        }
+        position = it->second;
+    }
+    if (position <= range.end) {
+        Range piece(range);
+        piece.start = position;
+        missing.push_back(piece);
+    }
+    // They go to the front of the queue in order, ahead of any retries
+    retry_.insert(retry_.begin(), missing.begin(), missing.end());
+}
+
+/*
+ * Create and start the request for one range.  Must be called with mutex_ held.
+ */
+void Scheduler::launch_range(const Range& range)
+{
+    size_t mirror = pick_mirror();
+    const URL& url = mirrors_[mirror].url;
+    size_t shard = pick_shard();
+    boost::asio::io_service& io_service = *shards_[shard].io_service;
+    HTTPGet* request;
+    if (output_) {
+        request = new HTTPGet(io_service, url.getServer(), url.getPath(), url.getPort(), range.start, range.end, output_);
+        active_.insert(request);
+    } else {
+        std::stringstream output_file_name;
+        output_file_name << "./tmpchunk" << range.index;
+        if (range.retries > 0) {
+            // The earlier attempts still own their files, which hold the start of the chunk
+            output_file_name << "." << retry_count_;
+        }
+        request = new HTTPGet(io_service, url.getServer(), url.getPath(), url.getPort(), range.start, range.end,
+                              output_file_name.str().c_str());
+        requests_.push_back(request);
+    }
+    setup_request(*request, url, shards_[shard].pool);
+    request->setChecksum(checksum_);
+    request->setCompletionHandler(boost::bind(&Scheduler::handle_complete, this, _1));
+    running_.insert(request);
+    request_mirror_[request] = mirror;
+    request_range_[request] = range;
+    request_shard_[request] = shard;
+    shards_[shard].in_flight++;
+    in_flight_++;
+    // Start the request on the thread that will run it, so its socket is only ever used there
+    io_service.post(boost::bind(&HTTPGet::start, request));
+}
+
+/*
+ * Choose the mirror for the next request.  The requests are shared out in proportion to
+ * each mirror's throughput per connection using a smooth weighted round robin.  A mirror
+ * that has not been measured yet is given the best throughput seen so far, so that it
+ * gets a fair chance to show what it can do.  Must be called with mutex_ held.
+ */
+size_t Scheduler::pick_mirror()
+{
+    double best = 0;
+    for (const Mirror& mirror: mirrors_) {
+        if (mirror.usable) {
+            best = std::max(best, mirror.throughput());
+        }
+    }
+    
+    double total_weight = 0;
+    size_t picked = 0;
+    bool found = false;
+    for (size_t i = 0; i < mirrors_.size(); i++) {
+        Mirror& mirror = mirrors_[i];
+        if (!mirror.usable) {
+            continue;
+        }
+        double weight = mirror.throughput() > 0 ? mirror.throughput() : (best > 0 ? best : 1);
+        mirror.current_weight += weight;
+        total_weight += weight;
+        if (!found || mirror.current_weight > mirrors_[picked].current_weight) {
+            picked = i;
+            found = true;
+        }
+    }
+    mirrors_[picked].current_weight -= total_weight;
+    return picked;
+}
+
+/*
+ * Choose the io_service for the next request: the one with the fewest requests running.
+ * Must be called with mutex_ held.
+ */
+size_t Scheduler::pick_shard()
+{
+    size_t picked = 0;
+    for (size_t i = 1; i < shards_.size(); i++) {
+        if (shards_[i].in_flight < shards_[picked].in_flight) {
+            picked = i;
+        }
+    }
+    return picked;
+}
+
+/*
+ * Stop sending requests to a mirror, unless it is the last one.  Must be called with
+ * mutex_ held.
+ */
+void Scheduler::drop_mirror(size_t mirror, const char* reason)
+{
+    if (!mirrors_[mirror].usable) {
+        return;
+    }
+    int usable = 0;
+    for (const Mirror& other: mirrors_) {
+        if (other.usable) {
+            usable++;
+        }
+    }
+    if (usable > 1) {
+        LogMessage() << "Dropping mirror " << mirrors_[mirror].url.getURL() << ": " << reason;
+        mirrors_[mirror].usable = false;
+    }
+}
+
+/*
+ * Find the running request that will take longest to finish and start a new request for
+ * the upper half of what it has left.  A request that has not received anything yet is
+ * treated as the slowest.  Must be called with mutex_ held.
+ */
+bool Scheduler::split_slowest()
+{
+    // Do not bother splitting off less than this, the new request would spend most
+    // of its time setting up rather than transferring
+    static const int64_t MIN_SPLIT_SIZE = 64 * 1024;
+    
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    HTTPGet* slowest = NULL;
+    double slowest_time = -1;
+    for (HTTPGet* request: running_) {
+        int64_t written = request->getBytesWritten();
+        int64_t remaining = request->getEndRange() - request->getStartRange() + 1 - written;
+        if (remaining < 2 * MIN_SPLIT_SIZE) {
+            continue;
+        }
+        double elapsed = std::chrono::duration<double>(now - request->getStartTime()).count();
+        double time_left = (written > 0 && elapsed > 0) ? remaining / (written / elapsed) : 1e12 * remaining;
+        if (time_left > slowest_time) {
+            slowest = request;
+            slowest_time = time_left;
+        }
+    }
+    if (!slowest) {
+        return false;
+    }
+    
+    int64_t end_range = slowest->getEndRange();
+    int64_t position = slowest->getStartRange() + slowest->getBytesWritten();
+    int64_t split = position + (end_range - position + 1) / 2;
+    if (!slowest->shrinkRange(split - 1)) {
+        return false;
+    }
+    Range range;
+    range.start = split;
+    range.end = end_range;
+    launch_range(range);
+    return true;
+}
+
+void Scheduler::handle_complete(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t mirror = request_mirror_[request];
+    Range range = request_range_[request];
+    request_mirror_.erase(request);
+    request_range_.erase(request);
+    running_.erase(request);
+    shards_[request_shard_[request]].in_flight--;
+    in_flight_--;
+    
+    // Keep the checksum of whatever the request wrote.  The bytes a failed request wrote
+    // are kept, only the rest of its range is fetched again.
+    if (journal_ && output_) {
+        journal_->add(request->getStartRange(), request->getBytesWritten());
+    }
+    finished_bytes_ += request->getBytesWritten();
+    if (metrics_) {
+        metrics_->add(*request, mirrors_[mirror].url.getURL());
+    }
+    if (checksum_ && request->getBytesWritten() > 0) {
+        Piece piece;
+        piece.length = request->getBytesWritten();
+        piece.crc = request->getCRC32C();
+        pieces_[request->getStartRange()] = piece;
+    }
+    
+    if (request->succeeded()) {
+        Mirror& source = mirrors_[mirror];
+        source.completed++;
+        source.bytes += request->getBytesWritten();
+        source.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - request->getStartTime()).count();
+        
+        // Once there are a few measurements, stop using a mirror that is far slower than the best
+        double best = 0;
+        for (const Mirror& other: mirrors_) {
+            if (other.usable && other.completed >= 2) {
+                best = std::max(best, other.throughput());
+            }
+        }
+        if (source.completed >= 2 && source.throughput() < best * SLOW_MIRROR_FRACTION) {
+            drop_mirror(mirror, "too slow");
+        }
+    } else {
+        // An error response (429 and 503 in particular) or no response at all is a sign of
+        // too many connections, a body that was cut short is not
+        unsigned int status = request->getResponse().status_code;
+        if (tuner_ && (status == 0 || status >= 400) && tuner_->backOff()) {
+            max_in_flight_ = tuner_->getConnections();
+            if (status > 0) {
+                LogMessage() << "Backing off to " << max_in_flight_ << " connections after a " << status << " response";
+            } else {
+                LogMessage() << "Backing off to " << max_in_flight_ << " connections after a request got no response";
+            }
+        }
+        // Only ask for what the request did not deliver
+        range.start = request->getStartRange() + request->getBytesWritten();
+        range.end = request->getEndRange();
+        retry(range, mirror, request->failedPermanently());
+    }
+    
+    // The request is still on the call stack, so delete it later.  A temporary chunk file
+    // is kept if it has any of the chunk in it.
+    if (output_ || request->getBytesWritten() == 0) {
+        if (!output_) {
+            requests_.erase(std::remove(requests_.begin(), requests_.end(), request), requests_.end());
+        }
+        shards_[request_shard_[request]].io_service->post(boost::bind(&Scheduler::release, this, request));
+    }
+    launch();
+    if (in_flight_ == 0 && waiting_ == 0) {
+        finished();
+    }
+}
+
+/*
+ * Request the rest of a range that failed.  If there is another mirror to go to the range
+ * is requested from it straight away, otherwise after a backoff.  A permanent failure is
+ * not retried on the same mirror, and if it was the last one the download stops.  Must be
+ * called with mutex_ held.
+ */
+void Scheduler::retry(const Range& failed, size_t mirror, bool permanent)
+{
+    Range range(failed);
+    if (range.end >= 0 && range.start > range.end) {
+        // Everything arrived, it was something after the body that went wrong
+        return;
+    }
+    if (permanent) {
+        drop_mirror(mirror, "the request cannot succeed");
+        if (!mirrors_[mirror].usable) {
+            retry_.push_back(range);
+            return;
+        }
+        if (!stopped_) {
+            LogMessage() << "Giving up on the download - asking again would get the same error";
+        }
+        failed_++;
+        stopped_ = true;
+        return;
+    }
+    if (range.retries >= max_range_retries_ || retry_count_ >= max_total_retries_) {
+        LogMessage() << "Giving up on bytes " << range.start << "-" << (range.end >= 0 ? std::to_string(range.end) : "") <<
+            " after " << range.retries << " retries";
+        failed_++;
+        return;
+    }
+    range.retries++;
+    retry_count_++;
+    
+    drop_mirror(mirror, "request failed");
+    if (!mirrors_[mirror].usable) {
+        // Another mirror can take over without waiting
+        retry_.push_back(range);
+        return;
+    }
+    
+    int delay = backoff(range.retries);
+    LogMessage() << "Retrying bytes " << range.start << "-" << (range.end >= 0 ? std::to_string(range.end) : "") << " in " <<
+        delay << "ms (retry " << range.retries << " of " << max_range_retries_ << ")";
+    
+    std::shared_ptr<boost::asio::deadline_timer> timer(new boost::asio::deadline_timer(*shards_[pick_shard()].io_service));
+    timer->expires_from_now(boost::posix_time::milliseconds(delay));
+    timer->async_wait(boost::bind(&Scheduler::handle_backoff, this, timer, range));
+    waiting_++;
+}
+
+void Scheduler::handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Range range)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_--;
+    // Retries go ahead of the chunks that have not started yet
+    retry_.push_front(range);
+    launch();
+    if (in_flight_ == 0 && waiting_ == 0) {
+        finished();
+    }
+}
+
+/*
+ * Nothing is running and nothing is left to start, so let the io_services stop once
+ * they have run the handlers they already have.  Must be called with mutex_ held.
+ */
+void Scheduler::finished()
+{
+    for (Shard& shard: shards_) {
+        shard.work.reset();
+    }
+    if (journal_timer_ || progress_timer_ || tune_timer_) {
+        // The timers belong to the first io_service, so stop them from there
+        shards_[0].io_service->post(boost::bind(&Scheduler::stop_timers, this));
+    }
+    if (journal_timer_) {
+        output_->sync();
+        journal_->save();
+    }
+}
+
+void Scheduler::stop_timers()
+{
+    boost::system::error_code ignored;
+    if (journal_timer_) {
+        journal_timer_->cancel(ignored);
+    }
+    if (tune_timer_) {
+        tune_timer_->cancel(ignored);
+    }
+    if (progress_timer_) {
+        progress_timer_->cancel(ignored);
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_handler_(bytes_done(), true);
+    }
+}
+
+/*
+ * Find out whether there is nothing running and nothing left to start.  Must be called
+ * with mutex_ held.
+ */
+bool Scheduler::done()
+{
+    return in_flight_ == 0 && waiting_ == 0 && retry_.empty() && !chunks_left();
+}
+
+/*
+ * Count the bytes written so far, including the running requests' progress.  Must be
+ * called with mutex_ held.
+ */
+int64_t Scheduler::bytes_done()
+{
+    int64_t bytes = finished_bytes_;
+    for (HTTPGet* request: running_) {
+        bytes += request->getBytesWritten();
+    }
+    return bytes;
+}
+
+/*
+ * Report the progress.  It is reported with mutex_ held, so that it is never reported
+ * again after the final count.
+ */
+void Scheduler::show_progress(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done()) {
+            return;
+        }
+        progress_handler_(bytes_done(), false);
+    }
+    progress_timer_->expires_from_now(boost::posix_time::milliseconds(PROGRESS_INTERVAL_MS));
+    progress_timer_->async_wait(boost::bind(&Scheduler::show_progress, this, boost::asio::placeholders::error));
+}
+
+/*
+ * Measure the throughput since the last call and let the tuner resize the window.  A
+ * bigger window is filled straight away, a smaller one as the requests finish.
+ */
+void Scheduler::tune(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done()) {
+            return;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int64_t bytes = bytes_done();
+        double seconds = std::chrono::duration<double>(now - tuned_at_).count();
+        int connections = tuner_->getConnections();
+        int64_t chunk_size = tuner_->getChunkSize();
+        if (tuner_->addSample(bytes - tuned_bytes_, seconds, in_flight_)) {
+            if (tuner_->getConnections() != connections || tuner_->getChunkSize() != chunk_size) {
+                LogMessage() << "Tuning: " << static_cast<int64_t>(tuner_->getThroughput()) << " bytes/s, now " <<
+                    tuner_->getConnections() << " connections and chunks of " << tuner_->getChunkSize() << " bytes";
+            }
+            max_in_flight_ = tuner_->getConnections();
+            launch();
+        }
+        tuned_bytes_ = bytes;
+        tuned_at_ = now;
+    }
+    tune_timer_->expires_from_now(boost::posix_time::milliseconds(TUNE_INTERVAL_MS));
+    tune_timer_->async_wait(boost::bind(&Scheduler::tune, this, boost::asio::placeholders::error));
+}
+
+/*
+ * Bring the journal up to date.  The running requests' progress is noted before the
+ * output file is synced, so everything the journal lists is on the disk.
+ */
+void Scheduler::save_journal(const boost::system::error_code& err)
+{
+    if (err) {
+        return;
+    }
+    std::vector<std::pair<int64_t, int64_t> > in_progress;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (done()) {
+            // Finished, the final save has been done
+            return;
+        }
+        for (HTTPGet* request: running_) {
+            in_progress.push_back(std::make_pair(request->getStartRange(), request->getBytesWritten()));
+        }
+    }
+    output_->sync();
+    journal_->save(in_progress);
+    journal_timer_->expires_from_now(boost::posix_time::milliseconds(JOURNAL_INTERVAL_MS));
+    journal_timer_->async_wait(boost::bind(&Scheduler::save_journal, this, boost::asio::placeholders::error));
+}
+
+/*
+ * Delete a finished request.  In direct mode its bytes are already in the output file
+ * so there is no reason to keep it around.
+ */
+void Scheduler::release(HTTPGet* request)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_.erase(request);
+    request_shard_.erase(request);
+    delete request;
+}
@@ -0,0 +1,323 @@
+#ifndef __multiget_scheduler_include__
+#define __multiget_scheduler_include__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+#include "url.h"
+#include "journal.h"
+#include "schedulerbase.h"
+
+class HTTPGet;
+class Sink;
+class ConnectionPool;
+class Journal;
+class ConnectionTuner;
+
+/*! \brief Run the chunk requests with a bounded number in flight
+ *
+ *  The Scheduler creates the HTTPGet objects lazily, one per chunk, and never has more
+ *  than the configured number of them running at once.  Each time a request finishes
+ *  the next chunk is started in its place, so the window is kept full until the file is
+ *  done.  Memory and file descriptor use depend only on the size of the window, not on
+ *  the number of chunks.
+ *
+ *  When the chunks are written to temporary files the finished requests are kept so the
+ *  caller can concatenate them.  In direct mode they are deleted as soon as they finish.
+ *
+ *  A request that fails is retried after an exponential backoff, for only the bytes it did
+ *  not get, so a connection reset part way through a chunk costs just the lost tail.  The
+ *  number of retries is limited for each range and for the download as a whole.
+ *
+ *  With a journal (direct mode only) the ranges already in the journal are skipped, and the
+ *  journal is brought up to date every few seconds, once the output file has been synced,
+ *  and again at the end.
+ *
+ *  Each finished request can be added to a Metrics report, and the progress is reported
+ *  to a handler from a timer (e.g. to draw a ProgressMeter).  The progress is read from the requests' byte counts, so the
+ *  requests themselves do nothing extra while they read.
+ *
+ *  In adaptive mode (direct mode only) a connection that frees up after the last chunk has
+ *  been started takes over the unfetched upper half of the slowest running request, so the
+ *  tail of the download runs on all of the connections instead of the slowest one.
+ *
+ *  With a ConnectionTuner the size of the window and of the chunks are not fixed.  The
+ *  throughput is measured every second and the tuner decides how many requests to run and
+ *  how much each should ask for (the window never goes above max_in_flight).  A request that
+ *  fails makes it back off.  When the window shrinks the requests over the limit are left
+ *  to finish.
+ *
+ *  The file can be fetched from several mirrors at once.  New requests are shared out
+ *  between the mirrors in proportion to the throughput each one has given per connection
+ *  so far.  A mirror that returns an error, or that is far slower than the best one, is
+ *  dropped and the part of the range it did not deliver is requested from another mirror
+ *  straight away.
+ *  The caller is responsible for making sure that every mirror has the same file.
+ *
+ *  The requests can be spread across several io_services, each run by its own thread.  A
+ *  request is created on the io_service with the fewest requests running, and it (its
+ *  socket, handlers and writes) stays there until it finishes.
+ */
+class Scheduler : public SchedulerBase {
+public:
+    /**
+     *   @brief  Create a Scheduler object.
+     *
+     *   @param  io_service The io_service that runs the requests (see also addIOService)
+     *   @param  mirrors The URLs to get the file from (at least one)
+     *   @param  max_in_flight Maximum number of requests (and connections) running at once
+     *   @param  output Preallocated output file (or other sink), or NULL to write temporary chunk files
+     *   @param  pool Persistent connections to reuse, or NULL to use one connection per request
+     *
+     *   @return Scheduler object
+     */
+    Scheduler(boost::asio::io_service& io_service, const std::vector<URL>& mirrors, int max_in_flight, Sink* output,
+              ConnectionPool* pool);
+    virtual ~Scheduler();
+
+    /**
+     *   @brief  Split the download into chunks and start the first window of requests
+     *
+     *   The last chunk is shorter if total_size is not a multiple of chunk_size.  The
+     *   requests run when the io_service is run.
+     *
+     *   @param  total_size Total number of bytes to download, or -1 to get the whole file
+     *           in a single request when the size is not known
+     *   @param  chunk_size Number of bytes to get on each request
+     *
+     *   @return void
+     */
+    void start(int64_t total_size, int64_t chunk_size);
+
+    /**
+     *   @brief  Split slow requests when a connection is free (must be called before start)
+     *
+     *   @param  adaptive true to enable range splitting (only used in direct mode)
+     *
+     *   @return void
+     */
+    void setAdaptive(bool adaptive) { adaptive_ = adaptive; }
+
+    /**
+     *   @brief  Checksum every range as it arrives (must be called before start)
+     *
+     *   @param  checksum true to keep a CRC32C of each range and check Content-MD5 headers
+     *
+     *   @return void
+     */
+    void setChecksum(bool checksum) { checksum_ = checksum; }
+
+    /**
+     *   @brief  Record progress in a journal and skip what it says is done (must be called before start)
+     *
+     *   @param  journal Journal for the output file, or NULL for none (direct mode only)
+     *
+     *   @return void
+     */
+    void setJournal(Journal* journal) { journal_ = journal; }
+
+    /**
+     *   @brief  Skip ranges that are already in the output, e.g. copied from a cache (must be
+     *          called before start, direct mode only, not used with a journal)
+     *
+     *   @param  done Ranges not to request
+     *
+     *   @return void
+     */
+    void setDone(const Journal::Extents& done) { done_ = done; }
+
+    /**
+     *   @brief  Add the CRC32C of bytes that are already in the output, so that getCRC32C
+     *          covers them as well as the ranges that are downloaded (must be called before start)
+     *
+     *   @param  offset Where the bytes start in the file
+     *   @param  length Number of bytes
+     *   @param  crc Their CRC32C
+     *
+     *   @return void
+     */
+    void addChecksum(int64_t offset, int64_t length, uint32_t crc);
+
+    /**
+     *   @brief  Let a tuner pick the number of requests and the chunk size (must be called before start)
+     *
+     *   @param  tuner Tuner to measure the throughput for, or NULL to keep the window and
+     *           chunk size fixed.  Its chunk size replaces the one passed to start.
+     *
+     *   @return void
+     */
+    void setTuner(ConnectionTuner* tuner) { tuner_ = tuner; }
+
+    // Called with the number of bytes written so far, and whether that is the final count
+    typedef boost::function<void (int64_t bytes_done, bool finished)> progress_handler;
+
+    /**
+     *   @brief  Report the progress of the download (must be called before start)
+     *
+     *   The handler is called when the download starts, a couple of times a second while
+     *   it runs, and once more when the last request is done.  It is never called again
+     *   after that.
+     *
+     *   @param  handler Function to call, or an empty function for none
+     *
+     *   @return void
+     */
+    void setProgressHandler(const progress_handler& handler) { progress_handler_ = handler; }
+
+    /**
+     *   @brief  Get the CRC32C of the whole download (see setChecksum)
+     *
+     *   The checksums of the ranges are combined in file order, nothing is read back.
+     *
+     *   @param  crc Receives the checksum
+     *
+     *   @return false if checksums were not turned on or some of the file is missing
+     */
+    bool getCRC32C(uint32_t& crc);
+
+    /**
+     *   @brief  Spread the requests over another io_service (must be called before start)
+     *
+     *   Each io_service is expected to be run by its own thread.  The scheduler keeps
+     *   every io_service busy until the last request has finished, so none of the threads
+     *   exit early.
+     *
+     *   @param  io_service Another io_service to run requests on
+     *   @param  pool Persistent connections that belong to io_service, or NULL to use one
+     *           connection per request
+     *
+     *   @return void
+     */
+    void addIOService(boost::asio::io_service& io_service, ConnectionPool* pool);
+
+    /**
+     *   @brief  Get the requests that wrote to temporary chunk files, in file order
+     *
+     *   A chunk that was retried has a request for each piece of it.  Each request's
+     *   file holds getBytesWritten() bytes from getStartRange() onwards.
+     *
+     *   @return The requests, or an empty vector in direct mode
+     */
+    std::vector<HTTPGet*> getRequests();
+
+    /**
+     *   @brief  Find out whether every chunk was downloaded
+     *
+     *   @return true if all of the requests succeeded
+     */
+    bool succeeded();
+
+private:
+    /*
+     * What we know about one of the places the file can be fetched from
+     */
+    struct Mirror {
+        explicit Mirror(const URL& url);
+        double throughput() const;
+        
+        URL         url;
+        bool        usable; // false once the mirror has been dropped
+        int         completed; // number of requests that finished successfully
+        int64_t     bytes; // body bytes received by the finished requests
+        double      seconds; // time taken by the finished requests
+        double      current_weight; // used to share out the requests
+    };
+    /*
+     * One of the io_services the requests run on
+     */
+    struct Shard {
+        boost::asio::io_service*                    io_service;
+        ConnectionPool*                             pool;
+        int                                         in_flight; // requests running on io_service
+        std::shared_ptr<boost::asio::io_service::work> work; // keeps io_service running until the download is over
+    };
+    /*
+     * The checksum of some bytes that have been written
+     */
+    struct Piece {
+        int64_t     length;
+        uint32_t    crc;
+    };
+    /*
+     * A range that has to be requested (again)
+     */
+    struct Range {
+        Range() : index(-1), start(0), end(-1), retries(0) {}
+        int64_t     index; // chunk number, used to name the temporary file
+        int64_t     start;
+        int64_t     end;
+        int         retries; // number of times the range has been retried
+    };
+    
+    void launch();
+    void launch_range(const Range& range);
+    bool split_slowest();
+    size_t pick_mirror();
+    size_t pick_shard();
+    void drop_mirror(size_t mirror, const char* reason);
+    void handle_complete(HTTPGet* request);
+    void retry(const Range& range, size_t mirror, bool permanent);
+    void queue_missing(const Range& range);
+    void save_journal(const boost::system::error_code& err);
+    void show_progress(const boost::system::error_code& err);
+    void tune(const boost::system::error_code& err);
+    bool chunks_left();
+    int64_t next_chunk_size();
+    void stop_timers();
+    bool done();
+    int64_t bytes_done();
+    void handle_backoff(std::shared_ptr<boost::asio::deadline_timer> timer, Range range);
+    void finished();
+    void release(HTTPGet* request);
+
+    int                         max_in_flight_; // size of the request window (changed by the tuner)
+    Sink*                       output_; // direct mode output, or NULL for temporary chunk files
+    bool                        adaptive_; // split slow requests once all chunks have started
+    bool                        checksum_; // checksum the ranges as they arrive
+    Journal*                    journal_; // progress record, or NULL
+    Journal::Extents            done_; // ranges the journal (or setDone) had when the download started
+    std::shared_ptr<boost::asio::deadline_timer> journal_timer_; // saves the journal every few seconds
+    progress_handler            progress_handler_; // may be empty
+    std::shared_ptr<boost::asio::deadline_timer> progress_timer_; // calls progress_handler_
+    ConnectionTuner*            tuner_; // picks the window and chunk size, or NULL
+    std::shared_ptr<boost::asio::deadline_timer> tune_timer_; // measures the throughput for tuner_
+
+    std::mutex                  mutex_; // protects everything below
+    std::vector<Mirror>         mirrors_;
+    std::vector<Shard>          shards_;
+    std::map<HTTPGet*, size_t>  request_shard_; // the io_service each request was created on
+    std::map<HTTPGet*, size_t>  request_mirror_; // the mirror each running request uses
+    std::map<HTTPGet*, Range>   request_range_; // the range each running request was started for
+    std::deque<Range>           retry_; // ranges to request again
+    int                         retry_count_; // number of retries so far, also used to name their temporary files
+    int                         waiting_; // number of retries waiting for their backoff to expire
+    int64_t                     total_size_;
+    int64_t                     chunk_size_;
+    int64_t                     next_chunk_; // index of the next chunk to request
+    int64_t                     next_offset_; // start of the next chunk to request
+    int                         in_flight_; // number of requests currently running
+    int                         failed_; // number of requests that did not succeed
+    bool                        stopped_; // a request failed for good, so no more are started
+    std::vector<HTTPGet*>       requests_; // requests that wrote to a temporary file, in no particular order
+    std::set<HTTPGet*>          active_; // requests that have not been released (direct mode)
+    std::set<HTTPGet*>          running_; // requests that have not finished
+    std::map<int64_t, Piece>    pieces_; // checksums of the bytes written, keyed by offset
+    int64_t                     finished_bytes_; // bytes written by finished requests, and found in the journal
+    int64_t                     tuned_bytes_; // bytes_done() when the tuner last measured the throughput
+    std::chrono::steady_clock::time_point tuned_at_; // when the tuner last measured the throughput
+
+    // Ensure that these method are not created explicitly
+    Scheduler(const Scheduler& in); // not implemented
+    Scheduler& operator = (const Scheduler &t); // not implemented
+};
+
+#endif // __multiget_scheduler_include__
@@ -0,0 +1,51 @@
+#include "schedulerbase.h"
+#include "httpget.h"
+#include "url.h"
+
+#include <algorithm>
+
+// The wait before the first retry of a range, doubled for each retry after that up to the maximum
+static const int RETRY_BACKOFF_MS = 500;
+static const int MAX_RETRY_BACKOFF_MS = 30000;
+
+SchedulerBase::SchedulerBase()
+: endpoint_cache_(NULL)
+, buffer_pool_(NULL)
+, tls_(NULL)
+, metrics_(NULL)
+, splice_(false)
+, max_range_retries_(5)
+, max_total_retries_(50)
+, random_(std::random_device()())
+{
+}
+
+/*
+ * Give a new request the connections, DNS results, TLS sessions and buffers it shares with
+ * the others.  The completion handler and anything else particular to the scheduler are
+ * left to the caller.
+ */
+void SchedulerBase::setup_request(HTTPGet& request, const URL& url, ConnectionPool* pool)
+{
+    request.setConnectionPool(pool);
+    request.setEndpointCache(endpoint_cache_);
+    request.setTLSContext(url.isHTTPS() ? tls_ : NULL);
+    request.setBufferPool(buffer_pool_);
+    request.setSplice(splice_);
+}
+
+/*
+ * The milliseconds to wait before a retry, given how many times the range has been
+ * retried including this one.  Wait a little longer after each failure, with some jitter
+ * so that the connections that failed together do not all come back at once.  Must be
+ * called with the scheduler's mutex held.
+ */
+int SchedulerBase::backoff(int retries)
+{
+    int delay = RETRY_BACKOFF_MS;
+    for (int i = 1; i < retries && delay < MAX_RETRY_BACKOFF_MS; i++) {
+        delay *= 2;
+    }
+    delay = std::min(delay, MAX_RETRY_BACKOFF_MS);
+    return delay + std::uniform_int_distribution<int>(0, delay / 2)(random_);
+}
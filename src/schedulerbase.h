@@ -0,0 +1,104 @@
+#ifndef __multiget_scheduler_base_include__
+#define __multiget_scheduler_base_include__
+
+#include <random>
+
+class HTTPGet;
+class URL;
+class ConnectionPool;
+class EndpointCache;
+class BufferPool;
+class TLSContext;
+class Metrics;
+
+/*! \brief What the schedulers have in common: the shared resources their requests are
+ *         set up with, the limits on retries and the backoff before each retry
+ *
+ *  Scheduler, BatchScheduler and RangeScheduler each decide what to request and when, and
+ *  leave the rest to this class, so that a request is set up and retried the same way
+ *  whichever of them started it.  The setters must be called before the scheduler is
+ *  started.
+ */
+class SchedulerBase {
+public:
+    SchedulerBase();
+    virtual ~SchedulerBase() {}
+
+    /**
+     *   @brief  Share DNS results between the requests
+     *
+     *   @param  endpoint_cache Resolved hosts, or NULL for every request to do its own lookup
+     *
+     *   @return void
+     */
+    void setEndpointCache(EndpointCache* endpoint_cache) { endpoint_cache_ = endpoint_cache; }
+
+    /**
+     *   @brief  Share TLS settings and sessions between the https:// requests (needed if
+     *          any URL is https://)
+     *
+     *   @param  tls Certificates and saved sessions
+     *
+     *   @return void
+     */
+    void setTLSContext(TLSContext* tls) { tls_ = tls; }
+
+    /**
+     *   @brief  Share receive buffers between the requests
+     *
+     *   @param  buffer_pool Receive buffers, or NULL for every request to allocate its own
+     *
+     *   @return void
+     */
+    void setBufferPool(BufferPool* buffer_pool) { buffer_pool_ = buffer_pool; }
+
+    /**
+     *   @brief  Splice the bodies into the output where possible (Linux only)
+     *
+     *   @param  splice true to move the bodies inside the kernel (see HTTPGet::setSplice)
+     *
+     *   @return void
+     */
+    void setSplice(bool splice) { splice_ = splice; }
+
+    /**
+     *   @brief  Record the timings of every request
+     *
+     *   @param  metrics Where to add each request when it finishes, or NULL for none
+     *
+     *   @return void
+     */
+    void setMetrics(Metrics* metrics) { metrics_ = metrics; }
+
+    /**
+     *   @brief  Limit the number of retries
+     *
+     *   @param  per_range Most times the missing part of a range (or of a request for
+     *           several ranges) is retried before giving up
+     *   @param  total Most retries for the whole download, or for each file of a batch
+     *
+     *   @return void
+     */
+    void setRetryLimits(int per_range, int total) { max_range_retries_ = per_range; max_total_retries_ = total; }
+
+protected:
+    void setup_request(HTTPGet& request, const URL& url, ConnectionPool* pool);
+    int backoff(int retries);
+
+    EndpointCache*              endpoint_cache_;
+    BufferPool*                 buffer_pool_;
+    TLSContext*                 tls_;
+    Metrics*                    metrics_; // timings of the finished requests, or NULL
+    bool                        splice_; // splice the bodies into the output
+    int                         max_range_retries_; // most retries for one range
+    int                         max_total_retries_; // most retries for the whole download (or file)
+
+private:
+    std::mt19937                random_; // jitter for the retry backoff
+
+    // Ensure that these method are not created explicitly
+    SchedulerBase(const SchedulerBase& in); // not implemented
+    SchedulerBase& operator = (const SchedulerBase &t); // not implemented
+};
+
+#endif // __multiget_scheduler_base_include__
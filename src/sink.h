@@ -0,0 +1,97 @@
+#ifndef __multiget_sink_include__
+#define __multiget_sink_include__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boost/function.hpp>
+
+/*! \brief Where the bytes of a download go
+ *
+ *  Each request writes its body at the body's position in the file, so a Sink sees the
+ *  ranges in whatever order they arrive, from several threads at once.  The ranges written
+ *  at the same time never overlap.  A range that is retried may be written again.
+ *
+ *  OutputFile writes to a file on disk, MemorySink to a buffer, CallbackSink hands the
+ *  bytes to a function and StreamSink writes them in order to a pipe.
+ */
+class Sink {
+public:
+    Sink() {}
+    virtual ~Sink() {}
+
+    /**
+     *   @brief  Write a block of data at the specified offset
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Bytes to write
+     *   @param  length Number of bytes to write
+     *
+     *   @return true if all the bytes were written, false otherwise
+     */
+    virtual bool write(int64_t offset, const char* data, size_t length) = 0;
+
+    /**
+     *   @brief  Make room for the whole file once its size is known
+     *
+     *   Writes to other parts of the file may be in progress.
+     *
+     *   @param  size Final size of the file in bytes
+     *
+     *   @return true if the space was reserved, false otherwise
+     */
+    virtual bool setSize(int64_t size) { return true; }
+
+    /**
+     *   @brief  Read back bytes that have been written, to checksum the whole file in order
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Receives the bytes
+     *   @param  length Number of bytes to read
+     *
+     *   @return Number of bytes read, 0 at the end of the file or if the sink cannot read back
+     */
+    virtual size_t read(int64_t offset, char* data, size_t length) { return 0; }
+
+    /**
+     *   @brief  Wait for everything written so far to be stored safely
+     *
+     *   @return true if the data was flushed
+     */
+    virtual bool sync() { return true; }
+
+    /**
+     *   @brief  Find out whether a request may carry on reading, and if not, have it told
+     *          when it can
+     *
+     *   A sink with a limited amount of room (see StreamSink) pauses the requests that
+     *   have got too far ahead of the bytes it is waiting for.
+     *
+     *   @param  offset Position in the file of the next byte the request will write
+     *   @param  resume Called (on any thread) once there is room, if the request has to wait
+     *
+     *   @return true if the request has to wait for resume, false to carry on now
+     */
+    virtual bool pause(int64_t offset, const boost::function<void ()>& resume) { return false; }
+
+    /**
+     *   @brief  Find out whether any requests are paused (see pause)
+     *
+     *   @return true if requests are waiting for the sink to catch up
+     */
+    virtual bool isFull() { return false; }
+
+    /**
+     *   @brief  Get the regular file the bytes are written to, so a request can have the
+     *          kernel move its body straight from the socket into it (see HTTPGet::setSplice)
+     *
+     *   @return file descriptor, or -1 if the sink is not a regular file
+     */
+    virtual int getFileDescriptor() { return -1; }
+
+private:
+    // Ensure that these method are not created explicitly
+    Sink(const Sink& in); // not implemented
+    Sink& operator = (const Sink &t); // not implemented
+};
+
+#endif // __multiget_sink_include__
@@ -0,0 +1,133 @@
+#include "streamsink.h"
+#include "log.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+StreamSink::StreamSink(int fd, size_t max_buffer)
+: fd_(fd)
+, max_buffer_(max_buffer > 0 ? max_buffer : 1)
+, written_(0)
+, buffered_(0)
+, max_buffered_(0)
+, failed_(false)
+{
+}
+
+bool StreamSink::write(int64_t offset, const char* data, size_t length)
+{
+    std::vector<boost::function<void ()> > resume;
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            return false;
+        }
+        if (offset < written_) {
+            // A retry of bytes that have already gone out
+            int64_t skip = std::min<int64_t>(written_ - offset, length);
+            offset += skip;
+            data += skip;
+            length -= skip;
+            if (length == 0) {
+                return true;
+            }
+        }
+        if (offset > written_) {
+            std::string& block = buffer_[offset];
+            if (block.size() < length) {
+                buffered_ += length - block.size();
+                block.assign(data, length);
+            }
+            max_buffered_ = std::max(max_buffered_, buffered_);
+            return true;
+        }
+        ok = write_out(data, length) && flush_buffer();
+        // Let the paused requests that are now close enough carry on.  If the pipe has
+        // failed they all carry on, to fail as well.
+        std::vector<std::pair<int64_t, boost::function<void ()> > >::iterator it = paused_.begin();
+        while (it != paused_.end()) {
+            if (failed_ || it->first < written_ + static_cast<int64_t>(max_buffer_)) {
+                resume.push_back(it->second);
+                it = paused_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (boost::function<void ()>& handler: resume) {
+        handler();
+    }
+    return ok;
+}
+
+/*
+ * Write bytes to the pipe at written_.  Must be called with mutex_ held.
+ */
+bool StreamSink::write_out(const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = ::write(fd_, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogMessage() << "Unable to write the download out: " << strerror(errno);
+            failed_ = true;
+            return false;
+        }
+        data += written;
+        length -= written;
+        written_ += written;
+    }
+    return true;
+}
+
+/*
+ * Write out the blocks in the buffer that now follow on from written_.  Must be called with
+ * mutex_ held.
+ */
+bool StreamSink::flush_buffer()
+{
+    while (!buffer_.empty() && buffer_.begin()->first <= written_) {
+        std::map<int64_t, std::string>::iterator block = buffer_.begin();
+        int64_t end = block->first + block->second.size();
+        if (end > written_ && !write_out(block->second.data() + (written_ - block->first), end - written_)) {
+            return false;
+        }
+        buffered_ -= block->second.size();
+        buffer_.erase(block);
+    }
+    return true;
+}
+
+bool StreamSink::pause(int64_t offset, const boost::function<void ()>& resume)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_ || offset < written_ + static_cast<int64_t>(max_buffer_)) {
+        return false;
+    }
+    paused_.push_back(std::make_pair(offset, resume));
+    return true;
+}
+
+bool StreamSink::isFull()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !paused_.empty();
+}
+
+int64_t StreamSink::getBytesWritten()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+size_t StreamSink::getMaxBuffered()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_buffered_;
+}
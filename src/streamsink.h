@@ -0,0 +1,85 @@
+#ifndef __multiget_stream_sink_include__
+#define __multiget_stream_sink_include__
+
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "sink.h"
+
+/*! \brief Write a download in order to a pipe (e.g. stdout) while it downloads
+ *
+ *  The longest run of bytes from the start of the file that has arrived is written out
+ *  straight away, so the next program in a pipeline (tar, zstd...) can start on the file
+ *  while the rest of it is still on the way.  Ranges that arrive ahead of the bytes before
+ *  them wait in a reorder buffer.
+ *
+ *  The buffer has a limit.  A request that gets further ahead of the bytes written out
+ *  than the limit is paused (see Sink::pause) until they catch up, so a slow consumer
+ *  slows the download down rather than filling memory.  The buffer can hold a little more
+ *  than the limit, up to one read for each request, as the bytes have already been
+ *  received when the request is paused.
+ *
+ *  Writing to the pipe may block, which holds up the other requests' writes too.
+ *
+ *  Writes may be made from several threads at once.
+ */
+class StreamSink : public Sink {
+public:
+    /**
+     *   @brief  Create a StreamSink object.
+     *
+     *   @param  fd File descriptor to write the file to, in order (it is not closed)
+     *   @param  max_buffer Most bytes to hold before pausing the requests that are ahead
+     *
+     *   @return StreamSink object
+     */
+    StreamSink(int fd, size_t max_buffer);
+    virtual ~StreamSink() {}
+
+    /**
+     *   @brief  Write a block of data, or keep it until the bytes before it have been written
+     *
+     *   @param  offset Position in the file of the first byte
+     *   @param  data Bytes to write
+     *   @param  length Number of bytes to write
+     *
+     *   @return false if the bytes could not be written out
+     */
+    virtual bool write(int64_t offset, const char* data, size_t length);
+
+    virtual bool pause(int64_t offset, const boost::function<void ()>& resume);
+    virtual bool isFull();
+
+    /**
+     *   @brief  Get the number of bytes written out so far
+     *
+     *   @return byte count
+     */
+    int64_t getBytesWritten();
+
+    /**
+     *   @brief  Get the most bytes that have been held in the reorder buffer at once
+     *
+     *   @return byte count
+     */
+    size_t getMaxBuffered();
+
+private:
+    bool write_out(const char* data, size_t length);
+    bool flush_buffer();
+
+    int                         fd_;
+    size_t                      max_buffer_;
+
+    std::mutex                  mutex_; // protects everything below
+    int64_t                     written_; // bytes written out (the next offset to write)
+    std::map<int64_t, std::string> buffer_; // blocks that are ahead of written_, keyed by offset
+    size_t                      buffered_; // bytes in buffer_
+    size_t                      max_buffered_;
+    bool                        failed_; // the pipe could not be written to
+    std::vector<std::pair<int64_t, boost::function<void ()> > > paused_; // requests waiting for room
+};
+
+#endif // __multiget_stream_sink_include__
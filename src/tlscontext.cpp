@@ -0,0 +1,145 @@
+#include "tlscontext.h"
+#include "log.h"
+
+#include <boost/bind.hpp>
+
+
+TLSContext::TLSContext(bool verify_peer)
+: context_(boost::asio::ssl::context::tls_client)
+{
+    context_.set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 |
+                         boost::asio::ssl::context::no_sslv3 | boost::asio::ssl::context::no_tlsv1 |
+                         boost::asio::ssl::context::no_tlsv1_1);
+    boost::system::error_code err;
+    context_.set_default_verify_paths(err);
+    if (verify_peer) {
+        context_.set_verify_mode(boost::asio::ssl::verify_peer);
+    } else {
+        context_.set_verify_mode(boost::asio::ssl::verify_none);
+    }
+    // The sessions are kept here, per server, rather than in OpenSSL's cache which is
+    // only looked up by servers
+    SSL_CTX_set_session_cache_mode(context_.native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+}
+
+TLSContext::~TLSContext()
+{
+    for (std::map<std::string, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->second.session) {
+            SSL_SESSION_free(it->second.session);
+        }
+    }
+}
+
+bool TLSContext::loadCAFile(const std::string& file)
+{
+    boost::system::error_code err;
+    context_.load_verify_file(file, err);
+    if (err) {
+        LogMessage() << "Error: unable to load the certificates in " << file << ": " << err.message();
+        return false;
+    }
+    return true;
+}
+
+void TLSContext::asyncWaitForSession(boost::asio::io_service& io_service, const std::string& server, const std::string& port,
+                                     const ready_handler& handler)
+{
+    bool first = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[server + ":" + port];
+        if (entry.pending) {
+            Waiter waiter;
+            waiter.io_service = &io_service;
+            waiter.handler = handler;
+            entry.waiters.push_back(waiter);
+            return;
+        }
+        if (!entry.session && !entry.unsupported) {
+            // Nobody has a session for this server yet, so this connection gets one for the rest
+            entry.pending = true;
+            first = true;
+        }
+    }
+    io_service.post(boost::bind(handler, first));
+}
+
+void TLSContext::prepare(SSL* ssl, const std::string& server, const std::string& port)
+{
+    boost::system::error_code err;
+    boost::asio::ip::address::from_string(server, err);
+    if (err) {
+        // A host name, which goes in the ClientHello (an IP address must not) and has to
+        // match the certificate
+        SSL_set_tlsext_host_name(ssl, server.c_str());
+        SSL_set1_host(ssl, server.c_str());
+    } else {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), server.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, Entry>::iterator it = entries_.find(server + ":" + port);
+    if (it != entries_.end() && it->second.session) {
+        SSL_SESSION* session = SSL_SESSION_dup(it->second.session);
+        if (session) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
+}
+
+void TLSContext::saveSession(SSL* ssl, const std::string& server, const std::string& port, bool first)
+{
+    // OpenSSL stops a session from being resumed when its connection is dropped without a
+    // close_notify, which is how most connections here end, so the cache keeps a copy of
+    // the session and only ever hands out copies of that
+    SSL_SESSION* session = NULL;
+    SSL_SESSION* current = SSL_get1_session(ssl);
+    if (current) {
+        if (SSL_SESSION_is_resumable(current)) {
+            session = SSL_SESSION_dup(current);
+        }
+        SSL_SESSION_free(current);
+    }
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[server + ":" + port];
+        if (session) {
+            // Keep the newest session, a server may not take a TLS 1.3 ticket twice
+            if (entry.session) {
+                SSL_SESSION_free(entry.session);
+            }
+            entry.session = session;
+        } else if (first) {
+            // The server gave no session that can be resumed, so there is no point waiting
+            // for one again
+            entry.unsupported = true;
+        }
+        if (first) {
+            entry.pending = false;
+            waiters.swap(entry.waiters);
+        }
+    }
+    wake(waiters);
+}
+
+void TLSContext::abandonSession(const std::string& server, const std::string& port)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[server + ":" + port];
+        entry.pending = false;
+        waiters.swap(entry.waiters);
+    }
+    wake(waiters);
+}
+
+void TLSContext::wake(const std::vector<Waiter>& waiters)
+{
+    for (const Waiter& waiter: waiters) {
+        waiter.io_service->post(boost::bind(waiter.handler, false));
+    }
+}
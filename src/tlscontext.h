@@ -0,0 +1,139 @@
+#ifndef __multiget_tls_context_include__
+#define __multiget_tls_context_include__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/function.hpp>
+
+/*! \brief The TLS settings and session cache shared by all of the https:// connections
+ *
+ *  There is one SSL context for the whole download, so the certificates are only loaded
+ *  once.  Each server's certificate is checked against the host name in the URL unless
+ *  verification is turned off.
+ *
+ *  A full handshake costs a couple of round trips and the server's public key operations,
+ *  which adds up when the file is split into many ranges.  So the first connection to a
+ *  server does the full handshake, and once its response has arrived (by which time any
+ *  TLS 1.3 session ticket has arrived too) its session is kept.  Every later connection to
+ *  the server resumes that session and skips the certificate exchange.  Connections that
+ *  are opened while the first handshake is still running wait for it instead of doing
+ *  full handshakes of their own.  If the server does not offer resumable sessions nobody
+ *  waits again.
+ *
+ *  The context is thread safe and may be shared by requests running on different io_services.
+ */
+class TLSContext {
+public:
+    typedef boost::function<void (bool first)> ready_handler;
+
+    /**
+     *   @brief  Create a context that trusts the system's certificate authorities
+     *
+     *   @param  verify_peer false to accept any certificate (e.g. a self-signed one)
+     *
+     *   @return TLSContext object
+     */
+    explicit TLSContext(bool verify_peer = true);
+    virtual ~TLSContext();
+
+    /**
+     *   @brief  Also trust the certificates in a file (e.g. a self-signed certificate)
+     *
+     *   @param  file PEM file with one or more certificates
+     *
+     *   @return true if the file was loaded, false otherwise (the reason is printed)
+     */
+    bool loadCAFile(const std::string& file);
+
+    /**
+     *   @brief  Get the SSL context to create the streams with
+     *
+     *   @return context
+     */
+    boost::asio::ssl::context& getContext() { return context_; }
+
+    /**
+     *   @brief  Wait until a new connection to the server can resume a session, if the first
+     *          connection to it is still getting one
+     *
+     *   The handler is called through io_service.  first is true if this connection is the
+     *   one to get the session, in which case it must call saveSession or abandonSession.
+     *
+     *   @param  io_service The io_service the connection is used on
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"https\" or port number
+     *   @param  handler Function to call when the handshake can start
+     *
+     *   @return void
+     */
+    void asyncWaitForSession(boost::asio::io_service& io_service, const std::string& server, const std::string& port,
+                             const ready_handler& handler);
+
+    /**
+     *   @brief  Set up a stream for the server before the handshake
+     *
+     *   This sets the server name (SNI), checks the certificate against it, and offers the
+     *   saved session if there is one.
+     *
+     *   @param  ssl The stream's native handle
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"https\" or port number
+     *
+     *   @return void
+     */
+    void prepare(SSL* ssl, const std::string& server, const std::string& port);
+
+    /**
+     *   @brief  Keep the session of a connection that has had a response, for the next
+     *          connections to the server to resume
+     *
+     *   @param  ssl The stream's native handle
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"https\" or port number
+     *   @param  first true if this connection was told it is the one to get the session
+     *
+     *   @return void
+     */
+    void saveSession(SSL* ssl, const std::string& server, const std::string& port, bool first);
+
+    /**
+     *   @brief  Be told that the connection that was to get the session failed first
+     *
+     *   The connections waiting for it go ahead with full handshakes.
+     *
+     *   @param  server dns name of server or IP address
+     *   @param  port either \"https\" or port number
+     *
+     *   @return void
+     */
+    void abandonSession(const std::string& server, const std::string& port);
+
+private:
+    struct Waiter {
+        boost::asio::io_service*    io_service;
+        ready_handler               handler;
+    };
+    struct Entry {
+        Entry() : session(NULL), pending(false), unsupported(false) {}
+        SSL_SESSION*                session; // the latest session to resume, or NULL
+        bool                        pending; // the first handshake is running
+        bool                        unsupported; // the server did not give a resumable session
+        std::vector<Waiter>         waiters; // connections waiting for the first handshake
+    };
+
+    static void wake(const std::vector<Waiter>& waiters);
+
+    boost::asio::ssl::context       context_;
+    std::mutex                      mutex_; // protects entries_
+    std::map<std::string, Entry>    entries_; // keyed by server:port
+
+    // Ensure that these method are not created explicitly
+    TLSContext(const TLSContext& in); // not implemented
+    TLSContext& operator = (const TLSContext &t); // not implemented
+};
+
+#endif // __multiget_tls_context_include__
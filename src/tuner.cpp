@@ -0,0 +1,128 @@
+#include "tuner.h"
+
+#include <algorithm>
+
+// Connections to start with
+static const int INITIAL_CONNECTIONS = 2;
+
+// A step up in connections has to raise the throughput by this fraction to be worth keeping
+static const double MIN_GAIN = 0.1;
+
+// Measurements to ignore after a change, while new connections do their handshakes and slow start
+static const int SETTLE_SAMPLES = 1;
+
+// Measurements to hold at the best number of connections before trying one more
+static const int PROBE_SAMPLES = 5;
+
+// Least number of measurements between two back offs
+static const int BACKOFF_SAMPLES = 2;
+
+// How long a request should take at the measured throughput per connection, and the range
+// of chunk sizes that gives
+static const double TARGET_REQUEST_SECONDS = 2.0;
+static const int64_t MIN_CHUNK_SIZE = 256 * 1024; // 256 KiB
+static const int64_t MAX_CHUNK_SIZE = 64 * 1024 * 1024; // 64 MiB
+static const int64_t CHUNK_SIZE_STEP = 64 * 1024; // 64 KiB
+
+ConnectionTuner::ConnectionTuner(int max_connections, int64_t chunk_size)
+: max_connections_(std::max(max_connections, 1))
+, connections_(std::min(INITIAL_CONNECTIONS, max_connections_))
+, chunk_size_(std::min(std::max(chunk_size, MIN_CHUNK_SIZE), MAX_CHUNK_SIZE))
+, throughput_(0)
+, holding_(false)
+, probing_(false)
+, previous_connections_(0)
+, previous_throughput_(0)
+, settling_(SETTLE_SAMPLES)
+, samples_(0)
+, held_for_(0)
+, last_backoff_(-1)
+{
+}
+
+bool ConnectionTuner::addSample(int64_t bytes, double seconds, int running)
+{
+    samples_++;
+    if (seconds <= 0) {
+        return false;
+    }
+    throughput_ = bytes / seconds;
+
+    // Size the chunks so each request lasts about TARGET_REQUEST_SECONDS.  Small changes are
+    // left alone, the measurements are too noisy for them to mean anything.
+    bool changed = false;
+    if (running > 0 && bytes > 0) {
+        int64_t target = static_cast<int64_t>(throughput_ / running * TARGET_REQUEST_SECONDS);
+        target = std::min(std::max(target / CHUNK_SIZE_STEP * CHUNK_SIZE_STEP, MIN_CHUNK_SIZE), MAX_CHUNK_SIZE);
+        if (target > chunk_size_ + chunk_size_ / 4 || target < chunk_size_ - chunk_size_ / 4) {
+            chunk_size_ = target;
+            changed = true;
+        }
+    }
+
+    if (settling_ > 0) {
+        settling_--;
+        return changed;
+    }
+    if (running < connections_) {
+        // Not all the connections were busy (e.g. near the end of the file), so this says
+        // nothing about whether the number is right
+        return changed;
+    }
+
+    if (holding_) {
+        if (++held_for_ >= PROBE_SAMPLES && connections_ < max_connections_) {
+            holding_ = false;
+            probing_ = true;
+            previous_connections_ = connections_;
+            previous_throughput_ = throughput_;
+            change_connections(connections_ + 1);
+            return true;
+        }
+        return changed;
+    }
+
+    if (previous_connections_ > 0 && throughput_ < previous_throughput_ * (1 + MIN_GAIN)) {
+        // The last step up did not pay for itself, so go back and stay there
+        holding_ = true;
+        probing_ = false;
+        change_connections(previous_connections_);
+        return true;
+    }
+    if (connections_ >= max_connections_) {
+        holding_ = true;
+        probing_ = false;
+        held_for_ = 0;
+        return changed;
+    }
+    previous_connections_ = connections_;
+    previous_throughput_ = throughput_;
+    change_connections(probing_ ? connections_ + 1 : connections_ + (connections_ + 1) / 2);
+    return true;
+}
+
+bool ConnectionTuner::backOff()
+{
+    if (last_backoff_ >= 0 && samples_ - last_backoff_ < BACKOFF_SAMPLES) {
+        // Probably the same overload as the last back off
+        return false;
+    }
+    last_backoff_ = samples_;
+    holding_ = true;
+    probing_ = false;
+    held_for_ = 0;
+    if (connections_ == 1) {
+        return false;
+    }
+    change_connections(connections_ / 2);
+    previous_connections_ = connections_;
+    previous_throughput_ = 0;
+    return true;
+}
+
+void ConnectionTuner::change_connections(int connections)
+{
+    connections_ = std::min(std::max(connections, 1), max_connections_);
+    settling_ = SETTLE_SAMPLES;
+    held_for_ = 0;
+}
@@ -0,0 +1,97 @@
+#ifndef __multiget_tuner_include__
+#define __multiget_tuner_include__
+
+#include <stdint.h>
+
+/*! \brief Work out how many connections to use, and how big to make the chunks, from the
+ *         throughput they give
+ *
+ *  The best number of connections depends on the round trip time and on how much the server
+ *  gives each connection, neither of which is known up front.  The tuner starts with a
+ *  couple of connections and is told every second how many bytes arrived.  While each step
+ *  up in connections raises the throughput by a worthwhile amount it keeps adding them, by
+ *  half again each time.  Once a step gains little or nothing it goes back to the number
+ *  before it and holds there, trying one more connection every so often in case things
+ *  have changed.
+ *
+ *  An error response from the server (a 429 or 503 in particular) or a request that gets no
+ *  response at all halves the number of connections, at most once every couple of seconds
+ *  so that a burst of failures does not close everything down.
+ *
+ *  The chunk size follows the throughput of each connection, so that a request lasts long
+ *  enough to get past TCP slow start but not so long that the file ends with one slow
+ *  connection.
+ *
+ *  The tuner only does the sums, the Scheduler measures the throughput and applies the
+ *  result.  It is not thread safe.
+ */
+class ConnectionTuner {
+public:
+    /**
+     *   @brief  Create a ConnectionTuner object.
+     *
+     *   @param  max_connections Most connections to ever use
+     *   @param  chunk_size Size of the first chunks, before anything has been measured
+     *
+     *   @return ConnectionTuner object
+     */
+    ConnectionTuner(int max_connections, int64_t chunk_size);
+    virtual ~ConnectionTuner() {}
+
+    /**
+     *   @brief  Take a measurement and decide whether to change the number of connections
+     *
+     *   @param  bytes Bytes received by all of the requests since the last measurement
+     *   @param  seconds Time since the last measurement
+     *   @param  running Number of requests that were running
+     *
+     *   @return true if the number of connections or the chunk size changed
+     */
+    bool addSample(int64_t bytes, double seconds, int running);
+
+    /**
+     *   @brief  Be told that the server turned a request away, or did not answer it
+     *
+     *   @return true if the number of connections was cut
+     */
+    bool backOff();
+
+    /**
+     *   @brief  Get the number of connections to use now
+     *
+     *   @return number of connections, at least 1
+     */
+    int getConnections() { return connections_; }
+
+    /**
+     *   @brief  Get the size to make the next chunks
+     *
+     *   @return bytes per request
+     */
+    int64_t getChunkSize() { return chunk_size_; }
+
+    /**
+     *   @brief  Get the throughput of the last measurement
+     *
+     *   @return bytes per second
+     */
+    double getThroughput() { return throughput_; }
+
+private:
+    void change_connections(int connections);
+
+    int         max_connections_;
+    int         connections_; // connections to use now
+    int64_t     chunk_size_; // bytes to ask for in each request
+    double      throughput_; // bytes per second in the last measurement
+    bool        holding_; // found the best number of connections, only probe for more now and then
+    bool        probing_; // trying one more connection while holding
+    int         previous_connections_; // connections before the last step up
+    double      previous_throughput_; // throughput with previous_connections_
+    int         settling_; // measurements to ignore while the new connections get going
+    int         samples_; // measurements taken so far
+    int         held_for_; // measurements since the number of connections last changed while holding
+    int         last_backoff_; // sample number of the last back off, or -1
+};
+
+#endif // __multiget_tuner_include__
@@ -0,0 +1,34 @@
+#include "url.h"
+#include "log.h"
+
+#include <boost/regex.hpp>
+
+bool URL::parse(const std::string& url)
+{
+    url_ = url;
+    // Parse the URL into server, port, and path
+    boost::regex pattern("(http|https)://([^/ :]+):?([^/ ]*)(/?[^ #?]*)");
+    boost::cmatch url_parts;
+    if(regex_match(url_.c_str(), url_parts, pattern))
+    {
+        https_ = url_parts[1] == "https";
+        server_ = std::string(url_parts[2].first, url_parts[2].second);
+        port_ = std::string(url_parts[3].first, url_parts[3].second);
+        path_ = std::string(url_parts[4].first, url_parts[4].second);
+        if (port_.length() == 0) {
+            port_ = https_ ? "https" : "http";
+        }
+        if (server_.length() == 0) {
+            LogMessage() << "Unable to parse server from the url: " << url_;
+            return false;
+        }
+        if (path_.length() == 0) {
+            LogMessage() << "Unable to parse file path from the url: " << url_;
+            return false;
+        }
+        return true;
+    } else {
+        LogMessage() << "Unable to parse the URL: " << url_;
+        return false;
+    }
+}
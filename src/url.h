@@ -0,0 +1,64 @@
+#ifndef __multiget_url_include__
+#define __multiget_url_include__
+
+#include <string>
+
+/*! \brief The parts of an http:// or https:// URL
+ *
+ *  The URL is split into the server, port and path used to make the request.
+ */
+class URL {
+public:
+    URL() : https_(false) {}
+    virtual ~URL() {}
+
+    /**
+     *   @brief  Split a URL into its parts
+     *
+     *   @param  url The URL to parse
+     *
+     *   @return true if the URL was parsed, false otherwise (the reason is printed)
+     */
+    bool parse(const std::string& url);
+
+    /**
+     *   @brief  Get the whole URL
+     *
+     *   @return url
+     */
+    const std::string& getURL() const { return url_; }
+    /**
+     *   @brief  Get the server name parsed from the URL
+     *
+     *   @return server part of url
+     */
+    const std::string& getServer() const { return server_; }
+    /**
+     *   @brief  Get the port parsed from the URL
+     *
+     *   If a port is included it will be return, otherwise port "http" (or "https") is returned
+     *   @return port part of url
+     */
+    const std::string& getPort() const { return port_; }
+    /**
+     *   @brief  Get the path parsed from the URL
+     *
+     *   @return path part of url
+     */
+    const std::string& getPath() const { return path_; }
+    /**
+     *   @brief  Find out whether the URL is https://, so the request goes over TLS
+     *
+     *   @return true for https
+     */
+    bool isHTTPS() const { return https_; }
+
+private:
+    std::string url_;
+    std::string server_;
+    std::string port_;
+    std::string path_;
+    bool        https_;
+};
+
+#endif // __multiget_url_include__